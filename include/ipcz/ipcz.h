@@ -558,6 +558,50 @@ typedef uint32_t IpczFeature;
 // and allocation behavior intended to be more efficient than the v1 scheme.
 #define IPCZ_FEATURE_MEM_V2 ((IpczFeature)0xA110C002)
 
+// When this feature is enabled on both nodes of a connection, new shared memory
+// buffers used to allocate fixed-size blocks between the nodes use a wider
+// block header format. This lifts the limit of 32767 blocks per buffer, so that
+// large buffers can serve many small fragments without being split into many
+// separate buffers.
+#define IPCZ_FEATURE_WIDE_BLOCK_ALLOCATORS ((IpczFeature)0xA110C003)
+
+// When this feature is enabled on both nodes of a connection and on whichever
+// node allocated the connection's primary shared buffer, small messages between
+// the nodes are queued in a pair of rings within that buffer. The driver
+// transport is then only used for messages which carry driver objects or which
+// don't fit in a ring, and to wake the receiving node when it may be idle.
+#define IPCZ_FEATURE_MESSAGE_RINGS ((IpczFeature)0xA110C004)
+
+// When this feature is enabled on both nodes of a connection, portals whose
+// routes span the connection track each other's consumption of parcels in
+// shared memory. This feeds the remote queue fields of IpczPortalStatus, along
+// with IpczPutLimits and the IPCZ_TRAP_BELOW_MAX_REMOTE_* trap conditions.
+// Otherwise those only account for parcels still queued on the sending node.
+#define IPCZ_FEATURE_REMOTE_QUEUE_STATE ((IpczFeature)0xA110C005)
+
+// When this feature is enabled on both nodes of a connection, consecutive
+// parcels without attached objects which are sent together (e.g. by PutMany())
+// are transmitted in a single message. Otherwise each parcel is transmitted in
+// its own message.
+#define IPCZ_FEATURE_BATCHED_PARCELS ((IpczFeature)0xA110C006)
+
+// When this feature is enabled on both nodes of a connection, small boxed
+// parcels attached to a parcel are transmitted within the same message as that
+// parcel. Otherwise each is transmitted in its own message.
+#define IPCZ_FEATURE_EMBEDDED_SUBPARCELS ((IpczFeature)0xA110C007)
+
+// Describes an amount of shared memory capacity to reserve for fragments of a
+// specific size. See `initial_memory_capacities` in IpczCreateNodeOptions.
+struct IPCZ_ALIGN(8) IpczMemoryCapacity {
+  // The size of each fragment in bytes. This is rounded up to a power of two.
+  // Sizes above 1 MB are not supported and are ignored.
+  size_t fragment_size;
+
+  // The total number of bytes of capacity to reserve for fragments of this
+  // size.
+  size_t capacity;
+};
+
 // Options given to CreateNode() to configure the new node's behavior.
 struct IPCZ_ALIGN(8) IpczCreateNodeOptions {
   // The exact size of this structure in bytes. Must be set accurately before
@@ -575,6 +619,38 @@ struct IPCZ_ALIGN(8) IpczCreateNodeOptions {
   // both in `enabled_features` and `disabled_features`, it is disabled.
   const IpczFeature* disabled_features;
   size_t num_disabled_features;
+
+  // Idle policy for shared memory which the node allocates dynamically to
+  // expand parcel data capacity between itself and other nodes. If non-zero,
+  // the node checks for such memory that is no longer in use once every
+  // `idle_buffer_check_interval` messages received from a given remote node.
+  // Each buffer found idle is proposed for retirement to that node, which
+  // retires it only if it isn't using the buffer either; both nodes then
+  // release its memory. If zero (the default), buffers are retained for as
+  // long as the two nodes remain connected.
+  //
+  // Note that a node only proposes retiring buffers which it allocated itself,
+  // that checks only happen while the remote node is sending messages, and
+  // that retirement requires both nodes to support IPCZ_FEATURE_MEM_V2. The
+  // policy is therefore most effective when configured on both nodes.
+  uint32_t idle_buffer_check_interval;
+
+  // An optional memory profile used to provision shared memory capacity on each
+  // new connection between this node and another, before any of it is needed.
+  // Each entry specifies a minimum capacity for fragments of a given size.
+  // Without a profile, capacity is only expanded on demand once allocations
+  // begin to fail, so early messages on a new connection may fall back onto
+  // slower transmission through the driver.
+  const struct IpczMemoryCapacity* initial_memory_capacities;
+  size_t num_initial_memory_capacities;
+
+  // If larger than the default size of 128 kB, the size of each primary shared
+  // buffer allocated by this node for a new connection. When both nodes on the
+  // connection support IPCZ_FEATURE_MEM_V2, the additional space is used to
+  // satisfy any `initial_memory_capacities` for fragment sizes above 4 kB,
+  // making that capacity available to both nodes from the moment they're
+  // connected. Sizes above 16 MB are clamped to 16 MB.
+  size_t primary_buffer_size;
 };
 
 // See CreateNode() and the IPCZ_CREATE_NODE_* flag descriptions below.
@@ -651,6 +727,86 @@ typedef uint32_t IpczEndPutFlags;
 // without committing its parcel to the portal.
 #define IPCZ_END_PUT_ABORT IPCZ_FLAG_BIT(0)
 
+// Limits which can be imposed on a Put() or BeginPut() to bound the amount of
+// unretrieved data queued on the opposite portal. A portal's remote queue
+// consists of every parcel put into the portal which has not yet been retrieved
+// from its opposite, including any parcels still in transit.
+//
+// Limits are enforced against a best-effort snapshot of the remote queue,
+// which ipcz maintains in memory shared with the opposite portal's node
+// whenever possible. No messages are exchanged to enforce them. If no such
+// snapshot is available (for example while the route is still being
+// established after a portal transfer), only parcels still queued locally on
+// the portal count toward the limits.
+struct IPCZ_ALIGN(8) IpczPutLimits {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to any functions.
+  size_t size;
+
+  // The maximum number of parcels allowed in the remote queue. If the put
+  // would cause the queue to exceed this limit, it fails.
+  size_t max_queued_parcels;
+
+  // The maximum number of data bytes allowed in the remote queue. If the put
+  // would cause the queue to exceed this limit, it fails.
+  size_t max_queued_bytes;
+};
+
+// Options given to Put(), PutMany() or PutSegments() to modify their default
+// behavior.
+struct IPCZ_ALIGN(8) IpczPutOptions {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to Put(), PutMany() or PutSegments().
+  size_t size;
+
+  // Optional limits to apply when determining whether the put can succeed. May
+  // be null.
+  const struct IpczPutLimits* limits;
+};
+
+// Options given to BeginPut() to modify its default behavior.
+struct IPCZ_ALIGN(8) IpczBeginPutOptions {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to BeginPut().
+  size_t size;
+
+  // Optional limits to apply when determining how much data can be put into
+  // the portal by this transaction. May be null.
+  const struct IpczPutLimits* limits;
+};
+
+// Describes a single parcel to be put into a portal by PutMany().
+struct IPCZ_ALIGN(8) IpczPutParcel {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to PutMany().
+  size_t size;
+
+  // The parcel's data. May be null if `num_bytes` is zero.
+  const void* data;
+
+  // The number of bytes of data to copy from `data`.
+  size_t num_bytes;
+
+  // Handles to attach to the parcel. May be null if `num_handles` is zero.
+  const IpczHandle* handles;
+
+  // The number of handles in `handles`.
+  size_t num_handles;
+};
+
+// Describes one contiguous segment of a parcel's data, given to PutSegments().
+struct IPCZ_ALIGN(8) IpczPutSegment {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to PutSegments().
+  size_t size;
+
+  // The segment's data. May be null if `num_bytes` is zero.
+  const void* data;
+
+  // The number of bytes of data to copy from `data`.
+  size_t num_bytes;
+};
+
 // See Get() and the IPCZ_GET_* flag descriptions below.
 typedef uint32_t IpczGetFlags;
 
@@ -661,6 +817,41 @@ typedef uint32_t IpczGetFlags;
 // caller indicated they could accept.
 #define IPCZ_GET_PARTIAL IPCZ_FLAG_BIT(0)
 
+// See GetMany() and the IPCZ_GET_MANY_* flag descriptions below.
+typedef uint32_t IpczGetManyFlags;
+
+// When given to GetMany(), retrieved parcels are not copied out to the
+// caller's buffers. Instead each one is returned as a parcel handle, which the
+// caller can use with BeginGet() to read the parcel's contents in place.
+#define IPCZ_GET_MANY_AS_PARCELS IPCZ_FLAG_BIT(0)
+
+// Describes a single parcel retrieved by GetMany().
+struct IPCZ_ALIGN(8) IpczGetParcel {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to GetMany().
+  size_t size;
+
+  // Buffer to receive the parcel's data. Ignored if IPCZ_GET_MANY_AS_PARCELS
+  // is given. May be null if `num_bytes` is zero.
+  void* data;
+
+  // On input, the capacity of `data` in bytes. On output, the size of the
+  // retrieved parcel's data.
+  size_t num_bytes;
+
+  // Buffer to receive the parcel's handles. Ignored if
+  // IPCZ_GET_MANY_AS_PARCELS is given. May be null if `num_handles` is zero.
+  IpczHandle* handles;
+
+  // On input, the capacity of `handles`. On output, the number of handles
+  // attached to the retrieved parcel.
+  size_t num_handles;
+
+  // Only populated if IPCZ_GET_MANY_AS_PARCELS is given, in which case this
+  // is set to a handle to the retrieved parcel.
+  IpczHandle parcel;
+};
+
 // See BeginGet() and the IPCZ_BEGIN_GET_* flag descriptions below.
 typedef uint32_t IpczBeginGetFlags;
 
@@ -799,6 +990,18 @@ struct IPCZ_ALIGN(8) IpczPortalStatus {
   // The number of unretrieved bytes (across all unretrieved parcels) queued on
   // this portal.
   size_t num_local_bytes;
+
+  // The number of parcels put into this portal which have not yet been
+  // retrieved from the opposite portal, including any still in transit. See
+  // IpczPutLimits regarding how this is determined.
+  //
+  // This and `num_remote_bytes` were added in a later version of this
+  // structure. If the caller's `size` excludes them, they're not written.
+  size_t num_remote_parcels;
+
+  // The number of data bytes across all parcels counted by
+  // `num_remote_parcels`.
+  size_t num_remote_bytes;
 };
 
 // Flags given to IpczTrapConditions to indicate which types of conditions a
@@ -843,6 +1046,21 @@ typedef uint32_t IpczTrapConditionFlags;
 // IpczTrapConditions. Level-triggered.
 #define IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES IPCZ_FLAG_BIT(4)
 
+// Triggers a trap event whenever the number of parcels queued for retrieval on
+// the opposite portal drops below the threshold given by `max_remote_parcels`
+// in IpczTrapConditions. Level-triggered.
+//
+// This is fed by the same snapshot of remote queue state used to enforce
+// IpczPutLimits, so a producer can wait for room in the remote queue without
+// polling. See IpczPortalStatus for details about how the remote queue is
+// measured.
+#define IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS IPCZ_FLAG_BIT(5)
+
+// Triggers a trap event whenever the number of bytes queued for retrieval on
+// the opposite portal drops below the threshold given by `max_remote_bytes` in
+// IpczTrapConditions. Level-triggered.
+#define IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES IPCZ_FLAG_BIT(6)
+
 // Triggers a trap event whenever the number of locally available parcels
 // increases by any amount. Edge-triggered.
 #define IPCZ_TRAP_NEW_LOCAL_PARCEL IPCZ_FLAG_BIT(7)
@@ -876,6 +1094,18 @@ struct IPCZ_ALIGN(8) IpczTrapConditions {
   // See IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES. If that flag is not set in `flags`,
   // this field is ignored.
   size_t min_local_bytes;
+
+  // See IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS. If that flag is not set in
+  // `flags`, this field is ignored.
+  //
+  // This and `max_remote_bytes` were added in a later version of this
+  // structure. A caller whose `size` excludes them may not set either of the
+  // IPCZ_TRAP_BELOW_MAX_REMOTE_* flags.
+  size_t max_remote_parcels;
+
+  // See IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES. If that flag is not set in `flags`,
+  // this field is ignored.
+  size_t max_remote_bytes;
 };
 
 // Structure passed to each IpczTrapEventHandler invocation with details about
@@ -901,6 +1131,172 @@ struct IPCZ_ALIGN(8) IpczTrapEvent {
 // conditions are satisfied on the monitored portal.
 typedef void(IPCZ_API* IpczTrapEventHandler)(const struct IpczTrapEvent* event);
 
+// See Trap() and the IPCZ_TRAP_* flag descriptions below.
+typedef uint32_t IpczTrapFlags;
+
+// When given to Trap(), the new trap is persistent. Rather than being removed
+// when its handler is invoked, a persistent trap is only disabled, and it stays
+// installed until it's removed by RemoveTrap() or its portal is closed. Once
+// the application has handled an event it can re-enable the trap with
+// EnableTrap(), and any conditions met while the trap was disabled are reported
+// then. Persistent traps are identified by their context value, which must be
+// unique among persistent traps on the same portal.
+#define IPCZ_TRAP_PERSISTENT IPCZ_FLAG_BIT(0)
+
+// A timeout value for IpczWaitOptions which never expires.
+#define IPCZ_WAIT_INDEFINITELY ((uint64_t)-1)
+
+// Options given to Wait() to control how it blocks.
+struct IPCZ_ALIGN(8) IpczWaitOptions {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to Wait().
+  size_t size;
+
+  // The maximum amount of time to block before giving up, in microseconds. May
+  // be IPCZ_WAIT_INDEFINITELY to block until the conditions are met, or zero
+  // to poll the conditions without blocking.
+  uint64_t timeout_microseconds;
+
+  // How many times the calling thread may spin on the portal's state before
+  // going to sleep. Spinning can reduce wakeup latency when the portal is
+  // expected to change imminently, at the cost of burning CPU while waiting.
+  uint32_t spin_count;
+};
+
+// Describes a portal which is ready on a wait set. Populated by
+// WaitForReadyPortals().
+struct IPCZ_ALIGN(8) IpczWaitSetEvent {
+  // The size of this structure in bytes. Populated by ipcz to indicate which
+  // version is being provided.
+  size_t size;
+
+  // The context value that was given to AddToWaitSet() when the portal was
+  // added to the wait set.
+  uintptr_t context;
+
+  // Flags indicating which of the portal's registered conditions are met.
+  IpczTrapConditionFlags condition_flags;
+
+  // The status of the portal as of the last change to its state.
+  struct IpczPortalStatus status;
+};
+
+// The maximum number of distinct block sizes used by a single NodeLink's shared
+// memory pool. Block sizes are powers of two from 64 bytes through 1 MB.
+#define IPCZ_MAX_BLOCK_SIZE_CLASSES 15
+
+// Memory statistics for all blocks of a single size within the shared memory
+// pool of a single NodeLink. See IpczNodeLinkMemoryStats.
+struct IPCZ_ALIGN(8) IpczBlockMemoryStats {
+  // The size of each block in bytes.
+  size_t block_size;
+
+  // The number of buffer regions dedicated to blocks of this size, including
+  // any region within the link's primary buffer.
+  size_t num_allocators;
+
+  // The total number of blocks of this size across all of those regions,
+  // whether free or allocated.
+  size_t num_blocks;
+
+  // The number of blocks which are free for allocation by either node on the
+  // link. This is a snapshot which may be stale by the time it's returned.
+  size_t num_free_blocks;
+
+  // The number of blocks cached by the querying node for quick reuse. These
+  // are free for allocation by the querying node only, and they're not
+  // included in `num_free_blocks`.
+  size_t num_cached_blocks;
+};
+
+// Memory statistics for the shared memory pool of a single NodeLink, as
+// returned by QueryNodeMemoryStats(). All of this memory is shared between the
+// querying node and one remote node.
+struct IPCZ_ALIGN(8) IpczNodeLinkMemoryStats {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to QueryNodeMemoryStats().
+  size_t size;
+
+  // An opaque identifier for the remote node on this link. This is only
+  // meaningful for distinguishing links from each other, and it may be zero if
+  // the remote node has not been assigned a name yet.
+  uint64_t remote_node_id[2];
+
+  // The size in bytes of the link's primary buffer, which is allocated when the
+  // link is established and lives as long as the link.
+  size_t primary_buffer_size;
+
+  // The number and total size in bytes of all buffers currently in the link's
+  // memory pool, including the primary buffer and any large buffers.
+  size_t num_buffers;
+  size_t total_buffer_size;
+
+  // The number and total size in bytes of buffers dedicated to individual
+  // fragments too large for block allocation, and the number of those which
+  // are currently allocated.
+  size_t num_large_buffers;
+  size_t total_large_buffer_size;
+  size_t num_allocated_large_buffers;
+
+  // The number of requests by the querying node to add block or large buffer
+  // capacity to the pool which have not yet completed.
+  size_t num_pending_block_capacity_requests;
+  size_t num_pending_large_buffer_requests;
+
+  // Statistics for each block size in use by the pool, in ascending order of
+  // block size. Only the first `num_block_size_classes` entries are populated.
+  size_t num_block_size_classes;
+  struct IpczBlockMemoryStats block_size_classes[IPCZ_MAX_BLOCK_SIZE_CLASSES];
+
+  // The number of parcels with data transmitted by the querying node over this
+  // link, counted by how their data was conveyed: in a fragment of the link's
+  // memory where the data was originally allocated, in a fragment of the
+  // link's memory to which the data was moved from a fragment of some other
+  // link's memory, or inlined within the transmitted message itself. Data is
+  // moved between fragments when a route changes links between a parcel's
+  // allocation and its transmission, such as during proxy bypass.
+  size_t num_parcels_with_fragment_data;
+  size_t num_parcels_with_migrated_fragment_data;
+  size_t num_parcels_with_inlined_data;
+};
+
+// Options given to CreateDataPipe() to configure a new data pipe.
+struct IPCZ_ALIGN(8) IpczCreateDataPipeOptions {
+  // The exact size of this structure in bytes. Must be set accurately before
+  // passing the structure to CreateDataPipe().
+  size_t size;
+
+  // The minimum number of bytes the data pipe must be able to hold before its
+  // producer has to wait for the consumer. ipcz rounds this up to a power of
+  // two of at least 4096. If zero, a default capacity of 64 kB is used.
+  size_t capacity_num_bytes;
+};
+
+// See BeginWriteData() and the IPCZ_BEGIN_WRITE_DATA_* flags described below.
+typedef uint32_t IpczBeginWriteDataFlags;
+
+// Indicates that the caller is willing to write less data than requested by
+// their input `*num_bytes` to BeginWriteData(). With this flag the call can
+// succeed as long as there is any room in the data pipe at all.
+#define IPCZ_BEGIN_WRITE_DATA_ALLOW_PARTIAL IPCZ_FLAG_BIT(0)
+
+// See EndWriteData() and the IPCZ_END_WRITE_DATA_* flags described below.
+typedef uint32_t IpczEndWriteDataFlags;
+
+// If given to EndWriteData(), the write-transaction is aborted and nothing is
+// committed to the data pipe.
+#define IPCZ_END_WRITE_DATA_ABORT IPCZ_FLAG_BIT(0)
+
+// See BeginReadData() and the IPCZ_BEGIN_READ_DATA_* flags described below.
+typedef uint32_t IpczBeginReadDataFlags;
+
+// See EndReadData() and the IPCZ_END_READ_DATA_* flags described below.
+typedef uint32_t IpczEndReadDataFlags;
+
+// If given to EndReadData(), the read-transaction is aborted and no data is
+// consumed from the data pipe.
+#define IPCZ_END_READ_DATA_ABORT IPCZ_FLAG_BIT(0)
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -1212,7 +1608,9 @@ struct IPCZ_ALIGN(8) IpczAPI {
   // writing. In such cases, a two-phase put-transaction can be used instead by
   // calling BeginPut() and EndPut() as defined below.
   //
-  // `options` is ignored and must be null.
+  // `options` may be null. If it's non-null and specifies `limits`, the put
+  // fails unless the resulting parcel fits within those limits. See
+  // IpczPutLimits.
   //
   // Returns:
   //
@@ -1225,15 +1623,18 @@ struct IPCZ_ALIGN(8) IpczAPI {
   //        its (local) opposite if applicable, or if any handle in `handles` is
   //        invalid or not serializable.
   //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if `options` specifies limits which
+  //        would be exceeded by this parcel.
+  //
   //    IPCZ_RESULT_NOT_FOUND if it is known that the opposite portal has
   //        already been closed and anything put into this portal would be lost.
-  IpczResult(IPCZ_API* Put)(IpczHandle portal,          // in
-                            const void* data,           // in
-                            size_t num_bytes,           // in
-                            const IpczHandle* handles,  // in
-                            size_t num_handles,         // in
-                            uint32_t flags,             // in
-                            const void* options);       // in
+  IpczResult(IPCZ_API* Put)(IpczHandle portal,                      // in
+                            const void* data,                       // in
+                            size_t num_bytes,                       // in
+                            const IpczHandle* handles,              // in
+                            size_t num_handles,                     // in
+                            uint32_t flags,                         // in
+                            const struct IpczPutOptions* options);  // in
 
   // BeginPut()
   // ==========
@@ -1258,7 +1659,10 @@ struct IPCZ_ALIGN(8) IpczAPI {
   // Note that any handles to be included in a put-transaction are provided when
   // finalizing it with EndPut().
   //
-  // `options` is ignored and must be null.
+  // `options` may be null. If it's non-null and specifies `limits`, the
+  // transaction can only begin if a parcel of the requested size would fit
+  // within those limits. If IPCZ_BEGIN_PUT_ALLOW_PARTIAL is set in `flags`,
+  // the returned capacity may instead be reduced to fit. See IpczPutLimits.
   //
   // Returns:
   //
@@ -1273,14 +1677,18 @@ struct IPCZ_ALIGN(8) IpczAPI {
   //
   //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` or `transaction` is invalid.
   //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if `options` specifies limits which
+  //        leave no room for the requested transaction.
+  //
   //    IPCZ_RESULT_NOT_FOUND if it is known that the peer portal has already
   //        been closed and anything put into this portal would be lost.
-  IpczResult(IPCZ_API* BeginPut)(IpczHandle portal,              // in
-                                 IpczBeginPutFlags flags,        // in
-                                 const void* options,            // in
-                                 volatile void** data,           // out
-                                 size_t* num_bytes,              // in/out
-                                 IpczTransaction* transaction);  // out
+  IpczResult(IPCZ_API* BeginPut)(
+      IpczHandle portal,                          // in
+      IpczBeginPutFlags flags,                    // in
+      const struct IpczBeginPutOptions* options,  // in
+      volatile void** data,                       // out
+      size_t* num_bytes,                          // in/out
+      IpczTransaction* transaction);              // out
 
   // EndPut()
   // ========
@@ -1577,6 +1985,8 @@ struct IPCZ_ALIGN(8) IpczAPI {
   //
   // Immediately before invoking its handler, the trap is removed from the
   // portal and must be reinstalled in order to observe further state changes.
+  // If IPCZ_TRAP_PERSISTENT is given in `flags`, the trap is instead disabled
+  // and can be re-enabled with EnableTrap().
   //
   // When a portal is closed, any traps still installed on it are notified by
   // invoking their handler with IPCZ_TRAP_REMOVED in the event's
@@ -1592,7 +2002,8 @@ struct IPCZ_ALIGN(8) IpczAPI {
   // installed and this call returns IPCZ_RESULT_FAILED_PRECONDITION. See below
   // for details.
   //
-  // `flags` is ignored and must be 0.
+  // `flags` may include IPCZ_TRAP_PERSISTENT to install a persistent trap.
+  // Persistent traps are only supported on portals.
   //
   // `options` is ignored and must be null.
   //
@@ -1611,12 +2022,18 @@ struct IPCZ_ALIGN(8) IpczAPI {
   //        `conditions` which were already satisfied by the portal's state. If
   //        `status` is non-null, a copy of the portal's last known status will
   //        also be stored there.
+  //
+  //    IPCZ_RESULT_ALREADY_EXISTS if IPCZ_TRAP_PERSISTENT was given and the
+  //        portal already has a persistent trap installed with `context`.
+  //
+  //    IPCZ_RESULT_UNIMPLEMENTED if IPCZ_TRAP_PERSISTENT was given and `portal`
+  //        is a data pipe.
   IpczResult(IPCZ_API* Trap)(
       IpczHandle portal,                                  // in
       const struct IpczTrapConditions* conditions,        // in
       IpczTrapEventHandler handler,                       // in
       uintptr_t context,                                  // in
-      uint32_t flags,                                     // in
+      IpczTrapFlags flags,                                // in
       const void* options,                                // in
       IpczTrapConditionFlags* satisfied_condition_flags,  // out
       struct IpczPortalStatus* status);                   // out
@@ -1705,6 +2122,572 @@ struct IPCZ_ALIGN(8) IpczAPI {
                               IpczUnboxFlags flags,               // in
                               const void* options,                // in
                               struct IpczBoxContents* contents);  // out
+
+  // QueryNodeMemoryStats()
+  // ======================
+  //
+  // Reports statistics about the shared memory held by `node` for each of its
+  // links to other nodes. This can be used to tune the node's memory profile
+  // (see IpczCreateNodeOptions) and to detect links which accumulate excessive
+  // memory over time.
+  //
+  // On input, `*num_links` must specify the number of elements available in
+  // `link_stats`, and each of those elements must have its `size` field set
+  // accurately. On output, `*num_links` is set to the number of links for
+  // which statistics are available.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if statistics were successfully populated for every link
+  //        in the first `*num_links` elements of `link_stats`.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `node` is invalid, `num_links` is null,
+  //        `link_stats` is null but `*num_links` is non-zero, or any element of
+  //        `link_stats` has an invalid `size`.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if `*num_links` on input was too small to
+  //        report every link. In this case `*num_links` is updated to the
+  //        required number of elements and `link_stats` is left unmodified.
+  IpczResult(IPCZ_API* QueryNodeMemoryStats)(
+      IpczHandle node,                             // in
+      uint32_t flags,                              // in
+      const void* options,                         // in
+      struct IpczNodeLinkMemoryStats* link_stats,  // out
+      size_t* num_links);                          // in/out
+
+  // PutMany()
+  // =========
+  //
+  // Puts `num_parcels` parcels into `portal` as a single operation. This is
+  // equivalent to calling Put() once for each element of `parcels` in order,
+  // except that either all of the parcels are put or none of them are. The
+  // parcels occupy consecutive positions in the portal's outbound sequence, so
+  // no other concurrent put on the same portal can be interleaved with them.
+  //
+  // This is considerably cheaper than many individual Put() calls, since ipcz
+  // can generally transmit the whole batch to a remote peer at once.
+  //
+  // `flags` is unused and must be IPCZ_NO_FLAGS.
+  //
+  // If this call fails (returning anything other than IPCZ_RESULT_OK), any
+  // handles provided by `parcels` remain property of the caller. If it
+  // succeeds, their ownership is assumed by ipcz.
+  //
+  // `options` may be null. If it's non-null and specifies `limits`, the call
+  // fails unless the full batch of parcels fits within those limits. See
+  // IpczPutLimits.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if every parcel was successfully placed into the portal.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid, `parcels` is null
+  //        but `num_parcels` is non-zero, or any element of `parcels` has an
+  //        invalid `size` or would be rejected by Put() for the same reason.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if `options` specifies limits which
+  //        would be exceeded by the batch.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if it is known that the opposite portal has
+  //        already been closed and anything put into this portal would be lost.
+  IpczResult(IPCZ_API* PutMany)(
+      IpczHandle portal,                      // in
+      const struct IpczPutParcel* parcels,    // in
+      size_t num_parcels,                     // in
+      uint32_t flags,                         // in
+      const struct IpczPutOptions* options);  // in
+
+  // GetMany()
+  // =========
+  //
+  // Retrieves up to `*num_parcels` of the next available parcels from
+  // `portal` in a single operation. Parcels are retrieved in order, each one
+  // into the next element of `parcels`, until either the portal's queue is
+  // empty, `*num_parcels` parcels have been retrieved, or the next parcel
+  // doesn't fit within the capacity given by its corresponding element. This is
+  // considerably cheaper than calling Get() repeatedly to drain a portal, and
+  // any traps installed on `portal` observe the batch as a single update.
+  //
+  // Unless IPCZ_GET_MANY_AS_PARCELS is given in `flags`, each parcel's data
+  // and handles are copied out to the `data` and `handles` buffers of its
+  // corresponding IpczGetParcel, and parcels are never partially retrieved.
+  // If IPCZ_GET_MANY_AS_PARCELS is given, each parcel is instead returned
+  // intact as a parcel handle, avoiding any copies until the caller reads it
+  // with BeginGet() or Get().
+  //
+  // On input, `*num_parcels` must specify the number of elements available in
+  // `parcels`, and each of those elements must have its `size` field set
+  // accurately. On output, `*num_parcels` is set to the number of parcels
+  // retrieved.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if one or more parcels were retrieved.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid, `num_parcels` is
+  //        null or zero, `parcels` is null, or any element of `parcels` has an
+  //        invalid `size` or a null buffer with non-zero capacity.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if IPCZ_GET_MANY_AS_PARCELS was not given
+  //        and the first available parcel does not fit within the capacity of
+  //        the first element of `parcels`. Its `num_bytes` and `num_handles`
+  //        fields are updated to the capacity required, and nothing is
+  //        retrieved.
+  //
+  //    IPCZ_RESULT_UNAVAILABLE if the portal's parcel queue is currently
+  //        empty.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if the portal has no more parcels in its queue and
+  //        its peer is known to be closed.
+  //
+  //    IPCZ_RESULT_ALREADY_EXISTS if there is a non-overlapped two-phase
+  //        get-transaction in progress on `portal`.
+  IpczResult(IPCZ_API* GetMany)(IpczHandle portal,              // in
+                                IpczGetManyFlags flags,         // in
+                                const void* options,            // in
+                                struct IpczGetParcel* parcels,  // in/out
+                                size_t* num_parcels);           // in/out
+
+  // PutSegments()
+  // =============
+  //
+  // Puts a single parcel into `portal`, gathering its data from `num_segments`
+  // separate segments. This is equivalent to calling Put() with the
+  // concatenation of every segment's data in order, but each segment is copied
+  // directly into the parcel's final storage, so callers which naturally
+  // produce data in pieces (for example, a header followed by one or more
+  // payloads) need not concatenate them into a temporary buffer first.
+  //
+  // `handles` and `num_handles` are treated exactly as with Put(), as are
+  // `flags` and `options`.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the parcel was successfully placed into the portal.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid, `segments` is null
+  //        but `num_segments` is non-zero, any element of `segments` has an
+  //        invalid `size` or a null `data` with non-zero `num_bytes`, the
+  //        total size of all segments overflows, or the call would be rejected
+  //        by Put() for any other reason.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if `options` specifies limits which
+  //        would be exceeded by the parcel.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if it is known that the opposite portal has
+  //        already been closed and anything put into this portal would be lost.
+  IpczResult(IPCZ_API* PutSegments)(
+      IpczHandle portal,                      // in
+      const struct IpczPutSegment* segments,  // in
+      size_t num_segments,                    // in
+      const IpczHandle* handles,              // in
+      size_t num_handles,                     // in
+      uint32_t flags,                         // in
+      const struct IpczPutOptions* options);  // in
+
+  // CreateDataPipe()
+  // ================
+  //
+  // Creates a new data pipe on `node`, returning handles to its producer and
+  // consumer endpoints in `*producer` and `*consumer` respectively.
+  //
+  // A data pipe conveys an unframed stream of bytes from its producer to its
+  // consumer through a ring buffer in shared memory, so that data can be
+  // streamed in arbitrarily small pieces without allocating a parcel or
+  // exchanging a message for each one. Data is written with BeginWriteData()
+  // and EndWriteData(), and read with BeginReadData() and EndReadData().
+  //
+  // Either endpoint can be transferred to another node by attaching its handle
+  // to a parcel, just like a portal. An endpoint cannot be transferred while a
+  // two-phase transaction is in progress on it.
+  //
+  // Data pipe endpoints also support QueryPortalStatus() and Trap(). On a
+  // consumer, `num_local_bytes` in IpczPortalStatus is the number of bytes
+  // available to read, and IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES can be used to wait
+  // for them. On a producer, `num_remote_bytes` is the number of bytes written
+  // but not yet consumed, and IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES can be used to
+  // wait for room to write. Parcel counts are always zero. PEER_CLOSED and DEAD
+  // conditions reflect closure of the opposite endpoint, and a consumer is only
+  // dead once it has also read every byte.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` may be null to use a default configuration.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the data pipe was created successfully.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `node` is invalid, `options` is non-null
+  //        with an invalid `size`, or `producer` or `consumer` is null.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if the requested capacity is too large or
+  //        the node's driver could not allocate shared memory for it.
+  IpczResult(IPCZ_API* CreateDataPipe)(
+      IpczHandle node,                                  // in
+      uint32_t flags,                                   // in
+      const struct IpczCreateDataPipeOptions* options,  // in
+      IpczHandle* producer,                             // out
+      IpczHandle* consumer);                            // out
+
+  // BeginWriteData()
+  // ================
+  //
+  // Begins a write-transaction on the data pipe `producer`, returning the
+  // address of contiguous writable space within the data pipe in `*data`.
+  //
+  // The input value of `*num_bytes` is the number of bytes the caller would
+  // like to write. On success its output value is the amount of contiguous
+  // space available at `*data`, which may exceed the request. If
+  // IPCZ_BEGIN_WRITE_DATA_ALLOW_PARTIAL is given in `flags`, less space than
+  // requested may be returned, but never zero. Note that free space may wrap
+  // around the end of the ring buffer, in which case it takes two transactions
+  // to fill.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the write-transaction has begun.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `producer` is not a data pipe producer,
+  //        or `data` or `num_bytes` is null.
+  //
+  //    IPCZ_RESULT_RESOURCE_EXHAUSTED if there is not enough contiguous space
+  //        in the data pipe to satisfy the request.
+  //
+  //    IPCZ_RESULT_ALREADY_EXISTS if a write-transaction is already in progress
+  //        on `producer`.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if the consumer is known to be closed.
+  //
+  //    IPCZ_RESULT_UNKNOWN if the data pipe's shared state is corrupt.
+  IpczResult(IPCZ_API* BeginWriteData)(IpczHandle producer,            // in
+                                       IpczBeginWriteDataFlags flags,  // in
+                                       const void* options,            // in
+                                       volatile void** data,           // out
+                                       size_t* num_bytes);             // in/out
+
+  // EndWriteData()
+  // ==============
+  //
+  // Ends the write-transaction previously started on `producer` by
+  // BeginWriteData(), committing the first `num_bytes_produced` bytes written
+  // there to the data pipe. If the consumer is waiting for data, it's notified.
+  //
+  // If IPCZ_END_WRITE_DATA_ABORT is given in `flags`, `num_bytes_produced` is
+  // ignored and nothing is committed.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the transaction was completed or aborted.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `producer` is not a data pipe producer,
+  //        or `num_bytes_produced` exceeds the space returned by
+  //        BeginWriteData(). In the latter case the transaction remains in
+  //        progress.
+  //
+  //    IPCZ_RESULT_FAILED_PRECONDITION if no write-transaction is in progress.
+  IpczResult(IPCZ_API* EndWriteData)(IpczHandle producer,          // in
+                                     size_t num_bytes_produced,    // in
+                                     IpczEndWriteDataFlags flags,  // in
+                                     const void* options);         // in
+
+  // BeginReadData()
+  // ===============
+  //
+  // Begins a read-transaction on the data pipe `consumer`, returning the
+  // address and size of the contiguous data available to read in `*data` and
+  // `*num_bytes`. Available data may wrap around the end of the ring buffer,
+  // in which case it takes two transactions to read it all.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the read-transaction has begun.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `consumer` is not a data pipe consumer,
+  //        or `data` or `num_bytes` is null.
+  //
+  //    IPCZ_RESULT_UNAVAILABLE if there is currently no data to read.
+  //
+  //    IPCZ_RESULT_ALREADY_EXISTS if a read-transaction is already in progress
+  //        on `consumer`.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if there is no data to read and the producer is
+  //        known to be closed.
+  //
+  //    IPCZ_RESULT_UNKNOWN if the data pipe's shared state is corrupt.
+  IpczResult(IPCZ_API* BeginReadData)(IpczHandle consumer,           // in
+                                      IpczBeginReadDataFlags flags,  // in
+                                      const void* options,           // in
+                                      const volatile void** data,    // out
+                                      size_t* num_bytes);            // out
+
+  // EndReadData()
+  // =============
+  //
+  // Ends the read-transaction previously started on `consumer` by
+  // BeginReadData(), consuming the first `num_bytes_consumed` bytes it
+  // returned. If the producer is waiting for room to write, it's notified.
+  //
+  // If IPCZ_END_READ_DATA_ABORT is given in `flags`, `num_bytes_consumed` is
+  // ignored and nothing is consumed.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the transaction was completed or aborted.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `consumer` is not a data pipe consumer,
+  //        or `num_bytes_consumed` exceeds the size returned by
+  //        BeginReadData(). In the latter case the transaction remains in
+  //        progress.
+  //
+  //    IPCZ_RESULT_FAILED_PRECONDITION if no read-transaction is in progress.
+  IpczResult(IPCZ_API* EndReadData)(IpczHandle consumer,         // in
+                                    size_t num_bytes_consumed,   // in
+                                    IpczEndReadDataFlags flags,  // in
+                                    const void* options);        // in
+
+  // Wait()
+  // ======
+  //
+  // Blocks the calling thread until any of the conditions in `conditions` is
+  // met on `portal`. This is a synchronous alternative to Trap() for threads
+  // which have nothing else to do until the portal's state changes, and it
+  // costs no extra thread hop or handler invocation.
+  //
+  // Conditions are evaluated exactly as they are for traps, and
+  // IPCZ_TRAP_NEW_LOCAL_PARCEL is satisfied by any parcel which becomes
+  // available after the call begins. IPCZ_TRAP_REMOVED is ignored.
+  //
+  // Any number of threads may wait on the same portal at once, and waiting
+  // does not interfere with traps installed on the portal.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` may be null to wait indefinitely without spinning.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if any condition was met. If `satisfied_condition_flags`
+  //        is non-null, its pointee value is updated to reflect the flags in
+  //        `conditions` which were satisfied. If `status` is non-null, a copy
+  //        of the portal's status at that time is also stored there.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid, `conditions` is
+  //        null or invalid, or `options` or `status` is non-null but its
+  //        `size` field specifies an invalid value.
+  //
+  //    IPCZ_RESULT_DEADLINE_EXCEEDED if the timeout given in `options` expired
+  //        before any condition was met.
+  //
+  //    IPCZ_RESULT_CANCELLED if `portal` was closed or transferred elsewhere
+  //        while waiting.
+  IpczResult(IPCZ_API* Wait)(
+      IpczHandle portal,                                  // in
+      const struct IpczTrapConditions* conditions,        // in
+      uint32_t flags,                                     // in
+      const struct IpczWaitOptions* options,              // in
+      IpczTrapConditionFlags* satisfied_condition_flags,  // out
+      struct IpczPortalStatus* status);                   // out
+
+  // CreateWaitSet()
+  // ===============
+  //
+  // Creates a new wait set, which watches any number of portals for persistent
+  // sets of conditions. Portals are registered with AddToWaitSet(), and ready
+  // portals are retrieved in batches with WaitForReadyPortals(). Unlike traps,
+  // a portal's registration is not consumed when it becomes ready, so there's
+  // nothing to re-arm after handling an event.
+  //
+  // A wait set is destroyed by passing its handle to Close(), which also
+  // unregisters all of its portals.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the wait set was created and its handle stored in
+  //        `wait_set`.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `wait_set` is null.
+  IpczResult(IPCZ_API* CreateWaitSet)(uint32_t flags,         // in
+                                      const void* options,    // in
+                                      IpczHandle* wait_set);  // out
+
+  // AddToWaitSet()
+  // ==============
+  //
+  // Registers `portal` with `wait_set`. Whenever a change to the portal's state
+  // leaves any of the conditions in `conditions` met, the portal is queued as
+  // ready on the wait set, and it's subsequently reported by
+  // WaitForReadyPortals() along with `context`. A portal appears in the ready
+  // queue at most once no matter how many changes it sees before it's
+  // reported. If the conditions are already met, the portal is queued
+  // immediately.
+  //
+  // Conditions are evaluated as for traps. IPCZ_TRAP_NEW_LOCAL_PARCEL is met
+  // by any parcel which arrives after the portal was last reported, or after
+  // it was added if it hasn't been reported yet. IPCZ_TRAP_REMOVED is ignored.
+  //
+  // A portal is implicitly removed from its wait sets when it's closed or
+  // transferred to another portal.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the portal was added to the wait set.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `wait_set` or `portal` is invalid, or
+  //        `conditions` is null or invalid.
+  //
+  //    IPCZ_RESULT_ALREADY_EXISTS if `portal` is already registered with
+  //        `wait_set`.
+  IpczResult(IPCZ_API* AddToWaitSet)(
+      IpczHandle wait_set,                          // in
+      IpczHandle portal,                            // in
+      const struct IpczTrapConditions* conditions,  // in
+      uintptr_t context,                            // in
+      uint32_t flags,                               // in
+      const void* options);                         // in
+
+  // RemoveFromWaitSet()
+  // ===================
+  //
+  // Unregisters `portal` from `wait_set`. If the portal was ready, it will not
+  // be reported by any subsequent WaitForReadyPortals() call.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the portal was removed from the wait set.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `wait_set` or `portal` is invalid.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if `portal` is not registered with `wait_set`.
+  IpczResult(IPCZ_API* RemoveFromWaitSet)(IpczHandle wait_set,   // in
+                                          IpczHandle portal,     // in
+                                          uint32_t flags,        // in
+                                          const void* options);  // in
+
+  // WaitForReadyPortals()
+  // =====================
+  //
+  // Retrieves up to `*num_events` ready portals from `wait_set`, blocking until
+  // at least one is ready. Each portal is described by an element of `events`,
+  // which reflects the portal's latest status. Portals are reported in the
+  // order they became ready, and any ready portals which don't fit in `events`
+  // remain queued for the next call.
+  //
+  // A portal whose conditions are no longer met by the time it would be
+  // reported is skipped. It's queued again by any later change which
+  // satisfies them.
+  //
+  // Any number of threads may call this on the same wait set at once, and each
+  // ready portal is reported to only one of them.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` may be null to wait indefinitely without spinning.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if one or more portals were reported. `*num_events` is
+  //        updated to reflect the number of elements of `events` populated.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `wait_set` is invalid, `events` or
+  //        `num_events` is null, `*num_events` is zero, or `options` is
+  //        non-null but its `size` field specifies an invalid value.
+  //
+  //    IPCZ_RESULT_DEADLINE_EXCEEDED if the timeout given in `options` expired
+  //        before any portal was ready.
+  //
+  //    IPCZ_RESULT_CANCELLED if `wait_set` was closed while waiting.
+  IpczResult(IPCZ_API* WaitForReadyPortals)(
+      IpczHandle wait_set,                    // in
+      uint32_t flags,                         // in
+      const struct IpczWaitOptions* options,  // in
+      struct IpczWaitSetEvent* events,        // out
+      size_t* num_events);                    // in/out
+
+  // EnableTrap()
+  // ============
+  //
+  // Re-enables the persistent trap installed on `portal` with `context`, after
+  // its handler has been invoked. See IPCZ_TRAP_PERSISTENT.
+  //
+  // If any of the trap's conditions were met while it was disabled, including
+  // any new parcel arrival watched by IPCZ_TRAP_NEW_LOCAL_PARCEL, the trap's
+  // handler is invoked again before this call returns, with
+  // IPCZ_TRAP_WITHIN_API_CALL set, and the trap remains disabled. Otherwise
+  // the trap is enabled and fires on the next state change that satisfies
+  // its conditions. Either way the application never misses an event, and it
+  // never needs to poll or reinstall the trap between events.
+  //
+  // Enabling a trap which is already enabled has no effect.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if the trap was enabled or its handler was invoked.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if `portal` has no persistent trap installed with
+  //        `context`.
+  IpczResult(IPCZ_API* EnableTrap)(IpczHandle portal,     // in
+                                   uintptr_t context,     // in
+                                   uint32_t flags,        // in
+                                   const void* options);  // in
+
+  // RemoveTrap()
+  // ============
+  //
+  // Removes every trap installed on `portal` with `context`. Each removed
+  // trap's handler is invoked with IPCZ_TRAP_REMOVED before this call returns.
+  // This is primarily useful for persistent traps, which are otherwise only
+  // removed when their portal is closed.
+  //
+  // `flags` is ignored and must be 0.
+  //
+  // `options` is ignored and must be null.
+  //
+  // Returns:
+  //
+  //    IPCZ_RESULT_OK if one or more traps were removed.
+  //
+  //    IPCZ_RESULT_INVALID_ARGUMENT if `portal` is invalid.
+  //
+  //    IPCZ_RESULT_NOT_FOUND if `portal` has no trap installed with `context`.
+  IpczResult(IPCZ_API* RemoveTrap)(IpczHandle portal,     // in
+                                   uintptr_t context,     // in
+                                   uint32_t flags,        // in
+                                   const void* options);  // in
 };
 
 // A function which populates `api` with a table of ipcz API functions. The
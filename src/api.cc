@@ -2,14 +2,17 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <limits>
 #include <memory>
 
 #include "api.h"
 #include "ipcz/api_object.h"
 #include "ipcz/application_object.h"
 #include "ipcz/box.h"
+#include "ipcz/data_pipe.h"
 #include "ipcz/driver_object.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/node.h"
@@ -17,8 +20,60 @@
 #include "ipcz/parcel.h"
 #include "ipcz/parcel_wrapper.h"
 #include "ipcz/router.h"
+#include "ipcz/wait_set.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
 #include "util/ref_counted.h"
 
+namespace {
+
+// The sizes of IpczPortalStatus and IpczTrapConditions before remote queue
+// state was added to them. Callers built against that version of the API may
+// still pass these smaller structures, so only the fields which fit are read or
+// written.
+constexpr size_t kVersion0PortalStatusSize =
+    offsetof(IpczPortalStatus, num_local_bytes) +
+    sizeof(IpczPortalStatus::num_local_bytes);
+constexpr size_t kVersion0TrapConditionsSize =
+    offsetof(IpczTrapConditions, min_local_bytes) +
+    sizeof(IpczTrapConditions::min_local_bytes);
+
+bool IsValidPortalStatus(const IpczPortalStatus* status) {
+  return !status || status->size >= kVersion0PortalStatusSize;
+}
+
+// Copies the caller's `conditions` into `out`, leaving zero any fields which
+// the caller's version of the structure lacks. Returns false if `conditions`
+// is invalid, including if it sets flags for conditions it cannot describe.
+bool ReadTrapConditions(const IpczTrapConditions* conditions,
+                        IpczTrapConditions& out) {
+  if (!conditions || conditions->size < kVersion0TrapConditionsSize) {
+    return false;
+  }
+
+  constexpr IpczTrapConditionFlags kRemoteQueueFlags =
+      IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS | IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES;
+  if (conditions->size < sizeof(out) &&
+      (conditions->flags & kRemoteQueueFlags)) {
+    return false;
+  }
+
+  out = {};
+  memcpy(&out, conditions, std::min(conditions->size, sizeof(out)));
+  out.size = sizeof(out);
+  return true;
+}
+
+// Copies as much of `status` as fits into the caller's structure at `out`, and
+// updates its `size` to reflect how many bytes are actually meaningful.
+void WritePortalStatus(const IpczPortalStatus& status, IpczPortalStatus& out) {
+  const size_t size = std::min(out.size, sizeof(status));
+  memcpy(&out, &status, size);
+  out.size = size;
+}
+
+}  // namespace
+
 extern "C" {
 
 IpczResult Close(IpczHandle handle, uint32_t flags, const void* options) {
@@ -138,15 +193,24 @@ IpczResult QueryPortalStatus(IpczHandle portal_handle,
                              uint32_t flags,
                              const void* options,
                              IpczPortalStatus* status) {
-  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
-  if (!router) {
+  if (!status || !IsValidPortalStatus(status)) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
-  if (!status || status->size < sizeof(IpczPortalStatus)) {
+
+  IpczPortalStatus current_status = {.size = sizeof(current_status)};
+  if (ipcz::DataPipe* pipe = ipcz::DataPipe::FromHandle(portal_handle)) {
+    pipe->QueryStatus(current_status);
+    WritePortalStatus(current_status, *status);
+    return IPCZ_RESULT_OK;
+  }
+
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!router) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  router->QueryStatus(*status);
+  router->QueryStatus(current_status);
+  WritePortalStatus(current_status, *status);
   return IPCZ_RESULT_OK;
 }
 
@@ -156,19 +220,27 @@ IpczResult Put(IpczHandle portal_handle,
                const IpczHandle* handles,
                size_t num_handles,
                uint32_t flags,
-               const void* options) {
+               const IpczPutOptions* options) {
   ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
   if (!router) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
+  if (options && options->size < sizeof(IpczPutOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const IpczPutLimits* limits = options ? options->limits : nullptr;
+  if (limits && limits->size < sizeof(IpczPutLimits)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
   return router->Put(
       absl::MakeSpan(static_cast<const uint8_t*>(data), num_bytes),
-      absl::MakeSpan(handles, num_handles));
+      absl::MakeSpan(handles, num_handles), limits);
 }
 
 IpczResult BeginPut(IpczHandle portal_handle,
                     IpczBeginPutFlags flags,
-                    const void* options,
+                    const IpczBeginPutOptions* options,
                     volatile void** data,
                     size_t* num_bytes,
                     IpczTransaction* transaction) {
@@ -176,7 +248,15 @@ IpczResult BeginPut(IpczHandle portal_handle,
   if (!router || !transaction) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
-  return router->BeginPut(flags, data, num_bytes, transaction);
+  if (options && options->size < sizeof(IpczBeginPutOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const IpczPutLimits* limits = options ? options->limits : nullptr;
+  if (limits && limits->size < sizeof(IpczPutLimits)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+  return router->BeginPut(flags, limits, data, num_bytes, transaction);
 }
 
 IpczResult EndPut(IpczHandle portal_handle,
@@ -258,22 +338,36 @@ IpczResult Trap(IpczHandle portal_handle,
                 const IpczTrapConditions* conditions,
                 IpczTrapEventHandler handler,
                 uintptr_t context,
-                uint32_t flags,
+                IpczTrapFlags flags,
                 const void* options,
                 IpczTrapConditionFlags* satisfied_condition_flags,
                 IpczPortalStatus* status) {
-  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
-  if (!router || !handler || !conditions ||
-      conditions->size < sizeof(*conditions)) {
+  IpczTrapConditions trap_conditions;
+  if (!handler || !ReadTrapConditions(conditions, trap_conditions) ||
+      !IsValidPortalStatus(status)) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  if (status && status->size < sizeof(*status)) {
+  IpczPortalStatus current_status = {.size = sizeof(current_status)};
+  IpczPortalStatus* const status_out = status ? &current_status : nullptr;
+  IpczResult result;
+  if (ipcz::DataPipe* pipe = ipcz::DataPipe::FromHandle(portal_handle)) {
+    if (flags & IPCZ_TRAP_PERSISTENT) {
+      return IPCZ_RESULT_UNIMPLEMENTED;
+    }
+    result = pipe->Trap(trap_conditions, handler, context,
+                        satisfied_condition_flags, status_out);
+  } else if (ipcz::Router* router = ipcz::Router::FromHandle(portal_handle)) {
+    result = router->Trap(trap_conditions, handler, context, flags,
+                          satisfied_condition_flags, status_out);
+  } else {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  return router->Trap(*conditions, handler, context, satisfied_condition_flags,
-                      status);
+  if (status && result == IPCZ_RESULT_FAILED_PRECONDITION) {
+    WritePortalStatus(current_status, *status);
+  }
+  return result;
 }
 
 IpczResult Reject(IpczHandle parcel_handle,
@@ -345,6 +439,345 @@ IpczResult Unbox(IpczHandle handle,
   return box->Unbox(*contents);
 }
 
+IpczResult QueryNodeMemoryStats(IpczHandle node_handle,
+                                uint32_t flags,
+                                const void* options,
+                                IpczNodeLinkMemoryStats* link_stats,
+                                size_t* num_links) {
+  ipcz::Node* node = ipcz::Node::FromHandle(node_handle);
+  if (!node || !num_links || (*num_links > 0 && !link_stats)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const absl::Span<IpczNodeLinkMemoryStats> stats(link_stats, *num_links);
+  for (const IpczNodeLinkMemoryStats& entry : stats) {
+    if (entry.size < sizeof(IpczNodeLinkMemoryStats)) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+  }
+
+  return node->QueryMemoryStats(stats, *num_links);
+}
+
+IpczResult PutMany(IpczHandle portal_handle,
+                   const IpczPutParcel* parcels,
+                   size_t num_parcels,
+                   uint32_t flags,
+                   const IpczPutOptions* options) {
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!router || (num_parcels > 0 && !parcels)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+  if (options && options->size < sizeof(IpczPutOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const IpczPutLimits* limits = options ? options->limits : nullptr;
+  if (limits && limits->size < sizeof(IpczPutLimits)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const absl::Span<const IpczPutParcel> batch(parcels, num_parcels);
+  for (const IpczPutParcel& parcel : batch) {
+    if (parcel.size < sizeof(IpczPutParcel) ||
+        (parcel.num_bytes > 0 && !parcel.data) ||
+        (parcel.num_handles > 0 && !parcel.handles)) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+  }
+
+  return router->PutMany(batch, limits);
+}
+
+IpczResult GetMany(IpczHandle portal_handle,
+                   IpczGetManyFlags flags,
+                   const void* options,
+                   IpczGetParcel* parcels,
+                   size_t* num_parcels) {
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!router || !parcels || !num_parcels || *num_parcels == 0) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const absl::Span<IpczGetParcel> batch(parcels, *num_parcels);
+  const bool as_parcels = (flags & IPCZ_GET_MANY_AS_PARCELS) != 0;
+  for (const IpczGetParcel& parcel : batch) {
+    if (parcel.size < sizeof(IpczGetParcel)) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+    if (!as_parcels && ((parcel.num_bytes > 0 && !parcel.data) ||
+                        (parcel.num_handles > 0 && !parcel.handles))) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+  }
+
+  return router->GetMany(flags, batch, *num_parcels);
+}
+
+IpczResult PutSegments(IpczHandle portal_handle,
+                       const IpczPutSegment* segments,
+                       size_t num_segments,
+                       const IpczHandle* handles,
+                       size_t num_handles,
+                       uint32_t flags,
+                       const IpczPutOptions* options) {
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!router || (num_segments > 0 && !segments) ||
+      (num_handles > 0 && !handles)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+  if (options && options->size < sizeof(IpczPutOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const IpczPutLimits* limits = options ? options->limits : nullptr;
+  if (limits && limits->size < sizeof(IpczPutLimits)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  const absl::Span<const IpczPutSegment> data(segments, num_segments);
+  size_t num_bytes = 0;
+  for (const IpczPutSegment& segment : data) {
+    if (segment.size < sizeof(IpczPutSegment) ||
+        (segment.num_bytes > 0 && !segment.data) ||
+        segment.num_bytes > std::numeric_limits<size_t>::max() - num_bytes) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+    num_bytes += segment.num_bytes;
+  }
+
+  return router->PutSegments(data, absl::MakeSpan(handles, num_handles),
+                             limits);
+}
+
+IpczResult CreateDataPipe(IpczHandle node_handle,
+                          uint32_t flags,
+                          const IpczCreateDataPipeOptions* options,
+                          IpczHandle* producer,
+                          IpczHandle* consumer) {
+  ipcz::Node* node = ipcz::Node::FromHandle(node_handle);
+  if (!node || !producer || !consumer) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+  if (options && options->size < sizeof(IpczCreateDataPipeOptions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  size_t capacity = ipcz::DataPipe::kDefaultCapacity;
+  if (options && options->capacity_num_bytes > 0) {
+    capacity = options->capacity_num_bytes;
+  }
+
+  ipcz::DataPipe::Pair pipe =
+      ipcz::DataPipe::CreatePair(node->driver(), capacity);
+  if (!pipe.first) {
+    return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+  }
+
+  *producer = ipcz::DataPipe::ReleaseAsHandle(std::move(pipe.first));
+  *consumer = ipcz::DataPipe::ReleaseAsHandle(std::move(pipe.second));
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult BeginWriteData(IpczHandle producer_handle,
+                          IpczBeginWriteDataFlags flags,
+                          const void* options,
+                          volatile void** data,
+                          size_t* num_bytes) {
+  ipcz::DataPipe* producer = ipcz::DataPipe::FromHandle(producer_handle);
+  if (!producer || !producer->is_producer() || !data || !num_bytes) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return producer->BeginWrite(flags, data, num_bytes);
+}
+
+IpczResult EndWriteData(IpczHandle producer_handle,
+                        size_t num_bytes_produced,
+                        IpczEndWriteDataFlags flags,
+                        const void* options) {
+  ipcz::DataPipe* producer = ipcz::DataPipe::FromHandle(producer_handle);
+  if (!producer || !producer->is_producer()) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return producer->EndWrite(num_bytes_produced, flags);
+}
+
+IpczResult BeginReadData(IpczHandle consumer_handle,
+                         IpczBeginReadDataFlags flags,
+                         const void* options,
+                         const volatile void** data,
+                         size_t* num_bytes) {
+  ipcz::DataPipe* consumer = ipcz::DataPipe::FromHandle(consumer_handle);
+  if (!consumer || consumer->is_producer() || !data || !num_bytes) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return consumer->BeginRead(data, num_bytes);
+}
+
+IpczResult EndReadData(IpczHandle consumer_handle,
+                       size_t num_bytes_consumed,
+                       IpczEndReadDataFlags flags,
+                       const void* options) {
+  ipcz::DataPipe* consumer = ipcz::DataPipe::FromHandle(consumer_handle);
+  if (!consumer || consumer->is_producer()) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return consumer->EndRead(num_bytes_consumed, flags);
+}
+
+IpczResult Wait(IpczHandle portal_handle,
+                const IpczTrapConditions* conditions,
+                uint32_t flags,
+                const IpczWaitOptions* options,
+                IpczTrapConditionFlags* satisfied_condition_flags,
+                IpczPortalStatus* status) {
+  IpczTrapConditions wait_conditions;
+  if (!ReadTrapConditions(conditions, wait_conditions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  if ((options && options->size < sizeof(*options)) ||
+      !IsValidPortalStatus(status)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  // The portal may be closed by another thread while we're blocked, so keep
+  // the Router alive for the duration of the wait.
+  const ipcz::Ref<ipcz::Router> router =
+      ipcz::WrapRefCounted(ipcz::Router::FromHandle(portal_handle));
+  if (!router) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  absl::Time deadline = absl::InfiniteFuture();
+  size_t spin_count = 0;
+  if (options) {
+    if (options->timeout_microseconds != IPCZ_WAIT_INDEFINITELY) {
+      deadline =
+          absl::Now() + absl::Microseconds(options->timeout_microseconds);
+    }
+    spin_count = options->spin_count;
+  }
+
+  IpczPortalStatus current_status = {.size = sizeof(current_status)};
+  IpczPortalStatus* const status_out = status ? &current_status : nullptr;
+  const IpczResult result = router->Wait(wait_conditions, deadline, spin_count,
+                                         satisfied_condition_flags, status_out);
+  if (status && result == IPCZ_RESULT_OK) {
+    WritePortalStatus(current_status, *status);
+  }
+  return result;
+}
+
+IpczResult CreateWaitSet(uint32_t flags,
+                         const void* options,
+                         IpczHandle* wait_set) {
+  if (!wait_set) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  *wait_set = ipcz::WaitSet::ReleaseAsHandle(
+      ipcz::MakeRefCounted<ipcz::WaitSet>());
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult AddToWaitSet(IpczHandle wait_set_handle,
+                        IpczHandle portal_handle,
+                        const IpczTrapConditions* conditions,
+                        uintptr_t context,
+                        uint32_t flags,
+                        const void* options) {
+  IpczTrapConditions member_conditions;
+  if (!ReadTrapConditions(conditions, member_conditions)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  ipcz::WaitSet* wait_set = ipcz::WaitSet::FromHandle(wait_set_handle);
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!wait_set || !router) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return wait_set->Add(ipcz::WrapRefCounted(router), member_conditions,
+                       context);
+}
+
+IpczResult RemoveFromWaitSet(IpczHandle wait_set_handle,
+                             IpczHandle portal_handle,
+                             uint32_t flags,
+                             const void* options) {
+  ipcz::WaitSet* wait_set = ipcz::WaitSet::FromHandle(wait_set_handle);
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!wait_set || !router) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return wait_set->Remove(*router);
+}
+
+IpczResult WaitForReadyPortals(IpczHandle wait_set_handle,
+                               uint32_t flags,
+                               const IpczWaitOptions* options,
+                               IpczWaitSetEvent* events,
+                               size_t* num_events) {
+  if (!events || !num_events || *num_events == 0) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+  if (options && options->size < sizeof(*options)) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  // As with Wait(), the wait set may be closed by another thread while we're
+  // blocked.
+  const ipcz::Ref<ipcz::WaitSet> wait_set =
+      ipcz::WrapRefCounted(ipcz::WaitSet::FromHandle(wait_set_handle));
+  if (!wait_set) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  absl::Time deadline = absl::InfiniteFuture();
+  size_t spin_count = 0;
+  if (options) {
+    if (options->timeout_microseconds != IPCZ_WAIT_INDEFINITELY) {
+      deadline =
+          absl::Now() + absl::Microseconds(options->timeout_microseconds);
+    }
+    spin_count = options->spin_count;
+  }
+
+  return wait_set->WaitForEvents(deadline, spin_count,
+                                 absl::MakeSpan(events, *num_events),
+                                 *num_events);
+}
+
+IpczResult EnableTrap(IpczHandle portal_handle,
+                      uintptr_t context,
+                      uint32_t flags,
+                      const void* options) {
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!router) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return router->EnableTrap(context);
+}
+
+IpczResult RemoveTrap(IpczHandle portal_handle,
+                      uintptr_t context,
+                      uint32_t flags,
+                      const void* options) {
+  ipcz::Router* router = ipcz::Router::FromHandle(portal_handle);
+  if (!router) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  return router->RemoveTrap(context);
+}
+
 constexpr IpczAPI kCurrentAPI = {
     sizeof(kCurrentAPI),
     Close,
@@ -363,6 +796,22 @@ constexpr IpczAPI kCurrentAPI = {
     Reject,
     Box,
     Unbox,
+    QueryNodeMemoryStats,
+    PutMany,
+    GetMany,
+    PutSegments,
+    CreateDataPipe,
+    BeginWriteData,
+    EndWriteData,
+    BeginReadData,
+    EndReadData,
+    Wait,
+    CreateWaitSet,
+    AddToWaitSet,
+    RemoveFromWaitSet,
+    WaitForReadyPortals,
+    EnableTrap,
+    RemoveTrap,
 };
 
 constexpr size_t kVersion0APISize =
@@ -373,7 +822,11 @@ IPCZ_EXPORT IpczResult IPCZ_API IpczGetAPI(IpczAPI* api) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
-  memcpy(api, &kCurrentAPI, kVersion0APISize);
+  // Callers built against an older version of the API only get the functions
+  // they know about.
+  const size_t size = std::min(api->size, sizeof(kCurrentAPI));
+  memcpy(api, &kCurrentAPI, size);
+  api->size = size;
   return IPCZ_RESULT_OK;
 }
 
@@ -2,8 +2,11 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <cstddef>
 #include <cstring>
+#include <limits>
 #include <string>
+#include <string_view>
 
 #include "ipcz/ipcz.h"
 #include "reference_drivers/single_process_reference_driver_base.h"
@@ -172,6 +175,57 @@ TEST_F(APITest, QueryPortalStatus) {
   CloseAll({a, node});
 }
 
+TEST_F(APITest, VersionZeroPortalStatus) {
+  IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hello"));
+
+  // A status structure from before remote queue state was added is accepted,
+  // and nothing is written beyond its size.
+  constexpr size_t kVersion0Size =
+      offsetof(IpczPortalStatus, num_remote_parcels);
+  IpczPortalStatus status;
+  memset(&status, 0xff, sizeof(status));
+  status.size = kVersion0Size;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(b, IPCZ_NO_FLAGS, nullptr, &status));
+  EXPECT_EQ(kVersion0Size, status.size);
+  EXPECT_EQ(1u, status.num_local_parcels);
+  EXPECT_EQ(5u, status.num_local_bytes);
+  EXPECT_EQ(std::numeric_limits<size_t>::max(), status.num_remote_parcels);
+  EXPECT_EQ(std::numeric_limits<size_t>::max(), status.num_remote_bytes);
+
+  // The same goes for the status written by a Trap() which fails because its
+  // conditions are already met.
+  constexpr size_t kVersion0ConditionsSize =
+      offsetof(IpczTrapConditions, max_remote_parcels);
+  const auto handler = [](const IpczTrapEvent* event) {};
+  IpczTrapConditions conditions = {
+      .size = kVersion0ConditionsSize,
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+      .min_local_parcels = 0,
+  };
+  memset(&status, 0xff, sizeof(status));
+  status.size = kVersion0Size;
+  EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION,
+            ipcz().Trap(b, &conditions, handler, 0, IPCZ_NO_FLAGS, nullptr,
+                        nullptr, &status));
+  EXPECT_EQ(kVersion0Size, status.size);
+  EXPECT_EQ(1u, status.num_local_parcels);
+  EXPECT_EQ(std::numeric_limits<size_t>::max(), status.num_remote_parcels);
+
+  // Older conditions can't express remote queue conditions.
+  conditions.flags = IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Trap(a, &conditions, handler, 0, IPCZ_NO_FLAGS, nullptr,
+                        nullptr, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(a, &conditions, IPCZ_NO_FLAGS, nullptr, nullptr,
+                        nullptr));
+
+  CloseAll({a, b, node});
+}
+
 TEST_F(APITest, MergePortalsFailure) {
   const IpczHandle node = CreateNode(kDefaultDriver);
   auto [a, b] = OpenPortals(node);
@@ -325,6 +379,343 @@ TEST_F(APITest, PutGet) {
   CloseAll({a, b, c, node});
 }
 
+TEST_F(APITest, PutLimits) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Invalid options or limits sizes.
+  IpczPutLimits limits = {.size = sizeof(limits) - 1};
+  IpczPutOptions options = {.size = sizeof(options) - 1, .limits = &limits};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Put(a, "hi", 2, nullptr, 0, IPCZ_NO_FLAGS, &options));
+  options.size = sizeof(options);
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Put(a, "hi", 2, nullptr, 0, IPCZ_NO_FLAGS, &options));
+
+  // Null limits impose no limits.
+  options.limits = nullptr;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Put(a, "hi", 2, nullptr, 0, IPCZ_NO_FLAGS, &options));
+
+  // One parcel is already queued on `b`, so only one more fits.
+  limits = {
+      .size = sizeof(limits),
+      .max_queued_parcels = 2,
+      .max_queued_bytes = 8,
+  };
+  options.limits = &limits;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Put(a, "bye", 3, nullptr, 0, IPCZ_NO_FLAGS, &options));
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().Put(a, "x", 1, nullptr, 0, IPCZ_NO_FLAGS, &options));
+
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(a, IPCZ_NO_FLAGS, nullptr, &status));
+  EXPECT_EQ(2u, status.num_remote_parcels);
+  EXPECT_EQ(5u, status.num_remote_bytes);
+
+  // Retrieving a parcel from `b` makes room for another, but only as much data
+  // as still fits within the byte limit.
+  char data[4];
+  size_t num_bytes = 4;
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Get(b, IPCZ_NO_FLAGS, nullptr, data,
+                                       &num_bytes, nullptr, nullptr, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().Put(a, "hello", 6, nullptr, 0, IPCZ_NO_FLAGS, &options));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Put(a, "hey", 3, nullptr, 0, IPCZ_NO_FLAGS, &options));
+
+  // Two-phase puts are limited the same way, unless partial puts are allowed.
+  limits.max_queued_parcels = 3;
+  const IpczBeginPutOptions begin_options = {
+      .size = sizeof(begin_options),
+      .limits = &limits,
+  };
+  volatile void* put_data;
+  IpczTransaction transaction;
+  num_bytes = 4;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().BeginPut(a, IPCZ_NO_FLAGS, &begin_options, &put_data,
+                            &num_bytes, &transaction));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().BeginPut(a, IPCZ_BEGIN_PUT_ALLOW_PARTIAL, &begin_options,
+                            &put_data, &num_bytes, &transaction));
+  EXPECT_EQ(2u, num_bytes);
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().EndPut(a, transaction, 2, nullptr, 0,
+                                          IPCZ_NO_FLAGS, nullptr));
+
+  // Now the byte limit is reached, so not even a partial put can proceed.
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().BeginPut(a, IPCZ_BEGIN_PUT_ALLOW_PARTIAL, &begin_options,
+                            &put_data, &num_bytes, &transaction));
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(APITest, PutMany) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+  auto [c, d] = OpenPortals(node);
+
+  IpczPutParcel parcels[] = {
+      {.size = sizeof(IpczPutParcel), .data = "hi", .num_bytes = 2},
+      {.size = sizeof(IpczPutParcel), .handles = &c, .num_handles = 1},
+      {.size = sizeof(IpczPutParcel), .data = "bye", .num_bytes = 3},
+  };
+
+  // Invalid portal, null parcels, or any invalid parcel.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutMany(IPCZ_INVALID_HANDLE, parcels, 3, IPCZ_NO_FLAGS,
+                           nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutMany(a, nullptr, 3, IPCZ_NO_FLAGS, nullptr));
+  parcels[2].size = sizeof(IpczPutParcel) - 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutMany(a, parcels, 3, IPCZ_NO_FLAGS, nullptr));
+  parcels[2].size = sizeof(IpczPutParcel);
+
+  // Nothing is put if any parcel carries a handle which can't be sent, such as
+  // the sending portal's own peer.
+  parcels[1].handles = &b;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutMany(a, parcels, 3, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(b));
+  parcels[1].handles = &c;
+
+  // Nothing is put if the batch as a whole exceeds the given limits.
+  const IpczPutLimits limits = {
+      .size = sizeof(limits),
+      .max_queued_parcels = 2,
+      .max_queued_bytes = 64,
+  };
+  const IpczPutOptions options = {.size = sizeof(options), .limits = &limits};
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().PutMany(a, parcels, 3, IPCZ_NO_FLAGS, &options));
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(b));
+
+  // An empty batch is trivially successful.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutMany(a, nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutMany(a, parcels, 3, IPCZ_NO_FLAGS, nullptr));
+
+  std::string message;
+  IpczHandle portal;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ("hi", message);
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message, {&portal, 1}));
+  EXPECT_EQ("", message);
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ("bye", message);
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(b));
+
+  // The attached portal was transferred with its parcel.
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(d, "ok"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(portal, &message));
+  EXPECT_EQ("ok", message);
+
+  // Once the peer is closed, nothing more can be put.
+  Close(b);
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().PutMany(a, parcels, 1, IPCZ_NO_FLAGS, nullptr));
+
+  CloseAll({a, d, portal, node});
+}
+
+TEST_F(APITest, GetMany) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+  auto [c, d] = OpenPortals(node);
+
+  char data[3][4];
+  IpczHandle handles[3];
+  IpczGetParcel parcels[3];
+  auto reset_parcels = [&] {
+    for (size_t i = 0; i < 3; ++i) {
+      parcels[i] = {
+          .size = sizeof(IpczGetParcel),
+          .data = data[i],
+          .num_bytes = sizeof(data[i]),
+          .handles = &handles[i],
+          .num_handles = 1,
+      };
+    }
+  };
+  reset_parcels();
+
+  // Invalid portal, parcels, or parcel count.
+  size_t num_parcels = 3;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().GetMany(IPCZ_INVALID_HANDLE, IPCZ_NO_FLAGS, nullptr,
+                           parcels, &num_parcels));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, nullptr, &num_parcels));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, nullptr));
+  num_parcels = 0;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+  num_parcels = 3;
+  parcels[2].size = sizeof(IpczGetParcel) - 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+  parcels[2].size = sizeof(IpczGetParcel);
+  parcels[1].data = nullptr;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+  parcels[1].data = data[1];
+
+  // Nothing to get yet.
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "", {&c, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hello"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "bye"));
+
+  // Retrieval stops at the third parcel, which doesn't fit.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+  EXPECT_EQ(2u, num_parcels);
+  EXPECT_EQ("hi", std::string_view(data[0], parcels[0].num_bytes));
+  EXPECT_EQ(0u, parcels[0].num_handles);
+  EXPECT_EQ(0u, parcels[1].num_bytes);
+  EXPECT_EQ(1u, parcels[1].num_handles);
+  const IpczHandle portal = handles[1];
+
+  // If the first parcel doesn't fit, the required capacity is reported.
+  reset_parcels();
+  num_parcels = 3;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+  EXPECT_EQ(5u, parcels[0].num_bytes);
+  EXPECT_EQ(0u, parcels[0].num_handles);
+
+  // Parcels can also be retrieved without copying, and read with BeginGet().
+  reset_parcels();
+  num_parcels = 3;
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().GetMany(b, IPCZ_GET_MANY_AS_PARCELS,
+                                           nullptr, parcels, &num_parcels));
+  EXPECT_EQ(2u, num_parcels);
+  EXPECT_EQ(5u, parcels[0].num_bytes);
+  EXPECT_EQ(3u, parcels[1].num_bytes);
+  const char* kExpectedContents[] = {"hello", "bye"};
+  for (size_t i = 0; i < 2; ++i) {
+    const volatile void* parcel_data;
+    size_t num_bytes;
+    IpczTransaction transaction;
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().BeginGet(parcels[i].parcel, IPCZ_NO_FLAGS, nullptr,
+                              &parcel_data, &num_bytes, nullptr, nullptr,
+                              &transaction));
+    EXPECT_EQ(kExpectedContents[i], StringFromData(parcel_data, num_bytes));
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().EndGet(parcels[i].parcel, transaction, IPCZ_NO_FLAGS,
+                            nullptr, nullptr));
+    Close(parcels[i].parcel);
+  }
+
+  // The transferred portal still works.
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(d, "ok"));
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(portal, &message));
+  EXPECT_EQ("ok", message);
+
+  // Once the queue is drained and the peer is closed, nothing more can be
+  // retrieved.
+  Close(a);
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().GetMany(b, IPCZ_NO_FLAGS, nullptr, parcels, &num_parcels));
+
+  CloseAll({b, d, portal, node});
+}
+
+TEST_F(APITest, PutSegments) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+  auto [c, d] = OpenPortals(node);
+
+  IpczPutSegment segments[] = {
+      {.size = sizeof(IpczPutSegment), .data = "head", .num_bytes = 4},
+      {.size = sizeof(IpczPutSegment)},
+      {.size = sizeof(IpczPutSegment), .data = "er", .num_bytes = 2},
+      {.size = sizeof(IpczPutSegment), .data = "body", .num_bytes = 4},
+  };
+
+  // Invalid portal, null segments, or any invalid segment.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutSegments(IPCZ_INVALID_HANDLE, segments, 4, nullptr, 0,
+                               IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutSegments(a, nullptr, 4, nullptr, 0, IPCZ_NO_FLAGS,
+                               nullptr));
+  segments[3].size = sizeof(IpczPutSegment) - 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutSegments(a, segments, 4, nullptr, 0, IPCZ_NO_FLAGS,
+                               nullptr));
+  segments[3].size = sizeof(IpczPutSegment);
+  segments[1].num_bytes = 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutSegments(a, segments, 4, nullptr, 0, IPCZ_NO_FLAGS,
+                               nullptr));
+  segments[1].num_bytes = 0;
+
+  // The total size must not overflow.
+  const IpczPutSegment huge_segments[] = {
+      {.size = sizeof(IpczPutSegment), .data = "x", .num_bytes = 1},
+      {
+          .size = sizeof(IpczPutSegment),
+          .data = "x",
+          .num_bytes = std::numeric_limits<size_t>::max(),
+      },
+  };
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().PutSegments(a, huge_segments, 2, nullptr, 0, IPCZ_NO_FLAGS,
+                               nullptr));
+
+  // Limits apply to the parcel's total size.
+  const IpczPutLimits limits = {
+      .size = sizeof(limits),
+      .max_queued_parcels = 1,
+      .max_queued_bytes = 9,
+  };
+  const IpczPutOptions options = {.size = sizeof(options), .limits = &limits};
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().PutSegments(a, segments, 4, nullptr, 0, IPCZ_NO_FLAGS,
+                               &options));
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(b));
+
+  // Segments are concatenated into a single parcel, along with any handles.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutSegments(a, segments, 4, &c, 1, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutSegments(a, nullptr, 0, nullptr, 0, IPCZ_NO_FLAGS,
+                               nullptr));
+
+  std::string message;
+  IpczHandle portal;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message, {&portal, 1}));
+  EXPECT_EQ("headerbody", message);
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ("", message);
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, Get(b));
+
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(d, "ok"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(portal, &message));
+  EXPECT_EQ("ok", message);
+
+  // Once the peer is closed, nothing more can be put.
+  Close(b);
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().PutSegments(a, segments, 4, nullptr, 0, IPCZ_NO_FLAGS,
+                               nullptr));
+
+  CloseAll({a, d, portal, node});
+}
+
 TEST_F(APITest, BeginEndPutFailure) {
   const IpczHandle node = CreateNode(kDefaultDriver);
   auto [a, b] = OpenPortals(node);
@@ -561,7 +952,8 @@ TEST_F(APITest, TrapInvalid) {
                         nullptr));
 
   // Invalid conditions.
-  IpczTrapConditions conditions = {.size = sizeof(conditions) - 1};
+  IpczTrapConditions conditions = {
+      .size = offsetof(IpczTrapConditions, min_local_bytes)};
   EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
             ipcz().Trap(b, &conditions, handler, 0, IPCZ_NO_FLAGS, nullptr,
                         nullptr, nullptr));
@@ -581,7 +973,8 @@ TEST_F(APITest, TrapInvalid) {
                         nullptr, nullptr));
 
   // Invalid non-null output status.
-  IpczPortalStatus status = {.size = sizeof(status) - 1};
+  IpczPortalStatus status = {
+      .size = offsetof(IpczPortalStatus, num_local_bytes)};
   EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
             ipcz().Trap(b, &conditions, handler, 0, IPCZ_NO_FLAGS, nullptr,
                         nullptr, &status));
@@ -589,6 +982,122 @@ TEST_F(APITest, TrapInvalid) {
   CloseAll({a, b, node});
 }
 
+TEST_F(APITest, WaitInvalid) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Null conditions.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(b, nullptr, IPCZ_NO_FLAGS, nullptr, nullptr, nullptr));
+
+  // Invalid conditions.
+  IpczTrapConditions conditions = {
+      .size = offsetof(IpczTrapConditions, min_local_bytes)};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(b, &conditions, IPCZ_NO_FLAGS, nullptr, nullptr,
+                        nullptr));
+
+  // Invalid or non-portal handle.
+  conditions = {.size = sizeof(conditions)};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(IPCZ_INVALID_HANDLE, &conditions, IPCZ_NO_FLAGS,
+                        nullptr, nullptr, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(node, &conditions, IPCZ_NO_FLAGS, nullptr, nullptr,
+                        nullptr));
+
+  // Invalid options.
+  IpczWaitOptions options = {.size = sizeof(options) - 1};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(b, &conditions, IPCZ_NO_FLAGS, &options, nullptr,
+                        nullptr));
+
+  // Invalid non-null output status.
+  IpczPortalStatus status = {
+      .size = offsetof(IpczPortalStatus, num_local_bytes)};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().Wait(b, &conditions, IPCZ_NO_FLAGS, nullptr, nullptr,
+                        &status));
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(APITest, PersistentTrapInvalid) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Invalid portal handles.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().EnableTrap(IPCZ_INVALID_HANDLE, 0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().EnableTrap(node, 0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().RemoveTrap(IPCZ_INVALID_HANDLE, 0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().RemoveTrap(node, 0, IPCZ_NO_FLAGS, nullptr));
+
+  // No trap with the given context.
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().EnableTrap(b, 0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().RemoveTrap(b, 0, IPCZ_NO_FLAGS, nullptr));
+
+  CloseAll({a, b, node});
+}
+
+TEST_F(APITest, WaitSetInvalid) {
+  const IpczHandle node = CreateNode(kDefaultDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Null output handle.
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().CreateWaitSet(IPCZ_NO_FLAGS, nullptr, nullptr));
+
+  IpczHandle wait_set;
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            ipcz().CreateWaitSet(IPCZ_NO_FLAGS, nullptr, &wait_set));
+
+  // Null or invalid conditions.
+  IpczTrapConditions conditions = {
+      .size = offsetof(IpczTrapConditions, min_local_bytes)};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().AddToWaitSet(wait_set, b, nullptr, 0, IPCZ_NO_FLAGS,
+                                nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().AddToWaitSet(wait_set, b, &conditions, 0, IPCZ_NO_FLAGS,
+                                nullptr));
+
+  // Invalid wait set or portal handles.
+  conditions = {.size = sizeof(conditions)};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().AddToWaitSet(b, b, &conditions, 0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().AddToWaitSet(wait_set, node, &conditions, 0, IPCZ_NO_FLAGS,
+                                nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().RemoveFromWaitSet(wait_set, IPCZ_INVALID_HANDLE,
+                                     IPCZ_NO_FLAGS, nullptr));
+
+  // Null or empty output events.
+  IpczWaitSetEvent event;
+  size_t num_events = 0;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().WaitForReadyPortals(wait_set, IPCZ_NO_FLAGS, nullptr,
+                                       &event, &num_events));
+  num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().WaitForReadyPortals(wait_set, IPCZ_NO_FLAGS, nullptr,
+                                       nullptr, &num_events));
+
+  // Invalid options.
+  const IpczWaitOptions options = {.size = sizeof(options) - 1};
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().WaitForReadyPortals(wait_set, IPCZ_NO_FLAGS, &options,
+                                       &event, &num_events));
+
+  CloseAll({a, b, wait_set, node});
+}
+
 TEST_F(APITest, RejectInvalid) {
   EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
             ipcz().Reject(IPCZ_INVALID_HANDLE, 0, IPCZ_NO_FLAGS, nullptr));
@@ -661,6 +1170,96 @@ TEST_F(APITest, RejectRemote) {
   CloseAll({a, b, node_b, node_a, parcel});
 }
 
+TEST_F(APITest, QueryNodeMemoryStats) {
+  const IpczHandle node_a =
+      CreateNode(kDefaultDriver, IPCZ_CREATE_NODE_AS_BROKER);
+  const IpczHandle node_b = CreateNode(kDefaultDriver);
+
+  // A node with no links has nothing to report.
+  size_t num_links = 0;
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().QueryNodeMemoryStats(
+                                node_a, IPCZ_NO_FLAGS, nullptr, nullptr,
+                                &num_links));
+  EXPECT_EQ(0u, num_links);
+
+  IpczDriverHandle transport0, transport1;
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            kDefaultDriver.CreateTransports(
+                IPCZ_INVALID_DRIVER_HANDLE, IPCZ_INVALID_DRIVER_HANDLE,
+                IPCZ_NO_FLAGS, nullptr, &transport0, &transport1));
+  IpczHandle a;
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().ConnectNode(node_a, transport0, 1,
+                                               IPCZ_NO_FLAGS, nullptr, &a));
+  IpczHandle b;
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            ipcz().ConnectNode(node_b, transport1, 1,
+                               IPCZ_CONNECT_NODE_TO_BROKER, nullptr, &b));
+
+  // Invalid node handle, null count, and null stats with a non-zero count.
+  IpczNodeLinkMemoryStats stats = {.size = sizeof(stats)};
+  num_links = 1;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeMemoryStats(IPCZ_INVALID_HANDLE, IPCZ_NO_FLAGS,
+                                        nullptr, &stats, &num_links));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeMemoryStats(node_a, IPCZ_NO_FLAGS, nullptr,
+                                        &stats, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeMemoryStats(node_a, IPCZ_NO_FLAGS, nullptr,
+                                        nullptr, &num_links));
+
+  // Invalid stats size.
+  stats.size = 0;
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().QueryNodeMemoryStats(node_a, IPCZ_NO_FLAGS, nullptr,
+                                        &stats, &num_links));
+
+  // Too little space for any links.
+  num_links = 0;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().QueryNodeMemoryStats(node_a, IPCZ_NO_FLAGS, nullptr,
+                                        nullptr, &num_links));
+  EXPECT_EQ(1u, num_links);
+
+  stats.size = sizeof(stats);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryNodeMemoryStats(node_a, IPCZ_NO_FLAGS, nullptr,
+                                        &stats, &num_links));
+  EXPECT_EQ(1u, num_links);
+  EXPECT_GT(stats.primary_buffer_size, 0u);
+  EXPECT_EQ(1u, stats.num_buffers);
+  EXPECT_EQ(stats.primary_buffer_size, stats.total_buffer_size);
+  EXPECT_EQ(0u, stats.num_large_buffers);
+  EXPECT_GT(stats.num_block_size_classes, 0u);
+  for (size_t i = 0; i < stats.num_block_size_classes; ++i) {
+    const IpczBlockMemoryStats& block_stats = stats.block_size_classes[i];
+    EXPECT_GT(block_stats.num_blocks, 0u);
+    EXPECT_LE(block_stats.num_free_blocks + block_stats.num_cached_blocks,
+              block_stats.num_blocks);
+    if (i > 0) {
+      EXPECT_LT(stats.block_size_classes[i - 1].block_size,
+                block_stats.block_size);
+    }
+  }
+
+  // Parcel data put into a portal on the link is allocated directly from the
+  // link's memory, while empty parcels aren't counted at all.
+  const size_t num_parcels_with_fragment_data =
+      stats.num_parcels_with_fragment_data;
+  EXPECT_EQ(0u, stats.num_parcels_with_migrated_fragment_data);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, std::string(256, '!')));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, ""));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryNodeMemoryStats(node_a, IPCZ_NO_FLAGS, nullptr,
+                                        &stats, &num_links));
+  EXPECT_EQ(num_parcels_with_fragment_data + 1,
+            stats.num_parcels_with_fragment_data);
+  EXPECT_EQ(0u, stats.num_parcels_with_migrated_fragment_data);
+  EXPECT_EQ(0u, stats.num_parcels_with_inlined_data);
+
+  CloseAll({a, b, node_b, node_a});
+}
+
 TEST_F(APITest, BoxInvalid) {
   IpczDriverHandle transport0, transport1;
   ASSERT_EQ(IPCZ_RESULT_OK,
@@ -4,7 +4,10 @@
 
 #include <cstring>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
 #include "ipcz/ipcz.h"
 #include "test/multinode_test.h"
@@ -296,6 +299,101 @@ MULTINODE_TEST(BoxTest, SerializedApplicationObject) {
   CloseAll({c, q});
 }
 
+// Functions to box a string as an application object which serializes to its
+// own contents, with no handles.
+IpczResult SerializeString(uintptr_t object,
+                           uint32_t,
+                           const void*,
+                           volatile void* data,
+                           size_t* num_bytes,
+                           IpczHandle* handles,
+                           size_t* num_handles) {
+  const auto& contents = *reinterpret_cast<const std::string*>(object);
+  const size_t byte_capacity = num_bytes ? *num_bytes : 0;
+  if (num_bytes) {
+    *num_bytes = contents.size();
+  }
+  if (num_handles) {
+    *num_handles = 0;
+  }
+  if (byte_capacity < contents.size()) {
+    return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+  }
+  memcpy(const_cast<void*>(data), contents.data(), contents.size());
+  return IPCZ_RESULT_OK;
+}
+
+void DestroyString(uintptr_t object, uint32_t, const void*) {
+  delete reinterpret_cast<std::string*>(object);
+}
+
+// Returns distinct contents for each of a parcel's serialized strings.
+std::string GetBoxedString(size_t i, size_t size) {
+  return std::string(size, static_cast<char>('a' + i % 26));
+}
+
+constexpr size_t kNumSmallBoxedStrings = 100;
+constexpr size_t kSmallBoxedStringSize = 64;
+constexpr size_t kNumLargeBoxedStrings = 3;
+constexpr size_t kLargeBoxedStringSize = 32 * 1024;
+
+MULTINODE_TEST_NODE(BoxTestNode, ManySerializedApplicationObjectsClient) {
+  IpczHandle b = ConnectToBroker();
+
+  // With IPCZ_FEATURE_EMBEDDED_SUBPARCELS, small objects are embedded within
+  // the message for their parcel, while the larger ones exceed the size limit
+  // for embedding and are sent separately. Without the feature, all of them
+  // are sent separately. Either way they arrive intact.
+  for (auto [num_boxes, size] :
+       {std::make_pair(kNumSmallBoxedStrings, kSmallBoxedStringSize),
+        std::make_pair(kNumLargeBoxedStrings, kLargeBoxedStringSize)}) {
+    std::vector<IpczHandle> boxes(num_boxes);
+    std::string message;
+    ASSERT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message, absl::MakeSpan(boxes)));
+    EXPECT_EQ("boxes", message);
+    for (size_t i = 0; i < num_boxes; ++i) {
+      IpczBoxContents contents = {.size = sizeof(contents)};
+      ASSERT_EQ(IPCZ_RESULT_OK,
+                ipcz().Unbox(boxes[i], IPCZ_NO_FLAGS, nullptr, &contents));
+      ASSERT_EQ(IPCZ_BOX_TYPE_SUBPARCEL, contents.type);
+      std::string data;
+      EXPECT_EQ(IPCZ_RESULT_OK, Get(contents.object.subparcel, &data));
+      EXPECT_EQ(GetBoxedString(i, size), data);
+      Close(contents.object.subparcel);
+    }
+  }
+
+  PingPong(b);
+  Close(b);
+}
+
+MULTINODE_TEST(BoxTest, ManySerializedApplicationObjects) {
+  IpczHandle c = SpawnTestNode<ManySerializedApplicationObjectsClient>();
+  for (auto [num_boxes, size] :
+       {std::make_pair(kNumSmallBoxedStrings, kSmallBoxedStringSize),
+        std::make_pair(kNumLargeBoxedStrings, kLargeBoxedStringSize)}) {
+    std::vector<IpczHandle> boxes(num_boxes);
+    for (size_t i = 0; i < num_boxes; ++i) {
+      const IpczBoxContents contents = {
+          .size = sizeof(contents),
+          .type = IPCZ_BOX_TYPE_APPLICATION_OBJECT,
+          .object = {.application_object = reinterpret_cast<uintptr_t>(
+                         new std::string(GetBoxedString(i, size)))},
+          .serializer = &SerializeString,
+          .destructor = &DestroyString,
+      };
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                ipcz().Box(node(), &contents, IPCZ_NO_FLAGS, nullptr,
+                           &boxes[i]));
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "boxes", absl::MakeSpan(boxes)));
+  }
+
+  WaitForPingAndReply(c);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(c, IPCZ_TRAP_PEER_CLOSED));
+  Close(c);
+}
+
 MULTINODE_TEST(BoxTest, UnserializedApplicationObject) {
   auto [a, b] = OpenPortals();
   auto [q, p] = OpenPortals();
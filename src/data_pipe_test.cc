@@ -0,0 +1,480 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include "ipcz/ipcz.h"
+#include "test/multinode_test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+constexpr size_t kPipeCapacity = 4096;
+
+// Streamed through data pipes which are transferred between nodes. This is
+// many times the pipe's capacity, so the producer must regularly wait for the
+// consumer to make room.
+constexpr size_t kStreamSize = 256 * 1024;
+
+std::string MakeStreamData(size_t size) {
+  std::string data(size, 0);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>((i * 7 + i / 251) & 0xff);
+  }
+  return data;
+}
+
+class DataPipeTestNode : public test::TestNode {
+ public:
+  std::pair<IpczHandle, IpczHandle> CreateDataPipe(
+      size_t capacity = kPipeCapacity) {
+    const IpczCreateDataPipeOptions options = {
+        .size = sizeof(options),
+        .capacity_num_bytes = capacity,
+    };
+    IpczHandle producer;
+    IpczHandle consumer;
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().CreateDataPipe(node(), IPCZ_NO_FLAGS, &options, &producer,
+                                    &consumer));
+    return {producer, consumer};
+  }
+
+  // Writes as much of `data` as possible without waiting, returning the
+  // number of bytes written.
+  size_t TryWrite(IpczHandle producer, std::string_view data) {
+    size_t total = 0;
+    while (total < data.size()) {
+      volatile void* buffer;
+      size_t num_bytes = data.size() - total;
+      const IpczResult result =
+          ipcz().BeginWriteData(producer, IPCZ_BEGIN_WRITE_DATA_ALLOW_PARTIAL,
+                                nullptr, &buffer, &num_bytes);
+      if (result != IPCZ_RESULT_OK) {
+        EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED, result);
+        break;
+      }
+
+      num_bytes = std::min(num_bytes, data.size() - total);
+      memcpy(const_cast<void*>(buffer), data.data() + total, num_bytes);
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                ipcz().EndWriteData(producer, num_bytes, IPCZ_NO_FLAGS,
+                                    nullptr));
+      total += num_bytes;
+    }
+    return total;
+  }
+
+  // Reads all data currently available from `consumer` and appends it to
+  // `data`. Returns the result of the last BeginReadData() call.
+  IpczResult TryRead(IpczHandle consumer, std::string& data) {
+    for (;;) {
+      const volatile void* buffer;
+      size_t num_bytes;
+      const IpczResult result = ipcz().BeginReadData(
+          consumer, IPCZ_NO_FLAGS, nullptr, &buffer, &num_bytes);
+      if (result != IPCZ_RESULT_OK) {
+        return result;
+      }
+
+      const char* bytes = static_cast<const char*>(const_cast<void*>(buffer));
+      data.append(bytes, num_bytes);
+      EXPECT_EQ(IPCZ_RESULT_OK, ipcz().EndReadData(consumer, num_bytes,
+                                                   IPCZ_NO_FLAGS, nullptr));
+    }
+  }
+
+  // Writes all of `data` to `producer`, waiting for room as needed.
+  void WriteAll(IpczHandle producer, std::string_view data) {
+    const IpczTrapConditions has_room = {
+        .size = sizeof(has_room),
+        .flags = IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES | IPCZ_TRAP_PEER_CLOSED,
+        .max_remote_bytes = kPipeCapacity,
+    };
+    while (!data.empty()) {
+      data.remove_prefix(TryWrite(producer, data));
+      if (!data.empty()) {
+        ASSERT_EQ(IPCZ_RESULT_OK, WaitForConditions(producer, has_room));
+      }
+    }
+  }
+
+  // Reads from `consumer` until its producer is closed and all data has been
+  // read, returning the data.
+  std::string ReadAll(IpczHandle consumer) {
+    const IpczTrapConditions has_data = {
+        .size = sizeof(has_data),
+        .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES | IPCZ_TRAP_DEAD,
+        .min_local_bytes = 0,
+    };
+    std::string data;
+    while (TryRead(consumer, data) == IPCZ_RESULT_UNAVAILABLE) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditions(consumer, has_data));
+    }
+    return data;
+  }
+};
+
+using DataPipeTest = test::MultinodeTest<DataPipeTestNode>;
+
+MULTINODE_TEST(DataPipeTest, WriteAndRead) {
+  auto [producer, consumer] = CreateDataPipe();
+
+  const volatile void* data;
+  size_t num_bytes;
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE,
+            ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS, nullptr, &data,
+                                 &num_bytes));
+
+  constexpr std::string_view kMessage = "hello, data pipe";
+  EXPECT_EQ(kMessage.size(), TryWrite(producer, kMessage));
+
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(producer, IPCZ_NO_FLAGS, nullptr,
+                                     &status));
+  EXPECT_EQ(kMessage.size(), status.num_remote_bytes);
+  EXPECT_EQ(0u, status.num_local_bytes);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(consumer, IPCZ_NO_FLAGS, nullptr,
+                                     &status));
+  EXPECT_EQ(kMessage.size(), status.num_local_bytes);
+  EXPECT_EQ(0u, status.num_local_parcels);
+
+  // A read can consume less than what's available.
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS,
+                                                 nullptr, &data, &num_bytes));
+  EXPECT_EQ(kMessage.size(), num_bytes);
+  EXPECT_EQ(IPCZ_RESULT_ALREADY_EXISTS,
+            ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS, nullptr, &data,
+                                 &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().EndReadData(consumer, kMessage.size() + 1, IPCZ_NO_FLAGS,
+                               nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EndReadData(consumer, 7, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION,
+            ipcz().EndReadData(consumer, 0, IPCZ_NO_FLAGS, nullptr));
+
+  std::string contents;
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, TryRead(consumer, contents));
+  EXPECT_EQ(kMessage.substr(7), contents);
+
+  CloseAll({producer, consumer});
+}
+
+MULTINODE_TEST(DataPipeTest, AbortTransactions) {
+  auto [producer, consumer] = CreateDataPipe();
+
+  volatile void* out;
+  size_t num_bytes = 4;
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().BeginWriteData(producer, IPCZ_NO_FLAGS,
+                                                  nullptr, &out, &num_bytes));
+  EXPECT_EQ(kPipeCapacity, num_bytes);
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().EndWriteData(producer, 4,
+                                                IPCZ_END_WRITE_DATA_ABORT,
+                                                nullptr));
+
+  const volatile void* in;
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE,
+            ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS, nullptr, &in,
+                                 &num_bytes));
+
+  EXPECT_EQ(4u, TryWrite(producer, "abcd"));
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS,
+                                                 nullptr, &in, &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().EndReadData(consumer, 4,
+                                               IPCZ_END_READ_DATA_ABORT,
+                                               nullptr));
+
+  std::string contents;
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, TryRead(consumer, contents));
+  EXPECT_EQ("abcd", contents);
+
+  CloseAll({producer, consumer});
+}
+
+MULTINODE_TEST(DataPipeTest, FullAndWrapAround) {
+  auto [producer, consumer] = CreateDataPipe();
+
+  const std::string data = MakeStreamData(kPipeCapacity + 1000);
+  EXPECT_EQ(kPipeCapacity, TryWrite(producer, data));
+
+  volatile void* out;
+  size_t num_bytes = 1;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().BeginWriteData(producer, IPCZ_BEGIN_WRITE_DATA_ALLOW_PARTIAL,
+                                  nullptr, &out, &num_bytes));
+
+  // Free up some space at the front of the ring. Only the space at the end is
+  // contiguous with the current write position, so a larger write must be
+  // partial or wait.
+  const volatile void* in;
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS,
+                                                 nullptr, &in, &num_bytes));
+  EXPECT_EQ(kPipeCapacity, num_bytes);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EndReadData(consumer, 1000, IPCZ_NO_FLAGS, nullptr));
+
+  num_bytes = 1001;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().BeginWriteData(producer, IPCZ_NO_FLAGS, nullptr, &out,
+                                  &num_bytes));
+  EXPECT_EQ(1000u, TryWrite(producer, std::string_view(data).substr(
+                                          kPipeCapacity)));
+
+  // Reading the wrapped data takes two transactions.
+  std::string contents;
+  EXPECT_EQ(IPCZ_RESULT_UNAVAILABLE, TryRead(consumer, contents));
+  EXPECT_EQ(data.substr(1000), contents);
+
+  CloseAll({producer, consumer});
+}
+
+MULTINODE_TEST(DataPipeTest, Traps) {
+  auto [producer, consumer] = CreateDataPipe();
+
+  bool readable = false;
+  const IpczTrapConditions has_data = {
+      .size = sizeof(has_data),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES,
+      .min_local_bytes = 2,
+  };
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            Trap(consumer, has_data, [&](const IpczTrapEvent& event) {
+              EXPECT_TRUE(event.condition_flags &
+                          IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES);
+              EXPECT_EQ(3u, event.status->num_local_bytes);
+              readable = true;
+            }));
+
+  // Local pipes deliver their doorbells synchronously.
+  EXPECT_EQ(2u, TryWrite(producer, "ab"));
+  EXPECT_FALSE(readable);
+  EXPECT_EQ(1u, TryWrite(producer, "c"));
+  EXPECT_TRUE(readable);
+
+  // The trap is satisfied now, so it can't be installed again.
+  IpczTrapConditionFlags flags;
+  EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION,
+            Trap(consumer, has_data, [](const IpczTrapEvent&) {}, &flags));
+  EXPECT_TRUE(flags & IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES);
+
+  const std::string data = MakeStreamData(kPipeCapacity - 3);
+  EXPECT_EQ(data.size(), TryWrite(producer, data));
+
+  bool writable = false;
+  const IpczTrapConditions has_room = {
+      .size = sizeof(has_room),
+      .flags = IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES,
+      .max_remote_bytes = kPipeCapacity,
+  };
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            Trap(producer, has_room, [&](const IpczTrapEvent& event) {
+              EXPECT_EQ(kPipeCapacity - 3, event.status->num_remote_bytes);
+              writable = true;
+            }));
+
+  std::string contents;
+  const volatile void* in;
+  size_t num_bytes;
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS,
+                                                 nullptr, &in, &num_bytes));
+  EXPECT_FALSE(writable);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EndReadData(consumer, 3, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_TRUE(writable);
+
+  // Closing an endpoint removes its traps.
+  bool removed = false;
+  const IpczTrapConditions peer_closed = {
+      .size = sizeof(peer_closed),
+      .flags = IPCZ_TRAP_PEER_CLOSED,
+  };
+  ASSERT_EQ(IPCZ_RESULT_OK,
+            Trap(consumer, peer_closed, [&](const IpczTrapEvent& event) {
+              EXPECT_TRUE(event.condition_flags & IPCZ_TRAP_REMOVED);
+              removed = true;
+            }));
+  Close(consumer);
+  EXPECT_TRUE(removed);
+  Close(producer);
+}
+
+MULTINODE_TEST(DataPipeTest, PeerClosure) {
+  auto [producer, consumer] = CreateDataPipe();
+
+  const IpczTrapConditions dead = {
+      .size = sizeof(dead),
+      .flags = IPCZ_TRAP_DEAD,
+  };
+  bool consumer_dead = false;
+  ASSERT_EQ(IPCZ_RESULT_OK, Trap(consumer, dead, [&](const IpczTrapEvent&) {
+              consumer_dead = true;
+            }));
+
+  EXPECT_EQ(5u, TryWrite(producer, "hello"));
+  Close(producer);
+
+  // The consumer can still read the remaining data after the producer is
+  // closed, and it's only dead once that data is gone.
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(consumer, IPCZ_NO_FLAGS, nullptr,
+                                     &status));
+  EXPECT_TRUE(status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED);
+  EXPECT_FALSE(status.flags & IPCZ_PORTAL_STATUS_DEAD);
+  EXPECT_EQ(5u, status.num_local_bytes);
+  EXPECT_FALSE(consumer_dead);
+
+  std::string contents;
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND, TryRead(consumer, contents));
+  EXPECT_EQ("hello", contents);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(consumer, IPCZ_NO_FLAGS, nullptr,
+                                     &status));
+  EXPECT_TRUE(status.flags & IPCZ_PORTAL_STATUS_DEAD);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(consumer, IPCZ_TRAP_DEAD));
+  Close(consumer);
+
+  // A producer is dead as soon as its consumer is closed.
+  std::tie(producer, consumer) = CreateDataPipe();
+  Close(consumer);
+  volatile void* out;
+  size_t num_bytes = 1;
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().BeginWriteData(producer, IPCZ_NO_FLAGS, nullptr, &out,
+                                  &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(producer, IPCZ_TRAP_DEAD));
+  Close(producer);
+}
+
+MULTINODE_TEST(DataPipeTest, InvalidArguments) {
+  auto [producer, consumer] = CreateDataPipe();
+  auto [a, b] = OpenPortals();
+
+  volatile void* out;
+  const volatile void* in;
+  size_t num_bytes = 1;
+  const IpczCreateDataPipeOptions too_large = {
+      .size = sizeof(too_large),
+      .capacity_num_bytes = static_cast<size_t>(1) << 30,
+  };
+  IpczHandle p, c;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            ipcz().CreateDataPipe(node(), IPCZ_NO_FLAGS, &too_large, &p, &c));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().CreateDataPipe(a, IPCZ_NO_FLAGS, nullptr, &p, &c));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().BeginWriteData(consumer, IPCZ_NO_FLAGS, nullptr, &out,
+                                  &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().BeginWriteData(a, IPCZ_NO_FLAGS, nullptr, &out,
+                                  &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().BeginReadData(producer, IPCZ_NO_FLAGS, nullptr, &in,
+                                 &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT,
+            ipcz().BeginReadData(consumer, IPCZ_NO_FLAGS, nullptr, nullptr,
+                                 &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION,
+            ipcz().EndWriteData(producer, 0, IPCZ_NO_FLAGS, nullptr));
+
+  // An endpoint can't be transferred during a two-phase transaction.
+  ASSERT_EQ(IPCZ_RESULT_OK, ipcz().BeginWriteData(producer, IPCZ_NO_FLAGS,
+                                                  nullptr, &out, &num_bytes));
+  EXPECT_EQ(IPCZ_RESULT_INVALID_ARGUMENT, Put(a, "", {&producer, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EndWriteData(producer, 0, IPCZ_NO_FLAGS, nullptr));
+
+  CloseAll({producer, consumer, a, b});
+}
+
+MULTINODE_TEST(DataPipeTest, LocalTransfer) {
+  // Endpoints transferred between local portals keep working.
+  auto [producer, consumer] = CreateDataPipe();
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "", {&consumer, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&consumer, 1}));
+
+  EXPECT_EQ(5u, TryWrite(producer, "hello"));
+  Close(producer);
+  EXPECT_EQ("hello", ReadAll(consumer));
+  CloseAll({consumer, a, b});
+}
+
+MULTINODE_TEST_NODE(DataPipeTestNode, ReadStreamClient) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle consumer;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&consumer, 1}));
+  EXPECT_EQ(MakeStreamData(kStreamSize), ReadAll(consumer));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, "done"));
+  WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED);
+  CloseAll({consumer, b});
+}
+
+MULTINODE_TEST(DataPipeTest, TransferConsumer) {
+  IpczHandle c = SpawnTestNode<ReadStreamClient>();
+  auto [producer, consumer] = CreateDataPipe();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", {&consumer, 1}));
+
+  WriteAll(producer, MakeStreamData(kStreamSize));
+  Close(producer);
+  EXPECT_EQ("done", WaitToGetString(c));
+  Close(c);
+}
+
+MULTINODE_TEST_NODE(DataPipeTestNode, WriteStreamClient) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle producer;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&producer, 1}));
+  WriteAll(producer, MakeStreamData(kStreamSize));
+  Close(producer);
+  WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED);
+  Close(b);
+}
+
+MULTINODE_TEST(DataPipeTest, TransferProducer) {
+  IpczHandle c = SpawnTestNode<WriteStreamClient>();
+  auto [producer, consumer] = CreateDataPipe();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", {&producer, 1}));
+  EXPECT_EQ(MakeStreamData(kStreamSize), ReadAll(consumer));
+  CloseAll({consumer, c});
+}
+
+MULTINODE_TEST_NODE(DataPipeTestNode, ForwardConsumerClient) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle consumer;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&consumer, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, "", {&consumer, 1}));
+  WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED);
+  Close(b);
+}
+
+MULTINODE_TEST(DataPipeTest, TransferConsumerAndBack) {
+  // A consumer can round-trip through another node, and data written in the
+  // meantime is still delivered in order.
+  IpczHandle c = SpawnTestNode<ForwardConsumerClient>();
+  auto [producer, consumer] = CreateDataPipe();
+  const std::string data = MakeStreamData(kPipeCapacity);
+  EXPECT_EQ(1000u, TryWrite(producer, std::string_view(data).substr(0, 1000)));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "", {&consumer, 1}));
+  EXPECT_EQ(data.size() - 1000,
+            TryWrite(producer, std::string_view(data).substr(1000)));
+  Close(producer);
+
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c, nullptr, {&consumer, 1}));
+  EXPECT_EQ(data, ReadAll(consumer));
+  CloseAll({consumer, c});
+}
+
+}  // namespace
+}  // namespace ipcz
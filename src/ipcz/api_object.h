@@ -25,6 +25,8 @@ class APIObject : public RefCounted<APIObject> {
     kBox,
     kTransportListener,
     kParcel,
+    kDataPipe,
+    kWaitSet,
   };
 
   explicit APIObject(ObjectType type);
@@ -20,54 +20,477 @@ namespace ipcz {
 
 namespace {
 
-constexpr int16_t kFrontBlockIndex = 0;
+// For a region of N bytes with a block size B, BlockAllocator divides the
+// region into `N/B` contiguous blocks with a block header structure at the
+// beginning of each. These headers form a singly-linked free-list of available
+// blocks. Block 0 can never be allocated and is used exclusively for its header
+// to point to the first free block. Each free block references the next free
+// block in the list, and the last free block references back to block 0 to
+// terminate the list.
+//
+// Once a block is allocated, its entire span of B bytes -- including the header
+// space -- will remain untouched by BlockAllocator and is available for
+// application use until freed. When a block is freed, its header is restored.
+//
+// Each header has two fields:
+//
+// `version` is only meaningful within the first block. This field is
+// incremented any time the block's header changes, and it's used to resolve
+// races between concurrent Allocate() or Free() operations modifying the head
+// of the free-list. For blocks other than the first block, this is always zero.
+//
+// `next` is a relative index to the next free block in the list. Note that this
+// is not relative to the index of the header's own block, but rather to the
+// index of the block which physically follows it within the region (this
+// block's "successor".) For example if this header belongs to block 3, the
+// value of `next` is relative to index 4.
+//
+// This scheme is chosen so that a region can be initialized efficiently by
+// zeroing it out and then updating only the last block's header to terminate
+// the list. That way block 0 begins by pointing to block 1 as the first free
+// block, block 1 points to block 2 as the next free block, and so on.
+//
+// Two header formats are supported, per BlockAllocator::HeaderFormat.
+struct IPCZ_ALIGN(4) NarrowBlockHeader {
+  using Index = int16_t;
+  uint16_t version;
+  int16_t next;
+};
+static_assert(sizeof(NarrowBlockHeader) == 4, "Invalid BlockHeader size");
+
+struct IPCZ_ALIGN(8) WideBlockHeader {
+  using Index = int32_t;
+  uint32_t version;
+  int32_t next;
+};
+static_assert(sizeof(WideBlockHeader) == 8, "Invalid BlockHeader size");
+
+static_assert(std::atomic<NarrowBlockHeader>::is_always_lock_free &&
+                  std::atomic<WideBlockHeader>::is_always_lock_free,
+              "ipcz requires lock-free atomics");
 
 // Helper for legibility of relative/absolute index conversions.
+template <typename Index>
 struct ForBaseIndex {
   // Constructs a helper to compute absolute or relative indexes based around
-  // the successor to the block at `index`. See documentation on BlockHeader's
-  // `next` field.
-  explicit constexpr ForBaseIndex(int16_t index) : index_(index) {}
+  // the successor to the block at `index`. See documentation on the `next`
+  // field of block headers above.
+  explicit constexpr ForBaseIndex(Index index) : index_(index) {}
 
   // Returns an index equivalent to `absolute_index`, but relative to the
   // successor of the block at `index_`.
-  constexpr int16_t GetRelativeFromAbsoluteIndex(int16_t absolute_index) const {
+  constexpr Index GetRelativeFromAbsoluteIndex(Index absolute_index) const {
     // NOTE: We intentionally ignore overflow. Absolute indices are always
     // validated before use anyway, and it would be redundant in some cases to
     // validate these inputs.
-    return absolute_index - index_ - 1;
+    return static_cast<Index>(static_cast<int64_t>(absolute_index) - index_ -
+                              1);
   }
 
   // Returns an absolute index which is equivalent to `relative_index` if taken
   // as relative to the successor of the block at `index_`.
-  constexpr int16_t GetAbsoluteFromRelativeIndex(int16_t relative_index) const {
+  constexpr Index GetAbsoluteFromRelativeIndex(Index relative_index) const {
     // NOTE: We intentionally ignore overflow. The returned index is only stored
     // and maybe eventually used to reconstruct an absolute index. Absolute
     // indices are always validated before use, and it would be redundant in
     // some cases to validate these inputs.
-    return index_ + relative_index + 1;
+    return static_cast<Index>(static_cast<int64_t>(index_) + relative_index +
+                              1);
   }
 
  private:
-  const int16_t index_;
+  const Index index_;
+};
+
+// The implementation of BlockAllocator for a specific block header format.
+// These objects are cheap to construct and only live for the duration of a
+// single BlockAllocator operation.
+template <typename Header>
+class BlockAllocatorImpl {
+ public:
+  using Index = typename Header::Index;
+  using AtomicBlockHeader = std::atomic<Header>;
+
+  static constexpr Index kFrontBlockIndex = 0;
+
+  BlockAllocatorImpl(absl::Span<uint8_t> region,
+                     size_t block_size,
+                     size_t num_blocks)
+      : region_(region),
+        block_size_(block_size),
+        num_blocks_(static_cast<Index>(num_blocks)) {}
+
+  void InitializeRegion() const {
+    // By zeroing the entire region, every block effectively points to its
+    // immediate successor as the next free block. See comments on the `next`
+    // field of block headers.
+    memset(region_.data(), 0, region_.size());
+
+    // Ensure that the last block points back to the unallocable first block,
+    // indicating the end of the free-list.
+    free_block_at(last_block_index()).SetNextFreeBlock(kFrontBlockIndex);
+  }
+
+  void* Allocate() const {
+    Header front =
+        block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
+    for (;;) {
+      const Index first_free_block_index =
+          ForBaseIndex<Index>(kFrontBlockIndex)
+              .GetAbsoluteFromRelativeIndex(front.next);
+      if (first_free_block_index == kFrontBlockIndex ||
+          !is_index_valid(first_free_block_index)) {
+        // Note that the front block can never be allocated, so if that's where
+        // the head of the free-list points then the free-list is empty. If it
+        // otherwise points to an out-of-range index, the allocator is in an
+        // invalid state. In either case, we fail the allocation.
+        return nullptr;
+      }
+
+      // Extract the index of the *next* free block from the header of the
+      // first.
+      FreeBlock first_free_block = free_block_at(first_free_block_index);
+
+      // SUBTLE: This stack requires a race suppression when running with TSan.
+      //
+      // Multiple threads may race to load the front block header at roughly
+      // the same time and end up with the same `first_free_block`. Only one
+      // thread will successfully claim the block via TryUpdateFrontHeader()
+      // below, but all of them will still load the maybe-free block's header
+      // here.
+      //
+      // Meanwhile, the winning thread may at any point begin using the block
+      // and e.g. issuing non-atomic writes to its memory. This can cause TSan
+      // to blow up, as it will detect data races between the winner's writes,
+      // and the losing thread(s) issuing this atomic load. The races are
+      // legitimate but harmless, because the result of this load is unused
+      // unless the subsequent TryUpdateFrontHeader() succeeds, which it won't.
+      Header first_free_block_header =
+          first_free_block.header().load(std::memory_order_acquire);
+      const Index next_free_block_index =
+          ForBaseIndex<Index>(first_free_block_index)
+              .GetAbsoluteFromRelativeIndex(first_free_block_header.next);
+      if (!is_index_valid(next_free_block_index)) {
+        // Invalid block header, so we cannot proceed.
+        return nullptr;
+      }
+
+      if (TryUpdateFrontHeader(front, next_free_block_index)) {
+        // If we successfully update the front block's header to point at the
+        // second free block, we have effectively allocated the first free
+        // block by removing it from the free-list. This means we're done and
+        // the allocator will not touch the contents of this block (including
+        // header) until it's freed.
+        return first_free_block.address();
+      }
+
+      // Another thread must have modified the front block header since we
+      // fetched it above. `front` now has a newly updated copy, so we loop
+      // around again to retry allocation.
+    }
+  }
+
+  bool Free(void* ptr) const {
+    const Index new_free_index = GetFreeableBlockIndex(ptr);
+    if (new_free_index == kInvalidBlockIndex) {
+      return false;
+    }
+
+    FreeBlock free_block = free_block_at(new_free_index);
+    Header front =
+        block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
+    do {
+      const Index first_free_index = ForBaseIndex<Index>(kFrontBlockIndex)
+                                         .GetAbsoluteFromRelativeIndex(
+                                             front.next);
+      if (!is_index_valid(first_free_index)) {
+        // The front block header is in an invalid state, so we cannot proceed.
+        return false;
+      }
+
+      // The application calling Free() implies that it's done using the
+      // block. The allocator is therefore free to overwrite the contents with
+      // a new block header. Write a header which points to the current head of
+      // the free-list.
+      free_block.SetNextFreeBlock(first_free_index);
+
+      // And now try to update the front block so that this newly freed block
+      // becomes the new head of the free-list. Upon success, the block is
+      // effectively freed. Upon failure, `front` will have an updated copy of
+      // the front block header, so we can loop around and try to insert the
+      // freed block again.
+    } while (!TryUpdateFrontHeader(front, new_free_index));
+
+    return true;
+  }
+
+  size_t AllocateBatch(absl::Span<void*> blocks) const {
+    if (blocks.empty()) {
+      return 0;
+    }
+
+    Header front =
+        block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
+    for (;;) {
+      // Walk the free-list from its head, collecting up to `blocks.size()`
+      // free blocks. Any other Allocate(), Free() or batch operation which
+      // completes while we're walking must modify the front block's header, so
+      // if the TryUpdateFrontHeader() below succeeds, the chain we walked was
+      // still intact and is now exclusively ours.
+      //
+      // SUBTLE: As with Allocate(), the headers loaded here may belong to
+      // blocks which have since been claimed by another thread and are being
+      // written non-atomically. Such races are harmless because the loaded
+      // values are only used if the front block's header is unchanged, and all
+      // indices are validated before use.
+      size_t num_blocks = 0;
+      Index next_free_block_index = ForBaseIndex<Index>(kFrontBlockIndex)
+                                        .GetAbsoluteFromRelativeIndex(
+                                            front.next);
+      while (num_blocks < blocks.size()) {
+        if (next_free_block_index == kFrontBlockIndex ||
+            !is_index_valid(next_free_block_index)) {
+          // Either the end of the free-list, or an invalid (or stale) header.
+          break;
+        }
+
+        FreeBlock block = free_block_at(next_free_block_index);
+        const Header header = block.header().load(std::memory_order_acquire);
+        blocks[num_blocks++] = block.address();
+        next_free_block_index = ForBaseIndex<Index>(next_free_block_index)
+                                    .GetAbsoluteFromRelativeIndex(header.next);
+      }
+
+      if (num_blocks == 0 || !is_index_valid(next_free_block_index)) {
+        // Either the free-list is empty, or the allocator is in an invalid
+        // state. The latter can't be due to a stale walk unless the front
+        // header has changed, so re-check that before giving up.
+        Header current_front =
+            block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
+        if (num_blocks == 0 || (current_front.version == front.version &&
+                                current_front.next == front.next)) {
+          return 0;
+        }
+        front = current_front;
+        continue;
+      }
+
+      if (TryUpdateFrontHeader(front, next_free_block_index)) {
+        // The front block now points past the last block we collected, so the
+        // whole chain has been removed from the free-list.
+        return num_blocks;
+      }
+
+      // Another thread modified the front block header since we fetched it.
+      // `front` now has an updated copy, so loop around and walk again.
+    }
+  }
+
+  bool FreeBatch(absl::Span<void* const> blocks) const {
+    if (blocks.empty()) {
+      return true;
+    }
+
+    // Validate the whole batch before touching any block headers.
+    for (void* ptr : blocks) {
+      if (GetFreeableBlockIndex(ptr) == kInvalidBlockIndex) {
+        return false;
+      }
+    }
+
+    // Link the freed blocks into a chain, in order, so that the first block in
+    // `blocks` will become the new head of the free-list. None of these blocks
+    // are reachable from the free-list yet, so these headers can be written
+    // without contention.
+    for (size_t i = 0; i + 1 < blocks.size(); ++i) {
+      free_block_at(GetFreeableBlockIndex(blocks[i]))
+          .SetNextFreeBlock(GetFreeableBlockIndex(blocks[i + 1]));
+    }
+
+    // Now splice the chain onto the head of the free-list. Only the last
+    // block's header needs to be updated on each attempt.
+    FreeBlock last_block = free_block_at(GetFreeableBlockIndex(blocks.back()));
+    const Index new_first_free_index = GetFreeableBlockIndex(blocks.front());
+    Header front =
+        block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
+    do {
+      const Index first_free_index = ForBaseIndex<Index>(kFrontBlockIndex)
+                                         .GetAbsoluteFromRelativeIndex(
+                                             front.next);
+      if (!is_index_valid(first_free_index)) {
+        // The front block header is in an invalid state, so we cannot proceed.
+        return false;
+      }
+
+      last_block.SetNextFreeBlock(first_free_index);
+    } while (!TryUpdateFrontHeader(front, new_first_free_index));
+
+    return true;
+  }
+
+  size_t CountFreeBlocks() const {
+    // A walk which races with other operations may follow a stale chain, so
+    // retry a few times if the front block's header changes during the walk.
+    // This mitigates but cannot eliminate inaccuracy, which is fine for
+    // diagnostic purposes.
+    constexpr size_t kMaxAttempts = 4;
+    const size_t max_free_blocks = static_cast<size_t>(last_block_index());
+    size_t num_free_blocks = 0;
+    for (size_t attempt = 0; attempt < kMaxAttempts; ++attempt) {
+      const Header front =
+          block_header_at(kFrontBlockIndex).load(std::memory_order_acquire);
+      num_free_blocks = 0;
+      Index index = ForBaseIndex<Index>(kFrontBlockIndex)
+                        .GetAbsoluteFromRelativeIndex(front.next);
+      while (index != kFrontBlockIndex && is_index_valid(index) &&
+             num_free_blocks < max_free_blocks) {
+        // SUBTLE: As with AllocateBatch(), this may load the header of a block
+        // which was allocated and is being written concurrently. The result is
+        // only trusted if the front header is unchanged after the walk.
+        const Header header =
+            block_header_at(index).load(std::memory_order_acquire);
+        ++num_free_blocks;
+        index = ForBaseIndex<Index>(index).GetAbsoluteFromRelativeIndex(
+            header.next);
+      }
+
+      const Header current_front =
+          block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
+      if (current_front.version == front.version &&
+          current_front.next == front.next) {
+        break;
+      }
+    }
+    return num_free_blocks;
+  }
+
+ private:
+  // Helper class which tracks an absolute block index, as well as a reference
+  // to that block's atomic header within the managed region.
+  class FreeBlock {
+   public:
+    FreeBlock(Index index, AtomicBlockHeader& header)
+        : index_(index), header_(header) {
+      ABSL_ASSERT(index > 0);
+    }
+
+    AtomicBlockHeader& header() { return header_; }
+
+    // Returns the address of the start of this block.
+    void* address() const { return &header_; }
+
+    // Atomically updates the header for this free block, implying that this
+    // block will become the new head of the allocator's free-list.
+    //
+    // `next_free_block` is the absolute index of the previous head of the
+    // free-list, which this block will now reference as the next free block.
+    void SetNextFreeBlock(Index next_free_block) {
+      const Index relative_next = ForBaseIndex<Index>(index_)
+                                      .GetRelativeFromAbsoluteIndex(
+                                          next_free_block);
+      header_.store({.version = 0, .next = relative_next},
+                    std::memory_order_release);
+    }
+
+   private:
+    const Index index_;
+    AtomicBlockHeader& header_;
+  };
+
+  // Returns the index of the block whose base address is `ptr`, or
+  // kInvalidBlockIndex if `ptr` is not the address of a block which can be
+  // freed by this allocator.
+  static constexpr Index kInvalidBlockIndex = -1;
+  Index GetFreeableBlockIndex(void* ptr) const {
+    // Derive a block index from the given address, relative to the start of
+    // this allocator's managed region.
+    const ptrdiff_t offset = reinterpret_cast<uint8_t*>(ptr) - region_.data();
+    if (offset < 0 || static_cast<size_t>(offset) >= region_.size()) {
+      return kInvalidBlockIndex;
+    }
+
+    const Index index = static_cast<Index>(offset / block_size_);
+    if (index == kFrontBlockIndex || !is_index_valid(index)) {
+      // The first block cannot be freed, and obviously neither can any block
+      // out of range for this allocator.
+      return kInvalidBlockIndex;
+    }
+    return index;
+  }
+
+  // Attempts to update the front block's header to point to `first_free_block`
+  // as the free-list's new head block. `last_known_header` is a reference to
+  // a copy of the most recently known header value from the first block. This
+  // call can only succeed if that value can be atomically swapped out for a
+  // new value.
+  //
+  // On failure, `last_known_header` is updated to reflect the value of the
+  // current front block's header.
+  bool TryUpdateFrontHeader(Header& last_known_header,
+                            Index first_free_block) const {
+    // Note that `version` overflow is acceptable here. The version is only
+    // used as a tag to protect against the ABA problem. Because all alloc and
+    // free operations are completed via an atomic exchange of the front block
+    // header, and because they must always increment the header version at the
+    // same time, we effectively avoid one operation trampling the result of
+    // another.
+    const decltype(Header::version) new_version = last_known_header.version + 1;
+    const Index relative_next =
+        ForBaseIndex<Index>(kFrontBlockIndex)
+            .GetRelativeFromAbsoluteIndex(first_free_block);
+
+    // A weak compare/exchange is used since in practice this will always be
+    // called within a tight retry loop.
+    return block_header_at(kFrontBlockIndex)
+        .compare_exchange_weak(
+            last_known_header, {.version = new_version, .next = relative_next},
+            std::memory_order_release, std::memory_order_relaxed);
+  }
+
+  Index last_block_index() const { return num_blocks_ - 1; }
+
+  bool is_index_valid(Index index) const {
+    return index >= 0 && index <= last_block_index();
+  }
+
+  // Returns a reference to the AtomicBlockHeader for the block at `index`.
+  AtomicBlockHeader& block_header_at(Index index) const {
+    ABSL_ASSERT(is_index_valid(index));
+    return *reinterpret_cast<AtomicBlockHeader*>(
+        &region_[block_size_ * static_cast<size_t>(index)]);
+  }
+
+  // Returns a FreeBlock corresponding to the block at `index`.
+  FreeBlock free_block_at(Index index) const {
+    return FreeBlock(index, block_header_at(index));
+  }
+
+  const absl::Span<uint8_t> region_;
+  const size_t block_size_;
+  const Index num_blocks_;
 };
 
 }  // namespace
 
 BlockAllocator::BlockAllocator() = default;
-BlockAllocator::BlockAllocator(absl::Span<uint8_t> region, uint32_t block_size)
-    : region_(region), block_size_(block_size) {
+
+BlockAllocator::BlockAllocator(absl::Span<uint8_t> region,
+                               uint32_t block_size,
+                               HeaderFormat header_format)
+    : region_(region), block_size_(block_size), header_format_(header_format) {
   // Require 8-byte alignment of the region and of block sizes, to ensure that
-  // each BlockHeader is itself 8-byte aligned. Also a non-zero block size is
+  // each block header is itself 8-byte aligned. Also a non-zero block size is
   // obviously a requirement.
   ABSL_ASSERT((reinterpret_cast<uintptr_t>(region_.data()) & 7) == 0);
   ABSL_ASSERT(block_size > 0);
   ABSL_ASSERT((block_size & 7) == 0);
 
-  // BlockHeader uses a signed 16-bit index to reference other blocks, and block
-  // 0 must be able to reference any block; so the total number of blocks must
-  // not exceed the max value of an int16_t.
-  num_blocks_ = checked_cast<int16_t>(region.size() / block_size);
+  // Block headers use a signed index to reference other blocks, and block 0
+  // must be able to reference any block; so the total number of blocks must
+  // not exceed the max value of the header format's index type.
+  const size_t num_blocks = region.size() / block_size;
+  ABSL_HARDENING_ASSERT(num_blocks <= GetMaxNumBlocks(header_format));
+  num_blocks_ = checked_cast<int32_t>(num_blocks);
   ABSL_ASSERT(num_blocks_ > 0);
 }
 
@@ -77,141 +500,51 @@ BlockAllocator& BlockAllocator::operator=(const BlockAllocator&) = default;
 
 BlockAllocator::~BlockAllocator() = default;
 
-void BlockAllocator::InitializeRegion() const {
-  // By zeroing the entire region, every block effectively points to its
-  // immediate successor as the next free block. See comments on the `next`
-  // field if BlockHeader.
-  memset(region_.data(), 0, region_.size());
-
-  // Ensure that the last block points back to the unallocable first block,
-  // indicating the end of the free-list.
-  free_block_at(last_block_index()).SetNextFreeBlock(kFrontBlockIndex);
-}
-
-void* BlockAllocator::Allocate() const {
-  BlockHeader front =
-      block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
-  for (;;) {
-    const int16_t first_free_block_index =
-        ForBaseIndex(kFrontBlockIndex).GetAbsoluteFromRelativeIndex(front.next);
-    if (first_free_block_index == kFrontBlockIndex ||
-        !is_index_valid(first_free_block_index)) {
-      // Note that the front block can never be allocated, so if that's where
-      // the head of the free-list points then the free-list is empty. If it
-      // otherwise points to an out-of-range index, the allocator is in an
-      // invalid state. In either case, we fail the allocation.
-      return nullptr;
-    }
-
-    // Extract the index of the *next* free block from the header of the first.
-    FreeBlock first_free_block = free_block_at(first_free_block_index);
-
-    // SUBTLE: This stack requires a race suppression when running with TSan.
-    //
-    // Multiple threads may race to load the front block header at roughly the
-    // same time and end up with the same `first_free_block`. Only one thread
-    // will successfully claim the block via TryUpdateFrontHeader() below, but
-    // all of them will still load the maybe-free block's header here.
-    //
-    // Meanwhile, the winning thread may at any point begin using the block and
-    // e.g. issuing non-atomic writes to its memory. This can cause TSan to blow
-    // up, as it will detect data races between the winner's writes, and the
-    // losing thread(s) issuing this atomic load. The races are legitimate but
-    // harmless, because the result of this load is unused unless the subsequent
-    // TryUpdateFrontHeader() succeeds, which it won't.
-    BlockHeader first_free_block_header =
-        first_free_block.header().load(std::memory_order_acquire);
-    const int16_t next_free_block_index =
-        ForBaseIndex(first_free_block_index)
-            .GetAbsoluteFromRelativeIndex(first_free_block_header.next);
-    if (!is_index_valid(next_free_block_index)) {
-      // Invalid block header, so we cannot proceed.
-      return nullptr;
-    }
-
-    if (TryUpdateFrontHeader(front, next_free_block_index)) {
-      // If we successfully update the front block's header to point at the
-      // second free block, we have effectively allocated the first free block
-      // by removing it from the free-list. This means we're done and the
-      // allocator will not touch the contents of this block (including header)
-      // until it's freed.
-      return first_free_block.address();
-    }
-
-    // Another thread must have modified the front block header since we fetched
-    // it above. `front` now has a newly updated copy, so we loop around again
-    // to retry allocation.
+// static
+size_t BlockAllocator::GetMaxNumBlocks(HeaderFormat header_format) {
+  switch (header_format) {
+    case HeaderFormat::kNarrow:
+      return std::numeric_limits<NarrowBlockHeader::Index>::max();
+    case HeaderFormat::kWide:
+      return std::numeric_limits<WideBlockHeader::Index>::max();
   }
+  return 0;
 }
 
-bool BlockAllocator::Free(void* ptr) const {
-  // Derive a block index from the given address, relative to the start of this
-  // allocator's managed region.
-  const int16_t new_free_index =
-      (reinterpret_cast<uint8_t*>(ptr) - region_.data()) / block_size_;
-  if (new_free_index == kFrontBlockIndex || !is_index_valid(new_free_index)) {
-    // The first block cannot be freed, and obviously neither can any block out
-    // of range for this allocator.
-    return false;
+template <typename Fn>
+auto BlockAllocator::WithImpl(Fn fn) const {
+  if (header_format_ == HeaderFormat::kWide) {
+    return fn(BlockAllocatorImpl<WideBlockHeader>(region_, block_size_,
+                                                  num_blocks_));
   }
+  return fn(
+      BlockAllocatorImpl<NarrowBlockHeader>(region_, block_size_, num_blocks_));
+}
 
-  FreeBlock free_block = free_block_at(new_free_index);
-  BlockHeader front =
-      block_header_at(kFrontBlockIndex).load(std::memory_order_relaxed);
-  do {
-    const int16_t first_free_index =
-        ForBaseIndex(kFrontBlockIndex).GetAbsoluteFromRelativeIndex(front.next);
-    if (!is_index_valid(first_free_index)) {
-      // The front block header is in an invalid state, so we cannot proceed.
-      return false;
-    }
-
-    // The application calling Free() implies that it's done using the block.
-    // The allocator is therefore free to overwrite the contents with a new
-    // BlockHeader. Write a header which points to the current head of the
-    // free-list.
-    free_block.SetNextFreeBlock(first_free_index);
+void BlockAllocator::InitializeRegion() const {
+  WithImpl([](const auto& impl) { impl.InitializeRegion(); });
+}
 
-    // And now try to update the front block so that this newly freed block
-    // becomes the new head of the free-list. Upon success, the block is
-    // effectively freed. Upon failure, `front` will have an updated copy of
-    // the front block header, so we can loop around and try to insert the freed
-    // block again.
-  } while (!TryUpdateFrontHeader(front, new_free_index));
+void* BlockAllocator::Allocate() const {
+  return WithImpl([](const auto& impl) { return impl.Allocate(); });
+}
 
-  return true;
+bool BlockAllocator::Free(void* ptr) const {
+  return WithImpl([ptr](const auto& impl) { return impl.Free(ptr); });
 }
 
-bool BlockAllocator::TryUpdateFrontHeader(BlockHeader& last_known_header,
-                                          int16_t first_free_block) const {
-  // Note that `version` overflow is acceptable here. The version is only used
-  // as a tag to protect against the ABA problem. Because all alloc and free
-  // operations are completed via an atomic exchange of the front block header,
-  // and because they must always increment the header version at the same time,
-  // we effectively avoid one operation trampling the result of another.
-  const uint16_t new_version = last_known_header.version + 1;
-  const int16_t relative_next =
-      ForBaseIndex(kFrontBlockIndex)
-          .GetRelativeFromAbsoluteIndex(first_free_block);
-
-  // A weak compare/exchange is used since in practice this will always be
-  // called within a tight retry loop.
-  return block_header_at(kFrontBlockIndex)
-      .compare_exchange_weak(
-          last_known_header, {.version = new_version, .next = relative_next},
-          std::memory_order_release, std::memory_order_relaxed);
+size_t BlockAllocator::AllocateBatch(absl::Span<void*> blocks) const {
+  return WithImpl(
+      [blocks](const auto& impl) { return impl.AllocateBatch(blocks); });
 }
 
-BlockAllocator::FreeBlock::FreeBlock(int16_t index, AtomicBlockHeader& header)
-    : index_(index), header_(header) {
-  ABSL_ASSERT(index > 0);
+bool BlockAllocator::FreeBatch(absl::Span<void* const> blocks) const {
+  return WithImpl(
+      [blocks](const auto& impl) { return impl.FreeBatch(blocks); });
 }
 
-void BlockAllocator::FreeBlock::SetNextFreeBlock(int16_t next_free_block) {
-  const int16_t relative_next =
-      ForBaseIndex(index_).GetRelativeFromAbsoluteIndex(next_free_block);
-  header_.store({.version = 0, .next = relative_next},
-                std::memory_order_release);
+size_t BlockAllocator::CountFreeBlocks() const {
+  return WithImpl([](const auto& impl) { return impl.CountFreeBlocks(); });
 }
 
 }  // namespace ipcz
@@ -4,21 +4,70 @@
 
 #include "ipcz/block_allocator_pool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "util/log.h"
 #include "util/safe_math.h"
 
 namespace ipcz {
 
+namespace {
+
+// Indicates whether `address` is the base address of a block which could have
+// been allocated by `allocator`.
+bool IsAllocableBlockAddress(const BlockAllocator& allocator, void* address) {
+  const uint8_t* region_start = allocator.region().data();
+  const uint8_t* block = static_cast<const uint8_t*>(address);
+  if (block < region_start) {
+    return false;
+  }
+
+  // Note that the first block within any allocator's region is never allocable.
+  const size_t offset = static_cast<size_t>(block - region_start);
+  const size_t index = offset / allocator.block_size();
+  return offset % allocator.block_size() == 0 && index > 0 &&
+         index <= allocator.capacity();
+}
+
+}  // namespace
+
 BlockAllocatorPool::BlockAllocatorPool() = default;
 
-BlockAllocatorPool::~BlockAllocatorPool() = default;
+BlockAllocatorPool::~BlockAllocatorPool() {
+  // Blocks cached by magazines are still reserved within their allocators'
+  // (shared) regions, so return them before going away.
+  FlushMagazines();
+}
 
 size_t BlockAllocatorPool::GetCapacity() {
   absl::MutexLock lock(&mutex_);
   return capacity_;
 }
 
+BlockAllocatorPool::Stats BlockAllocatorPool::GetStats() {
+  Stats stats;
+  {
+    absl::MutexLock lock(&mutex_);
+    for (const Entry& entry : entries_) {
+      ++stats.num_allocators;
+      stats.num_blocks += entry.allocator.capacity();
+      stats.num_free_blocks += entry.allocator.CountFreeBlocks();
+    }
+  }
+
+  for (Magazines::MagazineType& magazine : magazines_) {
+    absl::MutexLock lock(&magazine.mutex);
+    stats.num_cached_blocks += magazine.size;
+  }
+  return stats;
+}
+
 bool BlockAllocatorPool::Add(BufferId buffer_id,
                              absl::Span<uint8_t> buffer_memory,
                              const BlockAllocator& allocator) {
@@ -29,7 +78,6 @@ bool BlockAllocatorPool::Add(BufferId buffer_id,
     previous_tail = &entries_.back();
   }
 
-  capacity_ += allocator.capacity() * allocator.block_size();
   entries_.emplace_back(buffer_id, buffer_memory, allocator);
 
   new_entry = &entries_.back();
@@ -39,78 +87,248 @@ bool BlockAllocatorPool::Add(BufferId buffer_id,
     return false;
   }
 
+  capacity_ += allocator.capacity() * allocator.block_size();
+  num_blocks_ += allocator.capacity();
+  const size_t magazine_limit =
+      std::min(kMagazineCapacity,
+               num_blocks_ / (kNumMagazines * kMaxCachedBlocksDivisor));
+  magazine_limit_.store(
+      magazine_limit >= kMinMagazineLimit ? magazine_limit : 0,
+      std::memory_order_relaxed);
+
+  // These store-releases are balanced by load-acquires in FindEntry() and
+  // AllocateFromAllocators().
   if (previous_tail) {
-    previous_tail->next = new_entry;
+    previous_tail->next.store(new_entry, std::memory_order_release);
   } else {
-    // Balanced by a load-acquire in Allocate().
+    first_entry_.store(new_entry, std::memory_order_release);
     active_entry_.store(new_entry, std::memory_order_release);
   }
 
   return true;
 }
 
-Fragment BlockAllocatorPool::Allocate() {
+void BlockAllocatorPool::FlushMagazines() {
+  for (Magazines::MagazineType& magazine : magazines_) {
+    absl::MutexLock lock(&magazine.mutex);
+    magazine.FlushAll([this](absl::Span<const CachedBlock> blocks) {
+      FreeToAllocators(blocks);
+    });
+  }
+}
+
+std::unique_ptr<BlockAllocatorPool> BlockAllocatorPool::CloneWithout(
+    BufferId buffer_id) {
+  auto pool = std::make_unique<BlockAllocatorPool>();
+  absl::MutexLock lock(&mutex_);
+  for (const Entry& entry : entries_) {
+    if (entry.buffer_id != buffer_id) {
+      pool->Add(entry.buffer_id, entry.buffer_memory, entry.allocator);
+    }
+  }
+  return pool;
+}
+
+Fragment BlockAllocatorPool::Allocate(bool* low_capacity) {
+  if (low_capacity) {
+    *low_capacity = false;
+  }
+
+  const size_t magazine_limit = magazine_limit_.load(std::memory_order_relaxed);
+  if (magazine_limit == 0) {
+    // Too few blocks to cache any of them away from the other side. Reserve a
+    // second block only to gauge remaining capacity, and return it right away.
+    CachedBlock blocks[2];
+    const size_t num_blocks = AllocateFromAllocators(blocks);
+    if (low_capacity && num_blocks < std::size(blocks)) {
+      *low_capacity = true;
+    }
+    if (num_blocks == 0) {
+      return {};
+    }
+    if (num_blocks > 1) {
+      FreeToAllocators({&blocks[1], 1});
+    }
+    return blocks[0].fragment;
+  }
+
+  Magazines::MagazineType& magazine = magazines_.ForCurrentThread();
+  {
+    absl::MutexLock lock(&magazine.mutex);
+    if (magazine.empty()) {
+      // Refill only half of the magazine, leaving room for subsequent frees to
+      // be cached without an immediate flush.
+      const size_t refill_size = magazine_limit / 2;
+      const size_t num_refilled = magazine.Refill(
+          refill_size, [this](absl::Span<CachedBlock> blocks) {
+            return AllocateFromAllocators(blocks);
+          });
+      if (low_capacity && num_refilled < refill_size) {
+        *low_capacity = true;
+      }
+    }
+
+    if (!magazine.empty()) {
+      return magazine.Pop().fragment;
+    }
+  }
+
+  // The pool's allocators are exhausted, but other threads' magazines may still
+  // be holding onto blocks. Take one of those before giving up. Note that our
+  // own magazine is unlocked at this point, so magazines are only ever locked
+  // one at a time.
+  for (Magazines::MagazineType& other_magazine : magazines_) {
+    if (&other_magazine == &magazine) {
+      continue;
+    }
+
+    absl::MutexLock lock(&other_magazine.mutex);
+    if (!other_magazine.empty()) {
+      return other_magazine.Pop().fragment;
+    }
+  }
+
+  return {};
+}
+
+bool BlockAllocatorPool::Free(const Fragment& fragment) {
+  Entry* entry = FindEntry(fragment.buffer_id());
+  if (!entry ||
+      !IsAllocableBlockAddress(entry->allocator, fragment.address())) {
+    DLOG(ERROR) << "Invalid Free() call on BlockAllocatorPool";
+    return false;
+  }
+
+  const CachedBlock block = {.entry = entry, .fragment = fragment};
+  const size_t magazine_limit = magazine_limit_.load(std::memory_order_relaxed);
+  if (magazine_limit == 0) {
+    FreeToAllocators({&block, 1});
+    return true;
+  }
+
+  Magazines::MagazineType& magazine = magazines_.ForCurrentThread();
+  absl::MutexLock lock(&magazine.mutex);
+  if (magazine.size >= magazine_limit) {
+    // The magazine is full, so flush its least recently cached blocks back to
+    // the pool's allocators, keeping only the most recent half.
+    magazine.FlushOldest(magazine.size - magazine_limit / 2,
+                         [this](absl::Span<const CachedBlock> blocks) {
+                           FreeToAllocators(blocks);
+                         });
+  }
+
+  magazine.Push(block);
+  return true;
+}
+
+BlockAllocatorPool::Entry* BlockAllocatorPool::FindEntry(BufferId buffer_id) {
+  // Most frees target the buffer most recently used for allocation, so check
+  // that one first. These load-acquires are balanced by store-releases in
+  // Add().
+  Entry* entry = active_entry_.load(std::memory_order_acquire);
+  if (entry && entry->buffer_id == buffer_id) {
+    return entry;
+  }
+
+  for (entry = first_entry_.load(std::memory_order_acquire); entry;
+       entry = entry->next.load(std::memory_order_acquire)) {
+    if (entry->buffer_id == buffer_id) {
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+size_t BlockAllocatorPool::AllocateFromAllocators(
+    absl::Span<CachedBlock> blocks) {
   // For the fast common case, we always start by trying to reuse the most
   // recently used allocator. This load-acquire is balanced by a store-release
   // below (via compare_exchange_weak) and in Add() above.
   Entry* entry = active_entry_.load(std::memory_order_acquire);
   if (!entry) {
-    return {};
+    return 0;
   }
 
   Entry* starting_entry = entry;
+  size_t num_blocks = 0;
+  void* addresses[kMagazineCapacity];
   do {
     const BlockAllocator& allocator = entry->allocator;
-    void* block = allocator.Allocate();
-    if (block) {
-      // Success! Compute a FragmentDescriptor based on the block address and
-      // the mapped region's location.
+    const size_t num_requested =
+        std::min(blocks.size() - num_blocks, std::size(addresses));
+    const size_t num_allocated =
+        allocator.AllocateBatch(absl::MakeSpan(addresses, num_requested));
+    for (size_t i = 0; i < num_allocated; ++i) {
+      // Compute a FragmentDescriptor based on each block address and the
+      // mapped region's location.
       const size_t offset =
-          (static_cast<uint8_t*>(block) - entry->buffer_memory.data());
+          (static_cast<uint8_t*>(addresses[i]) - entry->buffer_memory.data());
       if (entry->buffer_memory.size() - allocator.block_size() < offset) {
         // Allocator did something bad and this span would fall outside of the
         // mapped region's bounds.
         DLOG(ERROR) << "Invalid address from BlockAllocator.";
-        return {};
-      }
-
-      if (entry != starting_entry) {
-        // Attempt to update the active entry to reflect our success. Since this
-        // is only meant as a helpful hint for future allocations, we don't
-        // really care whether it succeeds.
-        active_entry_.compare_exchange_weak(starting_entry, entry,
-                                            std::memory_order_release,
-                                            std::memory_order_relaxed);
+        return num_blocks;
       }
 
       FragmentDescriptor descriptor(
           entry->buffer_id, checked_cast<uint32_t>(offset),
           checked_cast<uint32_t>(allocator.block_size()));
-      return Fragment::FromDescriptorUnsafe(descriptor, block);
+      blocks[num_blocks++] = {
+          .entry = entry,
+          .fragment = Fragment::FromDescriptorUnsafe(descriptor, addresses[i]),
+      };
     }
 
-    // Allocation from the active allocator failed. Try another if available.
-    absl::MutexLock lock(&mutex_);
-    entry = entry->next;
-  } while (entry && entry != starting_entry);
+    if (num_allocated > 0 && entry != starting_entry) {
+      // Attempt to update the active entry to reflect our success. Since this
+      // is only meant as a helpful hint for future allocations, we don't
+      // really care whether it succeeds.
+      active_entry_.compare_exchange_weak(starting_entry, entry,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed);
+    }
 
-  return {};
+    if (num_blocks == blocks.size()) {
+      return num_blocks;
+    }
+
+    // The current allocator couldn't satisfy the whole request. Try another if
+    // available, wrapping around to the first entry so that a short result
+    // implies a complete pass over every allocator in the pool.
+    entry = entry->next.load(std::memory_order_acquire);
+    if (!entry) {
+      entry = first_entry_.load(std::memory_order_acquire);
+    }
+  } while (entry != starting_entry);
+
+  return num_blocks;
 }
 
-bool BlockAllocatorPool::Free(const Fragment& fragment) {
-  Entry* entry;
-  {
-    absl::MutexLock lock(&mutex_);
-    auto it = entry_map_.find(fragment.buffer_id());
-    if (it == entry_map_.end()) {
-      DLOG(ERROR) << "Invalid Free() call on BlockAllocatorPool";
-      return false;
+void BlockAllocatorPool::FreeToAllocators(
+    absl::Span<const CachedBlock> blocks) {
+  // Blocks typically all belong to the same allocator, but not necessarily.
+  // Gather each allocator's blocks into a single batch.
+  bool freed[kMagazineCapacity] = {};
+  ABSL_ASSERT(blocks.size() <= kMagazineCapacity);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    if (freed[i]) {
+      continue;
     }
 
-    entry = it->second;
-  }
+    Entry* entry = blocks[i].entry;
+    void* addresses[kMagazineCapacity];
+    size_t num_addresses = 0;
+    for (size_t j = i; j < blocks.size(); ++j) {
+      if (!freed[j] && blocks[j].entry == entry) {
+        addresses[num_addresses++] = blocks[j].fragment.address();
+        freed[j] = true;
+      }
+    }
 
-  return entry->allocator.Free(fragment.address());
+    if (!entry->allocator.FreeBatch(absl::MakeSpan(addresses, num_addresses))) {
+      DLOG(ERROR) << "Failed to free cached blocks to their BlockAllocator";
+    }
+  }
 }
 
 BlockAllocatorPool::Entry::Entry(BufferId buffer_id,
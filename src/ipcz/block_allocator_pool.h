@@ -6,8 +6,10 @@
 #define IPCZ_SRC_IPCZ_BLOCK_ALLOCATOR_POOL_H_
 
 #include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <list>
+#include <memory>
 
 #include "ipcz/block_allocator.h"
 #include "ipcz/buffer_id.h"
@@ -15,6 +17,7 @@
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/magazine.h"
 
 namespace ipcz {
 
@@ -26,6 +29,19 @@ namespace ipcz {
 // failing only once a complete pass over all allocators fails to yield a
 // successful allocation.
 //
+// To keep concurrent allocations from contending on shared state, the pool
+// also maintains a small set of magazines: lock-striped caches of blocks which
+// have already been reserved from the pool's allocators. Threads are assigned
+// magazines round-robin, so each thread's magazine lock is uncontended until
+// there are more threads than magazines. Allocate() and Free() are served from
+// the calling thread's magazine whenever possible, and only touch the shared
+// allocators to refill an empty magazine or to flush an overflowing one.
+//
+// The allocators' regions are shared with another pool on the other side of a
+// link, so blocks cached here are unavailable over there. Each magazine's size
+// is therefore limited relative to the pool's total capacity, and pools with
+// very few blocks bypass their magazines entirely.
+//
 // BlockAllocatorPool is is thread-safe.
 class BlockAllocatorPool {
  public:
@@ -36,6 +52,23 @@ class BlockAllocatorPool {
   // this counts all blocks, including ones which are currently allocated.
   size_t GetCapacity();
 
+  // A snapshot of block usage within the pool, for diagnostics.
+  struct Stats {
+    // The number of allocators registered with the pool.
+    size_t num_allocators = 0;
+
+    // The total number of blocks managed by those allocators.
+    size_t num_blocks = 0;
+
+    // The number of blocks currently free within the allocators themselves.
+    size_t num_free_blocks = 0;
+
+    // The number of blocks reserved from the allocators and cached by this
+    // pool's magazines.
+    size_t num_cached_blocks = 0;
+  };
+  Stats GetStats();
+
   // Registers a new allocator. `buffer_memory` is the entire mapped region
   // associated with `buffer_id`, not just the subspan managed by `allocator`.
   //
@@ -46,14 +79,41 @@ class BlockAllocatorPool {
            absl::Span<uint8_t> buffer_memory,
            const BlockAllocator& allocator);
 
+  // Returns every block cached by the pool's magazines to its allocator, so
+  // that the blocks can be allocated by other pools sharing the same regions.
+  void FlushMagazines();
+
+  // Returns a new pool with the same allocators as this one, excluding any
+  // allocator registered for `buffer_id`. The new pool's magazines start out
+  // empty. Blocks cached by this pool's magazines remain reserved until this
+  // pool is destroyed.
+  std::unique_ptr<BlockAllocatorPool> CloneWithout(BufferId buffer_id);
+
   // Allocates a block from the pool and returns a reference to it as a
   // Fragment. Returns a null Fragment if a block could not be allocated.
-  Fragment Allocate();
+  //
+  // If `low_capacity` is non-null, it's set to indicate whether the pool's
+  // allocators were found to be nearly exhausted while serving this request.
+  // This happens when a complete pass over the allocators cannot fully refill
+  // a magazine, and it's a useful hint to expand capacity before allocations
+  // begin to fail.
+  Fragment Allocate(bool* low_capacity = nullptr);
 
   // Frees a fragment previously allocated from one of this pool's allocators.
   // Returns true if and only if `fragment` was a valid fragment to free.
   bool Free(const Fragment& fragment);
 
+  // The number of magazines maintained by each pool, and the maximum number of
+  // blocks cached by each magazine.
+  static constexpr size_t kNumMagazines = 8;
+  static constexpr size_t kMagazineCapacity = 16;
+
+  // All of a pool's magazines together may cache at most this fraction of the
+  // pool's blocks. If that leaves fewer than kMinMagazineLimit blocks for each
+  // magazine, the magazines aren't used at all.
+  static constexpr size_t kMaxCachedBlocksDivisor = 4;
+  static constexpr size_t kMinMagazineLimit = 4;
+
  private:
   struct Entry {
     Entry(BufferId buffer_id,
@@ -65,10 +125,35 @@ class BlockAllocatorPool {
     const absl::Span<uint8_t> buffer_memory;
     const BlockAllocator allocator;
 
-    // Cached pointer to the next entry.
-    Entry* next = nullptr;
+    // Cached pointer to the next entry. This is only set once, when the next
+    // entry is added to the pool, and it may be read without holding the
+    // pool's lock.
+    std::atomic<Entry*> next{nullptr};
+  };
+
+  // A block which has been reserved from one of the pool's allocators but not
+  // yet handed out by Allocate().
+  struct CachedBlock {
+    Entry* entry = nullptr;
+    Fragment fragment;
   };
 
+  using Magazines = MagazineSet<CachedBlock, kMagazineCapacity, kNumMagazines>;
+
+  // Finds the Entry for the identified buffer, or null if there is none. This
+  // does not acquire `mutex_`.
+  Entry* FindEntry(BufferId buffer_id);
+
+  // Allocates up to `blocks.size()` blocks directly from the pool's
+  // allocators, bypassing any magazines. Blocks are claimed in batches, so this
+  // typically costs only one atomic update per allocator touched. Returns the
+  // number of blocks allocated into `blocks`.
+  size_t AllocateFromAllocators(absl::Span<CachedBlock> blocks);
+
+  // Returns every block in `blocks` to its allocator, freeing all blocks which
+  // belong to the same allocator as a single batch.
+  void FreeToAllocators(absl::Span<const CachedBlock> blocks);
+
   absl::Mutex mutex_;
 
   // List of all allocators added to this pool. Once added, elements are never
@@ -76,16 +161,30 @@ class BlockAllocatorPool {
   // references are stable over time.
   std::list<Entry> entries_ ABSL_GUARDED_BY(mutex_);
 
-  // Maps BufferId to a specific Entry in the pool, so individual Fragments can
-  // be freed efficiently by the pool.
+  // Maps BufferId to a specific Entry in the pool. Used to reject duplicate
+  // entries when adding new allocators.
   absl::flat_hash_map<BufferId, Entry*> entry_map_ ABSL_GUARDED_BY(mutex_);
 
+  // The first Entry added to the pool, for unsynchronized traversal of the
+  // full list of entries.
+  std::atomic<Entry*> first_entry_{nullptr};
+
   // The total capacity of all BlockAllocators added to the pool so far.
   size_t capacity_ ABSL_GUARDED_BY(mutex_) = 0;
 
+  // The total number of blocks in all BlockAllocators added to the pool so far.
+  size_t num_blocks_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // The maximum number of blocks each magazine may cache, derived from
+  // `num_blocks_` and never more than kMagazineCapacity. Zero if the pool is
+  // too small for magazines to be used at all.
+  std::atomic<size_t> magazine_limit_{0};
+
   // An atomic cache of the most recently used Entry, for fast unsynchronized
   // access in the common case.
   std::atomic<Entry*> active_entry_{nullptr};
+
+  Magazines magazines_;
 };
 
 }  // namespace ipcz
@@ -0,0 +1,245 @@
+// Copyright 2022 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/block_allocator_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "ipcz/block_allocator.h"
+#include "ipcz/buffer_id.h"
+#include "ipcz/fragment.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+namespace {
+
+constexpr size_t kBufferSize = 16384;
+constexpr size_t kBlockSize = 32;
+
+class BlockAllocatorPoolTest : public testing::Test {
+ public:
+  BlockAllocatorPoolTest() {
+    for (size_t i = 0; i < kNumBuffers; ++i) {
+      allocators_[i] = BlockAllocator(buffer(i), kBlockSize);
+      allocators_[i].InitializeRegion();
+    }
+  }
+
+  static constexpr size_t kNumBuffers = 2;
+
+  absl::Span<uint8_t> buffer(size_t i) {
+    return absl::MakeSpan(reinterpret_cast<uint8_t*>(buffers_[i]),
+                          kBufferSize);
+  }
+
+  const BlockAllocator& allocator(size_t i) const { return allocators_[i]; }
+
+  size_t total_capacity() const {
+    return allocator(0).capacity() + allocator(1).capacity();
+  }
+
+  void AddAllocators(BlockAllocatorPool& pool) {
+    for (size_t i = 0; i < kNumBuffers; ++i) {
+      EXPECT_TRUE(pool.Add(BufferId(i), buffer(i), allocator(i)));
+    }
+  }
+
+ private:
+  uint64_t buffers_[kNumBuffers][kBufferSize / sizeof(uint64_t)];
+  BlockAllocator allocators_[kNumBuffers];
+};
+
+TEST_F(BlockAllocatorPoolTest, AllocateAndFree) {
+  BlockAllocatorPool pool;
+  EXPECT_TRUE(pool.Allocate().is_null());
+
+  AddAllocators(pool);
+  EXPECT_FALSE(pool.Add(BufferId(0), buffer(0), allocator(0)));
+
+  std::set<void*> blocks;
+  std::vector<Fragment> fragments;
+  for (;;) {
+    const Fragment fragment = pool.Allocate();
+    if (fragment.is_null()) {
+      break;
+    }
+    EXPECT_TRUE(fragment.is_addressable());
+    EXPECT_EQ(kBlockSize, fragment.size());
+    auto [it, inserted] = blocks.insert(fragment.address());
+    EXPECT_TRUE(inserted);
+    fragments.push_back(fragment);
+  }
+  EXPECT_EQ(total_capacity(), fragments.size());
+
+  for (const Fragment& fragment : fragments) {
+    EXPECT_TRUE(pool.Free(fragment));
+  }
+
+  // Fragments from unknown buffers or with bogus addresses can't be freed.
+  const FragmentDescriptor bad_descriptor(BufferId(42), 0, kBlockSize);
+  EXPECT_FALSE(pool.Free(
+      Fragment::FromDescriptorUnsafe(bad_descriptor, buffer(0).data())));
+  const FragmentDescriptor front_block_descriptor(BufferId(0), 0, kBlockSize);
+  EXPECT_FALSE(pool.Free(Fragment::FromDescriptorUnsafe(
+      front_block_descriptor, buffer(0).data())));
+  const FragmentDescriptor misaligned_descriptor(BufferId(0), kBlockSize + 1,
+                                                 kBlockSize);
+  EXPECT_FALSE(pool.Free(Fragment::FromDescriptorUnsafe(
+      misaligned_descriptor, buffer(0).data() + kBlockSize + 1)));
+}
+
+TEST_F(BlockAllocatorPoolTest, CachedBlocksAreReleasedOnDestruction) {
+  // Blocks cached by a pool's magazines must be returned to the underlying
+  // allocators when the pool is destroyed, so other users of the same memory
+  // can still allocate them.
+  {
+    BlockAllocatorPool pool;
+    AddAllocators(pool);
+    std::vector<Fragment> fragments;
+    for (size_t i = 0; i < BlockAllocatorPool::kMagazineCapacity; ++i) {
+      fragments.push_back(pool.Allocate());
+    }
+    for (const Fragment& fragment : fragments) {
+      EXPECT_TRUE(pool.Free(fragment));
+    }
+  }
+
+  for (size_t i = 0; i < kNumBuffers; ++i) {
+    size_t num_allocated = 0;
+    while (allocator(i).Allocate()) {
+      ++num_allocated;
+    }
+    EXPECT_EQ(allocator(i).capacity(), num_allocated);
+  }
+}
+
+TEST_F(BlockAllocatorPoolTest, AllocateFromOtherThreadMagazines) {
+  // Blocks cached by one thread's magazine must still be allocable by other
+  // threads once the pool's allocators are otherwise exhausted.
+  BlockAllocatorPool pool;
+  AddAllocators(pool);
+
+  Fragment fragment;
+  std::thread other_thread([&] { fragment = pool.Allocate(); });
+  other_thread.join();
+  ASSERT_FALSE(fragment.is_null());
+
+  size_t num_allocated = 0;
+  while (!pool.Allocate().is_null()) {
+    ++num_allocated;
+  }
+  EXPECT_EQ(total_capacity() - 1, num_allocated);
+}
+
+TEST_F(BlockAllocatorPoolTest, MagazinesLeaveBlocksForOtherPools) {
+  // Two pools over the same allocators stand in for the two sides of a link.
+  // Blocks freed into one pool's magazines must not starve the other pool.
+  BlockAllocatorPool pool;
+  BlockAllocatorPool other_pool;
+  AddAllocators(pool);
+  AddAllocators(other_pool);
+
+  std::vector<Fragment> fragments;
+  for (Fragment f = pool.Allocate(); !f.is_null(); f = pool.Allocate()) {
+    fragments.push_back(f);
+  }
+  EXPECT_EQ(total_capacity(), fragments.size());
+  for (const Fragment& fragment : fragments) {
+    EXPECT_TRUE(pool.Free(fragment));
+  }
+
+  const size_t num_cached_blocks = pool.GetStats().num_cached_blocks;
+  EXPECT_LE(num_cached_blocks,
+            total_capacity() / (BlockAllocatorPool::kNumMagazines *
+                                BlockAllocatorPool::kMaxCachedBlocksDivisor));
+
+  size_t num_allocated = 0;
+  while (!other_pool.Allocate().is_null()) {
+    ++num_allocated;
+  }
+  EXPECT_EQ(total_capacity() - num_cached_blocks, num_allocated);
+}
+
+TEST_F(BlockAllocatorPoolTest, SmallPoolBypassesMagazines) {
+  // A pool with only a few large blocks caches none of them, since even one
+  // cached block could be most of what the other side can allocate.
+  constexpr size_t kLargeBlockSize = kBufferSize / 4;
+  BlockAllocator allocator(buffer(0), kLargeBlockSize);
+  allocator.InitializeRegion();
+
+  BlockAllocatorPool pool;
+  BlockAllocatorPool other_pool;
+  EXPECT_TRUE(pool.Add(BufferId(0), buffer(0), allocator));
+  EXPECT_TRUE(other_pool.Add(BufferId(0), buffer(0), allocator));
+
+  const Fragment fragment = pool.Allocate();
+  ASSERT_FALSE(fragment.is_null());
+  EXPECT_TRUE(pool.Free(fragment));
+  EXPECT_EQ(0u, pool.GetStats().num_cached_blocks);
+
+  size_t num_allocated = 0;
+  while (!other_pool.Allocate().is_null()) {
+    ++num_allocated;
+  }
+  EXPECT_EQ(allocator.capacity(), num_allocated);
+}
+
+TEST_F(BlockAllocatorPoolTest, Contention) {
+  // Races Allocate() and Free() across a varying number of threads. Workers
+  // mark their allocated blocks and verify consistency of markers when freeing
+  // them. Once all workers have finished, the test verifies that all blocks are
+  // still allocable and none were lost due to racy accounting errors.
+  static constexpr size_t kNumIterationsPerWorker = 2000;
+  static constexpr size_t kNumAllocationsPerIteration = 8;
+  for (uint32_t num_workers : {1, 2, 4, 8, 16, 32}) {
+    BlockAllocatorPool pool;
+    AddAllocators(pool);
+
+    auto worker = [&pool](uint32_t id) {
+      Fragment fragments[kNumAllocationsPerIteration];
+      for (size_t i = 0; i < kNumIterationsPerWorker; ++i) {
+        size_t num_allocations = 0;
+        for (size_t j = 0; j < kNumAllocationsPerIteration; ++j) {
+          const Fragment fragment = pool.Allocate();
+          if (!fragment.is_null()) {
+            static_cast<std::atomic<uint32_t>*>(fragment.address())
+                ->store(id, std::memory_order_relaxed);
+            fragments[num_allocations++] = fragment;
+          }
+        }
+        for (size_t j = 0; j < num_allocations; ++j) {
+          EXPECT_EQ(id, static_cast<std::atomic<uint32_t>*>(
+                            fragments[j].address())
+                            ->load(std::memory_order_relaxed));
+          EXPECT_TRUE(pool.Free(fragments[j]));
+        }
+      }
+    };
+
+    std::vector<std::thread> worker_threads;
+    for (uint32_t i = 0; i < num_workers; ++i) {
+      worker_threads.emplace_back(worker, i);
+    }
+    for (auto& t : worker_threads) {
+      t.join();
+    }
+
+    std::vector<Fragment> fragments;
+    for (Fragment f = pool.Allocate(); !f.is_null(); f = pool.Allocate()) {
+      fragments.push_back(f);
+    }
+    EXPECT_EQ(total_capacity(), fragments.size());
+    for (const Fragment& fragment : fragments) {
+      EXPECT_TRUE(pool.Free(fragment));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace ipcz
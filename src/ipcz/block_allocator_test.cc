@@ -4,6 +4,7 @@
 
 #include "ipcz/block_allocator.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <set>
@@ -19,18 +20,20 @@ namespace {
 constexpr size_t kPageSize = 16384;
 constexpr size_t kBlockSize = 32;
 
-class BlockAllocatorTest : public testing::Test {
+using HeaderFormat = BlockAllocator::HeaderFormat;
+
+class BlockAllocatorTest : public testing::TestWithParam<HeaderFormat> {
  public:
   BlockAllocatorTest() { allocator_.InitializeRegion(); }
 
   const BlockAllocator& allocator() const { return allocator_; }
 
  private:
-  uint8_t page_[kPageSize];
-  const BlockAllocator allocator_{page_, kBlockSize};
+  alignas(8) uint8_t page_[kPageSize];
+  const BlockAllocator allocator_{page_, kBlockSize, GetParam()};
 };
 
-TEST_F(BlockAllocatorTest, Basic) {
+TEST_P(BlockAllocatorTest, Basic) {
   // Basic consistency check for a single thread accessing the BlockAllocator
   // sequentially. Blocks are allocated, fully overwritten, and then freed.
 
@@ -59,7 +62,54 @@ TEST_F(BlockAllocatorTest, Basic) {
   }
 }
 
-TEST_F(BlockAllocatorTest, AllocUseFreeRace) {
+TEST_P(BlockAllocatorTest, Batch) {
+  // Basic consistency check for batched allocation and freeing from a single
+  // thread.
+
+  static constexpr size_t kBatchSize = 32;
+  std::set<void*> blocks;
+  std::vector<void*> batch(kBatchSize);
+  for (;;) {
+    const size_t num_allocated =
+        allocator().AllocateBatch(absl::MakeSpan(batch));
+    if (num_allocated == 0) {
+      break;
+    }
+    for (size_t i = 0; i < num_allocated; ++i) {
+      memset(batch[i], 0xaa, kBlockSize);
+      auto [it, inserted] = blocks.insert(batch[i]);
+      EXPECT_TRUE(inserted);
+    }
+  }
+
+  // All capacity has been allocated, so Allocate() should fail.
+  EXPECT_EQ(allocator().capacity(), blocks.size());
+  EXPECT_FALSE(allocator().Allocate());
+
+  // Batches containing any invalid block must be rejected as a whole.
+  void* front_block = allocator().region().data();
+  void* invalid_batch[] = {*blocks.begin(), front_block};
+  EXPECT_FALSE(allocator().FreeBatch(invalid_batch));
+  EXPECT_FALSE(allocator().Allocate());
+
+  // Free everything in batches of varying size, then verify that all blocks
+  // can be allocated again one at a time.
+  std::vector<void*> all_blocks(blocks.begin(), blocks.end());
+  absl::Span<void* const> remaining = absl::MakeSpan(all_blocks);
+  for (size_t n = 1; !remaining.empty(); ++n) {
+    const size_t batch_size = std::min(n, remaining.size());
+    EXPECT_TRUE(allocator().FreeBatch(remaining.first(batch_size)));
+    remaining.remove_prefix(batch_size);
+  }
+
+  std::set<void*> reallocated_blocks;
+  while (void* block = allocator().Allocate()) {
+    reallocated_blocks.insert(block);
+  }
+  EXPECT_EQ(blocks, reallocated_blocks);
+}
+
+TEST_P(BlockAllocatorTest, AllocUseFreeRace) {
   // Spins up a worker thread to allocate new blocks and write to them
   // non-atomically, along with a separate worker thread to free them. This
   // effectively exercises the various constraints on memory access ordering
@@ -96,7 +146,7 @@ TEST_F(BlockAllocatorTest, AllocUseFreeRace) {
   free_thread.join();
 }
 
-TEST_F(BlockAllocatorTest, StressTest) {
+TEST_P(BlockAllocatorTest, StressTest) {
   // This test creates a bunch of worker threads to race Allocate() and Free()
   // operations. Workers mark their allocated blocks and verify consistency of
   // markers when freeing them. Once all workers have finished, the test
@@ -145,5 +195,132 @@ TEST_F(BlockAllocatorTest, StressTest) {
   EXPECT_EQ(allocator().capacity(), allocable_capacity);
 }
 
+TEST_P(BlockAllocatorTest, BatchStressTest) {
+  // Like StressTest above, but with half of the workers allocating and freeing
+  // blocks in batches. This emulates contention between two processes sharing
+  // the same region, where one side uses batched operations to refill and
+  // flush local caches of blocks.
+
+  static constexpr size_t kNumIterationsPerWorker = 1000;
+  static constexpr size_t kNumAllocationsPerIteration = 50;
+  auto worker = [this](uint32_t id, bool batched) {
+    void* allocations[kNumAllocationsPerIteration] = {};
+    for (size_t i = 0; i < kNumIterationsPerWorker; ++i) {
+      size_t num_allocations = 0;
+      if (batched) {
+        num_allocations =
+            allocator().AllocateBatch(absl::MakeSpan(allocations));
+      } else {
+        for (void*& allocation : allocations) {
+          if (void* p = allocator().Allocate()) {
+            allocation = p;
+            ++num_allocations;
+          }
+        }
+      }
+
+      for (size_t j = 0; j < num_allocations; ++j) {
+        static_cast<std::atomic<uint32_t>*>(allocations[j])
+            ->store(id, std::memory_order_relaxed);
+      }
+      for (size_t j = 0; j < num_allocations; ++j) {
+        EXPECT_EQ(id, static_cast<std::atomic<uint32_t>*>(allocations[j])
+                          ->load(std::memory_order_relaxed));
+      }
+
+      if (batched) {
+        EXPECT_TRUE(allocator().FreeBatch(
+            absl::MakeSpan(allocations, num_allocations)));
+      } else {
+        for (size_t j = 0; j < num_allocations; ++j) {
+          EXPECT_TRUE(allocator().Free(allocations[j]));
+        }
+      }
+    }
+  };
+
+  static constexpr uint32_t kNumWorkers = 4;
+  std::vector<std::thread> worker_threads;
+  for (uint32_t i = 0; i < kNumWorkers; ++i) {
+    worker_threads.emplace_back(worker, i, /*batched=*/i % 2 == 0);
+  }
+
+  for (auto& t : worker_threads) {
+    t.join();
+  }
+
+  size_t allocable_capacity = 0;
+  while (allocator().Allocate()) {
+    ++allocable_capacity;
+  }
+
+  EXPECT_EQ(allocator().capacity(), allocable_capacity);
+}
+
+TEST_P(BlockAllocatorTest, CountFreeBlocks) {
+  EXPECT_EQ(allocator().capacity(), allocator().CountFreeBlocks());
+
+  std::vector<void*> blocks(allocator().capacity() / 2);
+  for (void*& block : blocks) {
+    block = allocator().Allocate();
+    ASSERT_TRUE(block);
+  }
+  EXPECT_EQ(allocator().capacity() - blocks.size(),
+            allocator().CountFreeBlocks());
+
+  // Freeing blocks out of order shuffles the free-list, but every free block
+  // is still counted.
+  for (size_t i = 0; i < blocks.size(); i += 2) {
+    EXPECT_TRUE(allocator().Free(blocks[i]));
+  }
+  EXPECT_EQ(allocator().capacity() - blocks.size() / 2,
+            allocator().CountFreeBlocks());
+
+  while (allocator().Allocate()) {
+  }
+  EXPECT_EQ(0u, allocator().CountFreeBlocks());
+}
+
+TEST(BlockAllocatorWideHeaderTest, MoreThan32kBlocks) {
+  // Wide headers allow a single region to hold far more blocks than narrow
+  // headers can index.
+  constexpr size_t kSmallBlockSize = 8;
+  constexpr size_t kNumBlocks = 100000;
+  ASSERT_GT(kNumBlocks, BlockAllocator::GetMaxNumBlocks(HeaderFormat::kNarrow));
+  std::vector<uint64_t> region(kNumBlocks);
+  const BlockAllocator allocator(
+      absl::MakeSpan(reinterpret_cast<uint8_t*>(region.data()),
+                     kNumBlocks * kSmallBlockSize),
+      kSmallBlockSize, HeaderFormat::kWide);
+  allocator.InitializeRegion();
+  EXPECT_EQ(kNumBlocks - 1, allocator.capacity());
+
+  std::set<void*> blocks;
+  while (void* block = allocator.Allocate()) {
+    memset(block, 0xaa, kSmallBlockSize);
+    EXPECT_TRUE(blocks.insert(block).second);
+  }
+  EXPECT_EQ(allocator.capacity(), blocks.size());
+
+  for (void* block : blocks) {
+    EXPECT_TRUE(allocator.Free(block));
+  }
+
+  // All blocks are still allocable once freed, including in batches.
+  std::vector<void*> batch(kNumBlocks);
+  size_t num_allocated = 0;
+  while (size_t n = allocator.AllocateBatch(
+             absl::MakeSpan(batch).subspan(num_allocated))) {
+    num_allocated += n;
+  }
+  EXPECT_EQ(allocator.capacity(), num_allocated);
+  EXPECT_TRUE(allocator.FreeBatch(absl::MakeSpan(batch.data(), num_allocated)));
+}
+
+INSTANTIATE_TEST_SUITE_P(,
+                         BlockAllocatorTest,
+                         testing::Values(HeaderFormat::kNarrow,
+                                         HeaderFormat::kWide));
+
 }  // namespace
 }  // namespace ipcz
@@ -5,15 +5,69 @@
 #include "ipcz/buffer_pool.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "ipcz/block_allocator_pool.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/link_side.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
 #include "third_party/abseil-cpp/absl/numeric/bits.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "util/log.h"
 
 namespace ipcz {
 
+namespace {
+
+// Header at the start of every large buffer. See BufferPool::AddLargeBuffer().
+struct IPCZ_ALIGN(8) LargeBufferHeader {
+  // Non-zero if and only if the buffer's fragment is currently allocated. This
+  // may be modified by either side of a NodeLink sharing the buffer.
+  std::atomic<uint32_t> is_allocated;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(LargeBufferHeader) <= BufferPool::kLargeBufferHeaderSize);
+
+LargeBufferHeader& GetLargeBufferHeader(absl::Span<uint8_t> buffer) {
+  return *reinterpret_cast<LargeBufferHeader*>(buffer.data());
+}
+
+// Attempts to allocate every block managed by `allocator`. If this succeeds, no
+// other allocator sharing the same region can allocate from it anymore and this
+// returns true. Otherwise any blocks allocated here are freed again and this
+// returns false.
+bool ClaimAllBlocks(const BlockAllocator& allocator) {
+  std::vector<void*> blocks(allocator.capacity());
+  size_t num_claimed = 0;
+  while (num_claimed < blocks.size()) {
+    const size_t num_allocated =
+        allocator.AllocateBatch(absl::MakeSpan(blocks).subspan(num_claimed));
+    if (num_allocated == 0) {
+      break;
+    }
+    num_claimed += num_allocated;
+  }
+
+  if (num_claimed == blocks.size()) {
+    return true;
+  }
+
+  if (num_claimed > 0 &&
+      !allocator.FreeBatch(absl::MakeSpan(blocks.data(), num_claimed))) {
+    DLOG(ERROR) << "Failed to release claimed blocks";
+  }
+  return false;
+}
+
+}  // namespace
+
 BufferPool::BufferPool() = default;
 
 BufferPool::~BufferPool() = default;
@@ -23,9 +77,30 @@ Fragment BufferPool::GetFragment(const FragmentDescriptor& descriptor) {
     return {};
   }
 
+  auto* slot = GetPublishedBufferSlot(descriptor.buffer_id(), /*create=*/false);
+  if (slot) {
+    // This acquire is balanced by the store-release in PublishBufferLocked(),
+    // so the published buffer is fully visible here.
+    PublishedBuffer* buffer = slot->load(std::memory_order_acquire);
+    if (buffer) {
+      const Fragment fragment =
+          Fragment::MappedFromDescriptor(descriptor, buffer->bytes);
+      if (fragment.is_null() ||
+          (buffer->is_retirable && !buffer->TryAcquireHold())) {
+        return {};
+      }
+      return fragment;
+    }
+  }
+
+  // Either the buffer is not yet known to this pool, or its BufferId is out of
+  // range for lock-free lookup.
   absl::MutexLock lock(&mutex_);
   auto it = mappings_.find(descriptor.buffer_id());
   if (it == mappings_.end()) {
+    if (retired_buffer_ids_.contains(descriptor.buffer_id())) {
+      return {};
+    }
     return Fragment::PendingFromDescriptor(descriptor);
   }
 
@@ -68,6 +143,12 @@ bool BufferPool::AddBlockBuffer(
   std::vector<WaitForBufferCallback> callbacks;
   {
     absl::MutexLock lock(&mutex_);
+    if (retired_buffer_ids_.contains(id)) {
+      // BufferIds are never reused, so there's nothing to do.
+      return true;
+    }
+
+    ReleaseRetiredBuffersLocked();
     auto [it, inserted] = mappings_.insert({id, std::move(mapping)});
     if (!inserted) {
       ABSL_ASSERT(buffer_callbacks_.empty());
@@ -87,10 +168,57 @@ bool BufferPool::AddBlockBuffer(
           block_allocator_pools_.insert({block_size, nullptr});
       auto& pool = pool_it->second;
       if (pool_inserted) {
-        pool = std::make_unique<BlockAllocatorPool>();
+        pool = std::make_shared<BlockAllocatorPool>();
       }
       pool->Add(id, inserted_mapping.bytes(), allocator);
     }
+    const bool is_retirable = block_allocators.size() == 1;
+    if (PublishBufferLocked(id, inserted_mapping.bytes(), is_retirable) &&
+        is_retirable) {
+      retirable_block_buffers_.insert({id, block_allocators.front()});
+    }
+  }
+
+  for (auto& callback : callbacks) {
+    callback();
+  }
+
+  return true;
+}
+
+bool BufferPool::AddLargeBuffer(BufferId id, DriverMemoryMapping mapping) {
+  ABSL_ASSERT(mapping.is_valid());
+  const size_t buffer_size = mapping.bytes().size();
+  if (buffer_size <= kLargeBufferHeaderSize ||
+      buffer_size - kLargeBufferHeaderSize >
+          std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+
+  std::vector<WaitForBufferCallback> callbacks;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (retired_buffer_ids_.contains(id)) {
+      return true;
+    }
+
+    auto [it, inserted] = mappings_.insert({id, std::move(mapping)});
+    if (!inserted) {
+      return false;
+    }
+
+    large_buffers_[id] = it->second.bytes();
+    if (!PublishBufferLocked(id, it->second.bytes(), /*is_retirable=*/true)) {
+      // The BufferId is out of range for lock-free lookup, so holds on the
+      // buffer's fragments can't be tracked. The buffer is still usable, with
+      // its fragment resolved under `mutex_`, but it can never be retired.
+      DVLOG(1) << "Large buffer " << id.value() << " is not retirable";
+    }
+    auto callbacks_it = buffer_callbacks_.find(id);
+    if (callbacks_it != buffer_callbacks_.end()) {
+      callbacks = std::move(callbacks_it->second);
+      buffer_callbacks_.erase(callbacks_it);
+    }
   }
 
   for (auto& callback : callbacks) {
@@ -100,8 +228,91 @@ bool BufferPool::AddBlockBuffer(
   return true;
 }
 
+// static
+void BufferPool::InitializeLargeBuffer(absl::Span<uint8_t> buffer) {
+  ABSL_ASSERT(buffer.size() > kLargeBufferHeaderSize);
+  LargeBufferHeader& header = GetLargeBufferHeader(buffer);
+  header.reserved = 0;
+  header.is_allocated.store(0, std::memory_order_release);
+}
+
+size_t BufferPool::GetTotalLargeBufferCapacity() {
+  absl::MutexLock lock(&mutex_);
+  size_t capacity = 0;
+  for (const auto& [id, buffer] : large_buffers_) {
+    capacity += buffer.size() - kLargeBufferHeaderSize;
+  }
+  return capacity;
+}
+
+Fragment BufferPool::AllocateLargeFragment(size_t size) {
+  absl::MutexLock lock(&mutex_);
+
+  // Large buffers are few, so a linear scan for the best fit is fine. Note that
+  // the other side of the link may be allocating from the same buffers, so
+  // we keep looking for a fit until we successfully claim one.
+  for (;;) {
+    const std::pair<const BufferId, absl::Span<uint8_t>>* best_fit = nullptr;
+    for (const auto& entry : large_buffers_) {
+      const size_t capacity = entry.second.size() - kLargeBufferHeaderSize;
+      if (capacity < size ||
+          GetLargeBufferHeader(entry.second)
+                  .is_allocated.load(std::memory_order_relaxed) != 0) {
+        continue;
+      }
+      if (!best_fit || entry.second.size() < best_fit->second.size()) {
+        best_fit = &entry;
+      }
+    }
+
+    if (!best_fit) {
+      return {};
+    }
+
+    // This acquire is balanced by the store-release in FreeLargeFragment(), so
+    // the previous owner's accesses happen before ours.
+    const auto& [id, buffer] = *best_fit;
+    uint32_t expected = 0;
+    if (GetLargeBufferHeader(buffer).is_allocated.compare_exchange_strong(
+            expected, 1, std::memory_order_acquire,
+            std::memory_order_relaxed)) {
+      const FragmentDescriptor descriptor(
+          id, static_cast<uint32_t>(kLargeBufferHeaderSize),
+          static_cast<uint32_t>(buffer.size() - kLargeBufferHeaderSize));
+
+      // Buffers are only retired while holding `mutex_`, so there's no race
+      // with retirement here.
+      if (PublishedBuffer* published = GetRetirableBuffer(id)) {
+        published->AddHold();
+      }
+      return Fragment::FromDescriptorUnsafe(
+          descriptor, buffer.subspan(kLargeBufferHeaderSize).data());
+    }
+  }
+}
+
+bool BufferPool::FreeLargeFragment(const Fragment& fragment) {
+  bool freed = false;
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = large_buffers_.find(fragment.buffer_id());
+    if (it != large_buffers_.end() &&
+        fragment.offset() == kLargeBufferHeaderSize &&
+        fragment.size() == it->second.size() - kLargeBufferHeaderSize) {
+      // Balanced by the load-acquire in AllocateLargeFragment().
+      freed = GetLargeBufferHeader(it->second)
+                  .is_allocated.exchange(0, std::memory_order_release) != 0;
+    }
+  }
+
+  if (freed) {
+    ReleaseFragment(fragment);
+  }
+  return freed;
+}
+
 size_t BufferPool::GetTotalBlockCapacity(size_t block_size) {
-  BlockAllocatorPool* pool;
+  std::shared_ptr<BlockAllocatorPool> pool;
   {
     absl::MutexLock lock(&mutex_);
     auto it = block_allocator_pools_.find(block_size);
@@ -109,30 +320,45 @@ size_t BufferPool::GetTotalBlockCapacity(size_t block_size) {
       return 0;
     }
 
-    pool = it->second.get();
+    pool = it->second;
   }
 
   return pool->GetCapacity();
 }
 
-Fragment BufferPool::AllocateBlock(size_t block_size) {
+Fragment BufferPool::AllocateBlock(size_t block_size, bool* low_capacity) {
   ABSL_ASSERT(absl::has_single_bit(block_size));
 
-  BlockAllocatorPool* pool;
+  std::shared_ptr<BlockAllocatorPool> pool;
+  bool is_exact_size = false;
   {
     absl::MutexLock lock(&mutex_);
     auto it = block_allocator_pools_.lower_bound(block_size);
     if (it == block_allocator_pools_.end()) {
+      if (low_capacity) {
+        *low_capacity = true;
+      }
       return {};
     }
 
-    // NOTE: BlockAllocatorPools live as long as this BufferPool once added, and
-    // they are thread-safe objects; so retaining this pointer through the
-    // extent of AllocateBlock() is safe.
-    pool = it->second.get();
+    // NOTE: BlockAllocatorPools are thread-safe objects, and the reference we
+    // retain here keeps this one (and the buffers it uses) alive through the
+    // extent of AllocateBlock() even if a buffer is retired concurrently.
+    pool = it->second;
+    is_exact_size = it->first == block_size;
   }
 
-  return pool->Allocate();
+  Fragment fragment = pool->Allocate(low_capacity);
+  if (low_capacity && !is_exact_size) {
+    // There's no dedicated capacity for `block_size` at all.
+    *low_capacity = true;
+  }
+  if (!AcquireHold(fragment)) {
+    // The block's buffer was retired after `pool` was replaced. Its blocks
+    // should all have been claimed, so the block is abandoned.
+    return {};
+  }
+  return fragment;
 }
 
 Fragment BufferPool::AllocateBlockBestEffort(size_t preferred_block_size) {
@@ -143,7 +369,7 @@ Fragment BufferPool::AllocateBlockBestEffort(size_t preferred_block_size) {
   constexpr size_t kMaxAttempts = 3;
 
   BlockAllocatorPoolMap::iterator pool_iter;
-  BlockAllocatorPool* pool;
+  std::shared_ptr<BlockAllocatorPool> pool;
   {
     absl::MutexLock lock(&mutex_);
     if (block_allocator_pools_.empty()) {
@@ -155,13 +381,13 @@ Fragment BufferPool::AllocateBlockBestEffort(size_t preferred_block_size) {
       --pool_iter;
     }
 
-    pool = pool_iter->second.get();
+    pool = pool_iter->second;
   }
 
   for (size_t attempts = 0; attempts < kMaxAttempts; ++attempts) {
     const Fragment fragment = pool->Allocate();
     if (!fragment.is_null()) {
-      return fragment;
+      return AcquireHold(fragment) ? fragment : Fragment();
     }
 
     absl::MutexLock lock(&mutex_);
@@ -170,25 +396,290 @@ Fragment BufferPool::AllocateBlockBestEffort(size_t preferred_block_size) {
     }
 
     --pool_iter;
-    pool = pool_iter->second.get();
+    pool = pool_iter->second;
   }
 
   return {};
 }
 
 bool BufferPool::FreeBlock(const Fragment& fragment) {
-  BlockAllocatorPool* pool;
+  std::shared_ptr<BlockAllocatorPool> pool;
   {
     absl::MutexLock lock(&mutex_);
     auto it = block_allocator_pools_.find(fragment.size());
-    if (it == block_allocator_pools_.end()) {
+    if (it != block_allocator_pools_.end()) {
+      pool = it->second;
+    }
+  }
+
+  // NOTE: The hold is released only after the block is freed, since freeing
+  // may touch the block's memory.
+  const bool freed = pool && pool->Free(fragment);
+  if (freed) {
+    ReleaseFragment(fragment);
+  }
+  return freed;
+}
+
+void BufferPool::AddFragmentHold(const Fragment& fragment) {
+  if (!fragment.is_addressable()) {
+    return;
+  }
+  if (PublishedBuffer* buffer = GetRetirableBuffer(fragment.buffer_id())) {
+    buffer->AddHold();
+  }
+}
+
+void BufferPool::ReleaseFragment(const Fragment& fragment) {
+  if (!fragment.is_addressable()) {
+    return;
+  }
+  if (PublishedBuffer* buffer = GetRetirableBuffer(fragment.buffer_id())) {
+    buffer->ReleaseHold();
+  }
+}
+
+void BufferPool::FlushCachedBlocks() {
+  std::vector<std::shared_ptr<BlockAllocatorPool>> pools;
+  {
+    absl::MutexLock lock(&mutex_);
+    for (const auto& [block_size, pool] : block_allocator_pools_) {
+      pools.push_back(pool);
+    }
+  }
+
+  for (const auto& pool : pools) {
+    pool->FlushMagazines();
+  }
+}
+
+bool BufferPool::IsRetirableBufferIdle(BufferId id) {
+  PublishedBuffer* buffer = GetRetirableBuffer(id);
+  return buffer && !buffer->is_retired.load(std::memory_order_relaxed) &&
+         buffer->num_holds.load(std::memory_order_relaxed) == 0;
+}
+
+BufferPool::RetireResult BufferPool::TryRetireBuffer(BufferId id) {
+  absl::MutexLock lock(&mutex_);
+  ReleaseRetiredBuffersLocked();
+  if (retired_buffer_ids_.contains(id)) {
+    return RetireResult::kInvalid;
+  }
+  if (!mappings_.contains(id)) {
+    // The buffer may still be on its way to this pool.
+    return RetireResult::kInUse;
+  }
+  PublishedBuffer* buffer = GetRetirableBuffer(id);
+  if (!buffer) {
+    return RetireResult::kInvalid;
+  }
+  if (buffer->num_holds.load(std::memory_order_seq_cst) != 0) {
+    return RetireResult::kInUse;
+  }
+
+  auto large_it = large_buffers_.find(id);
+  if (large_it != large_buffers_.end()) {
+    // Claiming a large buffer's only fragment is enough to keep anyone else
+    // from allocating it.
+    uint32_t expected = 0;
+    if (!GetLargeBufferHeader(large_it->second)
+             .is_allocated.compare_exchange_strong(
+                 expected, 1, std::memory_order_acquire,
+                 std::memory_order_relaxed)) {
+      return RetireResult::kInUse;
+    }
+
+    RemoveBufferLocked(id);
+    return RetireResult::kRetired;
+  }
+
+  auto block_it = retirable_block_buffers_.find(id);
+  if (block_it == retirable_block_buffers_.end()) {
+    return RetireResult::kInvalid;
+  }
+
+  // Blocks cached by this pool are allocated as far as the buffer is
+  // concerned, so they must be returned before the buffer can be claimed.
+  const BlockAllocator& allocator = block_it->second;
+  block_allocator_pools_[allocator.block_size()]->FlushMagazines();
+  if (!ClaimAllBlocks(allocator)) {
+    return RetireResult::kInUse;
+  }
+
+  RemoveBufferLocked(id);
+  return RetireResult::kRetired;
+}
+
+bool BufferPool::RemoveRetiredBuffer(BufferId id) {
+  absl::MutexLock lock(&mutex_);
+  if (retired_buffer_ids_.contains(id) || !mappings_.contains(id) ||
+      !GetRetirableBuffer(id)) {
+    return false;
+  }
+
+  auto large_it = large_buffers_.find(id);
+  if (large_it != large_buffers_.end()) {
+    if (GetLargeBufferHeader(large_it->second)
+            .is_allocated.load(std::memory_order_acquire) == 0) {
       return false;
     }
 
-    pool = it->second.get();
+    RemoveBufferLocked(id);
+    return true;
+  }
+
+  auto block_it = retirable_block_buffers_.find(id);
+  if (block_it == retirable_block_buffers_.end()) {
+    return false;
+  }
+
+  // All of a retired buffer's blocks must already be claimed. If we can still
+  // allocate one, the buffer was not actually retired.
+  const BlockAllocator& allocator = block_it->second;
+  if (void* block = allocator.Allocate()) {
+    allocator.Free(block);
+    return false;
+  }
+
+  RemoveBufferLocked(id);
+  return true;
+}
+
+void BufferPool::ReleaseRetiredBuffers() {
+  absl::MutexLock lock(&mutex_);
+  ReleaseRetiredBuffersLocked();
+}
+
+std::atomic<BufferPool::PublishedBuffer*>* BufferPool::GetPublishedBufferSlot(
+    BufferId id,
+    bool create) {
+  constexpr uint64_t kSideMask = 1ull << kLinkSideBIdBit;
+  const uint64_t index = id.value() & ~kSideMask;
+  if (index >= kMaxSegmentsPerSide * kNumSlotsPerSegment) {
+    return nullptr;
+  }
+
+  auto& segments = published_buffer_segments_[(id.value() & kSideMask) ? 1 : 0];
+  std::atomic<PublishedBufferSegment*>& segment_ptr =
+      segments[index / kNumSlotsPerSegment];
+  PublishedBufferSegment* segment =
+      segment_ptr.load(std::memory_order_acquire);
+  if (!segment) {
+    if (!create) {
+      return nullptr;
+    }
+
+    // Only reached while holding `mutex_`, so there's no race to allocate.
+    auto new_segment = std::make_unique<PublishedBufferSegment>();
+    segment = new_segment.get();
+    owned_published_buffer_segments_.push_back(std::move(new_segment));
+    segment_ptr.store(segment, std::memory_order_release);
   }
+  return &segment->slots[index % kNumSlotsPerSegment];
+}
 
-  return pool->Free(fragment);
+BufferPool::PublishedBuffer* BufferPool::GetRetirableBuffer(BufferId id) {
+  auto* slot = GetPublishedBufferSlot(id, /*create=*/false);
+  if (!slot) {
+    return nullptr;
+  }
+
+  PublishedBuffer* buffer = slot->load(std::memory_order_acquire);
+  return buffer && buffer->is_retirable ? buffer : nullptr;
+}
+
+bool BufferPool::PublishBufferLocked(BufferId id,
+                                     absl::Span<uint8_t> bytes,
+                                     bool is_retirable) {
+  auto* slot = GetPublishedBufferSlot(id, /*create=*/true);
+  if (!slot) {
+    return false;
+  }
+
+  // NOTE: Elements of a std::deque remain at a stable address as it grows.
+  published_buffers_.emplace_back(bytes, is_retirable);
+  slot->store(&published_buffers_.back(), std::memory_order_release);
+  return true;
+}
+
+bool BufferPool::AcquireHold(const Fragment& fragment) {
+  if (fragment.is_null()) {
+    return true;
+  }
+
+  PublishedBuffer* buffer = GetRetirableBuffer(fragment.buffer_id());
+  return !buffer || buffer->TryAcquireHold();
+}
+
+void BufferPool::PublishRetiredBufferLocked(BufferId id) {
+  PublishedBuffer* buffer = GetRetirableBuffer(id);
+  ABSL_ASSERT(buffer);
+
+  // Paired with the sequentially consistent operations in TryAcquireHold() and
+  // ReleaseRetiredBuffersLocked(): any thread which acquires a hold on one of
+  // the buffer's fragments concurrently either sees that the buffer is
+  // retired, or has its hold seen before the buffer is unmapped.
+  buffer->is_retired.store(true, std::memory_order_seq_cst);
+}
+
+void BufferPool::RemoveBufferLocked(BufferId id) {
+  auto mapping_it = mappings_.find(id);
+  ABSL_ASSERT(mapping_it != mappings_.end());
+  DriverMemoryMapping mapping = std::move(mapping_it->second);
+  mappings_.erase(mapping_it);
+  retired_buffer_ids_.insert(id);
+  PublishRetiredBufferLocked(id);
+
+  PublishedBuffer& published = *GetRetirableBuffer(id);
+  if (large_buffers_.erase(id)) {
+    // Large buffers aren't allocated through any BlockAllocatorPool, so only
+    // holds on their fragments can keep them mapped.
+    retired_buffers_.emplace_back(std::move(mapping), nullptr, published);
+    ReleaseRetiredBuffersLocked();
+    return;
+  }
+
+  auto block_it = retirable_block_buffers_.find(id);
+  ABSL_ASSERT(block_it != retirable_block_buffers_.end());
+  const size_t block_size = block_it->second.block_size();
+  retirable_block_buffers_.erase(block_it);
+
+  // Other threads may be using the current pool for this block size without
+  // holding `mutex_`, so swap in a new pool which excludes the retired buffer
+  // and keep the buffer mapped until nothing is using the old pool anymore.
+  auto& pool = block_allocator_pools_[block_size];
+  std::shared_ptr<BlockAllocatorPool> old_pool = std::move(pool);
+  pool = old_pool->CloneWithout(id);
+  retired_buffers_.emplace_back(std::move(mapping), std::move(old_pool),
+                                published);
+  ReleaseRetiredBuffersLocked();
+}
+
+void BufferPool::ReleaseRetiredBuffersLocked() {
+  // An older pool may still include buffers which were retired after it was
+  // replaced, so buffers must be released in the order they were retired. A
+  // pool referenced only by `retired_buffers_` can't be referenced again,
+  // since new references are only acquired from `block_allocator_pools_`.
+  // Likewise, no new holds can be acquired on a retired buffer's fragments.
+  size_t num_unused = 0;
+  for (const RetiredBuffer& retired : retired_buffers_) {
+    if ((retired.pool && retired.pool.use_count() > 1) ||
+        retired.published->num_holds.load(std::memory_order_seq_cst) != 0) {
+      break;
+    }
+    ++num_unused;
+  }
+
+  if (num_unused == 0) {
+    return;
+  }
+
+  // Ensure that any other thread's use of a pool happens before we unmap its
+  // buffers. This pairs with the release performed when other threads drop
+  // their references.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  retired_buffers_.erase(retired_buffers_.begin(),
+                         retired_buffers_.begin() + num_unused);
 }
 
 void BufferPool::WaitForBufferAsync(BufferId id,
@@ -205,4 +696,100 @@ void BufferPool::WaitForBufferAsync(BufferId id,
   callback();
 }
 
+BufferPool::MemoryStats BufferPool::GetMemoryStats() {
+  MemoryStats stats;
+  BlockAllocatorPoolMap pools;
+  {
+    absl::MutexLock lock(&mutex_);
+    stats.num_buffers = mappings_.size();
+    for (const auto& [id, mapping] : mappings_) {
+      stats.total_buffer_size += mapping.bytes().size();
+    }
+
+    stats.num_large_buffers = large_buffers_.size();
+    for (const auto& [id, buffer] : large_buffers_) {
+      stats.total_large_buffer_size += buffer.size();
+      if (GetLargeBufferHeader(buffer).is_allocated.load(
+              std::memory_order_relaxed) != 0) {
+        ++stats.num_allocated_large_buffers;
+      }
+    }
+
+    pools = block_allocator_pools_;
+  }
+
+  // Counting free blocks may walk long free-lists, so do it without holding
+  // `mutex_`. The references we hold keep each pool and its buffers alive.
+  stats.block_stats.reserve(pools.size());
+  for (const auto& [block_size, pool] : pools) {
+    const BlockAllocatorPool::Stats pool_stats = pool->GetStats();
+    stats.block_stats.push_back({
+        .block_size = block_size,
+        .num_allocators = pool_stats.num_allocators,
+        .num_blocks = pool_stats.num_blocks,
+        .num_free_blocks = pool_stats.num_free_blocks,
+        .num_cached_blocks = pool_stats.num_cached_blocks,
+    });
+  }
+  return stats;
+}
+
+BufferPool::MemoryStats::MemoryStats() = default;
+
+BufferPool::MemoryStats::MemoryStats(MemoryStats&&) = default;
+
+BufferPool::MemoryStats& BufferPool::MemoryStats::operator=(MemoryStats&&) =
+    default;
+
+BufferPool::MemoryStats::~MemoryStats() = default;
+
+BufferPool::PublishedBuffer::PublishedBuffer(absl::Span<uint8_t> bytes,
+                                             bool is_retirable)
+    : bytes(bytes), is_retirable(is_retirable) {}
+
+BufferPool::PublishedBuffer::~PublishedBuffer() = default;
+
+void BufferPool::PublishedBuffer::AddHold() {
+  num_holds.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool BufferPool::PublishedBuffer::TryAcquireHold() {
+  // See PublishRetiredBufferLocked().
+  num_holds.fetch_add(1, std::memory_order_seq_cst);
+  if (is_retired.load(std::memory_order_seq_cst)) {
+    ReleaseHold();
+    return false;
+  }
+  return true;
+}
+
+void BufferPool::PublishedBuffer::ReleaseHold() {
+  // Balanced by the load in ReleaseRetiredBuffersLocked(), so that the holder's
+  // accesses to the buffer happen before it's unmapped.
+  num_holds.fetch_sub(1, std::memory_order_release);
+}
+
+BufferPool::RetiredBuffer::RetiredBuffer(
+    DriverMemoryMapping mapping,
+    std::shared_ptr<BlockAllocatorPool> pool,
+    PublishedBuffer& published)
+    : mapping(std::move(mapping)),
+      pool(std::move(pool)),
+      published(&published) {}
+
+BufferPool::RetiredBuffer::RetiredBuffer(RetiredBuffer&&) = default;
+
+BufferPool::RetiredBuffer& BufferPool::RetiredBuffer::operator=(
+    RetiredBuffer&&) = default;
+
+BufferPool::RetiredBuffer::~RetiredBuffer() = default;
+
+BufferPool::PublishedBufferSegment::PublishedBufferSegment() {
+  for (auto& slot : slots) {
+    slot.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+BufferPool::PublishedBufferSegment::~PublishedBufferSegment() = default;
+
 }  // namespace ipcz
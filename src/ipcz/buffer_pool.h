@@ -5,9 +5,13 @@
 #ifndef IPCZ_SRC_IPCZ_BUFFER_POOL_H_
 #define IPCZ_SRC_IPCZ_BUFFER_POOL_H_
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <map>
 #include <memory>
+#include <vector>
 
 #include "ipcz/block_allocator.h"
 #include "ipcz/buffer_id.h"
@@ -15,6 +19,7 @@
 #include "ipcz/fragment.h"
 #include "ipcz/fragment_descriptor.h"
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_set.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
 
@@ -25,8 +30,14 @@ class BlockAllocatorPool;
 // BufferPool maintains ownership of an extensible collection of mapped
 // DriverMemory buffers, exposing access to them for dynamic memory allocation
 // and arbitrary state sharing. Every buffer owned by a BufferPool is identified
-// by a unique BufferId, and once a buffer is added to the pool it remains there
-// indefinitely.
+// by a unique BufferId. Once a buffer is added to the pool it remains there
+// until it's retired (see TryRetireBuffer()), and a BufferId is never reused
+// for another buffer.
+//
+// Fragments resolved or allocated within a retirable buffer are "held" by the
+// caller until they're freed or released, and a retired buffer remains mapped
+// until none of its fragments are held anymore. This keeps memory in use on
+// this side of a link mapped, regardless of what the other side does.
 //
 // BufferPool objects are thread-safe.
 class BufferPool {
@@ -34,16 +45,22 @@ class BufferPool {
   BufferPool();
   ~BufferPool();
 
-  // Resolves `descriptor` to a concrete Fragment. If the descriptor is null or
-  // describes a region of memory which exceeds the bounds of the identified
-  // buffer, this returns a null Fragment.
+  // Resolves `descriptor` to a concrete Fragment. If the descriptor is null,
+  // identifies a retired buffer, or describes a region of memory which exceeds
+  // the bounds of the identified buffer, this returns a null Fragment.
   //
   // If the descriptor's BufferId is not yet registered with this pool, this
   // returns a pending Fragment with the same BufferId and dimensions as
   // `descriptor`.
   //
   // Otherwise this returns a resolved Fragment which references an appropriate
-  // span of mapped memory.
+  // span of mapped memory. If the fragment belongs to a retirable buffer, the
+  // caller holds it until passing it to FreeBlock(), FreeLargeFragment() or
+  // ReleaseFragment().
+  //
+  // This is called for nearly every message and parcel transmitted over shared
+  // memory, so buffers with reasonably small BufferIds are resolved without
+  // acquiring any locks. See `published_buffers_` below.
   Fragment GetFragment(const FragmentDescriptor& descriptor);
 
   // Registers `mapping` under `id` within this pool, along with a collection of
@@ -62,6 +79,44 @@ class BufferPool {
                       DriverMemoryMapping mapping,
                       absl::Span<const BlockAllocator> block_allocators);
 
+  // Registers `mapping` under `id` within this pool as a large buffer. Each
+  // large buffer begins with a small header followed by a single allocable
+  // fragment spanning the rest of the buffer, and these buffers are used to
+  // allocate fragments too large for any BlockAllocator. The mapped memory must
+  // already have been initialized by InitializeLargeBuffer().
+  //
+  // Returns true if the buffer was successfully added to the pool, or false if
+  // the pool already had a buffer registered under the given `id` or if the
+  // mapping is too small or too large to be a valid large buffer.
+  bool AddLargeBuffer(BufferId id, DriverMemoryMapping mapping);
+
+  // The number of bytes reserved at the start of every large buffer for its
+  // header. This also keeps each large buffer's fragment page-aligned.
+  static constexpr size_t kLargeBufferHeaderSize = 4096;
+
+  // Performs a one-time initialization of `buffer` as a large buffer whose
+  // fragment is not yet allocated. This must be done before the buffer is
+  // shared with any other BufferPool.
+  static void InitializeLargeBuffer(absl::Span<uint8_t> buffer);
+
+  // Returns the total size in bytes of all fragments (allocated or not) within
+  // large buffers registered with this pool.
+  size_t GetTotalLargeBufferCapacity();
+
+  // Attempts to allocate a fragment of at least `size` bytes from any large
+  // buffer in the pool, preferring the smallest suitable buffer. Note that
+  // large buffers can only be allocated whole, so the returned Fragment spans
+  // the whole of its buffer after the header. If no suitable buffer is
+  // available, this returns a null Fragment. As with GetFragment(), the caller
+  // holds the new fragment.
+  Fragment AllocateLargeFragment(size_t size);
+
+  // Frees a fragment previously allocated from this pool via
+  // AllocateLargeFragment(). Returns true if successful, or false if `fragment`
+  // does not identify a currently allocated large buffer fragment. On success,
+  // the caller's hold on `fragment` is released.
+  bool FreeLargeFragment(const Fragment& fragment);
+
   // Returns the total size in bytes of capacity available across all registered
   // BlockAllocators for the given `block_size`.
   size_t GetTotalBlockCapacity(size_t block_size);
@@ -69,8 +124,13 @@ class BufferPool {
   // Attempts to allocate an unused block of at least `block_size` bytes from
   // any available block allocation buffer in the pool, preferring the smaller
   // blocks over larger ones. If the BufferPool cannot accommodate the
-  // allocation request, this returns a null Fragment.
-  Fragment AllocateBlock(size_t block_size);
+  // allocation request, this returns a null Fragment. As with GetFragment(),
+  // the caller holds the new block.
+  //
+  // If `low_capacity` is non-null, it's set to indicate whether capacity for
+  // blocks of `block_size` bytes is missing or nearly exhausted. See
+  // BlockAllocatorPool::Allocate().
+  Fragment AllocateBlock(size_t block_size, bool* low_capacity = nullptr);
 
   // Similar to AllocateFragment(), but this may allocate less space than
   // requested if that's all that's available. May still return a null Fragment
@@ -79,27 +139,247 @@ class BufferPool {
 
   // Frees a block previously allocated from this pool via AllocateBlock() or
   // AllocateBlockBestEffort(). Returns true if successful, or false if
-  // `fragment` was not allocated from one of this pool's block buffers.
+  // `fragment` was not allocated from one of this pool's block buffers. On
+  // success, the caller's hold on `fragment` is released; a failed free leaves
+  // any hold in place, which at worst keeps the buffer mapped.
   bool FreeBlock(const Fragment& fragment);
 
+  // Adds another hold on `fragment`, which the caller must already hold. Used
+  // when a fragment is shared by multiple owners on this side of a link.
+  void AddFragmentHold(const Fragment& fragment);
+
+  // Releases the caller's hold on `fragment` without freeing it, for example
+  // because ownership of the fragment was transferred to the other side of the
+  // link. The caller must not access the fragment's memory afterward.
+  void ReleaseFragment(const Fragment& fragment);
+
+  // Returns any blocks which this pool has cached for fast reuse to their
+  // allocators, so that they can be allocated by other pools sharing the same
+  // buffers. This also allows buffers to be retired if the cached blocks were
+  // the only ones in use.
+  void FlushCachedBlocks();
+
+  // Indicates whether the identified buffer is eligible for retirement and
+  // none of its fragments are held by users of this pool. Only large buffers
+  // and buffers added with a single BlockAllocator can be retired, and only if
+  // their BufferIds are eligible for lock-free lookup by GetFragment(). Other
+  // buffers remain usable but are never retired.
+  bool IsRetirableBufferIdle(BufferId id);
+
+  // The outcome of TryRetireBuffer().
+  enum class RetireResult {
+    // The buffer was retired.
+    kRetired,
+
+    // The buffer can't be retired yet, because some of its fragments are still
+    // held or allocated, or because it hasn't been added to this pool yet.
+    kInUse,
+
+    // The buffer can never be retired by this pool, because it's not eligible
+    // for retirement or because it was already retired.
+    kInvalid,
+  };
+
+  // Attempts to retire the identified buffer so that its memory can be
+  // released. Any blocks this pool has cached for the buffer's block size are
+  // flushed first, and then all of the buffer's capacity is claimed by this
+  // pool so that no other pool sharing the buffer can allocate from it. This
+  // fails if any of the buffer's fragments are held by users of this pool or
+  // if any of its capacity is still allocated.
+  //
+  // On success the buffer is removed from this pool, and the caller is then
+  // responsible for having any other pools sharing the buffer call
+  // RemoveRetiredBuffer().
+  RetireResult TryRetireBuffer(BufferId id);
+
+  // Removes the identified buffer from this pool after it was retired by
+  // another pool sharing it via TryRetireBuffer(). Returns false if the buffer
+  // is unknown, not eligible for retirement, or still has capacity available
+  // for allocation, implying that it was not actually retired.
+  bool RemoveRetiredBuffer(BufferId id);
+
+  // Releases the mappings of any retired buffers whose fragments are no longer
+  // held or otherwise in use.
+  void ReleaseRetiredBuffers();
+
   // Runs `callback` as soon as the identified buffer is added to the underlying
   // BufferPool. If the buffer is already present here, `callback` is run
   // immediately.
   using WaitForBufferCallback = std::function<void()>;
   void WaitForBufferAsync(BufferId id, WaitForBufferCallback callback);
 
+  // A snapshot of the buffers and blocks within this pool, for diagnostics.
+  struct MemoryStats {
+    MemoryStats();
+    MemoryStats(MemoryStats&&);
+    MemoryStats& operator=(MemoryStats&&);
+    ~MemoryStats();
+
+    // All buffers in the pool, including large buffers.
+    size_t num_buffers = 0;
+    size_t total_buffer_size = 0;
+
+    // Large buffers in the pool, and how many of them are allocated.
+    size_t num_large_buffers = 0;
+    size_t total_large_buffer_size = 0;
+    size_t num_allocated_large_buffers = 0;
+
+    // Block usage for each block size, in ascending order of block size. See
+    // BlockAllocatorPool::Stats.
+    struct BlockStats {
+      size_t block_size = 0;
+      size_t num_allocators = 0;
+      size_t num_blocks = 0;
+      size_t num_free_blocks = 0;
+      size_t num_cached_blocks = 0;
+    };
+    std::vector<BlockStats> block_stats;
+  };
+  MemoryStats GetMemoryStats();
+
  private:
+  // A buffer published for lock-free lookup by GetFragment().
+  struct PublishedBuffer {
+    PublishedBuffer(absl::Span<uint8_t> bytes, bool is_retirable);
+    ~PublishedBuffer();
+
+    // Adds a hold on one of this buffer's fragments.
+    void AddHold();
+
+    // Like AddHold(), but returns false without adding a hold if the buffer
+    // has been retired.
+    bool TryAcquireHold();
+
+    // Releases a hold added by AddHold() or TryAcquireHold().
+    void ReleaseHold();
+
+    // The buffer's mapped memory. Only valid while `is_retired` is false, or
+    // while some of the buffer's fragments are held.
+    const absl::Span<uint8_t> bytes;
+
+    // Whether holds on this buffer's fragments are counted.
+    const bool is_retirable;
+
+    // Set once the buffer is retired, after which its fragments can no longer
+    // be resolved or allocated.
+    std::atomic<bool> is_retired{false};
+
+    // The number of holds on this buffer's fragments. Only used if
+    // `is_retirable` is true.
+    std::atomic<int64_t> num_holds{0};
+  };
+
+  // A retired buffer's mapping, along with the BlockAllocatorPool which was in
+  // use for its block size at the time it was retired (or null for a large
+  // buffer). Other threads may still be using that pool (or an older one) or
+  // holding fragments within the buffer, so the mapping must outlive them.
+  struct RetiredBuffer {
+    RetiredBuffer(DriverMemoryMapping mapping,
+                  std::shared_ptr<BlockAllocatorPool> pool,
+                  PublishedBuffer& published);
+    RetiredBuffer(RetiredBuffer&&);
+    RetiredBuffer& operator=(RetiredBuffer&&);
+    ~RetiredBuffer();
+
+    DriverMemoryMapping mapping;
+    std::shared_ptr<BlockAllocatorPool> pool;
+    PublishedBuffer* published;
+  };
+
+  // A fixed-size block of lookup slots within `published_buffers_`. A null slot
+  // identifies a buffer which hasn't been added or retired yet.
+  static constexpr size_t kNumSlotsPerSegment = 256;
+  struct PublishedBufferSegment {
+    PublishedBufferSegment();
+    ~PublishedBufferSegment();
+
+    std::array<std::atomic<PublishedBuffer*>, kNumSlotsPerSegment> slots;
+  };
+
+  // The maximum number of segments per link side. Together with
+  // kNumSlotsPerSegment this bounds the BufferIds eligible for lock-free
+  // lookup; any other BufferIds are resolved by locking `mutex_`.
+  static constexpr size_t kMaxSegmentsPerSide = 64;
+
+  // Returns the published lookup slot for `id`, or null if `id` is outside the
+  // range of lock-free lookup. If `create` is true, this allocates the slot's
+  // segment as needed, and `mutex_` must be held.
+  std::atomic<PublishedBuffer*>* GetPublishedBufferSlot(BufferId id,
+                                                        bool create);
+
+  // Returns the published buffer identified by `id` if it's retirable, or null
+  // otherwise.
+  PublishedBuffer* GetRetirableBuffer(BufferId id);
+
+  // Publishes `bytes` as the mapped memory of the buffer identified by `id`,
+  // for lock-free lookup by GetFragment(). Returns true if the buffer was
+  // published, or false if `id` is out of range for lock-free lookup.
+  bool PublishBufferLocked(BufferId id,
+                           absl::Span<uint8_t> bytes,
+                           bool is_retirable)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Acquires a hold on a newly allocated `fragment` if it belongs to a
+  // retirable buffer. Returns false if the buffer was retired, in which case
+  // `fragment` must not be used.
+  bool AcquireHold(const Fragment& fragment);
+
+  // Marks `id` as retired for lock-free lookup by GetFragment().
+  void PublishRetiredBufferLocked(BufferId id)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes the identified buffer from the pool and records it as retired.
+  // The buffer must be registered with the pool.
+  void RemoveBufferLocked(BufferId id) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Releases the mappings of any retired buffers which can no longer be in use
+  // by other threads.
+  void ReleaseRetiredBuffersLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   absl::Mutex mutex_;
   absl::flat_hash_map<BufferId, DriverMemoryMapping> mappings_
       ABSL_GUARDED_BY(mutex_);
 
   // Mapping from block size to a pool of BlockAllocators for that size. When
   // a new BlockAllocator is registered with this BufferPool, it's added to an
-  // appropriate BlockAllocatorPool within this map.
+  // appropriate BlockAllocatorPool within this map. Entries are never removed
+  // from this map, but when a buffer is retired the pool for its block size is
+  // replaced with a new one which excludes the buffer. Users retain a reference
+  // to the pool while using it.
   using BlockAllocatorPoolMap =
-      std::map<size_t, std::unique_ptr<BlockAllocatorPool>>;
+      std::map<size_t, std::shared_ptr<BlockAllocatorPool>>;
   BlockAllocatorPoolMap block_allocator_pools_ ABSL_GUARDED_BY(mutex_);
 
+  // The sole BlockAllocator of each block buffer which is eligible to be
+  // retired, keyed by BufferId.
+  absl::flat_hash_map<BufferId, BlockAllocator> retirable_block_buffers_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Retired buffers whose mappings may still be in use, in the order they were
+  // retired.
+  std::vector<RetiredBuffer> retired_buffers_ ABSL_GUARDED_BY(mutex_);
+
+  // The IDs of all buffers which have been retired from this pool.
+  absl::flat_hash_set<BufferId> retired_buffer_ids_ ABSL_GUARDED_BY(mutex_);
+
+  // Mapped regions of all large buffers in this pool, keyed by BufferId. Each
+  // of these also has its mapping owned by `mappings_`.
+  absl::flat_hash_map<BufferId, absl::Span<uint8_t>> large_buffers_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Lock-free lookup table for GetFragment(), indexed first by the link side
+  // encoded in a BufferId and then by the rest of its value. Since each side
+  // allocates BufferIds sequentially, these tables are dense. Segments are
+  // allocated on demand and, like the buffers they reference, they are never
+  // freed or modified except to publish a new buffer or to retire one.
+  std::array<std::array<std::atomic<PublishedBufferSegment*>,
+                        kMaxSegmentsPerSide>,
+             2>
+      published_buffer_segments_{};
+  std::vector<std::unique_ptr<PublishedBufferSegment>>
+      owned_published_buffer_segments_ ABSL_GUARDED_BY(mutex_);
+  std::deque<PublishedBuffer> published_buffers_ ABSL_GUARDED_BY(mutex_);
+
   // Callbacks to be invoked when an identified buffer becomes available.
   absl::flat_hash_map<BufferId, std::vector<WaitForBufferCallback>>
       buffer_callbacks_ ABSL_GUARDED_BY(mutex_);
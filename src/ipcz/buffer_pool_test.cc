@@ -4,11 +4,15 @@
 
 #include "ipcz/buffer_pool.h"
 
+#include <atomic>
+#include <iterator>
+#include <thread>
 #include <vector>
 
 #include "ipcz/block_allocator.h"
 #include "ipcz/driver_memory.h"
 #include "ipcz/driver_memory_mapping.h"
+#include "ipcz/link_side.h"
 #include "ipcz/node.h"
 #include "reference_drivers/sync_reference_driver.h"
 #include "testing/gtest/include/gtest/gtest.h"
@@ -20,6 +24,8 @@ namespace {
 
 class BufferPoolTest : public testing::Test {
  protected:
+  Node& node() { return *node_; }
+
   DriverMemoryMapping AllocateDriverMemory(size_t size) {
     return DriverMemory(node_->driver(), size).Map();
   }
@@ -168,6 +174,86 @@ TEST_F(BufferPoolTest, GetFragment) {
   EXPECT_TRUE(fragment.is_null());
 }
 
+TEST_F(BufferPoolTest, ConcurrentGetFragment) {
+  // Resolves fragments from multiple threads while buffers are added and
+  // retired. Includes BufferIds from both link sides, as well as one too large
+  // for lock-free lookup.
+  constexpr size_t kBufferSize = 4096;
+  constexpr size_t kBlockSize = 64;
+  constexpr uint64_t kSideB = 1ull << kLinkSideBIdBit;
+  const BufferId kIds[] = {
+      BufferId(1),          BufferId(2),           BufferId(300),
+      BufferId(kSideB | 1), BufferId(kSideB | 2),  BufferId(kSideB | 1000),
+      BufferId(1ull << 40),
+  };
+  constexpr size_t kNumBuffers = std::size(kIds);
+  constexpr BufferId kRetiredId(2);
+
+  BufferPool pool;
+  std::vector<DriverMemoryMapping> mappings;
+  std::vector<const uint8_t*> addresses;
+  for (size_t i = 0; i < kNumBuffers; ++i) {
+    mappings.push_back(AllocateDriverMemory(kBufferSize));
+    addresses.push_back(mappings.back().bytes().data());
+  }
+
+  constexpr size_t kNumThreads = 4;
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < kNumBuffers; ++i) {
+          const Fragment fragment =
+              pool.GetFragment({kIds[i], kBlockSize, kBlockSize});
+          if (fragment.is_addressable()) {
+            EXPECT_EQ(kIds[i], fragment.buffer_id());
+            EXPECT_EQ(addresses[i] + kBlockSize, fragment.bytes().data());
+          } else if (fragment.is_null()) {
+            EXPECT_EQ(kRetiredId, kIds[i]);
+          } else {
+            EXPECT_TRUE(fragment.is_pending());
+          }
+          pool.ReleaseFragment(fragment);
+        }
+      }
+    });
+  }
+
+  for (size_t i = 0; i < kNumBuffers; ++i) {
+    const BlockAllocator allocator(mappings[i].bytes(), kBlockSize);
+    allocator.InitializeRegion();
+    EXPECT_TRUE(
+        pool.AddBlockBuffer(kIds[i], std::move(mappings[i]), {&allocator, 1}));
+  }
+  // Other threads' holds on the buffer are transient, so retirement eventually
+  // succeeds.
+  while (pool.TryRetireBuffer(kRetiredId) !=
+         BufferPool::RetireResult::kRetired) {
+  }
+
+  done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < kNumBuffers; ++i) {
+    const Fragment fragment = pool.GetFragment({kIds[i], 0, kBlockSize});
+    if (kIds[i] == kRetiredId) {
+      EXPECT_TRUE(fragment.is_null());
+    } else {
+      EXPECT_TRUE(fragment.is_addressable());
+      EXPECT_EQ(addresses[i], fragment.bytes().data());
+    }
+  }
+
+  // Buffers which were never added can't be retired yet.
+  EXPECT_EQ(BufferPool::RetireResult::kInUse,
+            pool.TryRetireBuffer(BufferId(kSideB | 3)));
+  EXPECT_FALSE(pool.RemoveRetiredBuffer(BufferId(kSideB | 3)));
+  EXPECT_TRUE(pool.GetFragment({BufferId(kSideB | 3), 0, 8}).is_pending());
+}
+
 TEST_F(BufferPoolTest, BasicBlockAllocation) {
   constexpr size_t kBufferSize = 4096;
   constexpr size_t kBlockSize = 64;
@@ -310,5 +396,177 @@ TEST_F(BufferPoolTest, BestEffortBlockAllocation) {
   EXPECT_EQ(kBuffer1BlockSize, partial_fragment.size());
 }
 
+TEST_F(BufferPoolTest, RetireBlockBuffer) {
+  // Two pools sharing the same buffers, as with each end of a NodeLink. The
+  // buffers are large enough for the pools to cache freed blocks.
+  constexpr size_t kBufferSize = 64 * 1024;
+  constexpr size_t kBlockSize = 64;
+  constexpr BufferId kPrimaryId(0);
+  constexpr BufferId kRetiredId(1);
+  BufferPool pool_a;
+  BufferPool pool_b;
+  DriverMemory primary_memory(node().driver(), kBufferSize);
+  DriverMemory memory(node().driver(), kBufferSize);
+  for (BufferPool* pool : {&pool_a, &pool_b}) {
+    DriverMemoryMapping primary_mapping = primary_memory.Map();
+    DriverMemoryMapping mapping = memory.Map();
+    const BlockAllocator primary_allocators[] = {
+        {primary_mapping.bytes().subspan(0, kBufferSize / 2), kBlockSize},
+        {primary_mapping.bytes().subspan(kBufferSize / 2), kBlockSize * 2}};
+    const BlockAllocator allocator(mapping.bytes(), kBlockSize);
+    if (pool == &pool_a) {
+      for (const auto& primary_allocator : primary_allocators) {
+        primary_allocator.InitializeRegion();
+      }
+      allocator.InitializeRegion();
+    }
+    EXPECT_TRUE(pool->AddBlockBuffer(kPrimaryId, std::move(primary_mapping),
+                                     primary_allocators));
+    EXPECT_TRUE(
+        pool->AddBlockBuffer(kRetiredId, std::move(mapping), {&allocator, 1}));
+  }
+
+  // Buffers with multiple allocators can't be retired.
+  EXPECT_EQ(BufferPool::RetireResult::kInvalid,
+            pool_a.TryRetireBuffer(kPrimaryId));
+
+  // Neither can buffers with blocks in use by either pool, even if they've
+  // been freed to a pool's cache.
+  std::vector<Fragment> fragments;
+  for (;;) {
+    Fragment fragment = pool_b.AllocateBlock(kBlockSize);
+    if (fragment.is_null()) {
+      break;
+    }
+    fragments.push_back(fragment);
+  }
+  EXPECT_EQ(BufferPool::RetireResult::kInUse,
+            pool_a.TryRetireBuffer(kRetiredId));
+  for (const Fragment& fragment : fragments) {
+    EXPECT_TRUE(pool_b.FreeBlock(fragment));
+  }
+  EXPECT_EQ(BufferPool::RetireResult::kInUse,
+            pool_a.TryRetireBuffer(kRetiredId));
+  EXPECT_FALSE(pool_b.RemoveRetiredBuffer(kRetiredId));
+
+  // Nor can buffers with fragments held by the retiring pool.
+  pool_b.FlushCachedBlocks();
+  const Fragment held = pool_a.GetFragment({kRetiredId, 0, kBlockSize});
+  EXPECT_TRUE(held.is_addressable());
+  EXPECT_EQ(BufferPool::RetireResult::kInUse,
+            pool_a.TryRetireBuffer(kRetiredId));
+  pool_a.ReleaseFragment(held);
+
+  // Blocks cached by the retiring pool itself are flushed before the buffer is
+  // claimed, so once no other pool has the buffer's blocks allocated or cached,
+  // it can be retired.
+  fragments.clear();
+  for (;;) {
+    Fragment fragment = pool_a.AllocateBlock(kBlockSize);
+    if (fragment.is_null()) {
+      break;
+    }
+    fragments.push_back(fragment);
+  }
+  for (const Fragment& fragment : fragments) {
+    EXPECT_TRUE(pool_a.FreeBlock(fragment));
+  }
+  EXPECT_EQ(BufferPool::RetireResult::kRetired,
+            pool_a.TryRetireBuffer(kRetiredId));
+  EXPECT_TRUE(pool_a.GetFragment({kRetiredId, 0, kBlockSize}).is_null());
+
+  // The other pool can no longer allocate from the retired buffer, so it can
+  // remove it too.
+  for (;;) {
+    Fragment fragment = pool_b.AllocateBlock(kBlockSize);
+    if (fragment.is_null()) {
+      break;
+    }
+    EXPECT_EQ(kPrimaryId, fragment.buffer_id());
+  }
+  EXPECT_TRUE(pool_b.RemoveRetiredBuffer(kRetiredId));
+  EXPECT_TRUE(pool_b.GetFragment({kRetiredId, 0, kBlockSize}).is_null());
+  EXPECT_GT(pool_b.GetTotalBlockCapacity(kBlockSize), 0u);
+  EXPECT_LT(pool_b.GetTotalBlockCapacity(kBlockSize), kBufferSize);
+
+  // Buffers can only be retired once, and they're ignored if added again.
+  DriverMemoryMapping mapping = memory.Map();
+  const BlockAllocator allocator(mapping.bytes(), kBlockSize);
+  EXPECT_EQ(BufferPool::RetireResult::kInvalid,
+            pool_a.TryRetireBuffer(kRetiredId));
+  EXPECT_TRUE(
+      pool_a.AddBlockBuffer(kRetiredId, std::move(mapping), {&allocator, 1}));
+  EXPECT_TRUE(pool_a.GetFragment({kRetiredId, 0, kBlockSize}).is_null());
+}
+
+TEST_F(BufferPoolTest, RetireLargeBuffer) {
+  constexpr size_t kBufferSize = BufferPool::kLargeBufferHeaderSize + 8192;
+  constexpr BufferId kId(1);
+  BufferPool pool_a;
+  BufferPool pool_b;
+  DriverMemory memory(node().driver(), kBufferSize);
+  DriverMemoryMapping mapping_a = memory.Map();
+  BufferPool::InitializeLargeBuffer(mapping_a.bytes());
+  EXPECT_TRUE(pool_a.AddLargeBuffer(kId, std::move(mapping_a)));
+  EXPECT_TRUE(pool_b.AddLargeBuffer(kId, memory.Map()));
+
+  // A large buffer can't be retired while its fragment is allocated.
+  Fragment fragment = pool_b.AllocateLargeFragment(8192);
+  EXPECT_TRUE(fragment.is_addressable());
+  const Fragment fragment_a = pool_a.GetFragment(fragment.descriptor());
+  EXPECT_TRUE(fragment_a.is_addressable());
+  EXPECT_EQ(BufferPool::RetireResult::kInUse, pool_a.TryRetireBuffer(kId));
+  EXPECT_TRUE(pool_b.FreeLargeFragment(fragment));
+
+  // Nor while the retiring pool still holds the fragment.
+  EXPECT_EQ(BufferPool::RetireResult::kInUse, pool_a.TryRetireBuffer(kId));
+  pool_a.ReleaseFragment(fragment_a);
+  EXPECT_EQ(BufferPool::RetireResult::kRetired, pool_a.TryRetireBuffer(kId));
+  EXPECT_TRUE(pool_b.AllocateLargeFragment(8192).is_null());
+
+  // A pool keeps a retired buffer mapped for as long as any of its fragments
+  // are still held.
+  const Fragment fragment_b = pool_b.GetFragment(fragment.descriptor());
+  EXPECT_TRUE(fragment_b.is_addressable());
+  EXPECT_TRUE(pool_b.RemoveRetiredBuffer(kId));
+  EXPECT_EQ(0u, pool_b.GetTotalLargeBufferCapacity());
+  EXPECT_TRUE(pool_b.GetFragment(fragment.descriptor()).is_null());
+  fragment_b.mutable_bytes()[0] = 42;
+  pool_b.ReleaseFragment(fragment_b);
+  pool_b.ReleaseRetiredBuffers();
+
+  EXPECT_TRUE(pool_a.GetFragment(fragment.descriptor()).is_null());
+  EXPECT_FALSE(pool_b.FreeLargeFragment(fragment));
+}
+
+TEST_F(BufferPoolTest, UnpublishedLargeBuffer) {
+  // BufferIds beyond the range of lock-free lookup (256 slots in each of 64
+  // segments per link side) still work for large buffers, but such buffers are
+  // never retired.
+  constexpr size_t kBufferSize = BufferPool::kLargeBufferHeaderSize + 8192;
+  constexpr BufferId kId(256 * 64);
+  BufferPool pool_a;
+  BufferPool pool_b;
+  DriverMemory memory(node().driver(), kBufferSize);
+  DriverMemoryMapping mapping_a = memory.Map();
+  BufferPool::InitializeLargeBuffer(mapping_a.bytes());
+  EXPECT_TRUE(pool_a.AddLargeBuffer(kId, std::move(mapping_a)));
+  EXPECT_TRUE(pool_b.AddLargeBuffer(kId, memory.Map()));
+
+  const Fragment fragment = pool_b.AllocateLargeFragment(8192);
+  ASSERT_TRUE(fragment.is_addressable());
+  EXPECT_EQ(kId, fragment.buffer_id());
+  const Fragment fragment_a = pool_a.GetFragment(fragment.descriptor());
+  EXPECT_TRUE(fragment_a.is_addressable());
+  pool_a.ReleaseFragment(fragment_a);
+  EXPECT_TRUE(pool_b.FreeLargeFragment(fragment));
+
+  EXPECT_FALSE(pool_a.IsRetirableBufferIdle(kId));
+  EXPECT_EQ(BufferPool::RetireResult::kInvalid, pool_a.TryRetireBuffer(kId));
+  EXPECT_FALSE(pool_b.RemoveRetiredBuffer(kId));
+  EXPECT_TRUE(pool_a.GetFragment(fragment.descriptor()).is_addressable());
+  EXPECT_TRUE(pool_b.AllocateLargeFragment(8192).is_addressable());
+}
+
 }  // namespace
 }  // namespace ipcz
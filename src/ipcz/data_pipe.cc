@@ -0,0 +1,431 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/data_pipe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/monitored_atomic.h"
+#include "ipcz/router.h"
+#include "ipcz/trap_event_dispatcher.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/numeric/bits.h"
+
+namespace ipcz {
+
+// The shared state of a data pipe, at the start of its memory region and
+// followed immediately by the ring's data. Each cursor sits on its own cache
+// line, since the producer and consumer each advance a different one.
+struct IPCZ_ALIGN(8) DataPipe::RingHeader {
+  // The consumer's read position. Its value is written only by the consumer,
+  // but the producer sets its monitor bit when it's waiting for room to write.
+  MonitoredAtomic<uint64_t> head;
+  uint8_t padding0[56];
+
+  // The producer's write position. Its value is written only by the producer,
+  // but the consumer sets its monitor bit when it's waiting for data.
+  MonitoredAtomic<uint64_t> tail;
+  uint8_t padding1[56];
+};
+
+DataPipe::DataPipe(Endpoint endpoint, Ref<Router> router)
+    : endpoint_(endpoint), router_(std::move(router)) {}
+
+DataPipe::~DataPipe() = default;
+
+// static
+DataPipe::Pair DataPipe::CreatePair(const IpczDriver& driver,
+                                    size_t capacity) {
+  static_assert(sizeof(RingHeader) == 128, "Invalid RingHeader size");
+  if (capacity > kMaxCapacity) {
+    return {};
+  }
+
+  capacity = absl::bit_ceil(std::max(capacity, kMinCapacity));
+  DriverMemory memory(driver, sizeof(RingHeader) + capacity);
+  if (!memory.is_valid()) {
+    return {};
+  }
+
+  DriverMemory consumer_memory = memory.Clone();
+  if (!consumer_memory.is_valid()) {
+    return {};
+  }
+
+  Router::Pair routers = Router::CreatePair();
+  auto producer =
+      MakeRefCounted<DataPipe>(Endpoint::kProducer, std::move(routers.first));
+  auto consumer =
+      MakeRefCounted<DataPipe>(Endpoint::kConsumer, std::move(routers.second));
+  if (!producer->SetMemory(std::move(memory))) {
+    producer->Close();
+    consumer->Close();
+    return {};
+  }
+
+  {
+    absl::MutexLock lock(&producer->mutex_);
+    producer->InitializeRegion();
+  }
+
+  if (!consumer->SetMemory(std::move(consumer_memory))) {
+    producer->Close();
+    consumer->Close();
+    return {};
+  }
+
+  return {std::move(producer), std::move(consumer)};
+}
+
+bool DataPipe::has_memory() {
+  absl::MutexLock lock(&mutex_);
+  return header_ != nullptr;
+}
+
+bool DataPipe::SetMemory(DriverMemory memory) {
+  if (!memory.is_valid() ||
+      memory.size() < sizeof(RingHeader) + kMinCapacity) {
+    return false;
+  }
+
+  DriverMemoryMapping mapping = memory.Map();
+  if (!mapping.is_valid() ||
+      reinterpret_cast<uintptr_t>(mapping.address()) % 8 != 0) {
+    return false;
+  }
+
+  absl::MutexLock lock(&mutex_);
+  if (header_) {
+    return false;
+  }
+
+  memory_ = std::move(memory);
+  mapping_ = std::move(mapping);
+  header_ = reinterpret_cast<RingHeader*>(mapping_.address());
+  data_ = mapping_.bytes().data() + sizeof(RingHeader);
+  capacity_ = absl::bit_floor(std::min<size_t>(
+      mapping_.bytes().size() - sizeof(RingHeader), kMaxCapacity));
+  position_ = is_producer() ? header_->tail.Query({.monitor = false}).value
+                            : header_->head.Query({.monitor = false}).value;
+  return true;
+}
+
+DriverObject DataPipe::TakeMemoryForTransmission(
+    const OperationContext& context) {
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&mutex_);
+  traps_.RemoveAll(context, dispatcher);
+  return memory_.TakeDriverObject();
+}
+
+IpczResult DataPipe::Close() {
+  {
+    TrapEventDispatcher dispatcher;
+    absl::MutexLock lock(&mutex_);
+    traps_.RemoveAll(OperationContext{OperationContext::kAPICall}, dispatcher);
+  }
+
+  // Closing the control route removes its doorbell trap, if installed, and
+  // notifies the peer of our closure.
+  router_->CloseRoute();
+  return IPCZ_RESULT_OK;
+}
+
+bool DataPipe::CanSendFrom(Router& sender) {
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!header_ || !memory_.is_valid() || two_phase_size_) {
+      return false;
+    }
+  }
+  return router_->CanSendFrom(sender);
+}
+
+IpczResult DataPipe::BeginWrite(IpczBeginWriteDataFlags flags,
+                                volatile void** data,
+                                size_t* num_bytes) {
+  ABSL_ASSERT(is_producer());
+  const bool peer_closed = router_->IsPeerClosed();
+  absl::MutexLock lock(&mutex_);
+  if (!header_) {
+    return IPCZ_RESULT_FAILED_PRECONDITION;
+  }
+  if (two_phase_size_) {
+    return IPCZ_RESULT_ALREADY_EXISTS;
+  }
+  if (peer_closed) {
+    return IPCZ_RESULT_NOT_FOUND;
+  }
+
+  // Pairs with the release in the consumer's UpdateValueAndResetMonitor(), so
+  // that the consumer is done reading any space we're about to reuse.
+  const uint64_t head = header_->head.Query({.monitor = false}).value;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t used = position_ - head;
+  if (used > capacity_) {
+    return IPCZ_RESULT_UNKNOWN;
+  }
+
+  const uint64_t offset = position_ & (capacity_ - 1);
+  const uint64_t contiguous_size =
+      std::min(capacity_ - used, capacity_ - offset);
+  const bool allow_partial =
+      (flags & IPCZ_BEGIN_WRITE_DATA_ALLOW_PARTIAL) != 0;
+  if (contiguous_size == 0 ||
+      (!allow_partial && contiguous_size < *num_bytes)) {
+    return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+  }
+
+  *data = &data_[offset];
+  *num_bytes = static_cast<size_t>(contiguous_size);
+  two_phase_size_ = contiguous_size;
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult DataPipe::EndWrite(size_t num_bytes_produced,
+                              IpczEndWriteDataFlags flags) {
+  ABSL_ASSERT(is_producer());
+  bool wake_consumer = false;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!two_phase_size_) {
+      return IPCZ_RESULT_FAILED_PRECONDITION;
+    }
+
+    if (!(flags & IPCZ_END_WRITE_DATA_ABORT)) {
+      if (num_bytes_produced > *two_phase_size_) {
+        return IPCZ_RESULT_INVALID_ARGUMENT;
+      }
+      if (num_bytes_produced > 0) {
+        position_ += num_bytes_produced;
+        wake_consumer = header_->tail.UpdateValueAndResetMonitor(position_);
+      }
+    }
+    two_phase_size_.reset();
+  }
+
+  if (wake_consumer) {
+    RingPeerDoorbell();
+  }
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult DataPipe::BeginRead(const volatile void** data, size_t* num_bytes) {
+  ABSL_ASSERT(!is_producer());
+
+  // Peer closure must be observed before the producer's cursor, since the
+  // producer may write more data just before closing.
+  const bool peer_closed = router_->IsPeerClosed();
+  absl::MutexLock lock(&mutex_);
+  if (!header_) {
+    return IPCZ_RESULT_FAILED_PRECONDITION;
+  }
+  if (two_phase_size_) {
+    return IPCZ_RESULT_ALREADY_EXISTS;
+  }
+
+  // Pairs with the release in the producer's UpdateValueAndResetMonitor(), so
+  // that all data up to `tail` is visible.
+  const uint64_t tail = header_->tail.Query({.monitor = false}).value;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t available = tail - position_;
+  if (available > capacity_) {
+    return IPCZ_RESULT_UNKNOWN;
+  }
+  if (available == 0) {
+    return peer_closed ? IPCZ_RESULT_NOT_FOUND : IPCZ_RESULT_UNAVAILABLE;
+  }
+
+  const uint64_t offset = position_ & (capacity_ - 1);
+  const uint64_t contiguous_size = std::min(available, capacity_ - offset);
+  *data = &data_[offset];
+  *num_bytes = static_cast<size_t>(contiguous_size);
+  two_phase_size_ = contiguous_size;
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult DataPipe::EndRead(size_t num_bytes_consumed,
+                             IpczEndReadDataFlags flags) {
+  ABSL_ASSERT(!is_producer());
+  bool wake_producer = false;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!two_phase_size_) {
+      return IPCZ_RESULT_FAILED_PRECONDITION;
+    }
+
+    if (!(flags & IPCZ_END_READ_DATA_ABORT)) {
+      if (num_bytes_consumed > *two_phase_size_) {
+        return IPCZ_RESULT_INVALID_ARGUMENT;
+      }
+      if (num_bytes_consumed > 0) {
+        position_ += num_bytes_consumed;
+        wake_producer = header_->head.UpdateValueAndResetMonitor(position_);
+      }
+    }
+    two_phase_size_.reset();
+  }
+
+  if (wake_producer) {
+    RingPeerDoorbell();
+  }
+  return IPCZ_RESULT_OK;
+}
+
+void DataPipe::QueryStatus(IpczPortalStatus& status) {
+  absl::MutexLock lock(&mutex_);
+  const size_t size = std::min(status.size, sizeof(IpczPortalStatus));
+  status = GetStatus(/*monitor=*/false);
+  status.size = size;
+}
+
+IpczResult DataPipe::Trap(const IpczTrapConditions& conditions,
+                          IpczTrapEventHandler handler,
+                          uintptr_t context,
+                          IpczTrapConditionFlags* satisfied_condition_flags,
+                          IpczPortalStatus* status) {
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&mutex_);
+
+  // Monitor the peer's cursor before evaluating the conditions, so that any
+  // later update from the peer is guaranteed to ring our doorbell.
+  const IpczPortalStatus current_status = GetStatus(/*monitor=*/true);
+  const IpczResult result =
+      traps_.Add(conditions, handler, context, /*is_persistent=*/false,
+                 current_status, satisfied_condition_flags, status);
+  if (result != IPCZ_RESULT_OK || doorbell_armed_ ||
+      (current_status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED)) {
+    return result;
+  }
+
+  if (!ArmDoorbell()) {
+    // A doorbell was already queued, possibly from an earlier monitored
+    // update. Drain it and re-evaluate; the new trap may fire immediately.
+    UpdateTraps(OperationContext{OperationContext::kAPICall}, dispatcher);
+  }
+  return IPCZ_RESULT_OK;
+}
+
+void DataPipe::InitializeRegion() {
+  ABSL_ASSERT(header_);
+  new (header_) RingHeader();
+  position_ = 0;
+}
+
+bool DataPipe::GetQueuedBytes(bool monitor, uint64_t& num_bytes) {
+  if (!header_) {
+    num_bytes = 0;
+    return true;
+  }
+
+  if (is_producer()) {
+    const uint64_t head = header_->head.Query({.monitor = monitor}).value;
+    num_bytes = position_ - head;
+  } else {
+    const uint64_t tail = header_->tail.Query({.monitor = monitor}).value;
+    num_bytes = tail - position_;
+  }
+  return num_bytes <= capacity_;
+}
+
+IpczPortalStatus DataPipe::GetStatus(bool monitor) {
+  IpczPortalStatus status = {.size = sizeof(status)};
+  const bool peer_closed = router_->IsPeerClosed();
+  uint64_t num_bytes;
+  if (!GetQueuedBytes(monitor, num_bytes)) {
+    // The peer has published a bogus cursor. Treat the pipe as broken.
+    status.flags = IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
+    return status;
+  }
+
+  if (is_producer()) {
+    status.num_remote_bytes = static_cast<size_t>(num_bytes);
+  } else {
+    status.num_local_bytes = static_cast<size_t>(num_bytes);
+  }
+
+  if (peer_closed) {
+    status.flags |= IPCZ_PORTAL_STATUS_PEER_CLOSED;
+    if (is_producer() || num_bytes == 0) {
+      status.flags |= IPCZ_PORTAL_STATUS_DEAD;
+    }
+  }
+  return status;
+}
+
+bool DataPipe::ArmDoorbell() {
+  ABSL_ASSERT(!doorbell_armed_);
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS | IPCZ_TRAP_PEER_CLOSED,
+      .min_local_parcels = 0,
+  };
+
+  // The trap owns a reference to this DataPipe, released by OnDoorbell().
+  Ref<DataPipe> self = WrapRefCounted(this);
+  const uintptr_t context = reinterpret_cast<uintptr_t>(self.get());
+  if (router_->Trap(conditions, &OnDoorbell, context, IPCZ_NO_FLAGS,
+                    nullptr, nullptr) != IPCZ_RESULT_OK) {
+    return false;
+  }
+
+  self.release();
+  doorbell_armed_ = true;
+  return true;
+}
+
+void DataPipe::UpdateTraps(const OperationContext& context,
+                           TrapEventDispatcher& dispatcher) {
+  for (;;) {
+    while (router_->Get(IPCZ_NO_FLAGS, nullptr, nullptr, nullptr, nullptr,
+                        nullptr) == IPCZ_RESULT_OK) {
+    }
+
+    if (traps_.empty()) {
+      return;
+    }
+
+    // Doorbells only tell us that the peer moved its cursor, so every update
+    // is treated as remote activity.
+    const IpczPortalStatus status = GetStatus(/*monitor=*/true);
+    if (status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED) {
+      // No further doorbells will arrive once the peer is gone.
+      traps_.NotifyPeerClosed(context, status, dispatcher);
+      return;
+    }
+
+    traps_.NotifyRemoteActivity(context, status, dispatcher);
+    if (traps_.empty() || ArmDoorbell()) {
+      return;
+    }
+  }
+}
+
+void DataPipe::RingPeerDoorbell() {
+  router_->Put({}, {}, nullptr);
+}
+
+// static
+void IPCZ_API DataPipe::OnDoorbell(const IpczTrapEvent* event) {
+  Ref<DataPipe> pipe = AdoptRef(reinterpret_cast<DataPipe*>(event->context));
+  if (event->condition_flags & IPCZ_TRAP_REMOVED) {
+    return;
+  }
+
+  const OperationContext context{
+      (event->condition_flags & IPCZ_TRAP_WITHIN_API_CALL)
+          ? OperationContext::kAPICall
+          : OperationContext::kTransportNotification};
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&pipe->mutex_);
+  pipe->doorbell_armed_ = false;
+  pipe->UpdateTraps(context, dispatcher);
+}
+
+}  // namespace ipcz
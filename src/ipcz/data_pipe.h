@@ -0,0 +1,175 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_DATA_PIPE_H_
+#define IPCZ_SRC_IPCZ_DATA_PIPE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "ipcz/api_object.h"
+#include "ipcz/driver_memory.h"
+#include "ipcz/driver_memory_mapping.h"
+#include "ipcz/driver_object.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/operation_context.h"
+#include "ipcz/trap_set.h"
+#include "third_party/abseil-cpp/absl/base/thread_annotations.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+
+class Router;
+class TrapEventDispatcher;
+
+// One endpoint of a data pipe: a unidirectional byte stream between a producer
+// and a consumer, backed by a ring buffer in a dedicated shared memory region.
+// Each endpoint maps the region and advances its own cursor there, so bytes
+// move between nodes without any per-write message.
+//
+// The endpoints are also connected by a private control route. A data pipe
+// endpoint is transferred by extending this route to the destination node
+// just like a portal, along with a handle to the shared region. The route
+// also carries empty "doorbell" parcels: an endpoint which has traps to
+// satisfy sets the monitor bit on its peer's cursor, and the peer puts a
+// doorbell parcel once its next update resets that bit. Peer closure is
+// likewise observed through the control route.
+class DataPipe : public APIObjectImpl<DataPipe, APIObject::kDataPipe> {
+ public:
+  enum class Endpoint {
+    kProducer,
+    kConsumer,
+  };
+
+  using Pair = std::pair<Ref<DataPipe>, Ref<DataPipe>>;
+
+  // Bounds on the capacity of a data pipe's ring buffer. Requested capacities
+  // are rounded up to a power of two no smaller than kMinCapacity.
+  static constexpr size_t kDefaultCapacity = 64 * 1024;
+  static constexpr size_t kMinCapacity = 4096;
+  static constexpr size_t kMaxCapacity = 256 * 1024 * 1024;
+
+  // Constructs an endpoint which uses `router` as its control route. The
+  // endpoint is unusable until given its shared memory by SetMemory().
+  DataPipe(Endpoint endpoint, Ref<Router> router);
+
+  // Creates a new producer and consumer pair, sharing a new ring buffer with a
+  // capacity of at least `capacity` bytes. The ring is allocated through
+  // `driver`. Returns a pair of null references on failure.
+  static Pair CreatePair(const IpczDriver& driver, size_t capacity);
+
+  Endpoint endpoint() const { return endpoint_; }
+  bool is_producer() const { return endpoint_ == Endpoint::kProducer; }
+  Router& router() const { return *router_; }
+
+  // Indicates whether this endpoint has been given its shared memory yet.
+  bool has_memory();
+
+  // Maps `memory` as this endpoint's ring buffer. Returns false if the region
+  // can't be mapped or is too small to hold a ring of kMinCapacity bytes.
+  bool SetMemory(DriverMemory memory);
+
+  // Prepares this endpoint for transmission to another node: removes any
+  // installed traps, and relinquishes the driver object for the shared memory
+  // so that it can be transmitted along with the control route.
+  DriverObject TakeMemoryForTransmission(const OperationContext& context);
+
+  // APIObject:
+  IpczResult Close() override;
+  bool CanSendFrom(Router& sender) override;
+
+  // Two-phase write and read operations, implementing the BeginWriteData(),
+  // EndWriteData(), BeginReadData() and EndReadData() APIs. See their
+  // descriptions in ipcz.h for details.
+  IpczResult BeginWrite(IpczBeginWriteDataFlags flags,
+                        volatile void** data,
+                        size_t* num_bytes);
+  IpczResult EndWrite(size_t num_bytes_produced, IpczEndWriteDataFlags flags);
+  IpczResult BeginRead(const volatile void** data, size_t* num_bytes);
+  IpczResult EndRead(size_t num_bytes_consumed, IpczEndReadDataFlags flags);
+
+  // Fills in an IpczPortalStatus corresponding to the current state of this
+  // endpoint. See QueryPortalStatus() in ipcz.h for how data pipe endpoints
+  // report their status.
+  void QueryStatus(IpczPortalStatus& status);
+
+  // Installs a trap on this endpoint, implementing the Trap() API for data
+  // pipe handles.
+  IpczResult Trap(const IpczTrapConditions& conditions,
+                  IpczTrapEventHandler handler,
+                  uintptr_t context,
+                  IpczTrapConditionFlags* satisfied_condition_flags,
+                  IpczPortalStatus* status);
+
+ private:
+  struct RingHeader;
+
+  ~DataPipe() override;
+
+  // Initializes the shared state of a newly allocated ring.
+  void InitializeRegion() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Computes the number of bytes written to the ring and not yet consumed.
+  // If `monitor` is true, this also sets the monitor bit on the peer's cursor
+  // so that its next update rings our doorbell. Returns false if the peer has
+  // published an invalid cursor.
+  bool GetQueuedBytes(bool monitor, uint64_t& num_bytes)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  IpczPortalStatus GetStatus(bool monitor)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Arms a trap on the control route to observe the next doorbell or peer
+  // closure. Returns false if the trap's conditions were already met, in which
+  // case the caller must re-evaluate and try again.
+  bool ArmDoorbell() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Discards any doorbell parcels queued on the control route, re-evaluates
+  // this endpoint's traps, and re-arms the doorbell if any traps remain.
+  void UpdateTraps(const OperationContext& context,
+                   TrapEventDispatcher& dispatcher)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Puts a doorbell parcel on the control route to wake the peer.
+  void RingPeerDoorbell();
+
+  // Trap event handler for the control route's doorbell trap. Its context is
+  // a reference to the DataPipe, owned by the trap.
+  static void IPCZ_API OnDoorbell(const IpczTrapEvent* event);
+
+  const Endpoint endpoint_;
+  const Ref<Router> router_;
+
+  absl::Mutex mutex_;
+
+  // The shared memory region containing the ring, and this endpoint's
+  // mapping of it. `memory_` is relinquished when the endpoint is transmitted
+  // to another node, but the mapping persists until destruction.
+  DriverMemory memory_ ABSL_GUARDED_BY(mutex_);
+  DriverMemoryMapping mapping_ ABSL_GUARDED_BY(mutex_);
+  RingHeader* header_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  volatile uint8_t* data_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  uint64_t capacity_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // This endpoint's own cursor: the write position for a producer, or the
+  // read position for a consumer. Only this endpoint ever advances it, so the
+  // copy in shared memory is only read back when the endpoint is reconstituted
+  // on another node.
+  uint64_t position_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // The size of the range exposed by an in-progress two-phase operation.
+  std::optional<uint64_t> two_phase_size_ ABSL_GUARDED_BY(mutex_);
+
+  // Indicates whether the control route's doorbell trap is installed.
+  bool doorbell_armed_ ABSL_GUARDED_BY(mutex_) = false;
+
+  TrapSet traps_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_DATA_PIPE_H_
@@ -11,6 +11,7 @@
 #include "ipcz/ipcz.h"
 #include "ipcz/message.h"
 #include "ipcz/node.h"
+#include "ipcz/trap_event_dispatcher.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
@@ -127,6 +128,10 @@ bool DriverTransport::Notify(const RawMessage& message) {
   // may drop their own last reference. Keep a reference here to ensure this
   // Listener remains alive through the extent of its notification.
   Ref<Listener> listener = listener_;
+
+  // A single notification may carry many parcels for the same portal, so trap
+  // events are coalesced until it's fully processed.
+  TrapEventDispatcher::Batch batch;
   return listener->OnTransportMessage(message, *this);
 }
 
@@ -61,6 +61,26 @@ void Features::SetFeatureEnabled(IpczFeature feature, bool enabled) {
       set_bit(kMemV2Bit, enabled);
       break;
 
+    case IPCZ_FEATURE_WIDE_BLOCK_ALLOCATORS:
+      set_bit(kWideBlockAllocatorsBit, enabled);
+      break;
+
+    case IPCZ_FEATURE_MESSAGE_RINGS:
+      set_bit(kMessageRingsBit, enabled);
+      break;
+
+    case IPCZ_FEATURE_REMOTE_QUEUE_STATE:
+      set_bit(kRemoteQueueStateBit, enabled);
+      break;
+
+    case IPCZ_FEATURE_BATCHED_PARCELS:
+      set_bit(kBatchedParcelsBit, enabled);
+      break;
+
+    case IPCZ_FEATURE_EMBEDDED_SUBPARCELS:
+      set_bit(kEmbeddedSubparcelsBit, enabled);
+      break;
+
     default:
       break;
   }
@@ -28,6 +28,11 @@ struct Features {
   static Features FromNodeOptions(const IpczCreateNodeOptions* options);
 
   bool mem_v2() const { return bit(kMemV2Bit); }
+  bool wide_block_allocators() const { return bit(kWideBlockAllocatorsBit); }
+  bool message_rings() const { return bit(kMessageRingsBit); }
+  bool remote_queue_state() const { return bit(kRemoteQueueStateBit); }
+  bool batched_parcels() const { return bit(kBatchedParcelsBit); }
+  bool embedded_subparcels() const { return bit(kEmbeddedSubparcelsBit); }
 
   // Serializes this object into an internal ipcz message and returns the offset
   // of the encoded data within the message, to be assigned to a field value.
@@ -43,6 +48,11 @@ struct Features {
 
   // Internal bit indices for different features.
   static constexpr BitIndex kMemV2Bit{0, 0};
+  static constexpr BitIndex kWideBlockAllocatorsBit{0, 1};
+  static constexpr BitIndex kMessageRingsBit{0, 2};
+  static constexpr BitIndex kRemoteQueueStateBit{0, 3};
+  static constexpr BitIndex kBatchedParcelsBit{0, 4};
+  static constexpr BitIndex kEmbeddedSubparcelsBit{0, 5};
 
   bool bit(BitIndex bit) const {
     return bitfield_values[bit.first] & (1ull << bit.second);
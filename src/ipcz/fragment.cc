@@ -16,15 +16,21 @@ namespace ipcz {
 // static
 Fragment Fragment::MappedFromDescriptor(const FragmentDescriptor& descriptor,
                                         DriverMemoryMapping& mapping) {
+  return MappedFromDescriptor(descriptor, mapping.bytes());
+}
+
+// static
+Fragment Fragment::MappedFromDescriptor(const FragmentDescriptor& descriptor,
+                                        absl::Span<uint8_t> mapped_bytes) {
   if (descriptor.is_null()) {
     return {};
   }
 
   const uint32_t end = SaturatedAdd(descriptor.offset(), descriptor.size());
-  if (end > mapping.bytes().size()) {
+  if (end > mapped_bytes.size()) {
     return {};
   }
-  return Fragment{descriptor, mapping.address_at(descriptor.offset())};
+  return Fragment{descriptor, mapped_bytes.data() + descriptor.offset()};
 }
 
 // static
@@ -32,6 +32,11 @@ struct Fragment {
   static Fragment MappedFromDescriptor(const FragmentDescriptor& descriptor,
                                        DriverMemoryMapping& mapping);
 
+  // Same as above, but given only the span of mapped bytes for the buffer
+  // identified by `descriptor`.
+  static Fragment MappedFromDescriptor(const FragmentDescriptor& descriptor,
+                                       absl::Span<uint8_t> mapped_bytes);
+
   // Returns a pending Fragment corresponding to `descriptor`.
   static Fragment PendingFromDescriptor(const FragmentDescriptor& descriptor);
 
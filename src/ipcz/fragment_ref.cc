@@ -37,7 +37,13 @@ void GenericFragmentRef::reset() {
   }
 
   auto* ref_counted = static_cast<RefCountedFragment*>(fragment.address());
-  if (ref_counted->ReleaseRef() > 1 || !memory) {
+  if (!memory) {
+    ref_counted->ReleaseRef();
+    return;
+  }
+
+  if (ref_counted->ReleaseRef() > 1) {
+    memory->ReleaseFragment(fragment);
     return;
   }
 
@@ -47,8 +53,20 @@ void GenericFragmentRef::reset() {
 Fragment GenericFragmentRef::release() {
   Fragment fragment;
   std::swap(fragment_, fragment);
+  if (memory_ && fragment.is_addressable()) {
+    // The ref itself is transferred to the caller, but this object's hold on
+    // the fragment's buffer is not.
+    memory_->ReleaseFragment(fragment);
+  }
   memory_.reset();
   return fragment;
 }
 
+void GenericFragmentRef::AddRef() {
+  AsRefCountedFragment()->AddRef();
+  if (memory_) {
+    memory_->AddFragmentHold(fragment_);
+  }
+}
+
 }  // namespace ipcz::internal
@@ -52,6 +52,11 @@ class GenericFragmentRef {
     return static_cast<RefCountedFragment*>(fragment_.address());
   }
 
+  // Adds a new ref to the underlying RefCountedFragment, along with a hold on
+  // its buffer if this FragmentRef is managed. Every managed ref holds its
+  // buffer until it's either reset or released.
+  void AddRef();
+
   // The NodeLinkMemory who ultimately owns this fragment's memory. May be null
   // if the FragmentRef is unmanaged.
   Ref<NodeLinkMemory> memory_;
@@ -107,7 +112,7 @@ class FragmentRef : public internal::GenericFragmentRef {
       : GenericFragmentRef(other.memory(), other.fragment()) {
     if (!fragment_.is_null()) {
       ABSL_ASSERT(fragment_.is_addressable());
-      AsRefCountedFragment()->AddRef();
+      AddRef();
     }
   }
 
@@ -122,7 +127,7 @@ class FragmentRef : public internal::GenericFragmentRef {
     fragment_ = other.fragment();
     if (!fragment_.is_null()) {
       ABSL_ASSERT(fragment_.is_addressable());
-      AsRefCountedFragment()->AddRef();
+      AddRef();
     }
     return *this;
   }
@@ -31,6 +31,14 @@ enum class HandleType : uint32_t {
   // and the main parcel is not available to the application until it all
   // subparcels are collected internally.
   kBoxedSubparcel = 3,
+
+  // A data pipe endpoint consumes the next available RouterDescriptor for its
+  // control portal, along with the next available element in the parcel's
+  // DriverObject array for its shared memory region. If the parcel's driver
+  // objects are relayed separately, the DriverObject array is empty and the
+  // region is attached once the relayed half of the parcel arrives.
+  kDataPipeProducer = 4,
+  kDataPipeConsumer = 5,
 };
 
 }  // namespace ipcz
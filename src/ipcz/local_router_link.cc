@@ -11,6 +11,7 @@
 #include "ipcz/link_type.h"
 #include "ipcz/router.h"
 #include "ipcz/router_link_state.h"
+#include "ipcz/spsc_parcel_queue.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "util/ref_counted.h"
 
@@ -38,6 +39,12 @@ class LocalRouterLink::SharedState
 
   RouterLinkState& link_state() { return link_state_; }
 
+  // Returns the queue of fast path parcels destined for the Router on the given
+  // `side` of this link.
+  SpscParcelQueue& GetFastPathQueue(LinkSide side) {
+    return side.is_side_a() ? fast_path_queue_a_ : fast_path_queue_b_;
+  }
+
   // Returns the Router on the given `side` of this link. Note that this may
   // return null if the Router in question has been deactivated, for example due
   // to the application closing the Router's controlling portal.
@@ -74,6 +81,8 @@ class LocalRouterLink::SharedState
 
   absl::Mutex mutex_;
   RouterLinkState link_state_;
+  SpscParcelQueue fast_path_queue_a_;
+  SpscParcelQueue fast_path_queue_b_;
   Ref<Router> router_a_ ABSL_GUARDED_BY(mutex_);
   Ref<Router> router_b_ ABSL_GUARDED_BY(mutex_);
 };
@@ -107,6 +116,14 @@ void LocalRouterLink::WaitForLinkStateAsync(std::function<void()> callback) {
   callback();
 }
 
+AtomicQueueState* LocalRouterLink::GetLocalQueueState() {
+  return &state_->link_state().GetQueueState(side_);
+}
+
+AtomicQueueState* LocalRouterLink::GetPeerQueueState() {
+  return &state_->link_state().GetQueueState(side_.opposite());
+}
+
 Ref<Router> LocalRouterLink::GetLocalPeer() {
   return state_->GetRouter(side_.opposite());
 }
@@ -123,6 +140,14 @@ void LocalRouterLink::AllocateParcelData(size_t num_bytes,
 
 void LocalRouterLink::AcceptParcel(const OperationContext& context,
                                    std::unique_ptr<Parcel> parcel) {
+  // While the receiving Router allows it, parcels on a central link bypass the
+  // receiver's lock entirely and wait on the link until the receiver picks
+  // them up. The fast path is never used for bridge links.
+  if (state_->type() == LinkType::kCentral &&
+      state_->GetFastPathQueue(side_.opposite()).TryPush(parcel)) {
+    return;
+  }
+
   if (Ref<Router> receiver = state_->GetRouter(side_.opposite())) {
     if (state_->type() == LinkType::kCentral) {
       receiver->AcceptInboundParcel(context, std::move(parcel));
@@ -133,6 +158,33 @@ void LocalRouterLink::AcceptParcel(const OperationContext& context,
   }
 }
 
+void LocalRouterLink::AcceptParcels(
+    const OperationContext& context,
+    absl::Span<std::unique_ptr<Parcel>> parcels) {
+  for (std::unique_ptr<Parcel>& parcel : parcels) {
+    AcceptParcel(context, std::move(parcel));
+  }
+}
+
+void LocalRouterLink::SetFastPathEnabled(bool enabled) {
+  SpscParcelQueue& queue = state_->GetFastPathQueue(side_);
+  if (enabled) {
+    queue.Enable();
+  } else {
+    queue.Disable();
+  }
+}
+
+std::unique_ptr<Parcel> LocalRouterLink::TakeFastPathParcel() {
+  return state_->GetFastPathQueue(side_).Pop();
+}
+
+void LocalRouterLink::NotifyDataConsumed(const OperationContext& context) {
+  if (Ref<Router> receiver = state_->GetRouter(side_.opposite())) {
+    receiver->NotifyPeerConsumedData(context);
+  }
+}
+
 void LocalRouterLink::AcceptRouteClosure(const OperationContext& context,
                                          SequenceNumber sequence_length) {
   if (Ref<Router> receiver = state_->GetRouter(side_.opposite())) {
@@ -225,6 +277,8 @@ void LocalRouterLink::StopProxyingToLocalPeer(
 }
 
 void LocalRouterLink::Deactivate() {
+  // Nothing on this side will retrieve fast path parcels anymore.
+  state_->GetFastPathQueue(side_).Disable();
   state_->Deactivate(side_);
 }
 
@@ -16,6 +16,11 @@ struct RouterLinkState;
 
 // Local link between two Routers on the same node. This class is thread-safe.
 //
+// Once a central link is stable and the Routers on either end are terminal,
+// each Router may enable a lock-free fast path for its own inbound parcels.
+// These are then queued on the link itself rather than being passed to the
+// receiving Router, which picks them up as needed. See SpscParcelQueue.
+//
 // NOTE: This implementation must take caution when calling into any Router. See
 // note on RouterLink's own class documentation.
 class LocalRouterLink : public RouterLink {
@@ -36,6 +41,8 @@ class LocalRouterLink : public RouterLink {
   LinkType GetType() const override;
   RouterLinkState* GetLinkState() const override;
   void WaitForLinkStateAsync(std::function<void()> callback) override;
+  AtomicQueueState* GetLocalQueueState() override;
+  AtomicQueueState* GetPeerQueueState() override;
   Ref<Router> GetLocalPeer() override;
   RemoteRouterLink* AsRemoteRouterLink() override;
   void AllocateParcelData(size_t num_bytes,
@@ -43,6 +50,11 @@ class LocalRouterLink : public RouterLink {
                           Parcel& parcel) override;
   void AcceptParcel(const OperationContext& context,
                     std::unique_ptr<Parcel> parcel) override;
+  void AcceptParcels(const OperationContext& context,
+                     absl::Span<std::unique_ptr<Parcel>> parcels) override;
+  void SetFastPathEnabled(bool enabled) override;
+  std::unique_ptr<Parcel> TakeFastPathParcel() override;
+  void NotifyDataConsumed(const OperationContext& context) override;
   void AcceptRouteClosure(const OperationContext& context,
                           SequenceNumber sequence_length) override;
   void AcceptRouteDisconnected(const OperationContext& context) override;
@@ -0,0 +1,43 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/memory_profile.h"
+
+#include "ipcz/ipcz.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+MemoryProfile::MemoryProfile() = default;
+
+MemoryProfile::MemoryProfile(const MemoryProfile&) = default;
+
+MemoryProfile& MemoryProfile::operator=(const MemoryProfile&) = default;
+
+MemoryProfile::~MemoryProfile() = default;
+
+// static
+MemoryProfile MemoryProfile::FromNodeOptions(
+    const IpczCreateNodeOptions* options) {
+  MemoryProfile profile;
+  if (!options) {
+    return profile;
+  }
+
+  profile.primary_buffer_size_ = options->primary_buffer_size;
+  if (!options->initial_memory_capacities) {
+    return profile;
+  }
+
+  for (const IpczMemoryCapacity& entry :
+       absl::MakeSpan(options->initial_memory_capacities,
+                      options->num_initial_memory_capacities)) {
+    if (entry.fragment_size > 0 && entry.capacity > 0) {
+      profile.capacities_.push_back(entry);
+    }
+  }
+  return profile;
+}
+
+}  // namespace ipcz
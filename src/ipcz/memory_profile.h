@@ -0,0 +1,48 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_MEMORY_PROFILE_H_
+#define IPCZ_SRC_IPCZ_MEMORY_PROFILE_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+// A node's memory profile describes how much shared memory capacity to
+// provision for each new NodeLink before any of it is needed. See
+// `initial_memory_capacities` and `primary_buffer_size` in
+// IpczCreateNodeOptions.
+class MemoryProfile {
+ public:
+  MemoryProfile();
+  MemoryProfile(const MemoryProfile&);
+  MemoryProfile& operator=(const MemoryProfile&);
+  ~MemoryProfile();
+
+  // Extracts a MemoryProfile from node options. Unlike the options themselves,
+  // the returned object owns a copy of all relevant data.
+  static MemoryProfile FromNodeOptions(const IpczCreateNodeOptions* options);
+
+  // The requested size of each primary buffer allocated for a new NodeLink, or
+  // zero if the default size should be used.
+  size_t primary_buffer_size() const { return primary_buffer_size_; }
+
+  // The minimum capacity requested for each fragment size. Entries with a zero
+  // fragment size or zero capacity are omitted.
+  absl::Span<const IpczMemoryCapacity> capacities() const {
+    return absl::MakeSpan(capacities_);
+  }
+
+ private:
+  size_t primary_buffer_size_ = 0;
+  std::vector<IpczMemoryCapacity> capacities_;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_MEMORY_PROFILE_H_
@@ -19,7 +19,10 @@
 // Note that listeners separate message receipt (OnMessage) from message
 // dispatch (DispatchMessage). By default, OnMessage() simply forwards to
 // DispatchMessage(), but the split allows subclasses to override this behavior,
-// for example to defer dispatch in some cases.
+// for example to defer dispatch in some cases. Subclasses which need to order
+// messages before they're even deserialized may also override
+// OnTransportMessage(), as long as every raw message is eventually forwarded to
+// the base implementation.
 //
 // All raw transport messages are fully validated and deserialized before
 // hitting OnMessage(), so implementations do not need to do any protocol-level
@@ -35,9 +38,11 @@
     virtual bool DispatchMessage(Message& message);
 
 #define IPCZ_MSG_END_INTERFACE()                                      \
- private:                                                             \
+ protected:                                                           \
   bool OnTransportMessage(const DriverTransport::RawMessage& message, \
-                          const DriverTransport& transport) final;    \
+                          const DriverTransport& transport) override; \
+                                                                      \
+ private:                                                             \
   void OnTransportError() override {}                                 \
   }                                                                   \
   ;
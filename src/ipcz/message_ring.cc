@@ -0,0 +1,230 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/message_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/monitored_atomic.h"
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/numeric/bits.h"
+
+namespace ipcz {
+
+namespace {
+
+// Flag set on records which only pad out the end of the ring, so that the next
+// record can start at offset zero rather than wrapping around.
+constexpr uint32_t kPaddingRecordFlag = 1;
+
+constexpr uint64_t AlignRecordSize(uint64_t size) {
+  return (size + 7) & ~uint64_t{7};
+}
+
+}  // namespace
+
+// The shared state of a MessageRing, at the start of its region. Each field
+// sits on its own cache line, since the producer and consumer each write to a
+// different one.
+struct IPCZ_ALIGN(8) MessageRing::Header {
+  // The consumer's read position. Written only by the consumer.
+  std::atomic<uint64_t> head;
+  uint8_t padding0[56];
+
+  // The producer's write position. Its value is written only by the producer,
+  // but the consumer sets its monitor bit when going idle. The producer resets
+  // the bit with its next update and takes responsibility for waking the
+  // consumer.
+  MonitoredAtomic<uint64_t> tail;
+  uint8_t padding1[56];
+};
+
+// Precedes every message within the ring. Records are always 8-byte aligned.
+struct IPCZ_ALIGN(8) MessageRing::RecordHeader {
+  // The size of the message following this header, excluding any padding.
+  uint32_t size;
+
+  // Zero or kPaddingRecordFlag.
+  uint32_t flags;
+};
+
+MessageRing::MessageRing() = default;
+
+MessageRing::MessageRing(absl::Span<uint8_t> region) {
+  static_assert(sizeof(Header) == 128, "Invalid Header size");
+  static_assert(sizeof(RecordHeader) == 8, "Invalid RecordHeader size");
+  if (region.size() < kMinRegionSize) {
+    return;
+  }
+
+  ABSL_ASSERT(reinterpret_cast<uintptr_t>(region.data()) % 8 == 0);
+  auto* header = reinterpret_cast<Header*>(region.data());
+  const uint32_t capacity = static_cast<uint32_t>(absl::bit_floor(
+      std::min<size_t>(region.size() - sizeof(Header),
+                       std::numeric_limits<int32_t>::max())));
+  const uint64_t tail = header->tail.Query({.monitor = false}).value;
+  const uint64_t head = header->head.load(std::memory_order_relaxed);
+  if (tail % 8 != 0 || head % 8 != 0 || tail < head ||
+      tail - head > capacity) {
+    // The region may be shared with a misbehaving node. Leave the ring invalid
+    // rather than trust positions that could lead outside of it.
+    return;
+  }
+
+  header_ = header;
+  data_ = region.data() + sizeof(Header);
+  capacity_ = capacity;
+  max_message_size_ = capacity_ / 4 - sizeof(RecordHeader);
+  tail_ = tail;
+  head_ = head;
+}
+
+MessageRing::MessageRing(const MessageRing&) = default;
+
+MessageRing& MessageRing::operator=(const MessageRing&) = default;
+
+MessageRing::~MessageRing() = default;
+
+void MessageRing::InitializeRegion() const {
+  ABSL_ASSERT(is_valid());
+  header_->head.store(0, std::memory_order_relaxed);
+  new (&header_->tail) MonitoredAtomic<uint64_t>(0);
+  header_->tail.Query({.monitor = true});
+}
+
+bool MessageRing::Push(absl::Span<const uint8_t> message,
+                       bool& wake_consumer) {
+  ABSL_ASSERT(is_valid());
+  wake_consumer = false;
+  if (message.size() > max_message_size_) {
+    return false;
+  }
+
+  const uint64_t used = tail_ - header_->head.load(std::memory_order_acquire);
+  if (used > capacity_) {
+    // The consumer has published a bogus position.
+    return false;
+  }
+
+  const uint32_t message_size = static_cast<uint32_t>(message.size());
+  const uint32_t record_size = static_cast<uint32_t>(
+      sizeof(RecordHeader) + AlignRecordSize(message_size));
+  uint32_t offset = static_cast<uint32_t>(tail_ & (capacity_ - 1));
+  const uint32_t contiguous_size = capacity_ - offset;
+  if (offset % 8 != 0 || contiguous_size < sizeof(RecordHeader)) {
+    // Unreachable unless our own position is corrupt, but a record header must
+    // never be written past the end of the ring.
+    return false;
+  }
+
+  const uint32_t padding_size =
+      record_size > contiguous_size ? contiguous_size : 0;
+  if (padding_size + record_size > capacity_ - used) {
+    return false;
+  }
+
+  if (padding_size) {
+    const RecordHeader padding = {
+        .size = padding_size - static_cast<uint32_t>(sizeof(RecordHeader)),
+        .flags = kPaddingRecordFlag,
+    };
+    memcpy(&data_[offset], &padding, sizeof(padding));
+    offset = 0;
+  }
+
+  const RecordHeader record = {.size = message_size, .flags = 0};
+  memcpy(&data_[offset], &record, sizeof(record));
+  memcpy(&data_[offset + sizeof(record)], message.data(), message.size());
+  tail_ += padding_size + record_size;
+
+  // This update and the consumer's monitoring in SetConsumerIdle() are both
+  // atomic read-modify-write operations on `tail`, so either the consumer sees
+  // this message before going idle, or we see that it's idle and wake it.
+  wake_consumer = header_->tail.UpdateValueAndResetMonitor(tail_);
+  return true;
+}
+
+bool MessageRing::Peek(absl::Span<const uint8_t>& message) {
+  ABSL_ASSERT(is_valid());
+  message = {};
+  peeked_record_size_ = 0;
+
+  // Pairs with the release in UpdateValueAndResetMonitor(), so that every
+  // record up to `tail` is visible.
+  const uint64_t tail = header_->tail.Query({.monitor = false}).value;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  for (;;) {
+    const uint64_t available = tail - head_;
+    if (available == 0) {
+      return true;
+    }
+    if (available > capacity_ || available % 8 != 0) {
+      return false;
+    }
+
+    // Copy the record header out of shared memory before validating it.
+    const uint32_t offset = static_cast<uint32_t>(head_ & (capacity_ - 1));
+    const uint32_t contiguous_size = capacity_ - offset;
+    if (offset % 8 != 0 || contiguous_size < sizeof(RecordHeader)) {
+      return false;
+    }
+
+    RecordHeader record;
+    memcpy(&record, &data_[offset], sizeof(record));
+    if (record.size > contiguous_size - sizeof(RecordHeader)) {
+      return false;
+    }
+
+    // Computed in 64 bits so that no `record.size` can wrap around.
+    const uint64_t record_size =
+        sizeof(RecordHeader) + AlignRecordSize(record.size);
+    if (record_size > available || record_size > contiguous_size) {
+      return false;
+    }
+
+    if (record.flags == kPaddingRecordFlag) {
+      if (record_size != contiguous_size) {
+        return false;
+      }
+      head_ += record_size;
+      header_->head.store(head_, std::memory_order_release);
+      continue;
+    }
+
+    if (record.flags != 0) {
+      return false;
+    }
+
+    peeked_record_size_ = static_cast<uint32_t>(record_size);
+    message = absl::MakeSpan(&data_[offset + sizeof(record)], record.size);
+    return true;
+  }
+}
+
+void MessageRing::Pop() {
+  ABSL_ASSERT(peeked_record_size_ > 0);
+  head_ += peeked_record_size_;
+  peeked_record_size_ = 0;
+  header_->head.store(head_, std::memory_order_release);
+}
+
+bool MessageRing::SetConsumerIdle() {
+  ABSL_ASSERT(is_valid());
+  if (header_->tail.Query({.monitor = false}).value != head_) {
+    return false;
+  }
+
+  // If a message arrives concurrently, the monitor bit may still be set on the
+  // new tail position. That only costs the producer a redundant wake-up.
+  return header_->tail.Query({.monitor = true}).value == head_;
+}
+
+}  // namespace ipcz
@@ -0,0 +1,107 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_MESSAGE_RING_H_
+#define IPCZ_SRC_IPCZ_MESSAGE_RING_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+// MessageRing is a single-producer, single-consumer queue of variable-length
+// messages within a region of shared memory. A NodeLink may use one in each
+// direction to convey small messages without a driver transmission per
+// message.
+//
+// Each side of the ring keeps its own position locally and only publishes it
+// through the shared region. The positions and record headers which are read
+// from the region are validated before use, so a misbehaving peer can't cause
+// out-of-bounds access.
+//
+// The ring also tracks whether its consumer is idle, meaning it has consumed
+// every message and is not expecting to look for more until prompted. The
+// producer uses this to decide when a message needs to be accompanied by some
+// out-of-band wake-up signal, such as a driver transmission. While the consumer
+// is actively draining the ring, any number of messages may be pushed without
+// waking it again. Idleness is tracked by the monitor bit of the producer's
+// MonitoredAtomic position, so it costs the producer no additional shared
+// memory access.
+class MessageRing {
+ public:
+  // The smallest region which can hold a usable MessageRing.
+  static constexpr size_t kMinRegionSize = 4096;
+
+  // Constructs an invalid MessageRing which cannot be used.
+  MessageRing();
+
+  // Constructs a MessageRing over `region`, which must be 8-byte aligned. Note
+  // that this DOES NOT initialize the region. InitializeRegion() must be called
+  // exactly once on some MessageRing for the region before it's shared with
+  // the producer or consumer. If `region` is smaller than kMinRegionSize, or if
+  // the positions currently stored in it are misaligned or inconsistent, the
+  // MessageRing is invalid.
+  explicit MessageRing(absl::Span<uint8_t> region);
+
+  MessageRing(const MessageRing&);
+  MessageRing& operator=(const MessageRing&);
+  ~MessageRing();
+
+  bool is_valid() const { return header_ != nullptr; }
+
+  // The largest message which can be pushed onto this ring.
+  size_t max_message_size() const { return max_message_size_; }
+
+  // Performs a one-time initialization of the managed region, leaving the ring
+  // empty and its consumer idle.
+  void InitializeRegion() const;
+
+  // Producer: copies `message` into the ring. Returns false if the message is
+  // too large or there is not enough free space in the ring. On success,
+  // `wake_consumer` is set to true if the consumer was idle, in which case the
+  // caller is responsible for signaling the consumer to resume.
+  bool Push(absl::Span<const uint8_t> message, bool& wake_consumer);
+
+  // Consumer: exposes the next message in the ring as `message`, or leaves it
+  // empty if the ring is empty. Returns false if the ring's contents are
+  // invalid. A non-empty `message` remains valid until Pop() is called, but its
+  // contents reside in shared memory and may be modified by a misbehaving
+  // producer at any time.
+  bool Peek(absl::Span<const uint8_t>& message);
+
+  // Consumer: frees the message most recently exposed by Peek().
+  void Pop();
+
+  // Consumer: indicates that the consumer has run out of messages and will not
+  // look for more until it's woken. Returns true if the ring is still empty. If
+  // any messages arrived concurrently, this returns false and the consumer
+  // remains active. The consumer becomes active again as soon as the producer
+  // observes that it must be woken.
+  bool SetConsumerIdle();
+
+ private:
+  struct Header;
+  struct RecordHeader;
+
+  Header* header_ = nullptr;
+  uint8_t* data_ = nullptr;
+  uint32_t capacity_ = 0;
+  size_t max_message_size_ = 0;
+
+  // The producer's next write position, or the consumer's next read position.
+  // Positions increase monotonically and are mapped into the ring by masking
+  // with `capacity_ - 1`. They're 64 bits wide, less the monitor bit, so they
+  // can never wrap in practice.
+  uint64_t tail_ = 0;
+  uint64_t head_ = 0;
+
+  // The size of the record exposed by the last Peek(), to be freed by Pop().
+  uint32_t peeked_record_size_ = 0;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_MESSAGE_RING_H_
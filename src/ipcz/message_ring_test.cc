@@ -0,0 +1,254 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/message_ring.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+namespace {
+
+constexpr size_t kRegionSize = 4096;
+
+class MessageRingTest : public testing::Test {
+ public:
+  MessageRingTest() { MessageRing(region_).InitializeRegion(); }
+
+  MessageRing& producer() { return producer_; }
+  MessageRing& consumer() { return consumer_; }
+  absl::Span<uint8_t> region() { return region_; }
+
+  // Pushes a message of `size` bytes, each with the value `fill`.
+  bool Push(size_t size, uint8_t fill, bool& wake_consumer) {
+    std::vector<uint8_t> message(size, fill);
+    return producer_.Push(message, wake_consumer);
+  }
+
+  bool Push(size_t size, uint8_t fill) {
+    bool wake_consumer;
+    return Push(size, fill, wake_consumer);
+  }
+
+  // Pops the next message and verifies that it has `size` bytes of `fill`.
+  void ExpectPop(size_t size, uint8_t fill) {
+    absl::Span<const uint8_t> message;
+    ASSERT_TRUE(consumer_.Peek(message));
+    ASSERT_EQ(size, message.size());
+    EXPECT_EQ(std::vector<uint8_t>(size, fill),
+              std::vector<uint8_t>(message.begin(), message.end()));
+    consumer_.Pop();
+  }
+
+  void ExpectEmpty() {
+    absl::Span<const uint8_t> message;
+    ASSERT_TRUE(consumer_.Peek(message));
+    EXPECT_TRUE(message.empty());
+  }
+
+  // Overwrites the 32-bit value at `offset` within the shared region.
+  void Corrupt(size_t offset, uint32_t value) {
+    memcpy(&region_[offset], &value, sizeof(value));
+  }
+
+ private:
+  alignas(8) uint8_t region_[kRegionSize] = {};
+  MessageRing producer_{region_};
+  MessageRing consumer_{region_};
+};
+
+TEST_F(MessageRingTest, Invalid) {
+  uint8_t small_region[MessageRing::kMinRegionSize - 8];
+  EXPECT_FALSE(MessageRing().is_valid());
+  EXPECT_FALSE(MessageRing(small_region).is_valid());
+  EXPECT_TRUE(producer().is_valid());
+}
+
+TEST_F(MessageRingTest, PushAndPop) {
+  ExpectEmpty();
+  ASSERT_TRUE(Push(1, 0x11));
+  ASSERT_TRUE(Push(24, 0x22));
+  ASSERT_TRUE(Push(0, 0x33));
+  ASSERT_TRUE(Push(producer().max_message_size(), 0x44));
+  ExpectPop(1, 0x11);
+  ExpectPop(24, 0x22);
+  ExpectPop(0, 0x33);
+  ExpectPop(producer().max_message_size(), 0x44);
+  ExpectEmpty();
+}
+
+TEST_F(MessageRingTest, TooLarge) {
+  EXPECT_FALSE(Push(producer().max_message_size() + 1, 0));
+  ExpectEmpty();
+}
+
+TEST_F(MessageRingTest, Full) {
+  // Fill the ring completely with messages of the largest size.
+  const size_t kSize = producer().max_message_size();
+  size_t num_messages = 0;
+  while (Push(kSize, static_cast<uint8_t>(num_messages))) {
+    ++num_messages;
+  }
+  EXPECT_GT(num_messages, 0u);
+
+  // Freeing one message makes room for exactly one more.
+  ExpectPop(kSize, 0);
+  EXPECT_TRUE(Push(kSize, static_cast<uint8_t>(num_messages)));
+  EXPECT_FALSE(Push(kSize, 0));
+
+  for (size_t i = 1; i <= num_messages; ++i) {
+    ExpectPop(kSize, static_cast<uint8_t>(i));
+  }
+  ExpectEmpty();
+}
+
+TEST_F(MessageRingTest, WrapAround) {
+  // Push and pop messages of varying sizes over several laps of the ring, so
+  // that messages regularly straddle its end and must be padded.
+  for (size_t i = 0; i < 1000; ++i) {
+    const size_t size = (i * 37) % producer().max_message_size();
+    const uint8_t fill = static_cast<uint8_t>(i);
+    ASSERT_TRUE(Push(size, fill));
+    ASSERT_TRUE(Push(size / 2, fill + 1));
+    ExpectPop(size, fill);
+    ExpectPop(size / 2, fill + 1);
+  }
+  ExpectEmpty();
+}
+
+TEST_F(MessageRingTest, WakeConsumer) {
+  // The consumer starts out idle, so the first message must wake it.
+  bool wake_consumer = false;
+  ASSERT_TRUE(Push(8, 1, wake_consumer));
+  EXPECT_TRUE(wake_consumer);
+
+  // Until the consumer goes idle again, no more wake-ups are needed.
+  ASSERT_TRUE(Push(8, 2, wake_consumer));
+  EXPECT_FALSE(wake_consumer);
+
+  // The consumer can't go idle while there are still messages to consume.
+  EXPECT_FALSE(consumer().SetConsumerIdle());
+  ASSERT_TRUE(Push(8, 3, wake_consumer));
+  EXPECT_FALSE(wake_consumer);
+
+  ExpectPop(8, 1);
+  ExpectPop(8, 2);
+  ExpectPop(8, 3);
+  EXPECT_TRUE(consumer().SetConsumerIdle());
+  ASSERT_TRUE(Push(8, 4, wake_consumer));
+  EXPECT_TRUE(wake_consumer);
+
+  // Going idle repeatedly still requires only one wake-up.
+  ExpectPop(8, 4);
+  EXPECT_TRUE(consumer().SetConsumerIdle());
+  EXPECT_TRUE(consumer().SetConsumerIdle());
+  ASSERT_TRUE(Push(8, 5, wake_consumer));
+  EXPECT_TRUE(wake_consumer);
+  ASSERT_TRUE(Push(8, 6, wake_consumer));
+  EXPECT_FALSE(wake_consumer);
+}
+
+TEST_F(MessageRingTest, InvalidTail) {
+  ASSERT_TRUE(Push(8, 1));
+
+  // A tail position beyond the ring's capacity is rejected.
+  Corrupt(64, 0x7fffffff);
+  absl::Span<const uint8_t> message;
+  EXPECT_FALSE(consumer().Peek(message));
+
+  // As is one which isn't aligned to a record boundary.
+  Corrupt(64, 12);
+  EXPECT_FALSE(consumer().Peek(message));
+}
+
+TEST_F(MessageRingTest, InvalidRecord) {
+  ASSERT_TRUE(Push(8, 1));
+
+  // A record which claims to extend beyond the tail is rejected.
+  Corrupt(128, 64);
+  absl::Span<const uint8_t> message;
+  EXPECT_FALSE(consumer().Peek(message));
+
+  // As is one whose size would wrap around when aligned.
+  Corrupt(128, 0xfffffffc);
+  EXPECT_FALSE(consumer().Peek(message));
+
+  // So is a record with unknown flags.
+  Corrupt(128, 8);
+  Corrupt(132, 0x80);
+  EXPECT_FALSE(consumer().Peek(message));
+}
+
+TEST_F(MessageRingTest, InvalidPositions) {
+  // A ring can only be used if its stored positions are aligned to record
+  // boundaries and the tail is no more than a full ring ahead of the head.
+  // Otherwise the producer could write record headers outside of the ring.
+  constexpr uint32_t kCapacity = 2048;
+  const struct {
+    uint32_t head;
+    uint32_t tail;
+  } kInvalidPositions[] = {
+      {0, kCapacity - 4},
+      {4, 8},
+      {16, 8},
+      {0, kCapacity + 8},
+  };
+  for (const auto& positions : kInvalidPositions) {
+    Corrupt(0, positions.head);
+    Corrupt(64, positions.tail);
+    EXPECT_FALSE(MessageRing(region()).is_valid());
+  }
+
+  // A full ring is fine.
+  Corrupt(0, 8);
+  Corrupt(64, kCapacity + 8);
+  EXPECT_TRUE(MessageRing(region()).is_valid());
+}
+
+TEST_F(MessageRingTest, Concurrent) {
+  // A producer and consumer operating concurrently on separate threads. Each
+  // message carries its own index, which the consumer verifies.
+  constexpr uint32_t kNumMessages = 100000;
+  std::thread producer_thread([this] {
+    for (uint32_t i = 0; i < kNumMessages;) {
+      uint32_t data[4] = {i, i, i, i};
+      const size_t size = sizeof(uint32_t) * (1 + i % 4);
+      bool wake_consumer;
+      if (producer().Push(absl::MakeSpan(reinterpret_cast<uint8_t*>(data),
+                                         size),
+                          wake_consumer)) {
+        ++i;
+      }
+    }
+  });
+
+  for (uint32_t i = 0; i < kNumMessages;) {
+    absl::Span<const uint8_t> message;
+    ASSERT_TRUE(consumer().Peek(message));
+    if (message.empty()) {
+      continue;
+    }
+
+    ASSERT_EQ(sizeof(uint32_t) * (1 + i % 4), message.size());
+    for (size_t j = 0; j < message.size() / sizeof(uint32_t); ++j) {
+      uint32_t value;
+      memcpy(&value, &message[j * sizeof(uint32_t)], sizeof(value));
+      ASSERT_EQ(i, value);
+    }
+    consumer().Pop();
+    ++i;
+  }
+
+  producer_thread.join();
+  ExpectEmpty();
+}
+
+}  // namespace
+}  // namespace ipcz
@@ -18,6 +18,7 @@
 #include "ipcz/router.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/cleanup/cleanup.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_set.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
@@ -97,7 +98,8 @@ Node::Node(Type type,
     : type_(type),
       driver_(driver),
       options_(CopyOrUseDefaultOptions(options)),
-      features_(Features::FromNodeOptions(options)) {
+      features_(Features::FromNodeOptions(options)),
+      memory_profile_(MemoryProfile::FromNodeOptions(&options_)) {
   if (type_ == Type::kBroker) {
     // Only brokers assign their own names.
     assigned_name_ = GenerateRandomName();
@@ -216,6 +218,37 @@ std::optional<Node::Connection> Node::GetConnection(const NodeName& name) {
   return it->second;
 }
 
+IpczResult Node::QueryMemoryStats(
+    absl::Span<IpczNodeLinkMemoryStats> link_stats,
+    size_t& num_links) {
+  // The same link may be registered for multiple connections, e.g. when a
+  // broker is reachable through it for other nodes' names.
+  absl::InlinedVector<Ref<NodeLink>, 4> links;
+  {
+    absl::MutexLock lock(&mutex_);
+    absl::flat_hash_set<NodeLink*> seen_links;
+    for (const auto& [name, connection] : connections_) {
+      if (connection.link && seen_links.insert(connection.link.get()).second) {
+        links.push_back(connection.link);
+      }
+    }
+  }
+
+  num_links = links.size();
+  if (link_stats.size() < links.size()) {
+    return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+  }
+
+  for (size_t i = 0; i < links.size(); ++i) {
+    IpczNodeLinkMemoryStats& stats = link_stats[i];
+    const NodeName& remote_node_name = links[i]->remote_node_name();
+    stats.remote_node_id[0] = remote_node_name.high();
+    stats.remote_node_id[1] = remote_node_name.low();
+    links[i]->memory().QueryMemoryStats(stats);
+  }
+  return IPCZ_RESULT_OK;
+}
+
 Ref<NodeLink> Node::GetLink(const NodeName& name) {
   absl::MutexLock lock(&mutex_);
   auto it = connections_.find(name);
@@ -644,7 +677,8 @@ void Node::IntroduceRemoteNodes(NodeLink& first, NodeLink& second) {
     in_progress_introductions_.erase(key);
   };
 
-  DriverMemoryWithMapping buffer = NodeLinkMemory::AllocateMemory(driver_);
+  DriverMemoryWithMapping buffer =
+      NodeLinkMemory::AllocateMemory(driver_, memory_profile_, features_);
   if (!buffer.memory.is_valid()) {
     return;
   }
@@ -14,6 +14,7 @@
 #include "ipcz/api_object.h"
 #include "ipcz/driver_memory.h"
 #include "ipcz/features.h"
+#include "ipcz/memory_profile.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
 #include "ipcz/node_messages.h"
@@ -61,6 +62,7 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   const IpczDriver& driver() const { return driver_; }
   const IpczCreateNodeOptions& options() const { return options_; }
   const Features& features() const { return features_; }
+  const MemoryProfile& memory_profile() const { return memory_profile_; }
 
   // APIObject:
   IpczResult Close() override;
@@ -92,6 +94,14 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   // case where the caller only wants the underlying NodeLink.
   Ref<NodeLink> GetLink(const NodeName& name);
 
+  // Populates `link_stats` with memory statistics for each of this node's
+  // links to other nodes, and sets `num_links` to the number of links. If
+  // `link_stats` is too small to describe every link, it's left unmodified and
+  // this returns IPCZ_RESULT_RESOURCE_EXHAUSTED. Each element must already
+  // have its `size` field validated by the caller.
+  IpczResult QueryMemoryStats(absl::Span<IpczNodeLinkMemoryStats> link_stats,
+                              size_t& num_links);
+
   // Generates a new random NodeName using this node's driver as a source of
   // randomness.
   NodeName GenerateRandomName() const;
@@ -193,6 +203,7 @@ class Node : public APIObjectImpl<Node, APIObject::kNode> {
   const IpczDriver& driver_;
   const IpczCreateNodeOptions options_;
   const Features features_;
+  const MemoryProfile memory_profile_;
 
   absl::Mutex mutex_;
 
@@ -384,7 +384,11 @@ class NodeConnectorForBrokerReferral : public NodeConnector {
     connect.v1()->broker_features = node_->features().Serialize(connect);
     connect.v1()->referrer_features =
         referrer_->remote_features().Serialize(connect);
-    link_to_referree->Transmit(connect);
+
+    // This is sent directly over the transport rather than through
+    // `link_to_referree`, since it's received by the referred node's
+    // NodeConnector before that node has a NodeLink of its own.
+    transport_->Transmit(connect);
 
     // Finally, give the referrer a repy which includes details of its new link
     // to the referred node.
@@ -509,7 +513,8 @@ std::pair<Ref<NodeConnector>, IpczResult> CreateConnector(
   const bool inherit_broker = (flags & IPCZ_CONNECT_NODE_INHERIT_BROKER) != 0;
   if (from_broker) {
     DriverMemoryWithMapping memory =
-        NodeLinkMemory::AllocateMemory(node->driver());
+        NodeLinkMemory::AllocateMemory(
+            node->driver(), node->memory_profile(), node->features());
     if (!memory.mapping.is_valid()) {
       return {nullptr, IPCZ_RESULT_RESOURCE_EXHAUSTED};
     }
@@ -14,11 +14,14 @@
 #include <utility>
 
 #include "ipcz/box.h"
+#include "ipcz/data_pipe.h"
+#include "ipcz/driver_memory.h"
 #include "ipcz/fragment_ref.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
 #include "ipcz/link_type.h"
 #include "ipcz/message.h"
+#include "ipcz/message_ring.h"
 #include "ipcz/node.h"
 #include "ipcz/node_connector.h"
 #include "ipcz/node_link_memory.h"
@@ -39,6 +42,25 @@ namespace ipcz {
 
 namespace {
 
+// The furthest ahead of the next expected transport message that any received
+// transport message may be. Transport messages only arrive out of order when
+// concurrent senders race between numbering and transmitting them, so
+// legitimate reordering stays well within this window. Anything beyond it is
+// treated as a validation failure, bounding `pending_transport_messages_`.
+constexpr uint64_t kMaxTransportMessageReorderWindow = 1024;
+
+// Returns the first entry of `byte_totals` and removes it from the span, or
+// returns null if `byte_totals` is empty.
+const RouterByteTotals* TakeByteTotals(
+    absl::Span<const RouterByteTotals>& byte_totals) {
+  if (byte_totals.empty()) {
+    return nullptr;
+  }
+  const RouterByteTotals* totals = &byte_totals.front();
+  byte_totals.remove_prefix(1);
+  return totals;
+}
+
 template <typename T>
 FragmentRef<T> MaybeAdoptFragmentRef(NodeLinkMemory& memory,
                                      const FragmentDescriptor& descriptor) {
@@ -50,6 +72,20 @@ FragmentRef<T> MaybeAdoptFragmentRef(NodeLinkMemory& memory,
   return memory.AdoptFragmentRef<T>(memory.GetFragment(descriptor));
 }
 
+// Indicates whether `message` is part of the buffer retirement handshake. Such
+// messages don't count toward periodic checks for idle buffers, so retirement
+// requests and their replies can't keep eliciting more requests.
+bool IsBufferRetirementMessage(const DriverTransport::RawMessage& message) {
+  if (message.data.size() < sizeof(internal::MessageHeaderV0)) {
+    return false;
+  }
+  const auto& header =
+      *reinterpret_cast<const internal::MessageHeaderV0*>(message.data.data());
+  return header.message_id == msg::RetireBuffer::kId ||
+         header.message_id == msg::AcceptBufferRetirement::kId ||
+         header.message_id == msg::RejectBufferRetirement::kId;
+}
+
 }  // namespace
 
 // static
@@ -104,13 +140,34 @@ NodeLink::NodeLink(Ref<Node> node,
       available_features_(node_->features().Intersect(remote_features_)),
       transport_(std::move(transport)),
       memory_(std::move(memory)),
-      activation_state_(initial_activation_state) {
+      activation_state_(initial_activation_state),
+      outgoing_message_ring_(memory_->GetMessageRingMemory(link_side_)),
+      incoming_message_ring_(
+          memory_->GetMessageRingMemory(link_side_.opposite())) {
   if (initial_activation_state == kActive) {
     transport_->set_listener(WrapRefCounted(this));
     memory_->SetNodeLink(WrapRefCounted(this));
   }
 }
 
+NodeLink::PendingTransportMessage::PendingTransportMessage(
+    const DriverTransport::RawMessage& message,
+    const DriverTransport& transport)
+    : data(message.data.begin(), message.data.end()) {
+  handles.reserve(message.handles.size());
+  for (IpczDriverHandle handle : message.handles) {
+    handles.emplace_back(*transport.driver_object().driver(), handle);
+  }
+}
+
+NodeLink::PendingTransportMessage::PendingTransportMessage(
+    PendingTransportMessage&&) = default;
+
+NodeLink::PendingTransportMessage& NodeLink::PendingTransportMessage::operator=(
+    PendingTransportMessage&&) = default;
+
+NodeLink::PendingTransportMessage::~PendingTransportMessage() = default;
+
 NodeLink::~NodeLink() {
   absl::MutexLock lock(&mutex_);
   ABSL_HARDENING_ASSERT(activation_state_ != kActive);
@@ -189,6 +246,19 @@ void NodeLink::AddBlockBuffer(BufferId id,
   Transmit(add);
 }
 
+void NodeLink::AddLargeBuffer(BufferId id, DriverMemory memory) {
+  msg::AddLargeBuffer add;
+  add.v0()->id = id;
+  add.v0()->buffer = add.AppendDriverObject(memory.TakeDriverObject());
+  Transmit(add);
+}
+
+void NodeLink::RetireBuffer(BufferId id) {
+  msg::RetireBuffer retire;
+  retire.v0()->id = id;
+  Transmit(retire);
+}
+
 void NodeLink::RequestIntroduction(const NodeName& name) {
   ABSL_ASSERT(remote_node_type_ == Node::Type::kBroker);
 
@@ -325,6 +395,11 @@ bool NodeLink::DispatchRelayedMessage(msg::AcceptRelayedMessage& accept) {
       return add.DeserializeRelayed(data, objects) && OnAddBlockBuffer(add);
     }
 
+    case msg::AddLargeBuffer::kId: {
+      msg::AddLargeBuffer add;
+      return add.DeserializeRelayed(data, objects) && OnAddLargeBuffer(add);
+    }
+
     default:
       DVLOG(4) << "Ignoring relayed message with ID "
                << static_cast<int>(message_id);
@@ -360,8 +435,39 @@ void NodeLink::Transmit(Message& message) {
     return;
   }
 
-  message.header().sequence_number = GenerateOutgoingSequenceNumber();
-  transport_->Transmit(message);
+  if (!outgoing_message_ring_.is_valid()) {
+    message.header().sequence_number = GenerateOutgoingSequenceNumber();
+    transport_->Transmit(message);
+    return;
+  }
+
+  // Messages without driver objects need no further serialization, so they can
+  // be copied directly into the ring if they fit.
+  bool pushed_to_ring = false;
+  bool wake_peer = false;
+  {
+    absl::MutexLock lock(&outgoing_message_ring_mutex_);
+    message.header().sequence_number =
+        SequenceNumber{num_transport_messages_sent_};
+    pushed_to_ring =
+        message.driver_objects().empty() &&
+        outgoing_message_ring_.Push(message.data_view(), wake_peer);
+    if (!pushed_to_ring) {
+      ++num_transport_messages_sent_;
+    }
+  }
+
+  if (!pushed_to_ring) {
+    // Concurrent transmissions may reach the transport out of sequence, but
+    // the receiving NodeLink reorders them.
+    transport_->Transmit(message);
+    return;
+  }
+
+  if (wake_peer) {
+    msg::FlushMessageRing flush;
+    transport_->Transmit(flush);
+  }
 }
 
 SequenceNumber NodeLink::GenerateOutgoingSequenceNumber() {
@@ -381,9 +487,11 @@ bool NodeLink::OnReferNonBroker(msg::ReferNonBroker& refer) {
   }
 
   DriverMemoryWithMapping link_memory =
-      NodeLinkMemory::AllocateMemory(node()->driver());
+      NodeLinkMemory::AllocateMemory(
+          node()->driver(), node()->memory_profile(), node()->features());
   DriverMemoryWithMapping client_link_memory =
-      NodeLinkMemory::AllocateMemory(node()->driver());
+      NodeLinkMemory::AllocateMemory(
+          node()->driver(), node()->memory_profile(), node()->features());
   if (!link_memory.mapping.is_valid() ||
       !client_link_memory.mapping.is_valid()) {
     // Not a validation failure, but we can't accept the referral because we
@@ -534,6 +642,43 @@ bool NodeLink::OnAddBlockBuffer(msg::AddBlockBuffer& add) {
                                  std::move(mapping));
 }
 
+bool NodeLink::OnAddLargeBuffer(msg::AddLargeBuffer& add) {
+  DriverMemoryMapping mapping =
+      DriverMemory(add.TakeDriverObject(add.v0()->buffer)).Map();
+  if (!mapping.is_valid()) {
+    return false;
+  }
+  return memory().AddLargeBuffer(add.v0()->id, std::move(mapping));
+}
+
+bool NodeLink::OnRetireBuffer(msg::RetireBuffer& retire) {
+  const BufferId id = retire.v0()->id;
+  bool retired;
+  if (!memory().RetireRemoteBuffer(id, retired)) {
+    return false;
+  }
+
+  if (retired) {
+    msg::AcceptBufferRetirement accept;
+    accept.v0()->id = id;
+    Transmit(accept);
+  } else {
+    msg::RejectBufferRetirement reject;
+    reject.v0()->id = id;
+    Transmit(reject);
+  }
+  return true;
+}
+
+bool NodeLink::OnAcceptBufferRetirement(msg::AcceptBufferRetirement& accept) {
+  return memory().CompleteBufferRetirement(accept.v0()->id, /*retired=*/true);
+}
+
+bool NodeLink::OnRejectBufferRetirement(msg::RejectBufferRetirement& reject) {
+  return memory().CompleteBufferRetirement(reject.v0()->id,
+                                           /*retired=*/false);
+}
+
 bool NodeLink::OnAcceptParcel(msg::AcceptParcel& accept) {
   absl::Span<uint8_t> parcel_data =
       accept.GetArrayView<uint8_t>(accept.v0()->parcel_data);
@@ -541,6 +686,15 @@ bool NodeLink::OnAcceptParcel(msg::AcceptParcel& accept) {
       accept.GetArrayView<HandleType>(accept.v0()->handle_types);
   absl::Span<const RouterDescriptor> new_routers =
       accept.GetArrayView<RouterDescriptor>(accept.v0()->new_routers);
+  absl::Span<const RouterByteTotals> new_router_byte_totals;
+  if (const auto* v2 = accept.v2()) {
+    new_router_byte_totals =
+        accept.GetArrayView<RouterByteTotals>(v2->new_router_byte_totals);
+    if (!new_router_byte_totals.empty() &&
+        new_router_byte_totals.size() != new_routers.size()) {
+      return false;
+    }
+  }
   auto driver_objects = accept.driver_objects();
 
   // Note that on any validation failure below, we defer rejection at least
@@ -557,7 +711,8 @@ bool NodeLink::OnAcceptParcel(msg::AcceptParcel& accept) {
           continue;
         }
 
-        Ref<Router> new_router = Router::Deserialize(new_routers[0], *this);
+        Ref<Router> new_router = Router::Deserialize(
+            new_routers[0], TakeByteTotals(new_router_byte_totals), *this);
         if (!new_router) {
           parcel_valid = false;
           continue;
@@ -583,6 +738,40 @@ bool NodeLink::OnAcceptParcel(msg::AcceptParcel& accept) {
         break;
       }
 
+      case HandleType::kDataPipeProducer:
+      case HandleType::kDataPipeConsumer: {
+        if (new_routers.empty()) {
+          parcel_valid = false;
+          continue;
+        }
+
+        Ref<Router> router = Router::Deserialize(
+            new_routers[0], TakeByteTotals(new_router_byte_totals), *this);
+        if (!router) {
+          parcel_valid = false;
+          continue;
+        }
+        new_routers.remove_prefix(1);
+
+        const DataPipe::Endpoint endpoint =
+            handle_types[i] == HandleType::kDataPipeProducer
+                ? DataPipe::Endpoint::kProducer
+                : DataPipe::Endpoint::kConsumer;
+        auto pipe = MakeRefCounted<DataPipe>(endpoint, std::move(router));
+        if (driver_objects.empty()) {
+          // The pipe's memory was relayed separately along with any other
+          // driver objects, and it will be attached by AcceptSplitParcel().
+          is_split_parcel = true;
+        } else {
+          if (!pipe->SetMemory(DriverMemory(std::move(driver_objects[0])))) {
+            parcel_valid = false;
+          }
+          driver_objects.remove_prefix(1);
+        }
+        objects[i] = std::move(pipe);
+        break;
+      }
+
       case HandleType::kBoxedSubparcel:
         // Store a placeholder object for each expected subparcel. These will
         // be filled in by AcceptCompleteParcel() once the last complete
@@ -610,6 +799,56 @@ bool NodeLink::OnAcceptParcel(msg::AcceptParcel& accept) {
     return false;
   }
 
+  // Any subparcels embedded in the message fill the placeholders above
+  // directly, in order. Their data is copied out here, since the message
+  // contents may be adopted by the main parcel below.
+  if (const auto* v1 = accept.v1()) {
+    const absl::Span<const uint32_t> subparcel_data_sizes =
+        accept.GetArrayView<uint32_t>(v1->subparcel_data_sizes);
+    absl::Span<const uint8_t> subparcel_data =
+        accept.GetArrayView<uint8_t>(v1->subparcel_data);
+    if (!subparcel_data_sizes.empty() &&
+        (num_subparcels != 1 || !available_features().embedded_subparcels())) {
+      return false;
+    }
+
+    size_t next_subparcel = 0;
+    for (size_t i = 0; i < handle_types.size() && !subparcel_data_sizes.empty();
+         ++i) {
+      if (handle_types[i] != HandleType::kBoxedSubparcel) {
+        continue;
+      }
+
+      if (next_subparcel == subparcel_data_sizes.size() ||
+          subparcel_data_sizes[next_subparcel] > subparcel_data.size()) {
+        // More placeholders than embedded subparcels, or a bogus size.
+        parcel_valid = false;
+        break;
+      }
+
+      const size_t num_bytes = subparcel_data_sizes[next_subparcel];
+
+      auto subparcel = std::make_unique<Parcel>(accept.v0()->sequence_number);
+      subparcel->AllocateData(num_bytes, /*allow_partial=*/false,
+                              /*memory=*/nullptr);
+      if (num_bytes > 0) {
+        memcpy(subparcel->data_view().data(), subparcel_data.data(),
+               num_bytes);
+      }
+      subparcel->CommitData(num_bytes);
+      subparcel_data.remove_prefix(num_bytes);
+      Box::FromObject(objects[i].get())->subparcel()->SetParcel(
+          std::move(subparcel));
+      ++next_subparcel;
+    }
+
+    if (next_subparcel != subparcel_data_sizes.size() ||
+        !subparcel_data.empty()) {
+      // Every embedded subparcel must fill exactly one placeholder.
+      parcel_valid = false;
+    }
+  }
+
   const SublinkId for_sublink = accept.v0()->sublink;
   auto parcel = std::make_unique<Parcel>(accept.v0()->sequence_number);
   parcel->set_num_subparcels(num_subparcels);
@@ -659,6 +898,70 @@ bool NodeLink::OnAcceptParcelDriverObjects(
   return AcceptParcelDriverObjects(accept.v0()->sublink, std::move(parcel));
 }
 
+bool NodeLink::OnAcceptParcels(msg::AcceptParcels& accept) {
+  if (!available_features().batched_parcels()) {
+    // Only nodes which negotiated this feature may send batched parcels.
+    return false;
+  }
+
+  const absl::Span<const FragmentDescriptor> fragments =
+      accept.GetArrayView<FragmentDescriptor>(accept.v0()->parcel_fragments);
+  const absl::Span<const uint32_t> inlined_data_sizes =
+      accept.GetArrayView<uint32_t>(accept.v0()->inlined_data_sizes);
+  absl::Span<const uint8_t> inlined_data =
+      accept.GetArrayView<uint8_t>(accept.v0()->parcel_data);
+  if (fragments.size() != inlined_data_sizes.size()) {
+    return false;
+  }
+
+  const SublinkId for_sublink = accept.v0()->sublink;
+  SequenceNumber sequence_number = accept.v0()->first_sequence_number;
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    auto parcel = std::make_unique<Parcel>(sequence_number);
+    sequence_number = NextSequenceNumber(sequence_number);
+
+    const FragmentDescriptor& descriptor = fragments[i];
+    if (!descriptor.is_null()) {
+      if (inlined_data_sizes[i] != 0) {
+        return false;
+      }
+
+      const Fragment fragment = memory().GetFragment(descriptor);
+      if (fragment.is_pending()) {
+        WaitForParcelFragmentToResolve(for_sublink, std::move(parcel),
+                                       descriptor, /*is_split_parcel=*/false);
+        continue;
+      }
+
+      if (!parcel->AdoptDataFragment(WrapRefCounted(&memory()), fragment)) {
+        return false;
+      }
+    } else {
+      // Unlike with AcceptParcel, the message contents are shared by every
+      // parcel in the batch, so inlined data is copied out.
+      const size_t num_bytes = inlined_data_sizes[i];
+      if (num_bytes > inlined_data.size()) {
+        return false;
+      }
+
+      parcel->AllocateData(num_bytes, /*allow_partial=*/false,
+                           /*memory=*/nullptr);
+      if (num_bytes > 0) {
+        memcpy(parcel->data_view().data(), inlined_data.data(), num_bytes);
+      }
+      parcel->CommitData(num_bytes);
+      inlined_data.remove_prefix(num_bytes);
+    }
+
+    if (!AcceptCompleteParcel(for_sublink, std::move(parcel))) {
+      return false;
+    }
+  }
+
+  // All inlined data must be claimed by some parcel.
+  return inlined_data.empty();
+}
+
 bool NodeLink::OnRouteClosed(msg::RouteClosed& route_closed) {
   std::optional<Sublink> sublink = GetSublink(route_closed.v0()->sublink);
   if (!sublink) {
@@ -795,6 +1098,19 @@ bool NodeLink::OnFlushRouter(msg::FlushRouter& flush) {
   return true;
 }
 
+bool NodeLink::OnNotifyDataConsumed(msg::NotifyDataConsumed& notify) {
+  if (!available_features().remote_queue_state()) {
+    // Only nodes which publish their queue state may notify us about it.
+    return false;
+  }
+
+  if (Ref<Router> router = GetRouter(notify.v0()->sublink)) {
+    const OperationContext context{OperationContext::kTransportNotification};
+    router->NotifyPeerConsumedData(context);
+  }
+  return true;
+}
+
 bool NodeLink::OnRequestMemory(msg::RequestMemory& request) {
   DriverMemory memory(node_->driver(), request.v0()->size);
   msg::ProvideMemory provide;
@@ -843,6 +1159,115 @@ bool NodeLink::OnAcceptRelayedMessage(msg::AcceptRelayedMessage& accept) {
   return node_->AcceptRelayedMessage(accept);
 }
 
+bool NodeLink::OnTransportMessage(const DriverTransport::RawMessage& message,
+                                  const DriverTransport& transport) {
+  if (!IsBufferRetirementMessage(message)) {
+    memory_->MaybeReclaimIdleBuffers();
+  }
+
+  if (!incoming_message_ring_.is_valid()) {
+    return NodeMessageListener::OnTransportMessage(message, transport);
+  }
+
+  if (message.data.size() < sizeof(internal::MessageHeaderV0)) {
+    return false;
+  }
+  const auto& header =
+      *reinterpret_cast<const internal::MessageHeaderV0*>(message.data.data());
+  if (header.message_id == msg::FlushMessageRing::kId) {
+    return DispatchOrderedMessages(transport);
+  }
+
+  const uint64_t sequence_number = header.sequence_number.value();
+  if (sequence_number == num_transport_messages_received_) {
+    // Any messages queued in the ring ahead of this one must be dispatched
+    // first.
+    bool is_ring_empty;
+    if (!DispatchMessagesFromRing(transport, is_ring_empty) ||
+        !NodeMessageListener::OnTransportMessage(message, transport)) {
+      return false;
+    }
+    ++num_transport_messages_received_;
+  } else if (sequence_number < num_transport_messages_received_ ||
+             sequence_number - num_transport_messages_received_ >
+                 kMaxTransportMessageReorderWindow ||
+             !pending_transport_messages_
+                  .try_emplace(sequence_number, message, transport)
+                  .second) {
+    return false;
+  }
+
+  return DispatchOrderedMessages(transport);
+}
+
+bool NodeLink::DispatchMessagesFromRing(const DriverTransport& transport,
+                                        bool& is_ring_empty) {
+  for (;;) {
+    absl::Span<const uint8_t> data;
+    if (!incoming_message_ring_.Peek(data)) {
+      DLOG(ERROR) << "Invalid MessageRing contents";
+      return false;
+    }
+
+    is_ring_empty = data.empty();
+    if (is_ring_empty) {
+      return true;
+    }
+
+    // Copy the header out of shared memory before inspecting it.
+    internal::MessageHeaderV0 header;
+    if (data.size() < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.sequence_number.value() > num_transport_messages_received_) {
+      // This message was sent after a transport message we haven't received.
+      return true;
+    }
+
+    // Deserialization copies the message out of shared memory before
+    // validating it, so it's safe to dispatch from within the ring.
+    const bool ok =
+        NodeMessageListener::OnTransportMessage({.data = data}, transport);
+    incoming_message_ring_.Pop();
+    if (!ok) {
+      return false;
+    }
+  }
+}
+
+bool NodeLink::DispatchOrderedMessages(const DriverTransport& transport) {
+  for (;;) {
+    bool is_ring_empty;
+    if (!DispatchMessagesFromRing(transport, is_ring_empty)) {
+      return false;
+    }
+
+    auto it =
+        pending_transport_messages_.find(num_transport_messages_received_);
+    if (it != pending_transport_messages_.end()) {
+      PendingTransportMessage pending = std::move(it->second);
+      pending_transport_messages_.erase(it);
+
+      std::vector<IpczDriverHandle> handles;
+      handles.reserve(pending.handles.size());
+      for (DriverObject& handle : pending.handles) {
+        handles.push_back(handle.release());
+      }
+      if (!NodeMessageListener::OnTransportMessage(
+              {.data = pending.data, .handles = handles}, transport)) {
+        return false;
+      }
+      ++num_transport_messages_received_;
+      continue;
+    }
+
+    if (!is_ring_empty || incoming_message_ring_.SetConsumerIdle()) {
+      return true;
+    }
+  }
+}
+
 void NodeLink::OnTransportError() {
   const OperationContext context{OperationContext::kTransportNotification};
   HandleTransportError(context);
@@ -953,7 +1378,8 @@ bool NodeLink::AcceptSplitParcel(
   auto& complete_parcel = parcel_without_driver_objects;
   auto remaining_driver_objects = parcel_with_driver_objects->objects_view();
   for (auto& object : complete_parcel->objects_view()) {
-    if (object) {
+    DataPipe* pipe = DataPipe::FromObject(object.get());
+    if (object && (!pipe || pipe->has_memory())) {
       continue;
     }
 
@@ -961,7 +1387,16 @@ bool NodeLink::AcceptSplitParcel(
       return false;
     }
 
-    object = std::move(remaining_driver_objects[0]);
+    if (pipe) {
+      // Data pipe endpoints take their memory out of the next boxed object.
+      Box* box = Box::FromObject(remaining_driver_objects[0].get());
+      if (!box || box->type() != Box::Type::kDriverObject ||
+          !pipe->SetMemory(DriverMemory(std::move(box->driver_object())))) {
+        return false;
+      }
+    } else {
+      object = std::move(remaining_driver_objects[0]);
+    }
     remaining_driver_objects.remove_prefix(1);
   }
 
@@ -13,11 +13,13 @@
 #include <vector>
 
 #include "ipcz/driver_memory.h"
+#include "ipcz/driver_object.h"
 #include "ipcz/driver_transport.h"
 #include "ipcz/features.h"
 #include "ipcz/fragment_ref.h"
 #include "ipcz/link_side.h"
 #include "ipcz/link_type.h"
+#include "ipcz/message_ring.h"
 #include "ipcz/node.h"
 #include "ipcz/node_link_memory.h"
 #include "ipcz/node_messages.h"
@@ -136,6 +138,18 @@ class NodeLink : public msg::NodeMessageListener {
   // AllocateNewBufferId().
   void AddBlockBuffer(BufferId id, uint32_t block_size, DriverMemory memory);
 
+  // Sends a new driver memory object to the remote endpoint to be associated
+  // with BufferId within the peer NodeLink's associated NodeLinkMemory as a
+  // large buffer. As with AddBlockBuffer(), the BufferId must have already been
+  // reserved locally.
+  void AddLargeBuffer(BufferId id, DriverMemory memory);
+
+  // Asks the remote endpoint to retire a buffer previously shared by this side
+  // via AddBlockBuffer() or AddLargeBuffer() and found idle by the local
+  // NodeLinkMemory. This elicits either an AcceptBufferRetirement or a
+  // RejectBufferRetirement message in response.
+  void RetireBuffer(BufferId id);
+
   // Asks the broker on the other end of this link to introduce the local node
   // to the node identified by `name`. This will always elicit a response from
   // the broker in the form of either an AcceptIntroduction or
@@ -241,6 +255,8 @@ class NodeLink : public msg::NodeMessageListener {
   SequenceNumber GenerateOutgoingSequenceNumber();
 
   // NodeMessageListener overrides:
+  bool OnTransportMessage(const DriverTransport::RawMessage& message,
+                          const DriverTransport& transport) override;
   bool OnReferNonBroker(msg::ReferNonBroker& refer) override;
   bool OnNonBrokerReferralAccepted(
       msg::NonBrokerReferralAccepted& accepted) override;
@@ -252,9 +268,14 @@ class NodeLink : public msg::NodeMessageListener {
   bool OnRequestIndirectIntroduction(
       msg::RequestIndirectIntroduction& request) override;
   bool OnAddBlockBuffer(msg::AddBlockBuffer& add) override;
+  bool OnAddLargeBuffer(msg::AddLargeBuffer& add) override;
+  bool OnRetireBuffer(msg::RetireBuffer& retire) override;
+  bool OnAcceptBufferRetirement(msg::AcceptBufferRetirement& accept) override;
+  bool OnRejectBufferRetirement(msg::RejectBufferRetirement& reject) override;
   bool OnAcceptParcel(msg::AcceptParcel& accept) override;
   bool OnAcceptParcelDriverObjects(
       msg::AcceptParcelDriverObjects& accept) override;
+  bool OnAcceptParcels(msg::AcceptParcels& accept) override;
   bool OnRouteClosed(msg::RouteClosed& route_closed) override;
   bool OnRouteDisconnected(msg::RouteDisconnected& route_disconnected) override;
   bool OnBypassPeer(msg::BypassPeer& bypass) override;
@@ -264,6 +285,7 @@ class NodeLink : public msg::NodeMessageListener {
   bool OnBypassPeerWithLink(msg::BypassPeerWithLink& bypass) override;
   bool OnStopProxyingToLocalPeer(msg::StopProxyingToLocalPeer& stop) override;
   bool OnFlushRouter(msg::FlushRouter& flush) override;
+  bool OnNotifyDataConsumed(msg::NotifyDataConsumed& notify) override;
   bool OnRequestMemory(msg::RequestMemory& request) override;
   bool OnProvideMemory(msg::ProvideMemory& provide) override;
   bool OnRelayMessage(msg::RelayMessage& relay) override;
@@ -272,6 +294,19 @@ class NodeLink : public msg::NodeMessageListener {
 
   void HandleTransportError(const OperationContext& context);
 
+  // Dispatches messages from `incoming_message_ring_` until the ring is empty,
+  // or until the next message in the ring must wait for a transport message
+  // which hasn't been dispatched yet. `is_ring_empty` indicates which of these
+  // conditions was met. Returns false if the ring or any of its messages was
+  // invalid.
+  bool DispatchMessagesFromRing(const DriverTransport& transport,
+                                bool& is_ring_empty);
+
+  // Dispatches as many messages as possible from `incoming_message_ring_` and
+  // `pending_transport_messages_` in order, and marks the ring as idle if
+  // it's left empty. Returns false if any message was invalid.
+  bool DispatchOrderedMessages(const DriverTransport& transport);
+
   // Invoked when we receive a Parcel whose data fragment resides in a buffer
   // not yet known to the local node. This schedules the parcel for acceptance
   // as soon as that buffer is available.
@@ -311,6 +346,41 @@ class NodeLink : public msg::NodeMessageListener {
   // reordered on the receiving end.
   std::atomic<uint64_t> next_outgoing_sequence_number_generator_{0};
 
+  // When message rings are available on this link, small messages without
+  // driver objects are queued in `outgoing_message_ring_` rather than being
+  // transmitted over the driver transport. Every message is then given a
+  // sequence number equal to the number of messages sent over the transport
+  // before it, so the receiving NodeLink can interleave messages from both
+  // paths in the order they were sent. These are unused when the ring is
+  // invalid, either because message rings are not available or because the
+  // remote node left the ring in an invalid state.
+  absl::Mutex outgoing_message_ring_mutex_;
+  MessageRing outgoing_message_ring_
+      ABSL_GUARDED_BY(outgoing_message_ring_mutex_);
+  uint64_t num_transport_messages_sent_
+      ABSL_GUARDED_BY(outgoing_message_ring_mutex_) = 0;
+
+  // The receiving counterpart to `outgoing_message_ring_`. This state is only
+  // accessed from within transport notifications, which the driver never
+  // invokes concurrently, so it needs no additional synchronization.
+  struct PendingTransportMessage {
+    PendingTransportMessage(const DriverTransport::RawMessage& message,
+                            const DriverTransport& transport);
+    PendingTransportMessage(PendingTransportMessage&&);
+    PendingTransportMessage& operator=(PendingTransportMessage&&);
+    ~PendingTransportMessage();
+
+    std::vector<uint8_t> data;
+    std::vector<DriverObject> handles;
+  };
+  MessageRing incoming_message_ring_;
+  uint64_t num_transport_messages_received_ = 0;
+
+  // Transport messages which arrived before some other transport message sent
+  // ahead of them, keyed by sequence number.
+  absl::flat_hash_map<uint64_t, PendingTransportMessage>
+      pending_transport_messages_;
+
   using SublinkMap = absl::flat_hash_map<SublinkId, Sublink>;
   SublinkMap sublinks_ ABSL_GUARDED_BY(mutex_);
 
@@ -4,23 +4,31 @@
 
 #include "ipcz/node_link_memory.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <utility>
+#include <vector>
 
+#include "ipcz/block_allocator.h"
 #include "ipcz/buffer_id.h"
 #include "ipcz/driver_memory.h"
 #include "ipcz/fragment_descriptor.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
+#include "ipcz/memory_profile.h"
+#include "ipcz/message_ring.h"
 #include "ipcz/node.h"
 #include "ipcz/node_link.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 #include "third_party/abseil-cpp/absl/numeric/bits.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "util/log.h"
 #include "util/ref_counted.h"
+#include "util/thread_index.h"
 
 namespace ipcz {
 
@@ -29,6 +37,9 @@ namespace {
 // Fixed allocation size for each NodeLink's primary shared buffer. (128 kB)
 constexpr size_t kPrimaryBufferSize = 128 * 1024;
 
+// The maximum size of a primary buffer enlarged by a node's MemoryProfile.
+constexpr size_t kMaxPrimaryBufferSize = 16 * 1024 * 1024;
+
 // The front of the primary buffer is reserved for special current and future
 // uses which require synchronous availability throughout a link's lifetime.
 constexpr size_t kPrimaryBufferReservedHeaderSize = 256;
@@ -44,6 +55,17 @@ constexpr size_t kBlockAllocatorPageSize = 64 * 1024;
 // See comments on kBlockAllocatorPageSize above.
 constexpr size_t kMinBlockAllocatorCapacity = 8;
 
+// The maximum number of blocks which can be managed by a single BlockAllocator
+// with narrow headers, including its unallocable first block. All allocators in
+// the primary buffer use narrow headers.
+constexpr size_t kMaxBlocksPerNarrowAllocator =
+    std::numeric_limits<int16_t>::max();
+
+// The maximum size of a new buffer allocated for blocks of any size. This is
+// only reachable with wide BlockAllocator headers, and it keeps fragment
+// offsets well within 32 bits.
+constexpr size_t kMaxBlockBufferSize = 256 * 1024 * 1024;
+
 // The maximum total BlockAllocator capacity to automatically reserve for any
 // given fragment size within the BufferPool. This is not a hard cap on capacity
 // per fragment size, but it sets a limit on how large the pool will grow
@@ -64,6 +86,33 @@ constexpr size_t kMaxFragmentSizeForBlockAllocation = 1024 * 1024;
 // when the requested size cannot be accommodated.
 constexpr size_t kMinBestEffortFallbackBlockSize = 4096;
 
+// The largest block size with a fixed BlockAllocator in the primary buffer.
+// Any extra space in an enlarged primary buffer is only used for larger sizes,
+// since each buffer may have at most one BlockAllocator per block size.
+constexpr size_t kMaxFixedPrimaryBufferBlockSize = 4096;
+
+// The maximum number of additional BlockAllocators which can reside in the
+// extra space of an enlarged primary buffer.
+constexpr size_t kMaxPrimaryBufferExtensionAllocators = 8;
+
+// The size of each of the two MessageRings appended to a primary buffer when
+// the allocating node supports message rings. (64 kB)
+constexpr size_t kMessageRingSize = 64 * 1024;
+
+// The maximum fragment size to support with dedicated large buffers, which are
+// used for fragments beyond kMaxFragmentSizeForBlockAllocation. Allocations
+// beyond this size always fail.
+constexpr size_t kMaxFragmentSizeForLargeAllocation = 128 * 1024 * 1024;
+
+// Large buffer capacity is allocated in multiples of this size, so that buffers
+// can be reused for other fragments of similar size.
+constexpr size_t kLargeBufferCapacityGranularity = 1024 * 1024;
+
+// The maximum total capacity to automatically reserve for large fragments
+// within the BufferPool. Like kMaxBlockAllocatorCapacityPerFragmentSize, this
+// only limits how large the pool will grow in response to failed allocations.
+constexpr size_t kMaxTotalLargeBufferCapacity = 256 * 1024 * 1024;
+
 // The number of fixed RouterLinkState locations in the primary buffer. This
 // limits the maximum number of initial portals supported by the ConnectNode()
 // API. Note that these states reside in a fixed location at the end of the
@@ -73,6 +122,14 @@ using InitialRouterLinkStateArray =
 static_assert(sizeof(InitialRouterLinkStateArray) == 768,
               "Invalid InitialRouterLinkStateArray size");
 
+// Describes a BlockAllocator within the extra space of an enlarged primary
+// buffer, beyond its fixed layout.
+struct PrimaryBufferExtensionAllocator {
+  uint32_t block_size;
+  uint32_t offset;
+  uint32_t size;
+};
+
 struct IPCZ_ALIGN(8) PrimaryBufferHeader {
   // Atomic generator for new unique BufferIds to use across the associated
   // NodeLink. This allows each side of a NodeLink to generate new BufferIds
@@ -83,6 +140,23 @@ struct IPCZ_ALIGN(8) PrimaryBufferHeader {
   // NodeLink. This allows each side of a NodeLink to generate new SublinkIds
   // spontaneously without synchronization or risk of collisions.
   std::atomic<uint64_t> next_sublink_id;
+
+  // BlockAllocators placed in the extra space of a primary buffer enlarged by
+  // the allocating node's MemoryProfile. Written once when the buffer is
+  // initialized, and only honored when both nodes support mem_v2.
+  uint32_t num_extension_allocators;
+  uint32_t reserved;
+  std::array<PrimaryBufferExtensionAllocator,
+             kMaxPrimaryBufferExtensionAllocators>
+      extension_allocators;
+
+  // The location of two adjacent MessageRings at the end of a primary buffer
+  // allocated by a node which supports message rings, or zero if there are
+  // none. The first ring carries messages from side A to side B, and the second
+  // carries messages from side B to side A. Written once when the buffer is
+  // initialized, and only honored when both nodes support message rings.
+  uint32_t message_ring_offset;
+  uint32_t message_ring_size;
 };
 
 static_assert(sizeof(PrimaryBufferHeader) < kPrimaryBufferReservedHeaderSize);
@@ -100,6 +174,134 @@ size_t GetBlockSizeForFragmentSize(size_t fragment_size) {
   return std::max(kMinFragmentSize, absl::bit_ceil(fragment_size));
 }
 
+size_t GetLargeBufferCapacityForFragmentSize(size_t fragment_size) {
+  return (fragment_size + kLargeBufferCapacityGranularity - 1) /
+         kLargeBufferCapacityGranularity * kLargeBufferCapacityGranularity;
+}
+
+// Returns the size of a new buffer to allocate for blocks of `block_size`
+// bytes, with enough capacity for at least `min_capacity` bytes if possible.
+// `header_format` determines how many blocks the buffer can hold.
+size_t GetBlockBufferSize(size_t block_size,
+                          size_t min_capacity,
+                          BlockAllocator::HeaderFormat header_format) {
+  // Note that the first block of every BlockAllocator is unallocable.
+  const size_t max_blocks =
+      std::min(BlockAllocator::GetMaxNumBlocks(header_format),
+               kMaxBlockBufferSize / block_size);
+  const size_t num_blocks =
+      std::clamp((min_capacity + block_size - 1) / block_size + 1,
+                 kMinBlockAllocatorCapacity, max_blocks);
+  const size_t num_pages =
+      (num_blocks * block_size + kBlockAllocatorPageSize - 1) /
+      kBlockAllocatorPageSize;
+  const size_t max_pages = max_blocks * block_size / kBlockAllocatorPageSize;
+  return std::min(num_pages, max_pages) * kBlockAllocatorPageSize;
+}
+
+// Returns the block capacities requested by `profile`, sorted by block size
+// with a single entry for each. Fragment sizes too large for block allocation
+// are ignored.
+std::vector<std::pair<size_t, size_t>> GetBlockCapacitiesForProfile(
+    const MemoryProfile& profile) {
+  std::vector<std::pair<size_t, size_t>> capacities;
+  for (const IpczMemoryCapacity& entry : profile.capacities()) {
+    if (entry.fragment_size <= kMaxFragmentSizeForBlockAllocation) {
+      capacities.emplace_back(GetBlockSizeForFragmentSize(entry.fragment_size),
+                              entry.capacity);
+    }
+  }
+  std::sort(capacities.begin(), capacities.end());
+
+  // Where the profile has multiple entries for the same block size, keep the
+  // largest capacity. Thanks to sorting, that's always the last one.
+  std::vector<std::pair<size_t, size_t>> merged_capacities;
+  for (const auto& [block_size, capacity] : capacities) {
+    if (!merged_capacities.empty() &&
+        merged_capacities.back().first == block_size) {
+      merged_capacities.back().second = capacity;
+    } else {
+      merged_capacities.emplace_back(block_size, capacity);
+    }
+  }
+  return merged_capacities;
+}
+
+// Divides the extra space of an enlarged primary buffer among new
+// BlockAllocators for the large block sizes requested by `profile`, and records
+// them in `header`.
+void InitializeExtensionAllocators(PrimaryBufferHeader& header,
+                                   absl::Span<uint8_t> buffer,
+                                   const MemoryProfile& profile) {
+  uint32_t num_allocators = 0;
+  size_t offset = kPrimaryBufferSize;
+  for (const auto& [block_size, capacity] :
+       GetBlockCapacitiesForProfile(profile)) {
+    if (block_size <= kMaxFixedPrimaryBufferBlockSize) {
+      continue;
+    }
+    if (num_allocators == kMaxPrimaryBufferExtensionAllocators) {
+      break;
+    }
+
+    const size_t max_blocks = std::min(kMaxBlocksPerNarrowAllocator,
+                                       (buffer.size() - offset) / block_size);
+    const size_t num_blocks =
+        std::min((capacity + block_size - 1) / block_size + 1, max_blocks);
+    if (num_blocks < 2) {
+      continue;
+    }
+
+    const size_t size = num_blocks * block_size;
+    BlockAllocator(buffer.subspan(offset, size),
+                   static_cast<uint32_t>(block_size))
+        .InitializeRegion();
+    header.extension_allocators[num_allocators++] = {
+        .block_size = static_cast<uint32_t>(block_size),
+        .offset = static_cast<uint32_t>(offset),
+        .size = static_cast<uint32_t>(size),
+    };
+    offset += size;
+  }
+  header.num_extension_allocators = num_allocators;
+}
+
+// Validates the extension allocators recorded in `header` for the primary
+// buffer in `buffer`, and appends a BlockAllocator to `allocators` for each.
+// The header was written by whichever node allocated the buffer, so validation
+// stops at the first entry which is out of bounds, overlaps another, or
+// duplicates a block size already in use.
+template <typename AllocatorList>
+void AppendExtensionAllocators(const PrimaryBufferHeader& header,
+                               absl::Span<uint8_t> buffer,
+                               AllocatorList& allocators) {
+  const size_t num_allocators = std::min<size_t>(
+      header.num_extension_allocators, kMaxPrimaryBufferExtensionAllocators);
+  size_t min_offset = kPrimaryBufferSize;
+  size_t min_block_size = kMaxFixedPrimaryBufferBlockSize + 1;
+  for (size_t i = 0; i < num_allocators; ++i) {
+    const PrimaryBufferExtensionAllocator& entry =
+        header.extension_allocators[i];
+    const size_t block_size = entry.block_size;
+    const size_t offset = entry.offset;
+    const size_t size = entry.size;
+    if (block_size < min_block_size || !absl::has_single_bit(block_size) ||
+        block_size > kMaxFragmentSizeForBlockAllocation ||
+        offset < min_offset || offset % 8 != 0 || size % block_size != 0 ||
+        size / block_size < 2 ||
+        size / block_size > kMaxBlocksPerNarrowAllocator ||
+        size > buffer.size() || offset > buffer.size() - size) {
+      DLOG(ERROR) << "Ignoring invalid primary buffer extension allocator";
+      return;
+    }
+
+    allocators.emplace_back(buffer.subspan(offset, size),
+                            static_cast<uint32_t>(block_size));
+    min_offset = offset + size;
+    min_block_size = block_size + 1;
+  }
+}
+
 }  // namespace
 
 // This structure always sits at offset 0 in the primary buffer and has a fixed
@@ -158,9 +360,13 @@ NodeLinkMemory::NodeLinkMemory(Ref<Node> node,
     : node_(std::move(node)),
       link_side_(side),
       available_features_(node_->features().Intersect(remote_features)),
+      block_header_format_(available_features_.wide_block_allocators()
+                               ? BlockAllocator::HeaderFormat::kWide
+                               : BlockAllocator::HeaderFormat::kNarrow),
       allow_memory_expansion_for_parcel_data_(
           (node_->options().memory_flags & IPCZ_MEMORY_FIXED_PARCEL_CAPACITY) ==
           0),
+      idle_buffer_check_interval_(node_->options().idle_buffer_check_interval),
       primary_buffer_memory_(primary_buffer_memory.bytes()),
       primary_buffer_(
           *reinterpret_cast<PrimaryBuffer*>(primary_buffer_memory_.data())) {
@@ -169,43 +375,79 @@ NodeLinkMemory::NodeLinkMemory(Ref<Node> node,
                 "PrimaryBuffer structure is too large.");
   ABSL_HARDENING_ASSERT(primary_buffer_memory_.size() >= kPrimaryBufferSize);
 
-  const BlockAllocator allocators[] = {primary_buffer_.block_allocator_64(),
-                                       primary_buffer_.block_allocator_256(),
-                                       primary_buffer_.block_allocator_512(),
-                                       primary_buffer_.block_allocator_1k(),
-                                       primary_buffer_.block_allocator_2k(),
-                                       primary_buffer_.block_allocator_4k()};
+  absl::InlinedVector<BlockAllocator, 6 + kMaxPrimaryBufferExtensionAllocators>
+      allocators = {primary_buffer_.block_allocator_64(),
+                    primary_buffer_.block_allocator_256(),
+                    primary_buffer_.block_allocator_512(),
+                    primary_buffer_.block_allocator_1k(),
+                    primary_buffer_.block_allocator_2k(),
+                    primary_buffer_.block_allocator_4k()};
+  if (available_features_.mem_v2()) {
+    AppendExtensionAllocators(primary_buffer_.header, primary_buffer_memory_,
+                              allocators);
+  }
   buffer_pool_.AddBlockBuffer(kPrimaryBufferId,
                               std::move(primary_buffer_memory), allocators);
+
+  if (available_features_.message_rings()) {
+    // As with extension allocators, the ring locations were written by
+    // whichever node allocated the buffer, so they must be validated.
+    const size_t offset = primary_buffer_.header.message_ring_offset;
+    const size_t size = primary_buffer_.header.message_ring_size;
+    if (offset >= kPrimaryBufferSize && offset % 8 == 0 &&
+        size >= MessageRing::kMinRegionSize && size % 8 == 0 &&
+        size <= primary_buffer_memory_.size() / 2 &&
+        offset <= primary_buffer_memory_.size() - 2 * size) {
+      message_ring_memory_[0] = primary_buffer_memory_.subspan(offset, size);
+      message_ring_memory_[1] =
+          primary_buffer_memory_.subspan(offset + size, size);
+    } else if (offset || size) {
+      DLOG(ERROR) << "Ignoring invalid primary buffer message rings";
+    }
+  }
 }
 
 NodeLinkMemory::~NodeLinkMemory() = default;
 
 void NodeLinkMemory::SetNodeLink(Ref<NodeLink> link) {
-  std::vector<size_t> block_sizes_needed;
+  std::vector<std::pair<size_t, size_t>> block_sizes_needed;
   {
     absl::MutexLock lock(&mutex_);
-    node_link_ = std::move(link);
+    node_link_ = link;
     if (!node_link_) {
       return;
     }
 
     // Any capcity requests accumulated before NodeLink activation can be
     // carried out now.
-    for (auto& [size, callbacks] : capacity_callbacks_) {
-      block_sizes_needed.push_back(size);
+    for (auto& [size, request] : capacity_requests_) {
+      block_sizes_needed.emplace_back(size, request.min_capacity);
     }
   }
 
-  for (size_t size : block_sizes_needed) {
-    RequestBlockCapacity(size, [](bool) {});
+  for (auto [size, min_capacity] : block_sizes_needed) {
+    AllocateBlockBuffer(
+        size, GetBlockBufferSize(size, min_capacity, block_header_format_),
+        link);
+  }
+
+  if (link->link_side().is_side_a()) {
+    ProvisionInitialCapacity();
   }
 }
 
 // static
 DriverMemoryWithMapping NodeLinkMemory::AllocateMemory(
-    const IpczDriver& driver) {
-  DriverMemory memory(driver, kPrimaryBufferSize);
+    const IpczDriver& driver,
+    const MemoryProfile& profile,
+    const Features& features) {
+  const size_t allocator_space_size =
+      std::clamp(profile.primary_buffer_size(), kPrimaryBufferSize,
+                 kMaxPrimaryBufferSize);
+  const size_t message_rings_size =
+      features.message_rings() ? 2 * kMessageRingSize : 0;
+  const size_t buffer_size = allocator_space_size + message_rings_size;
+  DriverMemory memory(driver, buffer_size);
   if (!memory.is_valid()) {
     return {};
   }
@@ -229,6 +471,21 @@ DriverMemoryWithMapping NodeLinkMemory::AllocateMemory(
   primary_buffer.header.next_sublink_id.store(kMaxInitialPortals,
                                               std::memory_order_relaxed);
 
+  InitializeExtensionAllocators(primary_buffer.header,
+                                mapping.bytes().first(allocator_space_size),
+                                profile);
+  if (message_rings_size) {
+    primary_buffer.header.message_ring_offset =
+        static_cast<uint32_t>(allocator_space_size);
+    primary_buffer.header.message_ring_size = kMessageRingSize;
+    for (size_t i = 0; i < 2; ++i) {
+      MessageRing(mapping.bytes().subspan(
+                      allocator_space_size + i * kMessageRingSize,
+                      kMessageRingSize))
+          .InitializeRegion();
+    }
+  }
+
   // Note: InitializeRegion() performs an atomic release, so atomic stores
   // before this section can be relaxed.
   primary_buffer.block_allocator_64().InitializeRegion();
@@ -249,6 +506,11 @@ Ref<NodeLinkMemory> NodeLinkMemory::Create(Ref<Node> node,
                                      std::move(memory)));
 }
 
+absl::Span<uint8_t> NodeLinkMemory::GetMessageRingMemory(
+    LinkSide from_side) const {
+  return message_ring_memory_[from_side.is_side_a() ? 0 : 1];
+}
+
 BufferId NodeLinkMemory::AllocateNewBufferId() {
   if (available_features_.mem_v2()) {
     const uint64_t side_bit =
@@ -290,37 +552,119 @@ Fragment NodeLinkMemory::GetFragment(const FragmentDescriptor& descriptor) {
   return buffer_pool_.GetFragment(descriptor);
 }
 
+void NodeLinkMemory::AddFragmentHold(const Fragment& fragment) {
+  buffer_pool_.AddFragmentHold(fragment);
+}
+
+void NodeLinkMemory::ReleaseFragment(const Fragment& fragment) {
+  buffer_pool_.ReleaseFragment(fragment);
+}
+
 bool NodeLinkMemory::AddBlockBuffer(BufferId id,
                                     size_t block_size,
                                     DriverMemoryMapping mapping) {
-  const BlockAllocator allocator(mapping.bytes(), block_size);
+  if (block_size < kMinFragmentSize ||
+      block_size > kMaxFragmentSizeForBlockAllocation ||
+      !absl::has_single_bit(block_size)) {
+    DLOG(ERROR) << "Invalid block size " << block_size;
+    return false;
+  }
+
+  const size_t num_blocks = mapping.bytes().size() / block_size;
+  if (num_blocks == 0 ||
+      num_blocks > BlockAllocator::GetMaxNumBlocks(block_header_format_)) {
+    DLOG(ERROR) << "Invalid block buffer size " << mapping.bytes().size();
+    return false;
+  }
+
+  const BlockAllocator allocator(mapping.bytes(),
+                                 static_cast<uint32_t>(block_size),
+                                 block_header_format_);
   return buffer_pool_.AddBlockBuffer(id, std::move(mapping), {&allocator, 1});
 }
 
+bool NodeLinkMemory::AddLargeBuffer(BufferId id, DriverMemoryMapping mapping) {
+  return buffer_pool_.AddLargeBuffer(id, std::move(mapping));
+}
+
+bool NodeLinkMemory::RetireRemoteBuffer(BufferId id, bool& retired) {
+  // Only buffers allocated by the remote node can be retired at its request,
+  // and with mem_v2 their BufferIds always identify the remote side.
+  const bool is_side_b_id = (id.value() >> kLinkSideBIdBit) != 0;
+  if (!available_features_.mem_v2() || id == kPrimaryBufferId ||
+      is_side_b_id == link_side_.is_side_b()) {
+    return false;
+  }
+
+  const BufferPool::RetireResult result = buffer_pool_.TryRetireBuffer(id);
+  if (result == BufferPool::RetireResult::kInvalid) {
+    return false;
+  }
+
+  retired = result == BufferPool::RetireResult::kRetired;
+  return true;
+}
+
+bool NodeLinkMemory::CompleteBufferRetirement(BufferId id, bool retired) {
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = expansion_buffers_.find(id);
+    if (it == expansion_buffers_.end() ||
+        it->second != ExpansionBufferState::kRetiring) {
+      return false;
+    }
+
+    if (!retired) {
+      // The remote node is still using the buffer. It may be retired by a
+      // later check once it's idle on both sides.
+      it->second = ExpansionBufferState::kActive;
+      return true;
+    }
+    expansion_buffers_.erase(it);
+  }
+
+  // The remote node has claimed all of the buffer's capacity, so neither side
+  // can allocate from it anymore.
+  return buffer_pool_.RemoveRetiredBuffer(id);
+}
+
 Fragment NodeLinkMemory::AllocateFragment(size_t size) {
-  if (size == 0 || size > kMaxFragmentSizeForBlockAllocation) {
-    // TODO: Support an alternative allocation scheme for large requests.
+  if (size == 0) {
     return {};
   }
 
+  if (size > kMaxFragmentSizeForBlockAllocation) {
+    return AllocateLargeFragment(size);
+  }
+
   const size_t block_size = GetBlockSizeForFragmentSize(size);
-  Fragment fragment = buffer_pool_.AllocateBlock(block_size);
+  bool low_capacity = false;
+  Fragment fragment = buffer_pool_.AllocateBlock(block_size, &low_capacity);
+  AllocationCounters& counters =
+      GetSizeClassState(block_size).GetCountersForCurrentThread();
   if (fragment.is_null()) {
-    // Use failure as a hint to possibly expand the pool's capacity. The
-    // caller's allocation will still fail, but maybe future allocations won't.
-    if (CanExpandBlockCapacity(block_size)) {
-      RequestBlockCapacity(block_size, [](bool success) {
-        if (!success) {
-          DLOG(ERROR) << "Failed to allocate new block capacity.";
-        }
-      });
-    }
+    counters.num_failures.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    counters.num_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (low_capacity) {
+    // Use failure or near-exhaustion as a hint to possibly expand the pool's
+    // capacity. A failed allocation will still fail, but maybe future
+    // allocations won't.
+    MaybeExpandBlockCapacity(block_size);
   }
   return fragment;
 }
 
 Fragment NodeLinkMemory::AllocateFragmentBestEffort(size_t size) {
-  // TODO: Support an alternative allocation scheme for larger requests.
+  if (size > kMaxFragmentSizeForBlockAllocation) {
+    const Fragment fragment = AllocateLargeFragment(size);
+    if (!fragment.is_null()) {
+      return fragment;
+    }
+  }
+
   const size_t ideal_block_size = GetBlockSizeForFragmentSize(size);
   const size_t largest_block_size =
       std::min(ideal_block_size, kMaxFragmentSizeForBlockAllocation);
@@ -337,15 +681,14 @@ Fragment NodeLinkMemory::AllocateFragmentBestEffort(size_t size) {
 }
 
 bool NodeLinkMemory::FreeFragment(const Fragment& fragment) {
-  if (fragment.is_null() ||
-      fragment.size() > kMaxFragmentSizeForBlockAllocation) {
-    // TODO: Once we support larger non-block-based allocations, support freeing
-    // them from here as well.
+  if (fragment.is_null()) {
     return false;
   }
 
   ABSL_ASSERT(fragment.is_addressable());
-  return buffer_pool_.FreeBlock(fragment);
+  return fragment.size() > kMaxFragmentSizeForBlockAllocation
+             ? buffer_pool_.FreeLargeFragment(fragment)
+             : buffer_pool_.FreeBlock(fragment);
 }
 
 FragmentRef<RouterLinkState> NodeLinkMemory::TryAllocateRouterLinkState() {
@@ -387,28 +730,172 @@ void NodeLinkMemory::WaitForBufferAsync(
   buffer_pool_.WaitForBufferAsync(id, std::move(callback));
 }
 
-bool NodeLinkMemory::CanExpandBlockCapacity(size_t block_size) {
-  return allow_memory_expansion_for_parcel_data_ &&
-         buffer_pool_.GetTotalBlockCapacity(block_size) <
-             kMaxBlockAllocatorCapacityPerFragmentSize;
+NodeLinkMemory::BlockSizeClassStats NodeLinkMemory::GetBlockSizeClassStats(
+    size_t fragment_size) {
+  const SizeClassState& state =
+      GetSizeClassState(GetBlockSizeForFragmentSize(fragment_size));
+  return {
+      .num_allocations = state.GetNumAllocations(),
+      .num_failures = state.GetNumFailures(),
+      .high_water_mark = state.high_water_mark.load(std::memory_order_relaxed),
+      .num_expansions = state.num_expansions.load(std::memory_order_relaxed),
+  };
+}
+
+void NodeLinkMemory::RecordParcelDataPath(ParcelDataPath path) {
+  switch (path) {
+    case ParcelDataPath::kFragment:
+      num_parcels_with_fragment_data_.fetch_add(1, std::memory_order_relaxed);
+      break;
+    case ParcelDataPath::kMigratedFragment:
+      num_parcels_with_migrated_fragment_data_.fetch_add(
+          1, std::memory_order_relaxed);
+      break;
+    case ParcelDataPath::kInlined:
+      num_parcels_with_inlined_data_.fetch_add(1, std::memory_order_relaxed);
+      break;
+  }
+}
+
+void NodeLinkMemory::QueryMemoryStats(IpczNodeLinkMemoryStats& stats) {
+  static_assert(kNumBlockSizeClasses == IPCZ_MAX_BLOCK_SIZE_CLASSES);
+  const BufferPool::MemoryStats pool_stats = buffer_pool_.GetMemoryStats();
+  stats.primary_buffer_size = primary_buffer_memory_.size();
+  stats.num_buffers = pool_stats.num_buffers;
+  stats.total_buffer_size = pool_stats.total_buffer_size;
+  stats.num_large_buffers = pool_stats.num_large_buffers;
+  stats.total_large_buffer_size = pool_stats.total_large_buffer_size;
+  stats.num_allocated_large_buffers = pool_stats.num_allocated_large_buffers;
+
+  stats.num_block_size_classes = 0;
+  for (const auto& block_stats : pool_stats.block_stats) {
+    if (stats.num_block_size_classes == IPCZ_MAX_BLOCK_SIZE_CLASSES) {
+      break;
+    }
+    stats.block_size_classes[stats.num_block_size_classes++] = {
+        .block_size = block_stats.block_size,
+        .num_allocators = block_stats.num_allocators,
+        .num_blocks = block_stats.num_blocks,
+        .num_free_blocks = block_stats.num_free_blocks,
+        .num_cached_blocks = block_stats.num_cached_blocks,
+    };
+  }
+
+  stats.num_parcels_with_fragment_data =
+      num_parcels_with_fragment_data_.load(std::memory_order_relaxed);
+  stats.num_parcels_with_migrated_fragment_data =
+      num_parcels_with_migrated_fragment_data_.load(std::memory_order_relaxed);
+  stats.num_parcels_with_inlined_data =
+      num_parcels_with_inlined_data_.load(std::memory_order_relaxed);
+
+  absl::MutexLock lock(&mutex_);
+  stats.num_pending_block_capacity_requests = capacity_requests_.size();
+  stats.num_pending_large_buffer_requests =
+      pending_large_buffer_requests_.size();
+}
+
+NodeLinkMemory::SizeClassState& NodeLinkMemory::GetSizeClassState(
+    size_t block_size) {
+  static_assert(kNumBlockSizeClasses ==
+                absl::countr_zero(kMaxFragmentSizeForBlockAllocation) -
+                    absl::countr_zero(kMinFragmentSize) + 1);
+  ABSL_ASSERT(absl::has_single_bit(block_size));
+  ABSL_ASSERT(block_size >= kMinFragmentSize);
+  ABSL_ASSERT(block_size <= kMaxFragmentSizeForBlockAllocation);
+  return size_classes_[absl::countr_zero(block_size) -
+                       absl::countr_zero(kMinFragmentSize)];
+}
+
+NodeLinkMemory::AllocationCounters&
+NodeLinkMemory::SizeClassState::GetCountersForCurrentThread() {
+  // This matches the thread's magazine assignment within BlockAllocatorPool.
+  return counters[GetCurrentThreadIndex() % counters.size()];
+}
+
+uint64_t NodeLinkMemory::SizeClassState::GetNumAllocations() const {
+  uint64_t num_allocations = 0;
+  for (const AllocationCounters& magazine_counters : counters) {
+    num_allocations +=
+        magazine_counters.num_allocations.load(std::memory_order_relaxed);
+  }
+  return num_allocations;
+}
+
+uint64_t NodeLinkMemory::SizeClassState::GetNumFailures() const {
+  uint64_t num_failures = 0;
+  for (const AllocationCounters& magazine_counters : counters) {
+    num_failures +=
+        magazine_counters.num_failures.load(std::memory_order_relaxed);
+  }
+  return num_failures;
+}
+
+void NodeLinkMemory::MaybeExpandBlockCapacity(size_t block_size) {
+  if (!allow_memory_expansion_for_parcel_data_) {
+    return;
+  }
+
+  SizeClassState& state = GetSizeClassState(block_size);
+  if (state.is_expansion_pending.exchange(true, std::memory_order_relaxed)) {
+    return;
+  }
+
+  const size_t capacity = buffer_pool_.GetTotalBlockCapacity(block_size);
+  if (capacity >= kMaxBlockAllocatorCapacityPerFragmentSize) {
+    state.is_expansion_pending.store(false, std::memory_order_relaxed);
+    return;
+  }
+
+  // Capacity grows geometrically while under pressure, so each expansion is at
+  // least as large as the existing capacity. It must also absorb at least as
+  // many allocations as the busiest interval between expansions so far. If
+  // allocations have failed since the last expansion, growth isn't keeping
+  // ahead of demand, so double it.
+  const uint64_t num_allocations = state.GetNumAllocations();
+  const uint64_t num_failures = state.GetNumFailures();
+  const uint64_t demand =
+      num_allocations - state.allocations_at_last_expansion.exchange(
+                            num_allocations, std::memory_order_relaxed);
+  const uint64_t new_failures =
+      num_failures - state.failures_at_last_expansion.exchange(
+                         num_failures, std::memory_order_relaxed);
+  const uint64_t high_water_mark = std::max(
+      state.high_water_mark.load(std::memory_order_relaxed), demand);
+  state.high_water_mark.store(high_water_mark, std::memory_order_relaxed);
+  state.num_expansions.fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t num_blocks = std::min<uint64_t>(
+      std::max<uint64_t>(high_water_mark, capacity / block_size),
+      kMaxBlocksPerNarrowAllocator);
+  if (new_failures > 0) {
+    num_blocks *= 2;
+  }
+  const size_t min_capacity =
+      std::min(static_cast<size_t>(num_blocks) * block_size,
+               kMaxBlockAllocatorCapacityPerFragmentSize - capacity);
+  RequestBlockCapacity(
+      block_size,
+      [](bool success) {
+        if (!success) {
+          DLOG(ERROR) << "Failed to allocate new block capacity.";
+        }
+      },
+      min_capacity);
 }
 
 void NodeLinkMemory::RequestBlockCapacity(
     size_t block_size,
-    RequestBlockCapacityCallback callback) {
+    RequestBlockCapacityCallback callback,
+    size_t min_capacity) {
   ABSL_ASSERT(block_size >= kMinFragmentSize);
 
-  const size_t min_buffer_size = block_size * kMinBlockAllocatorCapacity;
-  const size_t num_pages =
-      (min_buffer_size + kBlockAllocatorPageSize - 1) / kBlockAllocatorPageSize;
-  const size_t buffer_size = num_pages * kBlockAllocatorPageSize;
-
   Ref<NodeLink> link;
   {
     absl::MutexLock lock(&mutex_);
     auto [it, need_new_request] =
-        capacity_callbacks_.emplace(block_size, CapacityCallbackList());
-    it->second.push_back(std::move(callback));
+        capacity_requests_.emplace(block_size, PendingCapacityRequest());
+    it->second.callbacks.push_back(std::move(callback));
+    it->second.min_capacity = std::max(it->second.min_capacity, min_capacity);
     if (!need_new_request) {
       // There was already a request pending for this block size. `callback`
       // will be run when that request completes.
@@ -424,6 +911,15 @@ void NodeLinkMemory::RequestBlockCapacity(
     link = node_link_;
   }
 
+  AllocateBlockBuffer(
+      block_size,
+      GetBlockBufferSize(block_size, min_capacity, block_header_format_),
+      std::move(link));
+}
+
+void NodeLinkMemory::AllocateBlockBuffer(size_t block_size,
+                                         size_t buffer_size,
+                                         Ref<NodeLink> link) {
   node_->AllocateSharedMemory(
       buffer_size, [self = WrapRefCounted(this), block_size,
                     link = std::move(link)](DriverMemory memory) {
@@ -433,7 +929,9 @@ void NodeLinkMemory::RequestBlockCapacity(
           return;
         }
 
-        BlockAllocator allocator(mapping.bytes(), block_size);
+        BlockAllocator allocator(mapping.bytes(),
+                                 static_cast<uint32_t>(block_size),
+                                 self->block_header_format_);
         allocator.InitializeRegion();
 
         // SUBTLE: We first share the new buffer with the remote node, then
@@ -452,22 +950,93 @@ void NodeLinkMemory::RequestBlockCapacity(
         const BufferId id = self->AllocateNewBufferId();
         link->AddBlockBuffer(id, block_size, std::move(memory));
         self->AddBlockBuffer(id, block_size, std::move(mapping));
+        self->AddExpansionBuffer(id);
         self->OnCapacityRequestComplete(block_size, true);
       });
 }
 
+Fragment NodeLinkMemory::AllocateLargeFragment(size_t size) {
+  // Large buffers are shared using a message which older nodes may not
+  // understand, so they're only used when both nodes support mem_v2.
+  if (!available_features_.mem_v2() ||
+      size > kMaxFragmentSizeForLargeAllocation) {
+    return {};
+  }
+
+  Fragment fragment = buffer_pool_.AllocateLargeFragment(size);
+  if (fragment.is_null()) {
+    // As with block allocation, use failure as a hint to expand capacity for
+    // future allocations.
+    const size_t capacity = GetLargeBufferCapacityForFragmentSize(size);
+    if (CanExpandLargeBufferCapacity(capacity)) {
+      RequestLargeBuffer(capacity);
+    }
+  }
+  return fragment;
+}
+
+bool NodeLinkMemory::CanExpandLargeBufferCapacity(size_t capacity) {
+  return allow_memory_expansion_for_parcel_data_ &&
+         buffer_pool_.GetTotalLargeBufferCapacity() + capacity <=
+             kMaxTotalLargeBufferCapacity;
+}
+
+void NodeLinkMemory::RequestLargeBuffer(size_t capacity) {
+  Ref<NodeLink> link;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!node_link_) {
+      // There's no link to share a new buffer with yet.
+      return;
+    }
+
+    auto [it, inserted] = pending_large_buffer_requests_.insert(capacity);
+    if (!inserted) {
+      // A request for the same capacity is already in progress.
+      return;
+    }
+    link = node_link_;
+  }
+
+  const size_t buffer_size = BufferPool::kLargeBufferHeaderSize + capacity;
+  node_->AllocateSharedMemory(
+      buffer_size, [self = WrapRefCounted(this), capacity,
+                    link = std::move(link)](DriverMemory memory) {
+        DriverMemoryMapping mapping = memory.Map();
+        if (mapping.is_valid()) {
+          BufferPool::InitializeLargeBuffer(mapping.bytes());
+
+          // SUBTLE: As with block buffers in RequestBlockCapacity(), the new
+          // buffer must be shared with the remote node before it's registered
+          // locally.
+          const BufferId id = self->AllocateNewBufferId();
+          link->AddLargeBuffer(id, std::move(memory));
+          self->AddLargeBuffer(id, std::move(mapping));
+          self->AddExpansionBuffer(id);
+        } else {
+          DLOG(ERROR) << "Failed to allocate new large buffer.";
+        }
+
+        absl::MutexLock lock(&self->mutex_);
+        self->pending_large_buffer_requests_.erase(capacity);
+      });
+}
+
 void NodeLinkMemory::OnCapacityRequestComplete(size_t block_size,
                                                bool success) {
+  GetSizeClassState(block_size).is_expansion_pending.store(
+      false, std::memory_order_relaxed);
+
   CapacityCallbackList callbacks;
   {
     absl::MutexLock lock(&mutex_);
-    auto it = capacity_callbacks_.find(block_size);
-    if (it == capacity_callbacks_.end()) {
+    auto it = capacity_requests_.find(block_size);
+    if (it == capacity_requests_.end()) {
       return;
     }
 
-    callbacks = std::move(it->second);
-    capacity_callbacks_.erase(it);
+    callbacks = std::move(it->second.callbacks);
+    capacity_requests_.erase(it);
   }
 
   for (auto& callback : callbacks) {
@@ -475,6 +1044,76 @@ void NodeLinkMemory::OnCapacityRequestComplete(size_t block_size,
   }
 }
 
+void NodeLinkMemory::ProvisionInitialCapacity() {
+  for (const auto& [block_size, capacity] :
+       GetBlockCapacitiesForProfile(node_->memory_profile())) {
+    const size_t current_capacity =
+        buffer_pool_.GetTotalBlockCapacity(block_size);
+    if (current_capacity >= capacity) {
+      continue;
+    }
+
+    RequestBlockCapacity(
+        block_size,
+        [](bool success) {
+          if (!success) {
+            DLOG(ERROR) << "Failed to provision initial block capacity.";
+          }
+        },
+        capacity - current_capacity);
+  }
+}
+
+void NodeLinkMemory::AddExpansionBuffer(BufferId id) {
+  absl::MutexLock lock(&mutex_);
+  expansion_buffers_[id] = ExpansionBufferState::kNew;
+}
+
+void NodeLinkMemory::MaybeReclaimIdleBuffers() {
+  // Retirement relies on BufferIds which identify the side that allocated each
+  // buffer, so it's only supported with mem_v2.
+  if (idle_buffer_check_interval_ == 0 || !available_features_.mem_v2()) {
+    return;
+  }
+
+  const uint32_t n =
+      num_messages_received_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (n % idle_buffer_check_interval_ == 0) {
+    ReclaimIdleBuffers();
+  }
+}
+
+void NodeLinkMemory::ReclaimIdleBuffers() {
+  // Blocks freed on this side may be cached locally rather than freed to their
+  // buffers, which would keep the remote node from claiming them.
+  buffer_pool_.FlushCachedBlocks();
+  buffer_pool_.ReleaseRetiredBuffers();
+
+  Ref<NodeLink> link;
+  std::vector<BufferId> idle_buffers;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (!node_link_) {
+      return;
+    }
+
+    link = node_link_;
+    for (auto& [id, state] : expansion_buffers_) {
+      if (state == ExpansionBufferState::kNew) {
+        state = ExpansionBufferState::kActive;
+      } else if (state == ExpansionBufferState::kActive &&
+                 buffer_pool_.IsRetirableBufferIdle(id)) {
+        state = ExpansionBufferState::kRetiring;
+        idle_buffers.push_back(id);
+      }
+    }
+  }
+
+  for (BufferId id : idle_buffers) {
+    link->RetireBuffer(id);
+  }
+}
+
 FragmentRef<RouterLinkState> NodeLinkMemory::InitializeRouterLinkStateFragment(
     const Fragment& fragment) {
   ABSL_ASSERT(!fragment.is_null());
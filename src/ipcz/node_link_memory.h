@@ -5,12 +5,15 @@
 #ifndef IPCZ_SRC_IPCZ_NODE_LINK_MEMORY_H_
 #define IPCZ_SRC_IPCZ_NODE_LINK_MEMORY_H_
 
+#include <array>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <vector>
 
+#include "ipcz/block_allocator.h"
+#include "ipcz/block_allocator_pool.h"
 #include "ipcz/buffer_id.h"
 #include "ipcz/buffer_pool.h"
 #include "ipcz/driver_memory.h"
@@ -20,10 +23,12 @@
 #include "ipcz/fragment_ref.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
+#include "ipcz/memory_profile.h"
 #include "ipcz/ref_counted_fragment.h"
 #include "ipcz/router_link_state.h"
 #include "ipcz/sublink_id.h"
 #include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_set.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
 #include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
@@ -59,12 +64,27 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   // node, where another NodeLinkMemory is cooperatively managing the same
   // memory pool as this one. `link` must belong to the same side of the node
   // link as this object.
+  //
+  // When the link is first set, this also begins provisioning any initial
+  // capacity requested by the node's MemoryProfile.
   void SetNodeLink(Ref<NodeLink> link);
 
   // Allocates a new DriverMemory object and initializes its contents to be
   // suitable as the primary buffer of a new NodeLinkMemory. Returns the memory
   // along with a mapping of it.
-  static DriverMemoryWithMapping AllocateMemory(const IpczDriver& driver);
+  //
+  // If `profile` requests a primary buffer larger than the default, the extra
+  // space is divided among additional BlockAllocators for the profile's
+  // fragment sizes above 4 kB. These are only used if both nodes on the link
+  // support mem_v2.
+  //
+  // If `features` includes message rings, the buffer is further enlarged to
+  // hold a pair of MessageRings for the NodeLink, which are only used if both
+  // nodes on the link support them.
+  static DriverMemoryWithMapping AllocateMemory(
+      const IpczDriver& driver,
+      const MemoryProfile& profile = {},
+      const Features& features = {});
 
   // Constructs a new NodeLinkMemory with BufferId 0 (the primary buffer) mapped
   // as `primary_buffer_memory`. The buffer must have been created and
@@ -74,6 +94,11 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
                                     const Features& remote_features,
                                     DriverMemoryMapping primary_buffer_memory);
 
+  // Returns the region of the primary buffer holding the MessageRing which
+  // carries messages from `from_side` of the link to the other side, or an
+  // empty span if message rings are not available on this link.
+  absl::Span<uint8_t> GetMessageRingMemory(LinkSide from_side) const;
+
   // Returns a new BufferId which should still be unused by any buffer in this
   // NodeLinkMemory's BufferPool, or that of its peer NodeLinkMemory. When
   // allocating new a buffer to add to the BufferPool, its BufferId should be
@@ -96,8 +121,22 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   // buffer, this returns a null Fragment. If the descriptor's BufferId is not
   // yet registered with this NodeLinkMemory, this returns a pending Fragment
   // with the same BufferId and dimensions as `descriptor`.
+  //
+  // A resolved Fragment is held by the caller, which keeps its buffer mapped
+  // even if the buffer is retired. The caller must eventually pass it to
+  // FreeFragment() or ReleaseFragment(). The same applies to fragments
+  // returned by any of the allocation methods below.
   Fragment GetFragment(const FragmentDescriptor& descriptor);
 
+  // Adds another hold on `fragment`, which the caller must already hold. See
+  // GetFragment().
+  void AddFragmentHold(const Fragment& fragment);
+
+  // Releases the caller's hold on `fragment` without freeing it, for example
+  // because ownership of the fragment was transferred to the remote node. See
+  // GetFragment().
+  void ReleaseFragment(const Fragment& fragment);
+
   // Adopts an existing reference to a RefCountedFragment within `fragment`.
   // This does NOT increment the ref count of the RefCountedFragment.
   template <typename T>
@@ -109,13 +148,41 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   // Adds a new buffer to the underlying BufferPool to use as additional
   // allocation capacity for blocks of size `block_size`. Note that the
   // contents of the mapped region must already be initialized as a
-  // BlockAllocator.
+  // BlockAllocator, with wide headers if the link supports them. Returns false
+  // if `block_size` is invalid or the buffer holds too many blocks.
   bool AddBlockBuffer(BufferId id,
                       size_t block_size,
                       DriverMemoryMapping mapping);
 
+  // Adds a new large buffer to the underlying BufferPool to use for allocation
+  // of fragments too large for block allocation. Note that the contents of the
+  // mapped region must already be initialized as a large buffer.
+  bool AddLargeBuffer(BufferId id, DriverMemoryMapping mapping);
+
+  // Handles a request from the remote node to retire `id`, an expansion buffer
+  // which it allocated. Returns false if `id` does not identify such a buffer.
+  // Otherwise this returns true and sets `retired` to indicate whether the
+  // buffer was retired. The buffer can only be retired if none of its capacity
+  // is allocated, and it remains mapped here until none of its fragments are
+  // held by this node.
+  bool RetireRemoteBuffer(BufferId id, bool& retired);
+
+  // Completes a request made by this side to retire `id`, after the remote node
+  // either retired the buffer or declined to do so. Returns false if there was
+  // no such request or if the buffer was not validly retired.
+  bool CompleteBufferRetirement(BufferId id, bool retired);
+
+  // Counts a message received from the remote node against the node's idle
+  // buffer policy, and runs ReclaimIdleBuffers() whenever the configured
+  // interval elapses.
+  void MaybeReclaimIdleBuffers();
+
   // Allocates a Fragment of `size` bytes from the underlying BufferPool. May
   // return a null Fragment if there was no readily available capacity.
+  //
+  // Fragments up to 1 MB are allocated from block buffers. Larger fragments are
+  // only supported when the mem_v2 feature is available on both sides of the
+  // link, in which case they're allocated from dedicated large buffers.
   Fragment AllocateFragment(size_t size);
 
   // Attempts to allocate a Fragment of at least `size` bytes. If there are no
@@ -125,7 +192,8 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
 
   // Frees a Fragment previously allocated through this NodeLinkMemory. Returns
   // true on success. Returns false if `fragment` does not represent an
-  // allocated fragment within this NodeLinkMemory.
+  // allocated fragment within this NodeLinkMemory. On success, the caller's
+  // hold on `fragment` is released.
   bool FreeFragment(const Fragment& fragment);
 
   // Allocates a fragment to store a new RouterLinkState and initializes a new
@@ -149,9 +217,85 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   void WaitForBufferAsync(BufferId id,
                           BufferPool::WaitForBufferCallback callback);
 
+  // Allocation statistics gathered by this side of the link for a single block
+  // size class. These drive expansion of the class's capacity.
+  struct BlockSizeClassStats {
+    // The number of successful and failed fragment allocations.
+    uint64_t num_allocations = 0;
+    uint64_t num_failures = 0;
+
+    // The largest number of allocations observed between two consecutive
+    // capacity expansions. This approximates peak demand, and new capacity is
+    // requested in steps large enough to absorb it.
+    uint64_t high_water_mark = 0;
+
+    // The number of capacity expansions requested.
+    uint64_t num_expansions = 0;
+  };
+
+  // Returns the current statistics for the block size class which serves
+  // fragments of `fragment_size` bytes. `fragment_size` must not exceed 1 MB.
+  BlockSizeClassStats GetBlockSizeClassStats(size_t fragment_size);
+
+  // How the data of a parcel transmitted over this link was conveyed.
+  enum class ParcelDataPath {
+    // The data was already in a fragment of this link's memory.
+    kFragment,
+
+    // The data was moved into a fragment of this link's memory from a fragment
+    // of some other link's memory.
+    kMigratedFragment,
+
+    // The data was inlined within the transmitted message.
+    kInlined,
+  };
+
+  // Counts a parcel transmitted over this link whose data took `path`.
+  void RecordParcelDataPath(ParcelDataPath path);
+
+  // Populates `stats` with a snapshot of this link's shared memory usage. The
+  // `size` and `remote_node_id` fields are left untouched.
+  void QueryMemoryStats(IpczNodeLinkMemoryStats& stats);
+
  private:
   struct PrimaryBuffer;
 
+  // Counts of fragment allocations within a single block size class, as seen
+  // by the threads assigned to one BlockAllocatorPool magazine. Each is aligned
+  // to its own cache line so that threads using different magazines don't
+  // contend when counting.
+  struct alignas(64) AllocationCounters {
+    std::atomic<uint64_t> num_allocations{0};
+    std::atomic<uint64_t> num_failures{0};
+  };
+
+  // Live allocation statistics for a single block size class. Each is aligned
+  // to its own cache line. Per-allocation counts are kept per magazine and
+  // summed when read.
+  struct alignas(64) SizeClassState {
+    // Returns the counters for the calling thread to update.
+    AllocationCounters& GetCountersForCurrentThread();
+
+    // Each of these sums the corresponding counter over every magazine.
+    uint64_t GetNumAllocations() const;
+    uint64_t GetNumFailures() const;
+
+    std::array<AllocationCounters, BlockAllocatorPool::kNumMagazines> counters;
+    std::atomic<uint64_t> high_water_mark{0};
+    std::atomic<uint64_t> num_expansions{0};
+
+    // Snapshots of the counters above from the most recent expansion.
+    std::atomic<uint64_t> allocations_at_last_expansion{0};
+    std::atomic<uint64_t> failures_at_last_expansion{0};
+
+    // Set while an expansion requested by MaybeExpandBlockCapacity() is in
+    // progress, so that only one thread sizes each expansion.
+    std::atomic<bool> is_expansion_pending{false};
+  };
+
+  // Block sizes are powers of two from 64 bytes through 1 MB.
+  static constexpr size_t kNumBlockSizeClasses = 15;
+
   friend class RefCounted<NodeLinkMemory>;
 
   // Constructs a new NodeLinkMemory over `mapping`, which must correspond to
@@ -163,18 +307,62 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
                  DriverMemoryMapping mapping);
   ~NodeLinkMemory();
 
-  // Indicates whether the NodeLinkMemory should be allowed to expand its
-  // allocation capacity further for blocks of size `block_size`.
-  bool CanExpandBlockCapacity(size_t block_size);
+  // Returns the SizeClassState for blocks of `block_size` bytes.
+  SizeClassState& GetSizeClassState(size_t block_size);
+
+  // Expands the allocation capacity for blocks of `block_size` bytes after an
+  // allocation found that capacity missing or nearly exhausted, unless another
+  // expansion is already in progress or the class has grown to its limit. The
+  // size of the expansion is based on the class's allocation statistics.
+  void MaybeExpandBlockCapacity(size_t block_size);
 
   // Attempts to expand the total block allocation capacity for blocks of
-  // `block_size` bytes. `callback` may be called synchronously or
-  // asynchronously with a result indicating whether the expansion succeeded.
+  // `block_size` bytes, by at least `min_capacity` bytes if non-zero.
+  // `callback` may be called synchronously or asynchronously with a result
+  // indicating whether the expansion succeeded.
   using RequestBlockCapacityCallback = std::function<void(bool)>;
   void RequestBlockCapacity(size_t block_size,
-                            RequestBlockCapacityCallback callback);
+                            RequestBlockCapacityCallback callback,
+                            size_t min_capacity = 0);
   void OnCapacityRequestComplete(size_t block_size, bool success);
 
+  // Allocates a new buffer of `buffer_size` bytes for blocks of `block_size`
+  // bytes, and shares it over `link` before adding it to the local pool.
+  // Completes the pending capacity request for `block_size` when done.
+  void AllocateBlockBuffer(size_t block_size,
+                           size_t buffer_size,
+                           Ref<NodeLink> link);
+
+  // Requests expansion buffers for any fragment sizes whose current capacity
+  // falls short of the node's MemoryProfile. Only called on side A of the link,
+  // so that the shared capacity is provisioned once rather than by both sides.
+  void ProvisionInitialCapacity();
+
+  // Attempts to allocate a fragment of `size` bytes from a large buffer. If
+  // none is available, this may request a new large buffer to satisfy future
+  // allocations of similar size.
+  Fragment AllocateLargeFragment(size_t size);
+
+  // Indicates whether the NodeLinkMemory should be allowed to add another large
+  // buffer with a fragment capacity of `capacity` bytes.
+  bool CanExpandLargeBufferCapacity(size_t capacity);
+
+  // Asynchronously allocates a new large buffer with a fragment capacity of
+  // `capacity` bytes and shares it with the remote node. Redundant requests for
+  // the same capacity are ignored while one is already in progress.
+  void RequestLargeBuffer(size_t capacity);
+
+  // Records a buffer allocated by this side of the link to expand capacity.
+  // Such buffers may later be retired if they become idle.
+  void AddExpansionBuffer(BufferId id);
+
+  // Asks the remote node to retire any buffers allocated by this side of the
+  // link whose fragments are no longer held here. The remote node flushes any
+  // blocks it has cached from such a buffer and claims all of its capacity,
+  // which only succeeds if the buffer is idle on both sides. Both sides then
+  // release the buffer once they no longer hold any of its fragments.
+  void ReclaimIdleBuffers();
+
   // Initializes `fragment` as a new RouterLinkState and returns a ref to it.
   FragmentRef<RouterLinkState> InitializeRouterLinkStateFragment(
       const Fragment& fragment);
@@ -182,8 +370,29 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   const Ref<Node> node_;
   const LinkSide link_side_;
   const Features available_features_;
+
+  // The header format for BlockAllocators in buffers added by either side of
+  // the link after it's established. BlockAllocators in the primary buffer
+  // always use narrow headers, since the buffer is initialized before the
+  // available features are known.
+  const BlockAllocator::HeaderFormat block_header_format_;
   const bool allow_memory_expansion_for_parcel_data_;
 
+  // The number of messages received from the remote node between checks for
+  // idle buffers, or zero if idle buffers should never be reclaimed.
+  const uint32_t idle_buffer_check_interval_;
+  std::atomic<uint32_t> num_messages_received_{0};
+
+  // Allocation statistics for each block size class, indexed by
+  // GetSizeClassState().
+  std::array<SizeClassState, kNumBlockSizeClasses> size_classes_;
+
+  // Counts of transmitted parcels by ParcelDataPath. See
+  // RecordParcelDataPath().
+  std::atomic<uint64_t> num_parcels_with_fragment_data_{0};
+  std::atomic<uint64_t> num_parcels_with_migrated_fragment_data_{0};
+  std::atomic<uint64_t> num_parcels_with_inlined_data_{0};
+
   // Atomic ID generators for buffers and sublinks allocated by this side of the
   // link when memv2 is enabled.
   std::atomic<uint64_t> next_buffer_id_{1};
@@ -197,17 +406,51 @@ class NodeLinkMemory : public RefCounted<NodeLinkMemory> {
   const absl::Span<uint8_t> primary_buffer_memory_;
   PrimaryBuffer& primary_buffer_;
 
+  // Regions of the primary buffer holding the link's MessageRings, indexed by
+  // the side of the link which produces messages for each. Empty if message
+  // rings are not available.
+  std::array<absl::Span<uint8_t>, 2> message_ring_memory_;
+
   absl::Mutex mutex_;
 
   // The NodeLink which is using this NodeLinkMemory. Used to communicate with
   // the NodeLinkMemory on the other side of the link.
   Ref<NodeLink> node_link_ ABSL_GUARDED_BY(mutex_);
 
-  // Callbacks to invoke when a pending capacity request is fulfilled for a
-  // specific block size. Also used to prevent stacking of capacity requests for
-  // the same block size.
+  // A pending capacity request for a specific block size: the callbacks to
+  // invoke when it's fulfilled, and the largest capacity asked of it while it
+  // was waiting for NodeLink activation. Also used to prevent stacking of
+  // capacity requests for the same block size.
   using CapacityCallbackList = std::vector<RequestBlockCapacityCallback>;
-  absl::flat_hash_map<uint32_t, CapacityCallbackList> capacity_callbacks_
+  struct PendingCapacityRequest {
+    size_t min_capacity = 0;
+    CapacityCallbackList callbacks;
+  };
+  absl::flat_hash_map<uint32_t, PendingCapacityRequest> capacity_requests_
+      ABSL_GUARDED_BY(mutex_);
+
+  // Fragment capacities of large buffers currently being allocated.
+  absl::flat_hash_set<size_t> pending_large_buffer_requests_
+      ABSL_GUARDED_BY(mutex_);
+
+  // The retirement state of a buffer in `expansion_buffers_`.
+  enum class ExpansionBufferState {
+    // The buffer was added since the most recent check for idle buffers. Such
+    // buffers are not retired until the next check, so that new capacity isn't
+    // retired before it can be used.
+    kNew,
+
+    // The buffer may be retired by the next check if it's idle.
+    kActive,
+
+    // This side asked the remote node to retire the buffer and is waiting for
+    // a reply.
+    kRetiring,
+  };
+
+  // Buffers allocated by this side of the link to expand capacity, which have
+  // not been retired. These are the candidates for ReclaimIdleBuffers().
+  absl::flat_hash_map<BufferId, ExpansionBufferState> expansion_buffers_
       ABSL_GUARDED_BY(mutex_);
 };
 
@@ -4,6 +4,8 @@
 
 #include "ipcz/node_link_memory.h"
 
+#include <algorithm>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -12,6 +14,7 @@
 #include "ipcz/features.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
+#include "ipcz/message_ring.h"
 #include "ipcz/node.h"
 #include "ipcz/node_link.h"
 #include "ipcz/node_link_memory.h"
@@ -19,6 +22,8 @@
 #include "ipcz/parcel.h"
 #include "reference_drivers/sync_reference_driver.h"
 #include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_set.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
@@ -44,16 +49,17 @@ class NodeLinkMemoryTest : public testing::Test {
     std::pair<Ref<NodeLink>, Ref<NodeLink>> links;
     auto transports = DriverTransport::CreatePair(kTestDriver);
     DriverMemoryWithMapping buffer =
-        NodeLinkMemory::AllocateMemory(kTestDriver);
+        NodeLinkMemory::AllocateMemory(kTestDriver, broker->memory_profile(),
+                                       broker->features());
     links.first = NodeLink::CreateInactive(
         broker, LinkSide::kA, broker->GetAssignedName(), non_broker_name,
-        Node::Type::kNormal, 0, Features{}, transports.first,
-        NodeLinkMemory::Create(broker, LinkSide::kA, Features{},
+        Node::Type::kNormal, 0, non_broker->features(), transports.first,
+        NodeLinkMemory::Create(broker, LinkSide::kA, non_broker->features(),
                                std::move(buffer.mapping)));
     links.second = NodeLink::CreateInactive(
         non_broker, LinkSide::kB, non_broker_name, broker->GetAssignedName(),
-        Node::Type::kBroker, 0, Features{}, transports.second,
-        NodeLinkMemory::Create(non_broker, LinkSide::kB, Features{},
+        Node::Type::kBroker, 0, broker->features(), transports.second,
+        NodeLinkMemory::Create(non_broker, LinkSide::kB, broker->features(),
                                buffer.memory.Map()));
     broker->AddConnection(non_broker_name, {.link = links.first});
     non_broker->AddConnection(broker->GetAssignedName(),
@@ -63,6 +69,19 @@ class NodeLinkMemoryTest : public testing::Test {
     return links;
   }
 
+  // Returns `memory`'s statistics for the class of `block_size` blocks.
+  static IpczBlockMemoryStats GetBlockStats(NodeLinkMemory& memory,
+                                            size_t block_size) {
+    IpczNodeLinkMemoryStats stats = {.size = sizeof(stats)};
+    memory.QueryMemoryStats(stats);
+    for (size_t i = 0; i < stats.num_block_size_classes; ++i) {
+      if (stats.block_size_classes[i].block_size == block_size) {
+        return stats.block_size_classes[i];
+      }
+    }
+    return IpczBlockMemoryStats{};
+  }
+
   static void AddBlocksToMemory(NodeLinkMemory& memory, size_t block_size) {
     constexpr size_t kNumBlocks = 32;
     auto mapping = DriverMemory(kTestDriver, block_size * kNumBlocks).Map();
@@ -174,23 +193,23 @@ TEST_F(NodeLinkMemoryTest, SharedPrimaryBuffer) {
 
 TEST_F(NodeLinkMemoryTest, ExpandCapacity) {
   // If we depelete a NodeLinkMemory's capacity to allocate fragments of a given
-  // size, it should automatically acquire new capacity for future allocations.
+  // size, it should automatically acquire new capacity for future allocations
+  // before the existing capacity runs out.
 
   constexpr size_t kSize = 64;
   bool has_new_capacity = false;
   memory_a().WaitForBufferAsync(
       BufferId(1), [&has_new_capacity] { has_new_capacity = true; });
-  while (!memory_a().AllocateFragment(kSize).is_null())
-    ;
+  Fragment fragment;
+  do {
+    fragment = memory_a().AllocateFragment(kSize);
+    ASSERT_FALSE(fragment.is_null());
+  } while (fragment.buffer_id() == NodeLinkMemory::kPrimaryBufferId);
 
-  // Since we're using a synchronous driver, this should have already been true
-  // by the time the most recent failed allocation returned.
+  // Since we're using a synchronous driver, the new buffer should have been
+  // added as soon as it was requested, and allocation moved on to it without
+  // ever failing.
   EXPECT_TRUE(has_new_capacity);
-
-  // And a subsequent allocation request should now succeed with a fragment from
-  // the new buffer.
-  Fragment fragment = memory_a().AllocateFragment(kSize);
-  EXPECT_FALSE(fragment.is_null());
   EXPECT_TRUE(fragment.is_addressable());
   EXPECT_EQ(BufferId(1), fragment.buffer_id());
 
@@ -233,13 +252,211 @@ TEST_F(NodeLinkMemoryTest, LimitedCapacityExpansion) {
 }
 
 TEST_F(NodeLinkMemoryTest, OversizedAllocation) {
-  // Allocations which are too large for block-based allocation will fail for
-  // now. This may change as new allocation schemes are supported.
+  // Allocations which are too large for block-based allocation will fail
+  // unless both nodes support mem_v2. See LargeAllocation below.
   constexpr size_t kWayTooBig = 64 * 1024 * 1024;
   Fragment fragment = memory_a().AllocateFragment(kWayTooBig);
   EXPECT_TRUE(fragment.is_null());
 }
 
+TEST_F(NodeLinkMemoryTest, LargeAllocation) {
+  // With mem_v2 enabled on both nodes, allocations which are too large for
+  // block-based allocation are served by dedicated large buffers.
+  const IpczFeature kEnabledFeatures[] = {IPCZ_FEATURE_MEM_V2};
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .enabled_features = kEnabledFeatures,
+      .num_enabled_features = std::size(kEnabledFeatures),
+  };
+  const Ref<Node> broker{
+      MakeRefCounted<Node>(Node::Type::kBroker, kTestDriver, &options)};
+  const Ref<Node> non_broker{
+      MakeRefCounted<Node>(Node::Type::kNormal, kTestDriver, &options)};
+  auto links = ConnectNodes(broker, non_broker, kOtherTestNonBrokerName);
+  NodeLinkMemory& memory_a = links.first->memory();
+  NodeLinkMemory& memory_b = links.second->memory();
+
+  // No initial capacity for large fragments.
+  constexpr size_t kLargeSize = 3 * 1024 * 1024 + 1;
+  Fragment fragment = memory_a.AllocateFragment(kLargeSize);
+  EXPECT_TRUE(fragment.is_null());
+
+  // But the failure above should have added a suitable large buffer, and it
+  // should already be shared with the other side.
+  fragment = memory_a.AllocateFragment(kLargeSize);
+  ASSERT_TRUE(fragment.is_addressable());
+  EXPECT_GE(fragment.size(), kLargeSize);
+  EXPECT_NE(NodeLinkMemory::kPrimaryBufferId, fragment.buffer_id());
+
+  Fragment same_fragment = memory_b.GetFragment(fragment.descriptor());
+  EXPECT_TRUE(same_fragment.is_addressable());
+  EXPECT_EQ(fragment.size(), same_fragment.size());
+
+  // The buffer holds only one fragment, so it can't be allocated again until
+  // freed. Either side may then reuse it for a fragment of similar size. Note
+  // that the failed allocation here also adds another large buffer.
+  EXPECT_TRUE(memory_b.AllocateFragment(kLargeSize).is_null());
+  EXPECT_TRUE(memory_b.FreeFragment(same_fragment));
+  EXPECT_FALSE(memory_b.FreeFragment(same_fragment));
+  const Fragment reused_fragments[] = {
+      memory_b.AllocateFragment(kLargeSize - 1),
+      memory_b.AllocateFragment(kLargeSize - 1),
+  };
+  EXPECT_TRUE(fragment.buffer_id() == reused_fragments[0].buffer_id() ||
+              fragment.buffer_id() == reused_fragments[1].buffer_id());
+  for (const Fragment& reused_fragment : reused_fragments) {
+    EXPECT_TRUE(memory_a.FreeFragment(reused_fragment));
+  }
+
+  // Best-effort allocation also uses large buffers when possible.
+  fragment = memory_a.AllocateFragmentBestEffort(kLargeSize);
+  EXPECT_GE(fragment.size(), kLargeSize);
+  EXPECT_TRUE(memory_a.FreeFragment(fragment));
+
+  non_broker->Close();
+  broker->Close();
+}
+
+TEST_F(NodeLinkMemoryTest, ReclaimIdleBuffers) {
+  // Nodes can be configured to retire idle expansion buffers. Checks normally
+  // happen as messages are received from the remote node, but this test runs
+  // them explicitly.
+  const IpczFeature kEnabledFeatures[] = {IPCZ_FEATURE_MEM_V2};
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .enabled_features = kEnabledFeatures,
+      .num_enabled_features = std::size(kEnabledFeatures),
+      .idle_buffer_check_interval = 1,
+  };
+  const Ref<Node> broker{
+      MakeRefCounted<Node>(Node::Type::kBroker, kTestDriver, &options)};
+  const Ref<Node> non_broker{
+      MakeRefCounted<Node>(Node::Type::kNormal, kTestDriver, &options)};
+  auto links = ConnectNodes(broker, non_broker, kOtherTestNonBrokerName);
+  NodeLinkMemory& memory_a = links.first->memory();
+  NodeLinkMemory& memory_b = links.second->memory();
+
+  // Indicates whether `fragment` still resolves within `memory`.
+  auto is_mapped = [](NodeLinkMemory& memory, const Fragment& fragment) {
+    const Fragment resolved = memory.GetFragment(fragment.descriptor());
+    memory.ReleaseFragment(resolved);
+    return resolved.is_addressable();
+  };
+
+  // Expand capacity for a new block size and a large fragment size. New
+  // buffers are never retired by the first check after they're added.
+  constexpr size_t kBlockSize = 512 * 1024;
+  constexpr size_t kLargeSize = 2 * 1024 * 1024;
+  EXPECT_TRUE(memory_a.AllocateFragment(kBlockSize).is_null());
+  const Fragment block = memory_a.AllocateFragment(kBlockSize);
+  EXPECT_TRUE(memory_a.AllocateFragment(kLargeSize).is_null());
+  const Fragment large_fragment = memory_a.AllocateFragment(kLargeSize);
+  ASSERT_TRUE(block.is_addressable());
+  ASSERT_TRUE(large_fragment.is_addressable());
+  memory_a.MaybeReclaimIdleBuffers();
+
+  // Buffers aren't retired while side A holds any of their fragments.
+  memory_a.MaybeReclaimIdleBuffers();
+  for (const Fragment& fragment : {block, large_fragment}) {
+    EXPECT_TRUE(is_mapped(memory_a, fragment));
+    EXPECT_TRUE(is_mapped(memory_b, fragment));
+  }
+
+  // Nor are they retired while side B holds any, as when ownership of the
+  // fragments has been transferred from A to B. Side B rejects the request.
+  memory_a.ReleaseFragment(block);
+  memory_a.ReleaseFragment(large_fragment);
+  const Fragment block_b = memory_b.GetFragment(block.descriptor());
+  const Fragment large_fragment_b =
+      memory_b.GetFragment(large_fragment.descriptor());
+  memory_a.MaybeReclaimIdleBuffers();
+  for (const Fragment& fragment : {block, large_fragment}) {
+    EXPECT_TRUE(is_mapped(memory_a, fragment));
+    EXPECT_TRUE(is_mapped(memory_b, fragment));
+  }
+
+  // But once freed by side B, the next check on side A retires both buffers on
+  // both sides of the link. This works even though B may still have the freed
+  // block cached locally, since B flushes its cache before retiring a buffer.
+  EXPECT_TRUE(memory_b.FreeFragment(block_b));
+  EXPECT_TRUE(memory_b.FreeFragment(large_fragment_b));
+  memory_a.MaybeReclaimIdleBuffers();
+  for (const Fragment& fragment : {block, large_fragment}) {
+    EXPECT_TRUE(memory_a.GetFragment(fragment.descriptor()).is_null());
+    EXPECT_TRUE(memory_b.GetFragment(fragment.descriptor()).is_null());
+  }
+
+  // Capacity is expanded again as needed.
+  EXPECT_TRUE(memory_a.AllocateFragment(kBlockSize).is_null());
+  const Fragment new_block = memory_a.AllocateFragment(kBlockSize);
+  ASSERT_TRUE(new_block.is_addressable());
+  EXPECT_NE(block.buffer_id(), new_block.buffer_id());
+  EXPECT_TRUE(memory_a.FreeFragment(new_block));
+
+  // A request to retire a buffer which the requestor didn't allocate is a
+  // validation failure, and it disconnects the link.
+  links.first->RetireBuffer(NodeLinkMemory::kPrimaryBufferId);
+  EXPECT_FALSE(non_broker->GetLink(broker->GetAssignedName()));
+
+  non_broker->Close();
+  broker->Close();
+}
+
+TEST_F(NodeLinkMemoryTest, MemoryProfile) {
+  // A memory profile can provision capacity for new links before any of it is
+  // needed, within an enlarged primary buffer for fragment sizes above 4 kB.
+  constexpr size_t kLargeBlockSize = 16 * 1024;
+  constexpr size_t kSmallBlockSize = 64;
+  constexpr size_t kCapacity = 256 * 1024;
+  const IpczMemoryCapacity kCapacities[] = {
+      {.fragment_size = kLargeBlockSize, .capacity = kCapacity},
+      {.fragment_size = kSmallBlockSize, .capacity = kCapacity},
+  };
+  const IpczFeature kMemV2Features[] = {IPCZ_FEATURE_MEM_V2};
+  for (bool mem_v2 : {true, false}) {
+    const IpczCreateNodeOptions options = {
+        .size = sizeof(options),
+        .enabled_features = mem_v2 ? kMemV2Features : nullptr,
+        .num_enabled_features = mem_v2 ? std::size(kMemV2Features) : 0,
+        .initial_memory_capacities = kCapacities,
+        .num_initial_memory_capacities = std::size(kCapacities),
+        .primary_buffer_size = 1024 * 1024,
+    };
+    const Ref<Node> broker{
+        MakeRefCounted<Node>(Node::Type::kBroker, kTestDriver, &options)};
+    const Ref<Node> non_broker{
+        MakeRefCounted<Node>(Node::Type::kNormal, kTestDriver, &options)};
+    auto links = ConnectNodes(broker, non_broker, kOtherTestNonBrokerName);
+    NodeLinkMemory& memory_a = links.first->memory();
+    NodeLinkMemory& memory_b = links.second->memory();
+
+    // Only one side of the link provisions capacity, so the link isn't given
+    // twice what the profile asks for.
+    const IpczBlockMemoryStats large_stats =
+        GetBlockStats(memory_a, kLargeBlockSize);
+    EXPECT_EQ(large_stats.num_blocks,
+              GetBlockStats(memory_b, kLargeBlockSize).num_blocks);
+    EXPECT_LT(large_stats.num_blocks * kLargeBlockSize, 2 * kCapacity);
+
+    // The full capacity for each size is available without any failed
+    // allocations. Large blocks come from the primary buffer only if both
+    // nodes support mem_v2; otherwise they come from an expansion buffer
+    // allocated when the link was set up.
+    for (size_t i = 0; i < kCapacity / kLargeBlockSize; ++i) {
+      const Fragment fragment = memory_a.AllocateFragment(kLargeBlockSize);
+      ASSERT_TRUE(fragment.is_addressable());
+      EXPECT_EQ(mem_v2,
+                fragment.buffer_id() == NodeLinkMemory::kPrimaryBufferId);
+    }
+    for (size_t i = 0; i < kCapacity / kSmallBlockSize; ++i) {
+      ASSERT_TRUE(memory_b.AllocateFragment(kSmallBlockSize).is_addressable());
+    }
+
+    non_broker->Close();
+    broker->Close();
+  }
+}
+
 TEST_F(NodeLinkMemoryTest, NewBlockSizes) {
   // NodeLinkMemory begins life with a fixed set of block allocators available
   // for certain common block sizes. These are capped out at 64 kB blocks, but
@@ -265,6 +482,146 @@ TEST_F(NodeLinkMemoryTest, NewBlockSizes) {
   EXPECT_TRUE(memory_b().FreeFragment(fragment));
 }
 
+TEST_F(NodeLinkMemoryTest, AdaptiveCapacityGrowth) {
+  // Block capacity grows ahead of demand once a size class is in use, in steps
+  // which scale with the observed allocation rate. Only the very first
+  // allocation for a size class without any capacity should fail.
+  constexpr size_t kBlockSize = 8 * 1024;
+  constexpr size_t kNumFragments = 200;
+  EXPECT_TRUE(memory_a().AllocateFragment(kBlockSize).is_null());
+
+  std::vector<Fragment> fragments;
+  absl::flat_hash_set<BufferId> buffers;
+  for (size_t i = 0; i < kNumFragments; ++i) {
+    const Fragment fragment = memory_a().AllocateFragment(kBlockSize);
+    ASSERT_TRUE(fragment.is_addressable());
+    fragments.push_back(fragment);
+    buffers.insert(fragment.buffer_id());
+  }
+
+  const NodeLinkMemory::BlockSizeClassStats stats =
+      memory_a().GetBlockSizeClassStats(kBlockSize);
+  EXPECT_EQ(kNumFragments, stats.num_allocations);
+  EXPECT_EQ(1u, stats.num_failures);
+  EXPECT_EQ(buffers.size(), stats.num_expansions);
+  EXPECT_GT(stats.high_water_mark, 0u);
+
+  // Fixed-size expansions would have needed dozens of buffers here.
+  EXPECT_LE(buffers.size(), 6u);
+
+  for (const Fragment& fragment : fragments) {
+    EXPECT_TRUE(memory_b().FreeFragment(memory_b().GetFragment(
+        fragment.descriptor())));
+  }
+}
+
+TEST_F(NodeLinkMemoryTest, AllocationCountsFromManyThreads) {
+  // Allocations are counted per magazine, but every thread's allocations are
+  // reflected in the class's statistics.
+  constexpr size_t kBlockSize = 64;
+  constexpr size_t kNumThreads = BlockAllocatorPool::kNumMagazines * 2;
+  constexpr size_t kNumFragmentsPerThread = 100;
+  const uint64_t initial_num_allocations =
+      memory_a().GetBlockSizeClassStats(kBlockSize).num_allocations;
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([this] {
+      for (size_t j = 0; j < kNumFragmentsPerThread; ++j) {
+        const Fragment fragment = memory_a().AllocateFragment(kBlockSize);
+        if (!fragment.is_null()) {
+          EXPECT_TRUE(memory_a().FreeFragment(fragment));
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  const NodeLinkMemory::BlockSizeClassStats stats =
+      memory_a().GetBlockSizeClassStats(kBlockSize);
+  EXPECT_EQ(kNumThreads * kNumFragmentsPerThread,
+            stats.num_allocations + stats.num_failures -
+                initial_num_allocations);
+}
+
+TEST_F(NodeLinkMemoryTest, WideBlockAllocators) {
+  // When both nodes support wide BlockAllocator headers, a single new buffer
+  // can serve far more than 32767 small blocks.
+  constexpr size_t kBlockSize = 64;
+  constexpr size_t kNumFragments = 40000;
+  const IpczFeature kEnabledFeatures[] = {IPCZ_FEATURE_WIDE_BLOCK_ALLOCATORS};
+  const IpczMemoryCapacity kCapacities[] = {
+      {.fragment_size = kBlockSize, .capacity = kBlockSize * kNumFragments},
+  };
+  const IpczCreateNodeOptions options = {
+      .size = sizeof(options),
+      .enabled_features = kEnabledFeatures,
+      .num_enabled_features = std::size(kEnabledFeatures),
+      .initial_memory_capacities = kCapacities,
+      .num_initial_memory_capacities = std::size(kCapacities),
+  };
+  const Ref<Node> broker{
+      MakeRefCounted<Node>(Node::Type::kBroker, kTestDriver, &options)};
+  const Ref<Node> non_broker{
+      MakeRefCounted<Node>(Node::Type::kNormal, kTestDriver, &options)};
+  auto links = ConnectNodes(broker, non_broker, kOtherTestNonBrokerName);
+  NodeLinkMemory& memory = links.first->memory();
+
+  absl::flat_hash_map<BufferId, size_t> fragments_per_buffer;
+  for (size_t i = 0; i < kNumFragments; ++i) {
+    const Fragment fragment = memory.AllocateFragment(kBlockSize);
+    ASSERT_TRUE(fragment.is_addressable());
+    ++fragments_per_buffer[fragment.buffer_id()];
+  }
+
+  size_t max_fragments_per_buffer = 0;
+  for (const auto& [id, num_fragments] : fragments_per_buffer) {
+    max_fragments_per_buffer =
+        std::max(max_fragments_per_buffer, num_fragments);
+  }
+  EXPECT_GT(max_fragments_per_buffer, 32767u);
+
+  non_broker->Close();
+  broker->Close();
+}
+
+TEST_F(NodeLinkMemoryTest, QueryMemoryStats) {
+  constexpr size_t kBlockSize = 64;
+  const IpczBlockMemoryStats initial_stats =
+      GetBlockStats(memory_a(), kBlockSize);
+  ASSERT_GT(initial_stats.num_blocks, 0u);
+  EXPECT_EQ(1u, initial_stats.num_allocators);
+  EXPECT_EQ(initial_stats.num_blocks, initial_stats.num_free_blocks);
+  EXPECT_EQ(0u, initial_stats.num_cached_blocks);
+
+  // An allocation on one side may reserve more blocks for its own cache. The
+  // other side sees them all as unavailable.
+  const Fragment fragment = memory_a().AllocateFragment(kBlockSize);
+  ASSERT_TRUE(fragment.is_addressable());
+  const IpczBlockMemoryStats stats_a = GetBlockStats(memory_a(), kBlockSize);
+  const IpczBlockMemoryStats stats_b = GetBlockStats(memory_b(), kBlockSize);
+  EXPECT_EQ(initial_stats.num_blocks - 1,
+            stats_a.num_free_blocks + stats_a.num_cached_blocks);
+  EXPECT_EQ(stats_a.num_free_blocks, stats_b.num_free_blocks);
+  EXPECT_EQ(0u, stats_b.num_cached_blocks);
+
+  // The node reports the same link.
+  IpczNodeLinkMemoryStats node_stats = {.size = sizeof(node_stats)};
+  size_t num_links = 0;
+  EXPECT_EQ(IPCZ_RESULT_RESOURCE_EXHAUSTED,
+            node_a()->QueryMemoryStats({}, num_links));
+  EXPECT_EQ(1u, num_links);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            node_a()->QueryMemoryStats({&node_stats, 1}, num_links));
+  EXPECT_EQ(kTestNonBrokerName.high(), node_stats.remote_node_id[0]);
+  EXPECT_EQ(kTestNonBrokerName.low(), node_stats.remote_node_id[1]);
+  EXPECT_EQ(1u, node_stats.num_buffers);
+
+  EXPECT_TRUE(memory_a().FreeFragment(fragment));
+}
+
 TEST_F(NodeLinkMemoryTest, ParcelDataAllocation) {
   // NodeLinkMemory can in general be used by Parcel instances to allocate data
   // buffers, but dynamic expansion of the allocation capacity can be disabled
@@ -306,5 +663,50 @@ TEST_F(NodeLinkMemoryTest, ParcelDataAllocation) {
   node_c->Close();
 }
 
+TEST_F(NodeLinkMemoryTest, MessageRings) {
+  // Message rings are only available when both nodes support them, since the
+  // broker allocates the primary buffer with room for them.
+  const IpczFeature kEnabledFeatures[] = {IPCZ_FEATURE_MESSAGE_RINGS};
+  for (bool broker_rings : {true, false}) {
+    for (bool non_broker_rings : {true, false}) {
+      const IpczCreateNodeOptions broker_options = {
+          .size = sizeof(broker_options),
+          .enabled_features = kEnabledFeatures,
+          .num_enabled_features = broker_rings ? 1u : 0u,
+      };
+      const IpczCreateNodeOptions non_broker_options = {
+          .size = sizeof(non_broker_options),
+          .enabled_features = kEnabledFeatures,
+          .num_enabled_features = non_broker_rings ? 1u : 0u,
+      };
+      const Ref<Node> broker{MakeRefCounted<Node>(
+          Node::Type::kBroker, kTestDriver, &broker_options)};
+      const Ref<Node> non_broker{MakeRefCounted<Node>(
+          Node::Type::kNormal, kTestDriver, &non_broker_options)};
+      auto links = ConnectNodes(broker, non_broker, kOtherTestNonBrokerName);
+      NodeLinkMemory& memory_a = links.first->memory();
+      NodeLinkMemory& memory_b = links.second->memory();
+
+      const absl::Span<uint8_t> ring_a =
+          memory_a.GetMessageRingMemory(LinkSide::kA);
+      const absl::Span<uint8_t> ring_b =
+          memory_a.GetMessageRingMemory(LinkSide::kB);
+      if (!broker_rings || !non_broker_rings) {
+        EXPECT_TRUE(ring_a.empty());
+        EXPECT_TRUE(ring_b.empty());
+      } else {
+        EXPECT_GE(ring_a.size(), MessageRing::kMinRegionSize);
+        EXPECT_EQ(ring_a.size(), ring_b.size());
+        EXPECT_EQ(ring_a.data() + ring_a.size(), ring_b.data());
+        EXPECT_EQ(ring_a.size(),
+                  memory_b.GetMessageRingMemory(LinkSide::kA).size());
+      }
+
+      non_broker->Close();
+      broker->Close();
+    }
+  }
+}
+
 }  // namespace
 }  // namespace ipcz
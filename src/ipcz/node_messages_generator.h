@@ -353,6 +353,62 @@ IPCZ_MSG_BEGIN(AddBlockBuffer, IPCZ_MSG_ID(14))
   IPCZ_MSG_END_VERSION(0)
 IPCZ_MSG_END()
 
+// Shares a new large buffer, which holds a single fragment too large for block
+// allocation. The sender must initialize the buffer's header before sending
+// this message. Only sent when both nodes support the mem_v2 feature.
+IPCZ_MSG_BEGIN(AddLargeBuffer, IPCZ_MSG_ID(15))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    // The ID of the new buffer as allocated by the NodeLinkMemory on the
+    // NodeLink transmitting this message.
+    IPCZ_MSG_PARAM(BufferId, id)
+
+    // A handle to the driver-managed, read-write-mappable buffer.
+    IPCZ_MSG_PARAM_DRIVER_OBJECT(buffer)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
+// Asks the recipient to retire a buffer previously shared by the sender via
+// AddBlockBuffer or AddLargeBuffer, after the sender found the buffer idle on
+// its side. If the recipient also holds no fragments within the buffer, it
+// claims all of the buffer's allocable capacity, releases the buffer, and
+// replies with AcceptBufferRetirement. Otherwise it replies with
+// RejectBufferRetirement and both sides keep using the buffer.
+IPCZ_MSG_BEGIN(RetireBuffer, IPCZ_MSG_ID(16))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    // The ID of the buffer to retire.
+    IPCZ_MSG_PARAM(BufferId, id)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
+// Wakes the recipient to consume messages queued in the MessageRing which
+// carries messages to it from the sender. Only sent over links with message
+// rings, when the sender finds that the recipient had gone idle. This message
+// is not ordered with respect to other messages on the link.
+IPCZ_MSG_BEGIN(FlushMessageRing, IPCZ_MSG_ID(17))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    // Unused, since messages must have at least one parameter. Must be zero.
+    IPCZ_MSG_PARAM(uint64_t, reserved)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
+// Informs the recipient that a buffer it asked to retire via RetireBuffer has
+// been retired by the sender. The recipient can release the buffer too.
+IPCZ_MSG_BEGIN(AcceptBufferRetirement, IPCZ_MSG_ID(18))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    // The ID of the retired buffer.
+    IPCZ_MSG_PARAM(BufferId, id)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
+// Informs the recipient that a buffer it asked to retire via RetireBuffer is
+// still in use by the sender and remains available to both sides.
+IPCZ_MSG_BEGIN(RejectBufferRetirement, IPCZ_MSG_ID(19))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    // The ID of the buffer which was not retired.
+    IPCZ_MSG_PARAM(BufferId, id)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
 // Conveys the contents of a parcel.
 IPCZ_MSG_BEGIN(AcceptParcel, IPCZ_MSG_ID(20))
   IPCZ_MSG_BEGIN_VERSION(0)
@@ -373,7 +429,8 @@ IPCZ_MSG_BEGIN(AcceptParcel, IPCZ_MSG_ID(20))
 
     // The total number of subparcels belonging to this Parcel or its main
     // containing Parcel. If no subparcels are associated with this Parcel, this
-    // value is 1.
+    // value is 1. Subparcels embedded within this message (see version 1
+    // below) are not counted, since they aren't transmitted separately.
     //
     // Note that subparcels themselves never contain other subparcels, so for
     // subparcels this field always conveys the number of subparcels belonging
@@ -405,6 +462,25 @@ IPCZ_MSG_BEGIN(AcceptParcel, IPCZ_MSG_ID(20))
     // array.
     IPCZ_MSG_PARAM_DRIVER_OBJECT_ARRAY(driver_objects)
   IPCZ_MSG_END_VERSION(0)
+
+  IPCZ_MSG_BEGIN_VERSION(1)
+    // If non-empty, the main parcel's subparcels are embedded within this
+    // message rather than transmitted separately. Embedded subparcels have no
+    // attached objects, and each one fills the next subparcel placeholder in
+    // `handle_types`. This is the data size of each embedded subparcel, in
+    // order. `num_subparcels` must be 1 in this case.
+    IPCZ_MSG_PARAM_ARRAY(uint32_t, subparcel_data_sizes)
+
+    // The concatenated data of every embedded subparcel.
+    IPCZ_MSG_PARAM_ARRAY(uint8_t, subparcel_data)
+  IPCZ_MSG_END_VERSION(1)
+
+  IPCZ_MSG_BEGIN_VERSION(2)
+    // If the transmitting NodeLink supports remote queue state, this has an
+    // entry for each RouterDescriptor in `new_routers`, in the same order.
+    // Otherwise it's empty.
+    IPCZ_MSG_PARAM_ARRAY(RouterByteTotals, new_router_byte_totals)
+  IPCZ_MSG_END_VERSION(2)
 IPCZ_MSG_END()
 
 // Conveys partial parcel contents, namely just its attached driver objects.
@@ -429,6 +505,36 @@ IPCZ_MSG_BEGIN(AcceptParcelDriverObjects, IPCZ_MSG_ID(21))
   IPCZ_MSG_END_VERSION(0)
 IPCZ_MSG_END()
 
+// Conveys the contents of multiple parcels with consecutive SequenceNumbers in
+// a single message. Only parcels with no attached objects are batched this
+// way; any others are sent with AcceptParcel.
+IPCZ_MSG_BEGIN(AcceptParcels, IPCZ_MSG_ID(24))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    // The SublinkId linking the source and destination Routers along the
+    // transmitting NodeLink.
+    IPCZ_MSG_PARAM(SublinkId, sublink)
+
+    // The SequenceNumber of the first parcel in this batch. Each subsequent
+    // parcel has the next SequenceNumber.
+    IPCZ_MSG_PARAM(SequenceNumber, first_sequence_number)
+
+    // For each parcel, an optional shared memory fragment containing its data.
+    // If a parcel's descriptor is null, its data is instead inlined within
+    // `parcel_data` below.
+    IPCZ_MSG_PARAM_ARRAY(FragmentDescriptor, parcel_fragments)
+
+    // For each parcel, the number of bytes of its data inlined within
+    // `parcel_data`. Must be zero for parcels with a data fragment.
+    IPCZ_MSG_PARAM_ARRAY(uint32_t, inlined_data_sizes)
+
+    // The concatenated inlined data of every parcel in the batch, in order.
+    IPCZ_MSG_PARAM_ARRAY(uint8_t, parcel_data)
+
+    // Explicit padding to preserve 8-byte alignment.
+    IPCZ_MSG_PARAM(uint32_t, padding)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
 // Notifies a node that the route has been closed on one side. This message
 // always pertains to the side of the route opposite of the router receiving it,
 // guaranteed by the fact that the closed side of the route only transmits this
@@ -659,6 +765,16 @@ IPCZ_MSG_BEGIN(FlushRouter, IPCZ_MSG_ID(36))
   IPCZ_MSG_END_VERSION(0)
 IPCZ_MSG_END()
 
+// Notifies the target router that its peer on the other side of the link has
+// consumed inbound parcels while the target router was monitoring the peer's
+// queue state (see AtomicQueueState). The updated state itself is conveyed
+// through the link's shared RouterLinkState.
+IPCZ_MSG_BEGIN(NotifyDataConsumed, IPCZ_MSG_ID(37))
+  IPCZ_MSG_BEGIN_VERSION(0)
+    IPCZ_MSG_PARAM(SublinkId, sublink)
+  IPCZ_MSG_END_VERSION(0)
+IPCZ_MSG_END()
+
 // Requests allocation of a shared memory region of a given size. If the
 // recipient can comply, they will send back a corresponding ProvideMemory
 // message with a serialized memory region. This message is only sent to a
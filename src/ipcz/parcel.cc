@@ -7,6 +7,7 @@
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <utility>
@@ -31,6 +32,26 @@ Parcel::~Parcel() {
   }
 }
 
+// static
+void* Parcel::operator new(size_t size) {
+  ABSL_ASSERT(size == sizeof(Parcel));
+  return GetPool().Allocate();
+}
+
+// static
+void Parcel::operator delete(void* ptr) {
+  if (ptr) {
+    GetPool().Free(ptr);
+  }
+}
+
+// static
+ParcelPool& Parcel::GetPool() {
+  // Never destroyed, since Parcels may outlive static destruction.
+  static ParcelPool* pool = new ParcelPool(sizeof(Parcel));
+  return *pool;
+}
+
 void Parcel::SetDataFromMessage(Message::ReceivedDataBuffer buffer,
                                 absl::Span<uint8_t> data_view) {
   ABSL_ASSERT(data_view.empty() || data_view.begin() >= buffer.bytes().begin());
@@ -54,6 +75,13 @@ void Parcel::AllocateData(size_t num_bytes,
     }
   }
 
+  if (fragment.is_null() && num_bytes <= kMaxInlineDataSize) {
+    memset(inline_data_, 0, num_bytes);
+    data_.storage.emplace<InlineData>();
+    data_.view = absl::MakeSpan(inline_data_, num_bytes);
+    return;
+  }
+
   if (fragment.is_null()) {
     std::vector<uint8_t> bytes(num_bytes);
     data_.view = absl::MakeSpan(bytes);
@@ -76,8 +104,14 @@ void Parcel::AllocateData(size_t num_bytes,
 
 bool Parcel::AdoptDataFragment(Ref<NodeLinkMemory> memory,
                                const Fragment& fragment) {
-  if (!fragment.is_addressable() || fragment.size() <= sizeof(FragmentHeader) ||
-      fragment.offset() % 8 != 0) {
+  if (!fragment.is_addressable()) {
+    return false;
+  }
+
+  // On failure, drop the hold on the fragment's buffer which was acquired along
+  // with `fragment`.
+  if (fragment.size() <= sizeof(FragmentHeader) || fragment.offset() % 8 != 0) {
+    memory->ReleaseFragment(fragment);
     return false;
   }
 
@@ -88,6 +122,7 @@ bool Parcel::AdoptDataFragment(Ref<NodeLinkMemory> memory,
   const uint32_t data_size = header.size.load(std::memory_order_acquire);
   const size_t max_data_size = fragment.size() - sizeof(FragmentHeader);
   if (data_size > max_data_size) {
+    memory->ReleaseFragment(fragment);
     return false;
   }
 
@@ -130,6 +165,28 @@ void Parcel::ReleaseDataFragment() {
   data_.view = {};
 }
 
+bool Parcel::MigrateDataFragment(NodeLinkMemory& memory) {
+  ABSL_ASSERT(has_data_fragment());
+  const size_t num_bytes = data_size();
+  const Fragment fragment =
+      memory.AllocateFragment(num_bytes + sizeof(FragmentHeader));
+  if (fragment.is_null()) {
+    return false;
+  }
+
+  const absl::Span<uint8_t> new_view =
+      fragment.mutable_bytes().subspan(sizeof(FragmentHeader), num_bytes);
+  if (num_bytes > 0) {
+    memcpy(new_view.data(), data_.view.data(), num_bytes);
+  }
+
+  // Replacing the old DataFragment frees its fragment.
+  data_.storage.emplace<DataFragment>(WrapRefCounted(&memory), fragment);
+  data_.view = new_view;
+  CommitData(num_bytes);
+  return true;
+}
+
 void Parcel::ConsumeHandles(absl::Span<IpczHandle> out_handles) {
   absl::Span<Ref<APIObject>> objects = objects_.view;
   ABSL_ASSERT(out_handles.size() <= objects.size());
@@ -171,6 +228,11 @@ Parcel::DataFragment::~DataFragment() {
 }
 
 Fragment Parcel::DataFragment::release() {
+  if (is_valid()) {
+    // Ownership of the fragment is transferred, but this object's hold on its
+    // buffer is not.
+    memory_->ReleaseFragment(fragment_);
+  }
   memory_.reset();
   return std::exchange(fragment_, {});
 }
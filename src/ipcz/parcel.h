@@ -18,6 +18,7 @@
 #include "ipcz/message.h"
 #include "ipcz/node_link.h"
 #include "ipcz/node_link_memory.h"
+#include "ipcz/parcel_pool.h"
 #include "ipcz/sequence_number.h"
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
@@ -38,12 +39,24 @@ class Parcel {
   // a parcel, to mitigate the potential for abuse.
   static constexpr size_t kMaxSubparcelsPerParcel = 1024;
 
+  // Heap-allocated parcel data no larger than this is stored inline within the
+  // Parcel object itself.
+  static constexpr size_t kMaxInlineDataSize = 64;
+
   Parcel();
   explicit Parcel(SequenceNumber sequence_number);
   Parcel(const Parcel& other) = delete;
   Parcel& operator=(const Parcel& other) = delete;
   ~Parcel();
 
+  // Parcel objects are allocated from a process-wide ParcelPool rather than
+  // directly from the heap.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+
+  // Returns the pool which backs all Parcel allocations.
+  static ParcelPool& GetPool();
+
   void set_sequence_number(SequenceNumber n) { sequence_number_ = n; }
   SequenceNumber sequence_number() const { return sequence_number_; }
 
@@ -69,7 +82,8 @@ class Parcel {
 
   // Allocates `num_bytes` of storage for this Parcel's data. If `memory` is
   // non-null then its fragment pool is the preferred allocation source.
-  // Otherwise memory is allocated and zero-initialized on the heap, and the
+  // Otherwise memory is zero-initialized within the Parcel itself if it's no
+  // larger than kMaxInlineDataSize, or on the heap if larger. Either way, the
   // data placed therein will be inlined within any message that transmits this
   // parcel.
   //
@@ -89,7 +103,8 @@ class Parcel {
   // Configures this Parcel to adopt its data fragment from the `fragment`
   // belonging to `memory`. `fragment` must be addressable and must have a valid
   // FragmentHeader at the start describing the data which follows. Otherwise
-  // this returns false.
+  // this returns false. Either way, the caller's hold on `fragment` (see
+  // NodeLinkMemory::GetFragment()) is consumed.
   bool AdoptDataFragment(Ref<NodeLinkMemory> memory, const Fragment& fragment);
 
   void set_remote_source(Ref<NodeLink> source) {
@@ -128,6 +143,12 @@ class Parcel {
   // prevents the fragment from being freed upon Parcel destruction.
   void ReleaseDataFragment();
 
+  // Moves this Parcel's committed data out of its current data fragment and
+  // into a newly allocated fragment from `memory`, freeing the old fragment.
+  // The Parcel must have a data fragment. Returns false, leaving the Parcel
+  // unmodified, if no fragment could be allocated from `memory`.
+  bool MigrateDataFragment(NodeLinkMemory& memory);
+
   // Filling `out_handles` (of size N) with handles to the first N APIObjects in
   // objects_view(). The front of objects_view() is also advanced by N,
   // effectively removing the objects from this parcel.
@@ -186,11 +207,16 @@ class Parcel {
     Fragment fragment_;
   };
 
+  // Indicates that the parcel's data resides in `inline_data_`.
+  struct InlineData {};
+
   // A variant backing type for the parcel's data. Data may be in shared memory,
-  // heap-allocated and initialized from within the Parcel, or heap-allocated by
-  // a received Message and moved into the Parcel from there.
+  // stored inline within the Parcel, heap-allocated and initialized from within
+  // the Parcel, or heap-allocated by a received Message and moved into the
+  // Parcel from there.
   using DataStorage = absl::variant<absl::monostate,
                                     DataFragment,
+                                    InlineData,
                                     std::vector<uint8_t>,
                                     Message::ReceivedDataBuffer>;
 
@@ -240,6 +266,9 @@ class Parcel {
   // updated by the containing Parcel as needed.
   size_t num_subparcels_ = 1;
   size_t subparcel_index_ = 0;
+
+  // Storage for small heap-allocated data. See AllocateData().
+  alignas(8) uint8_t inline_data_[kMaxInlineDataSize];
 };
 
 }  // namespace ipcz
@@ -0,0 +1,85 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/parcel_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+
+ParcelPool::ParcelPool(size_t block_size) : block_size_(block_size) {
+  absl::MutexLock lock(&depot_mutex_);
+  depot_.reserve(kMaxDepotSize);
+}
+
+ParcelPool::~ParcelPool() {
+  for (Magazines::MagazineType& magazine : magazines_) {
+    absl::MutexLock lock(&magazine.mutex);
+    magazine.FlushAll([](absl::Span<void* const> blocks) {
+      for (void* block : blocks) {
+        ::operator delete(block);
+      }
+    });
+  }
+
+  absl::MutexLock lock(&depot_mutex_);
+  for (void* block : depot_) {
+    ::operator delete(block);
+  }
+  depot_.clear();
+}
+
+void* ParcelPool::Allocate() {
+  Magazines::MagazineType& magazine = magazines_.ForCurrentThread();
+  absl::MutexLock lock(&magazine.mutex);
+  if (magazine.empty()) {
+    // Refill half of the magazine from the depot, leaving room for blocks
+    // freed by this thread before it allocates again.
+    magazine.Refill(kMagazineCapacity / 2, [this](absl::Span<void*> blocks) {
+      absl::MutexLock depot_lock(&depot_mutex_);
+      const size_t count = std::min(depot_.size(), blocks.size());
+      std::copy(depot_.end() - count, depot_.end(), blocks.begin());
+      depot_.resize(depot_.size() - count);
+      return count;
+    });
+  }
+
+  if (!magazine.empty()) {
+    return magazine.Pop();
+  }
+
+  num_heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+  return ::operator new(block_size_);
+}
+
+void ParcelPool::Free(void* block) {
+  ABSL_ASSERT(block);
+  Magazines::MagazineType& magazine = magazines_.ForCurrentThread();
+  absl::MutexLock lock(&magazine.mutex);
+  if (magazine.size == kMagazineCapacity) {
+    // Flush the older half of the magazine into the depot. Anything which
+    // doesn't fit there goes back to the heap.
+    magazine.FlushOldest(
+        kMagazineCapacity / 2, [this](absl::Span<void* const> blocks) {
+          absl::MutexLock depot_lock(&depot_mutex_);
+          for (void* block : blocks) {
+            if (depot_.size() < kMaxDepotSize) {
+              depot_.push_back(block);
+            } else {
+              ::operator delete(block);
+            }
+          }
+        });
+  }
+
+  magazine.Push(block);
+}
+
+}  // namespace ipcz
@@ -0,0 +1,71 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_PARCEL_POOL_H_
+#define IPCZ_SRC_IPCZ_PARCEL_POOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "util/magazine.h"
+
+namespace ipcz {
+
+// A pool of fixed-size memory blocks used to recycle the storage of Parcel
+// objects, which are created and destroyed at very high rates.
+//
+// Like BlockAllocatorPool, this maintains a small set of magazines which act as
+// per-thread caches of free blocks, so Allocate() and Free() are usually served
+// by the calling thread's magazine without touching the heap or contending with
+// other threads. Since parcels are commonly allocated on one thread and freed
+// on another, magazines also exchange blocks in batches with a shared depot
+// whenever they run empty or overflow. Blocks only go back to the heap when the
+// depot is full.
+class ParcelPool {
+ public:
+  // The number of magazines maintained by each pool, and the maximum number of
+  // blocks cached by each magazine.
+  static constexpr size_t kNumMagazines = 8;
+  static constexpr size_t kMagazineCapacity = 32;
+
+  // The maximum number of free blocks held by the shared depot.
+  static constexpr size_t kMaxDepotSize = 1024;
+
+  explicit ParcelPool(size_t block_size);
+  ParcelPool(const ParcelPool&) = delete;
+  ParcelPool& operator=(const ParcelPool&) = delete;
+  ~ParcelPool();
+
+  size_t block_size() const { return block_size_; }
+
+  // The total number of blocks this pool has ever allocated from the heap.
+  size_t num_heap_allocations() const {
+    return num_heap_allocations_.load(std::memory_order_relaxed);
+  }
+
+  // Returns a block of block_size() bytes, suitably aligned for any object of
+  // that size. The block is recycled from the pool if possible, and otherwise
+  // it's allocated from the heap.
+  void* Allocate();
+
+  // Returns `block` to the pool. `block` must have been returned by a prior
+  // call to Allocate() on this pool.
+  void Free(void* block);
+
+ private:
+  using Magazines = MagazineSet<void*, kMagazineCapacity, kNumMagazines>;
+
+  const size_t block_size_;
+  Magazines magazines_;
+  std::atomic<size_t> num_heap_allocations_{0};
+
+  absl::Mutex depot_mutex_;
+  std::vector<void*> depot_ ABSL_GUARDED_BY(depot_mutex_);
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_PARCEL_POOL_H_
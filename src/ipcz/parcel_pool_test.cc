@@ -0,0 +1,169 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/parcel_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "ipcz/parcel.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+#if defined(IPCZ_STANDALONE)
+// While non-null, counts every heap allocation made through the global
+// operator new on the current thread. See the replacement operators below.
+thread_local size_t* g_num_heap_allocations = nullptr;
+
+// Counts heap allocations made by the current thread for its lifetime.
+class ScopedHeapAllocationCounter {
+ public:
+  ScopedHeapAllocationCounter() { g_num_heap_allocations = &count_; }
+  ~ScopedHeapAllocationCounter() { g_num_heap_allocations = nullptr; }
+
+  size_t count() const { return count_; }
+
+ private:
+  size_t count_ = 0;
+};
+#endif
+
+using ParcelPoolTest = test::Test;
+
+TEST_F(ParcelPoolTest, RecycleBlocks) {
+  ParcelPool pool(64);
+  void* block = pool.Allocate();
+  EXPECT_EQ(1u, pool.num_heap_allocations());
+
+  // Freed blocks are handed out again by subsequent allocations.
+  pool.Free(block);
+  EXPECT_EQ(block, pool.Allocate());
+  EXPECT_EQ(1u, pool.num_heap_allocations());
+  pool.Free(block);
+}
+
+TEST_F(ParcelPoolTest, CrossThreadRecycling) {
+  ParcelPool pool(64);
+
+  // Blocks allocated on one thread and freed on another overflow the freeing
+  // thread's magazine into the shared depot, where the allocating thread can
+  // find them again.
+  constexpr size_t kNumBlocks = 256;
+  std::vector<void*> blocks(kNumBlocks);
+  for (void*& block : blocks) {
+    block = pool.Allocate();
+  }
+  EXPECT_EQ(kNumBlocks, pool.num_heap_allocations());
+
+  std::thread([&] {
+    for (void* block : blocks) {
+      pool.Free(block);
+    }
+  }).join();
+
+  for (void*& block : blocks) {
+    block = pool.Allocate();
+  }
+
+  // At most one magazine's worth of blocks remains cached by the other thread.
+  EXPECT_LE(pool.num_heap_allocations(),
+            kNumBlocks + ParcelPool::kMagazineCapacity);
+  for (void* block : blocks) {
+    pool.Free(block);
+  }
+}
+
+TEST_F(ParcelPoolTest, InlineData) {
+  // Small heap-backed data lives within the Parcel itself.
+  auto parcel = std::make_unique<Parcel>();
+  parcel->AllocateData(Parcel::kMaxInlineDataSize, /*allow_partial=*/false,
+                       /*memory=*/nullptr);
+  const uint8_t* parcel_start = reinterpret_cast<const uint8_t*>(parcel.get());
+  const uint8_t* data = parcel->data_view().data();
+  EXPECT_GE(data, parcel_start);
+  EXPECT_LE(data + parcel->data_size(), parcel_start + sizeof(Parcel));
+
+  // Larger data does not.
+  auto large_parcel = std::make_unique<Parcel>();
+  large_parcel->AllocateData(Parcel::kMaxInlineDataSize + 1,
+                             /*allow_partial=*/false, /*memory=*/nullptr);
+  EXPECT_EQ(Parcel::kMaxInlineDataSize + 1, large_parcel->data_size());
+}
+
+TEST_F(ParcelPoolTest, PutGetDoesNotAllocate) {
+#if !defined(IPCZ_STANDALONE)
+  GTEST_SKIP() << "Heap allocations are only counted in standalone builds.";
+#else
+  const IpczHandle node = CreateNode(reference_drivers::kSyncReferenceDriver);
+  auto [a, b] = OpenPortals(node);
+
+  // Round trips parcels of `num_bytes` bytes from `a` to `b` without any test
+  // helpers, which might allocate on their own.
+  auto round_trip = [&, a = a, b = b](size_t num_bytes, size_t num_parcels) {
+    uint8_t data[Parcel::kMaxInlineDataSize] = {};
+    for (size_t i = 0; i < num_parcels; ++i) {
+      EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Put(a, data, num_bytes, nullptr, 0,
+                                           IPCZ_NO_FLAGS, nullptr));
+    }
+    for (size_t i = 0; i < num_parcels; ++i) {
+      size_t num_bytes_received = sizeof(data);
+      EXPECT_EQ(IPCZ_RESULT_OK,
+                ipcz().Get(b, IPCZ_NO_FLAGS, nullptr, data,
+                           &num_bytes_received, nullptr, nullptr, nullptr));
+      EXPECT_EQ(num_bytes, num_bytes_received);
+    }
+  };
+
+  // Steady-state round trips of small parcels, including ones whose data fills
+  // the parcel's inline storage, make no heap allocations at all once the
+  // calling thread's magazine and the portals' queues are warmed up.
+  for (size_t num_bytes : {size_t{5}, Parcel::kMaxInlineDataSize}) {
+    round_trip(num_bytes, ParcelPool::kMagazineCapacity);
+
+    ScopedHeapAllocationCounter counter;
+    for (size_t i = 0; i < 1000; ++i) {
+      round_trip(num_bytes, 1);
+    }
+    EXPECT_EQ(0u, counter.count()) << num_bytes << " byte parcels";
+  }
+
+  CloseAll({a, b, node});
+#endif
+}
+
+}  // namespace
+}  // namespace ipcz
+
+#if defined(IPCZ_STANDALONE)
+// Replacements for the global allocation functions, so that tests can count
+// heap allocations. Array and sized forms forward to these by default.
+void* operator new(size_t size) {
+  if (ipcz::g_num_heap_allocations) {
+    ++*ipcz::g_num_heap_allocations;
+  }
+  void* ptr = std::malloc(size ? size : 1);
+  if (!ptr) {
+    std::abort();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+#endif
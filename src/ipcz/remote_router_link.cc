@@ -5,22 +5,58 @@
 #include "ipcz/remote_router_link.h"
 
 #include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <utility>
 #include <vector>
 
 #include "ipcz/application_object.h"
 #include "ipcz/box.h"
+#include "ipcz/data_pipe.h"
 #include "ipcz/node_link.h"
 #include "ipcz/node_link_memory.h"
 #include "ipcz/node_messages.h"
 #include "ipcz/parcel.h"
+#include "ipcz/parcel_wrapper.h"
 #include "ipcz/router.h"
+#include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 #include "util/log.h"
 #include "util/safe_math.h"
 
 namespace ipcz {
 
+namespace {
+
+// Subparcels are only embedded within their main parcel's message if their
+// combined data fits within this many bytes. Otherwise they're transmitted as
+// separate messages, so that no single message grows too large for the
+// transport.
+constexpr size_t kMaxEmbeddedSubparcelDataSize = 64 * 1024;
+
+// Indicates whether every parcel in `subparcels` can be embedded within the
+// AcceptParcel message of its main parcel. If so, `num_bytes` is set to the
+// total data size of all subparcels.
+bool CanEmbedSubparcels(absl::Span<const Ref<ParcelWrapper>> subparcels,
+                        size_t& num_bytes) {
+  size_t total_num_bytes = 0;
+  for (const Ref<ParcelWrapper>& subparcel : subparcels) {
+    // Embedded subparcels carry only data.
+    Parcel& parcel = subparcel->parcel();
+    if (!parcel.objects_view().empty()) {
+      return false;
+    }
+
+    total_num_bytes += parcel.data_size();
+    if (total_num_bytes > kMaxEmbeddedSubparcelDataSize) {
+      return false;
+    }
+  }
+  num_bytes = total_num_bytes;
+  return true;
+}
+
+}  // namespace
+
 RemoteRouterLink::RemoteRouterLink(const OperationContext& context,
                                    Ref<NodeLink> node_link,
                                    SublinkId sublink,
@@ -124,6 +160,28 @@ void RemoteRouterLink::WaitForLinkStateAsync(std::function<void()> callback) {
   callback();
 }
 
+AtomicQueueState* RemoteRouterLink::GetLocalQueueState() {
+  // Nodes without remote queue state support neither publish their queue
+  // state nor expect NotifyDataConsumed messages.
+  if (!node_link()->available_features().remote_queue_state()) {
+    return nullptr;
+  }
+  if (RouterLinkState* state = GetLinkState()) {
+    return &state->GetQueueState(side_);
+  }
+  return nullptr;
+}
+
+AtomicQueueState* RemoteRouterLink::GetPeerQueueState() {
+  if (!node_link()->available_features().remote_queue_state()) {
+    return nullptr;
+  }
+  if (RouterLinkState* state = GetLinkState()) {
+    return &state->GetQueueState(side_.opposite());
+  }
+  return nullptr;
+}
+
 Ref<Router> RemoteRouterLink::GetLocalPeer() {
   return nullptr;
 }
@@ -193,6 +251,20 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
         break;
       }
 
+      case APIObject::kDataPipe: {
+        // A data pipe endpoint travels as a new router on its control route,
+        // along with its shared memory object.
+        ++num_portals;
+        DriverObject memory =
+            DataPipe::FromObject(object.get())->TakeMemoryForTransmission(
+                context);
+        if (!memory.CanTransmitOn(*node_link()->transport())) {
+          must_relay_driver_objects = true;
+        }
+        driver_objects.push_back(std::move(memory));
+        break;
+      }
+
       default:
         break;
     }
@@ -206,7 +278,19 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   ABSL_ASSERT(subparcels.size() < Parcel::kMaxSubparcelsPerParcel);
 
   uint32_t num_subparcels;
-  if (parcel->subparcel_index() == 0) {
+  std::vector<std::unique_ptr<Parcel>> embedded_subparcels;
+  size_t num_embedded_subparcel_bytes = 0;
+  if (parcel->subparcel_index() == 0 && !subparcels.empty() &&
+      node_link()->available_features().embedded_subparcels() &&
+      CanEmbedSubparcels(subparcels, num_embedded_subparcel_bytes)) {
+    // All subparcels travel within this parcel's own message, so the receiver
+    // has nothing else to collect.
+    num_subparcels = 1;
+    embedded_subparcels.reserve(subparcels.size());
+    for (Ref<ParcelWrapper>& subparcel : subparcels) {
+      embedded_subparcels.push_back(subparcel->TakeParcel());
+    }
+  } else if (parcel->subparcel_index() == 0) {
     // The total subparcel count includes this (the main) parcel.
     num_subparcels = checked_cast<uint32_t>(subparcels.size()) + 1;
 
@@ -246,12 +330,9 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   // Allocate all the arrays in the message. Note that each allocation may
   // relocate the parcel data in memory, so views into these arrays should not
   // be acquired until all allocations are complete.
-  if (!parcel->has_data_fragment() ||
-      parcel->data_fragment_memory() != &node_link()->memory()) {
-    // Only inline parcel data within the message when we don't have a separate
-    // data fragment allocated already, or if the allocated fragment is on the
-    // wrong link. The latter case is possible if the transmitting Router
-    // switched links since the Parcel's data was allocated.
+  if (!PrepareParcelData(*parcel)) {
+    // Only inline parcel data within the message when we don't have a data
+    // fragment in this link's memory.
     accept.v0()->parcel_data =
         accept.AllocateArray<uint8_t>(parcel->data_size());
   } else {
@@ -264,6 +345,14 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   accept.v0()->handle_types = accept.AllocateArray<HandleType>(objects.size());
   accept.v0()->new_routers =
       accept.AllocateArray<RouterDescriptor>(num_portals);
+  accept.v1()->subparcel_data_sizes =
+      accept.AllocateArray<uint32_t>(embedded_subparcels.size());
+  accept.v1()->subparcel_data =
+      accept.AllocateArray<uint8_t>(num_embedded_subparcel_bytes);
+  const bool send_byte_totals =
+      node_link()->available_features().remote_queue_state();
+  accept.v2()->new_router_byte_totals = accept.AllocateArray<RouterByteTotals>(
+      send_byte_totals ? num_portals : 0);
 
   const absl::Span<uint8_t> inline_parcel_data =
       accept.GetArrayView<uint8_t>(accept.v0()->parcel_data);
@@ -271,12 +360,32 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
       accept.GetArrayView<HandleType>(accept.v0()->handle_types);
   const absl::Span<RouterDescriptor> new_routers =
       accept.GetArrayView<RouterDescriptor>(accept.v0()->new_routers);
+  const absl::Span<uint32_t> subparcel_data_sizes =
+      accept.GetArrayView<uint32_t>(accept.v1()->subparcel_data_sizes);
+  absl::Span<uint8_t> subparcel_data =
+      accept.GetArrayView<uint8_t>(accept.v1()->subparcel_data);
+  const absl::Span<RouterByteTotals> new_router_byte_totals =
+      accept.GetArrayView<RouterByteTotals>(
+          accept.v2()->new_router_byte_totals);
 
   if (!inline_parcel_data.empty()) {
     memcpy(inline_parcel_data.data(), parcel->data_view().data(),
            parcel->data_size());
   }
 
+  // Embedded subparcel data is always inlined, regardless of where it resides
+  // locally. This spares the receiver from having to wait on any of their
+  // fragments.
+  for (size_t i = 0; i < embedded_subparcels.size(); ++i) {
+    const Parcel& subparcel = *embedded_subparcels[i];
+    const size_t num_bytes = subparcel.data_size();
+    subparcel_data_sizes[i] = checked_cast<uint32_t>(num_bytes);
+    if (num_bytes > 0) {
+      memcpy(subparcel_data.data(), subparcel.data_view().data(), num_bytes);
+      subparcel_data.remove_prefix(num_bytes);
+    }
+  }
+
   // Serialize attached objects. We accumulate the Routers of all attached
   // portals, because we need to reference them again after transmission, with
   // a 1:1 correspondence to the serialized RouterDescriptors.
@@ -286,6 +395,7 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   // Explicitly zero the descriptor memory since there may be padding bits
   // within and we'll be copying the full contents into message data below.
   memset(descriptors.data(), 0, descriptors.size() * sizeof(descriptors[0]));
+  absl::InlinedVector<RouterByteTotals, 4> byte_totals(num_portals);
 
   size_t portal_index = 0;
   for (size_t i = 0; i < objects.size(); ++i) {
@@ -298,7 +408,23 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
         Ref<Router> router = WrapRefCounted(Router::FromObject(&object));
         ABSL_ASSERT(portal_index < num_portals);
         router->SerializeNewRouter(context, *node_link(),
-                                   descriptors[portal_index]);
+                                   descriptors[portal_index],
+                                   byte_totals[portal_index]);
+        routers_to_proxy[portal_index] = std::move(router);
+        ++portal_index;
+        break;
+      }
+
+      case APIObject::kDataPipe: {
+        DataPipe* pipe = DataPipe::FromObject(&object);
+        handle_types[i] = pipe->is_producer() ? HandleType::kDataPipeProducer
+                                              : HandleType::kDataPipeConsumer;
+
+        Ref<Router> router = WrapRefCounted(&pipe->router());
+        ABSL_ASSERT(portal_index < num_portals);
+        router->SerializeNewRouter(context, *node_link(),
+                                   descriptors[portal_index],
+                                   byte_totals[portal_index]);
         routers_to_proxy[portal_index] = std::move(router);
         ++portal_index;
         break;
@@ -335,6 +461,10 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
     memcpy(new_routers.data(), descriptors.data(),
            new_routers.size() * sizeof(new_routers[0]));
   }
+  if (!new_router_byte_totals.empty()) {
+    memcpy(new_router_byte_totals.data(), byte_totals.data(),
+           new_router_byte_totals.size() * sizeof(new_router_byte_totals[0]));
+  }
 
   if (must_split_parcel) {
     msg::AcceptParcelDriverObjects accept_objects;
@@ -371,6 +501,51 @@ void RemoteRouterLink::AcceptParcel(const OperationContext& context,
   }
 }
 
+void RemoteRouterLink::AcceptParcels(
+    const OperationContext& context,
+    absl::Span<std::unique_ptr<Parcel>> parcels) {
+  if (!node_link()->available_features().batched_parcels()) {
+    // The remote node may not understand AcceptParcels messages.
+    for (std::unique_ptr<Parcel>& parcel : parcels) {
+      AcceptParcel(context, std::move(parcel));
+    }
+    return;
+  }
+
+  // Consecutive parcels without attached objects are batched into a single
+  // message. Any other parcels are transmitted individually.
+  while (!parcels.empty()) {
+    size_t batch_size = 0;
+    while (batch_size < parcels.size() &&
+           parcels[batch_size]->objects_view().empty()) {
+      ++batch_size;
+    }
+
+    if (batch_size < 2) {
+      AcceptParcel(context, std::move(parcels[0]));
+      parcels.remove_prefix(1);
+      continue;
+    }
+
+    TransmitParcelBatch(parcels.first(batch_size));
+    parcels.remove_prefix(batch_size);
+  }
+}
+
+void RemoteRouterLink::SetFastPathEnabled(bool enabled) {
+  // Parcels from another node always arrive through the NodeLink.
+}
+
+std::unique_ptr<Parcel> RemoteRouterLink::TakeFastPathParcel() {
+  return nullptr;
+}
+
+void RemoteRouterLink::NotifyDataConsumed(const OperationContext& context) {
+  msg::NotifyDataConsumed notify;
+  notify.v0()->sublink = sublink_;
+  node_link()->Transmit(notify);
+}
+
 void RemoteRouterLink::AcceptRouteClosure(const OperationContext& context,
                                           SequenceNumber sequence_length) {
   msg::RouteClosed route_closed;
@@ -494,6 +669,95 @@ void RemoteRouterLink::StopProxyingToLocalPeer(
   node_link()->Transmit(stop);
 }
 
+bool RemoteRouterLink::PrepareParcelData(Parcel& parcel) {
+  NodeLinkMemory& memory = node_link()->memory();
+  if (!parcel.has_data_fragment()) {
+    if (!parcel.data_view().empty()) {
+      memory.RecordParcelDataPath(NodeLinkMemory::ParcelDataPath::kInlined);
+    }
+    return false;
+  }
+
+  if (parcel.data_fragment_memory() == &memory) {
+    memory.RecordParcelDataPath(NodeLinkMemory::ParcelDataPath::kFragment);
+    return true;
+  }
+
+  // The transmitting Router switched links since the parcel's data was
+  // allocated. Copying the data into this link's memory costs no more than
+  // inlining it, and it spares the transport from carrying the data.
+  if (parcel.MigrateDataFragment(memory)) {
+    memory.RecordParcelDataPath(
+        NodeLinkMemory::ParcelDataPath::kMigratedFragment);
+    return true;
+  }
+
+  memory.RecordParcelDataPath(NodeLinkMemory::ParcelDataPath::kInlined);
+  return false;
+}
+
+void RemoteRouterLink::TransmitParcelBatch(
+    absl::Span<std::unique_ptr<Parcel>> parcels) {
+  msg::AcceptParcels accept;
+  accept.v0()->sublink = sublink_;
+  accept.v0()->first_sequence_number = parcels[0]->sequence_number();
+  accept.v0()->padding = 0;
+
+  // As with AcceptParcel(), data is inlined unless it's in a fragment of this
+  // link's memory.
+  absl::InlinedVector<bool, 16> is_inlined(parcels.size());
+  size_t num_inlined_bytes = 0;
+  for (size_t i = 0; i < parcels.size(); ++i) {
+    Parcel& parcel = *parcels[i];
+    ABSL_ASSERT(parcel.objects_view().empty());
+    ABSL_ASSERT(parcel.sequence_number().value() ==
+                accept.v0()->first_sequence_number.value() + i);
+    is_inlined[i] = !PrepareParcelData(parcel);
+    if (is_inlined[i]) {
+      num_inlined_bytes += parcel.data_size();
+    }
+  }
+
+  // Note that each allocation may relocate the message data, so views into
+  // these arrays are only acquired once all allocations are complete.
+  accept.v0()->parcel_fragments =
+      accept.AllocateArray<FragmentDescriptor>(parcels.size());
+  accept.v0()->inlined_data_sizes =
+      accept.AllocateArray<uint32_t>(parcels.size());
+  accept.v0()->parcel_data = accept.AllocateArray<uint8_t>(num_inlined_bytes);
+  const absl::Span<FragmentDescriptor> fragments =
+      accept.GetArrayView<FragmentDescriptor>(accept.v0()->parcel_fragments);
+  const absl::Span<uint32_t> inlined_data_sizes =
+      accept.GetArrayView<uint32_t>(accept.v0()->inlined_data_sizes);
+  absl::Span<uint8_t> inlined_data =
+      accept.GetArrayView<uint8_t>(accept.v0()->parcel_data);
+  for (size_t i = 0; i < parcels.size(); ++i) {
+    Parcel& parcel = *parcels[i];
+    if (!is_inlined[i]) {
+      // This relinquishes ownership of the fragment to the recipient.
+      fragments[i] = parcel.data_fragment().descriptor();
+      inlined_data_sizes[i] = 0;
+      parcel.ReleaseDataFragment();
+      continue;
+    }
+
+    const size_t num_bytes = parcel.data_size();
+    fragments[i] = FragmentDescriptor();
+    inlined_data_sizes[i] = checked_cast<uint32_t>(num_bytes);
+    if (num_bytes > 0) {
+      memcpy(inlined_data.data(), parcel.data_view().data(), num_bytes);
+      inlined_data.remove_prefix(num_bytes);
+    }
+  }
+
+  DVLOG(4) << "Transmitting " << parcels.size() << " parcels starting with "
+           << parcels[0]->Describe() << " over " << Describe();
+  node_link()->Transmit(accept);
+  for (std::unique_ptr<Parcel>& parcel : parcels) {
+    parcel.reset();
+  }
+}
+
 std::string RemoteRouterLink::Describe() const {
   std::stringstream ss;
   ss << type_.ToString() << " link from "
@@ -56,6 +56,8 @@ class RemoteRouterLink : public RouterLink {
   LinkType GetType() const override;
   RouterLinkState* GetLinkState() const override;
   void WaitForLinkStateAsync(std::function<void()> callback) override;
+  AtomicQueueState* GetLocalQueueState() override;
+  AtomicQueueState* GetPeerQueueState() override;
   Ref<Router> GetLocalPeer() override;
   RemoteRouterLink* AsRemoteRouterLink() override;
   void AllocateParcelData(size_t num_bytes,
@@ -63,6 +65,11 @@ class RemoteRouterLink : public RouterLink {
                           Parcel& parcel) override;
   void AcceptParcel(const OperationContext& context,
                     std::unique_ptr<Parcel> parcel) override;
+  void AcceptParcels(const OperationContext& context,
+                     absl::Span<std::unique_ptr<Parcel>> parcels) override;
+  void SetFastPathEnabled(bool enabled) override;
+  std::unique_ptr<Parcel> TakeFastPathParcel() override;
+  void NotifyDataConsumed(const OperationContext& context) override;
   void AcceptRouteClosure(const OperationContext& context,
                           SequenceNumber sequence_length) override;
   void AcceptRouteDisconnected(const OperationContext& context) override;
@@ -100,6 +107,18 @@ class RemoteRouterLink : public RouterLink {
 
   ~RemoteRouterLink() override;
 
+  // Prepares `parcel`'s data to be transmitted over this link. Data in a
+  // fragment of some other link's memory (e.g. because the route switched
+  // links after the data was allocated) is moved into a fragment of this link's
+  // memory if possible. Returns true if the data now resides in this link's
+  // memory and can be conveyed by fragment, or false if it must be inlined
+  // within the transmitted message.
+  bool PrepareParcelData(Parcel& parcel);
+
+  // Transmits `parcels` in a single AcceptParcels message. Parcels must have
+  // consecutive SequenceNumbers and no attached objects.
+  void TransmitParcelBatch(absl::Span<std::unique_ptr<Parcel>> parcels);
+
   // Sets this link's RouterLinkState. `state` must be pending or addressable
   // and this must be a central link.
   void SetLinkState(const OperationContext& context,
@@ -7,11 +7,13 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <limits>
 #include <optional>
 #include <utility>
 
 #include "ipcz/ipcz.h"
 #include "ipcz/local_router_link.h"
+#include "ipcz/monitored_atomic.h"
 #include "ipcz/node_link.h"
 #include "ipcz/operation_context.h"
 #include "ipcz/parcel_wrapper.h"
@@ -21,6 +23,8 @@
 #include "third_party/abseil-cpp/absl/base/macros.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
 #include "util/log.h"
 #include "util/multi_mutex_lock.h"
 #include "util/safe_math.h"
@@ -67,6 +71,20 @@ void CollectParcelsToFlush(ParcelQueue& queue,
   }
 }
 
+// Allocates a new parcel with `num_bytes` of data capacity, preferably within
+// memory associated with `link` if non-null.
+std::unique_ptr<Parcel> AllocateParcelForLink(RouterLink* link,
+                                              size_t num_bytes,
+                                              bool allow_partial) {
+  auto parcel = std::make_unique<Parcel>();
+  if (link) {
+    link->AllocateParcelData(num_bytes, allow_partial, *parcel);
+  } else {
+    parcel->AllocateData(num_bytes, allow_partial, nullptr);
+  }
+  return parcel;
+}
+
 bool ValidateAndAcquireObjectsForTransitFrom(
     Router& sender,
     absl::Span<const IpczHandle> handles,
@@ -84,7 +102,7 @@ bool ValidateAndAcquireObjectsForTransitFrom(
 
 }  // namespace
 
-Router::Router() = default;
+Router::Router() : traps_(*this) {}
 
 Router::~Router() {
   // A Router MUST be serialized or closed before it can be destroyed. Both
@@ -137,10 +155,21 @@ bool Router::IsOnCentralRemoteLink() {
 
 void Router::QueryStatus(IpczPortalStatus& status) {
   absl::MutexLock lock(&mutex_);
-  status.size = std::min(status.size, sizeof(IpczPortalStatus));
-  status.flags = status_flags_;
-  status.num_local_parcels = inbound_parcels_.GetNumAvailableElements();
-  status.num_local_bytes = inbound_parcels_.GetTotalAvailableElementSize();
+  PollInboundFastPath();
+  const size_t size = std::min(status.size, sizeof(IpczPortalStatus));
+  status = GetStatus({.monitor_parcels = false, .monitor_bytes = false});
+  status.size = size;
+}
+
+void Router::NotifyPeerConsumedData(const OperationContext& context) {
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&mutex_);
+  if (!inward_edge_) {
+    if (!traps_.empty()) {
+      traps_.NotifyRemoteActivity(context, GetStatusForTraps(), dispatcher);
+    }
+    NotifyWaiters(dispatcher);
+  }
 }
 
 bool Router::HasLocalPeer(Router& router) {
@@ -155,18 +184,17 @@ std::unique_ptr<Parcel> Router::AllocateOutboundParcel(size_t num_bytes,
     absl::MutexLock lock(&mutex_);
     outward_link = outward_edge_.primary_link();
   }
-
-  auto parcel = std::make_unique<Parcel>();
-  if (outward_link) {
-    outward_link->AllocateParcelData(num_bytes, allow_partial, *parcel);
-  } else {
-    parcel->AllocateData(num_bytes, allow_partial, nullptr);
-  }
-  return parcel;
+  return AllocateParcelForLink(outward_link.get(), num_bytes, allow_partial);
 }
 
 IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
+  return SendOutboundParcels(absl::MakeSpan(&parcel, 1));
+}
+
+IpczResult Router::SendOutboundParcels(
+    absl::Span<std::unique_ptr<Parcel>> parcels) {
   Ref<RouterLink> link;
+  size_t num_parcels_to_transmit = 0;
   {
     absl::MutexLock lock(&mutex_);
     if (inbound_parcels_.final_sequence_length()) {
@@ -174,18 +202,24 @@ IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
       return IPCZ_RESULT_NOT_FOUND;
     }
 
-    const SequenceNumber sequence_number =
-        outbound_parcels_.GetCurrentSequenceLength();
-    parcel->set_sequence_number(sequence_number);
-    if (outward_edge_.primary_link() &&
-        outbound_parcels_.SkipElement(sequence_number)) {
-      link = outward_edge_.primary_link();
-    } else {
+    link = outward_edge_.primary_link();
+    for (size_t i = 0; i < parcels.size(); ++i) {
+      std::unique_ptr<Parcel>& parcel = parcels[i];
+      const SequenceNumber sequence_number =
+          outbound_parcels_.GetCurrentSequenceLength();
+      parcel->set_sequence_number(sequence_number);
+
       // If there are no unsent parcels ahead of this one in the outbound
       // sequence, and we have an active outward link, we can immediately
-      // transmit the parcel without any intermediate queueing step. That is the
-      // most common case, but otherwise we have to queue the parcel here and it
-      // will be flushed out ASAP.
+      // transmit the parcel without any intermediate queueing step. That is
+      // the most common case, but otherwise we have to queue the parcel here
+      // and it will be flushed out ASAP.
+      if (link && num_parcels_to_transmit == i &&
+          outbound_parcels_.SkipElement(sequence_number, parcel->data_size())) {
+        ++num_parcels_to_transmit;
+        continue;
+      }
+
       DVLOG(4) << "Queuing outbound " << parcel->Describe();
       const bool push_ok =
           outbound_parcels_.Push(sequence_number, std::move(parcel));
@@ -193,12 +227,13 @@ IpczResult Router::SendOutboundParcel(std::unique_ptr<Parcel> parcel) {
     }
   }
 
+  // NOTE: Only the leading parcels which were not moved into the queue above
+  // are transmitted directly, so there is no use-after-move here.
   const OperationContext context{OperationContext::kAPICall};
-  if (link) {
-    // NOTE: This cannot be a use-after-move because `link` is always null in
-    // the case where `parcel` is moved above.
-    link->AcceptParcel(context, std::move(parcel));
-  } else {
+  if (num_parcels_to_transmit > 0) {
+    link->AcceptParcels(context, parcels.first(num_parcels_to_transmit));
+  }
+  if (num_parcels_to_transmit < parcels.size()) {
     Flush(context);
   }
   return IPCZ_RESULT_OK;
@@ -208,11 +243,18 @@ void Router::CloseRoute() {
   const OperationContext context{OperationContext::kAPICall};
   TrapEventDispatcher dispatcher;
   Ref<RouterLink> link;
+  WaitSetMemberList wait_set_members;
   {
     absl::MutexLock lock(&mutex_);
     outbound_parcels_.SetFinalSequenceLength(
         outbound_parcels_.GetCurrentSequenceLength());
     traps_.RemoveAll(context, dispatcher);
+    are_waits_cancelled_ = true;
+    wait_set_members.swap(wait_set_members_);
+    NotifyWaiters(dispatcher);
+  }
+  for (const Ref<WaitSet::Member>& member : wait_set_members) {
+    member->wait_set().ForgetMember(*member);
   }
   Flush(context);
 }
@@ -264,8 +306,10 @@ bool Router::AcceptInboundParcel(const OperationContext& context,
         // Only notify traps if the new parcel is actually available for
         // reading, which may not be the case if some preceding parcels have yet
         // to be received.
-        traps_.NotifyNewLocalParcel(context, status_flags_, inbound_parcels_,
-                                    dispatcher);
+        if (!traps_.empty()) {
+          traps_.NotifyNewLocalParcel(context, GetStatusForTraps(), dispatcher);
+        }
+        NotifyWaiters(dispatcher);
       }
     }
   }
@@ -307,6 +351,9 @@ bool Router::AcceptRouteClosureFrom(const OperationContext& context,
   {
     absl::MutexLock lock(&mutex_);
     if (link_type.is_outward()) {
+      // Closure always takes the slow path, so anything which arrived ahead of
+      // it on the fast path must be accounted for first.
+      PollInboundFastPath(/*allow_fast_path=*/false);
       if (!inbound_parcels_.SetFinalSequenceLength(sequence_length)) {
         // Ignore if and only if the sequence was terminated early.
         DVLOG(4) << "Discarding inbound route closure notification";
@@ -320,8 +367,10 @@ bool Router::AcceptRouteClosureFrom(const OperationContext& context,
           status_flags_ |=
               IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
         }
-        traps_.NotifyPeerClosed(context, status_flags_, inbound_parcels_,
-                                dispatcher);
+        if (!traps_.empty()) {
+          traps_.NotifyPeerClosed(context, GetStatusForTraps(), dispatcher);
+        }
+        NotifyWaiters(dispatcher);
       }
     } else if (link_type.is_peripheral_inward()) {
       if (!outbound_parcels_.SetFinalSequenceLength(sequence_length)) {
@@ -353,6 +402,7 @@ bool Router::AcceptRouteDisconnectedFrom(const OperationContext& context,
              << link_type.ToString() << "link";
 
     is_disconnected_ = true;
+    PollInboundFastPath();
     if (link_type.is_peripheral_inward()) {
       outbound_parcels_.ForceTerminateSequence();
     } else {
@@ -375,8 +425,10 @@ bool Router::AcceptRouteDisconnectedFrom(const OperationContext& context,
         status_flags_ |=
             IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
       }
-      traps_.NotifyPeerClosed(context, status_flags_, inbound_parcels_,
-                              dispatcher);
+      if (!traps_.empty()) {
+        traps_.NotifyPeerClosed(context, GetStatusForTraps(), dispatcher);
+      }
+      NotifyWaiters(dispatcher);
     }
   }
 
@@ -393,7 +445,19 @@ bool Router::AcceptRouteDisconnectedFrom(const OperationContext& context,
 }
 
 IpczResult Router::Put(absl::Span<const uint8_t> data,
-                       absl::Span<const IpczHandle> handles) {
+                       absl::Span<const IpczHandle> handles,
+                       const IpczPutLimits* limits) {
+  const IpczPutSegment segment = {
+      .size = sizeof(segment),
+      .data = data.data(),
+      .num_bytes = data.size(),
+  };
+  return PutSegments({&segment, 1}, handles, limits);
+}
+
+IpczResult Router::PutSegments(absl::Span<const IpczPutSegment> segments,
+                               absl::Span<const IpczHandle> handles,
+                               const IpczPutLimits* limits) {
   std::vector<Ref<APIObject>> objects;
   if (!ValidateAndAcquireObjectsForTransitFrom(*this, handles, objects)) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
@@ -403,12 +467,30 @@ IpczResult Router::Put(absl::Span<const uint8_t> data,
     return IPCZ_RESULT_NOT_FOUND;
   }
 
+  size_t num_bytes = 0;
+  for (const IpczPutSegment& segment : segments) {
+    num_bytes = CheckAdd(num_bytes, segment.num_bytes);
+  }
+
+  if (limits) {
+    const std::optional<size_t> capacity = GetPutCapacity(*limits);
+    if (!capacity || num_bytes > *capacity) {
+      return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+    }
+  }
+
+  // Each segment is copied directly into its final position within the
+  // parcel's data, whether that's in shared memory or on the heap.
   std::unique_ptr<Parcel> parcel =
-      AllocateOutboundParcel(data.size(), /*allow_partial=*/false);
-  if (!data.empty()) {
-    memcpy(parcel->data_view().data(), data.data(), data.size());
+      AllocateOutboundParcel(num_bytes, /*allow_partial=*/false);
+  uint8_t* data = parcel->data_view().data();
+  for (const IpczPutSegment& segment : segments) {
+    if (segment.num_bytes > 0) {
+      memcpy(data, segment.data, segment.num_bytes);
+      data += segment.num_bytes;
+    }
   }
-  parcel->CommitData(data.size());
+  parcel->CommitData(num_bytes);
   parcel->SetObjects(std::move(objects));
   const IpczResult result = SendOutboundParcel(std::move(parcel));
   if (result == IPCZ_RESULT_OK) {
@@ -422,7 +504,69 @@ IpczResult Router::Put(absl::Span<const uint8_t> data,
   return result;
 }
 
+IpczResult Router::PutMany(absl::Span<const IpczPutParcel> parcels,
+                           const IpczPutLimits* limits) {
+  std::vector<std::vector<Ref<APIObject>>> objects(parcels.size());
+  size_t total_num_bytes = 0;
+  for (size_t i = 0; i < parcels.size(); ++i) {
+    const IpczPutParcel& parcel = parcels[i];
+    if (!ValidateAndAcquireObjectsForTransitFrom(
+            *this, absl::MakeSpan(parcel.handles, parcel.num_handles),
+            objects[i])) {
+      return IPCZ_RESULT_INVALID_ARGUMENT;
+    }
+    total_num_bytes = CheckAdd(total_num_bytes, parcel.num_bytes);
+  }
+
+  if (IsPeerClosed()) {
+    return IPCZ_RESULT_NOT_FOUND;
+  }
+
+  if (limits) {
+    const std::optional<size_t> capacity =
+        GetPutCapacity(*limits, parcels.size());
+    if (!capacity || total_num_bytes > *capacity) {
+      return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+    }
+  }
+
+  Ref<RouterLink> outward_link;
+  {
+    absl::MutexLock lock(&mutex_);
+    outward_link = outward_edge_.primary_link();
+  }
+
+  std::vector<std::unique_ptr<Parcel>> outbound_parcels(parcels.size());
+  for (size_t i = 0; i < parcels.size(); ++i) {
+    const IpczPutParcel& parcel = parcels[i];
+    outbound_parcels[i] = AllocateParcelForLink(
+        outward_link.get(), parcel.num_bytes, /*allow_partial=*/false);
+    if (parcel.num_bytes > 0) {
+      memcpy(outbound_parcels[i]->data_view().data(), parcel.data,
+             parcel.num_bytes);
+    }
+    outbound_parcels[i]->CommitData(parcel.num_bytes);
+    outbound_parcels[i]->SetObjects(std::move(objects[i]));
+  }
+
+  const IpczResult result =
+      SendOutboundParcels(absl::MakeSpan(outbound_parcels));
+  if (result == IPCZ_RESULT_OK) {
+    // If the parcels were sent, the sender relinquishes handle ownership and
+    // therefore implicitly releases its ref to each object.
+    for (const IpczPutParcel& parcel : parcels) {
+      for (IpczHandle handle :
+           absl::MakeSpan(parcel.handles, parcel.num_handles)) {
+        std::ignore = APIObject::TakeFromHandle(handle);
+      }
+    }
+  }
+
+  return result;
+}
+
 IpczResult Router::BeginPut(IpczBeginPutFlags flags,
+                            const IpczPutLimits* limits,
                             volatile void** data,
                             size_t* num_bytes,
                             IpczTransaction* transaction) {
@@ -431,11 +575,22 @@ IpczResult Router::BeginPut(IpczBeginPutFlags flags,
     return IPCZ_RESULT_NOT_FOUND;
   }
 
-  const size_t num_bytes_to_request = num_bytes ? *num_bytes : 0;
+  size_t num_bytes_to_request = num_bytes ? *num_bytes : 0;
+  size_t max_num_bytes = std::numeric_limits<size_t>::max();
+  if (limits) {
+    const std::optional<size_t> capacity = GetPutCapacity(*limits);
+    if (!capacity || (num_bytes_to_request > *capacity &&
+                      (!allow_partial || *capacity == 0))) {
+      return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+    }
+    max_num_bytes = *capacity;
+    num_bytes_to_request = std::min(num_bytes_to_request, max_num_bytes);
+  }
+
   std::unique_ptr<Parcel> parcel =
       AllocateOutboundParcel(num_bytes_to_request, allow_partial);
   if (num_bytes) {
-    *num_bytes = parcel->data_size();
+    *num_bytes = std::min(parcel->data_size(), max_num_bytes);
   }
   if (data) {
     *data = parcel->data_view().data();
@@ -500,8 +655,10 @@ IpczResult Router::Get(IpczGetFlags flags,
   const OperationContext context{OperationContext::kAPICall};
   TrapEventDispatcher dispatcher;
   std::unique_ptr<Parcel> consumed_parcel;
+  Ref<RouterLink> link_to_notify;
   {
     absl::MutexLock lock(&mutex_);
+    PollInboundFastPath();
     if (inbound_parcels_.IsSequenceFullyConsumed()) {
       return IPCZ_RESULT_NOT_FOUND;
     }
@@ -551,8 +708,16 @@ IpczResult Router::Get(IpczGetFlags flags,
     if (inbound_parcels_.IsSequenceFullyConsumed()) {
       status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
     }
-    traps_.NotifyLocalParcelConsumed(context, status_flags_, inbound_parcels_,
-                                     dispatcher);
+    if (!traps_.empty()) {
+      traps_.NotifyLocalParcelConsumed(context, GetStatusForTraps(),
+                                       dispatcher);
+    }
+    NotifyWaiters(dispatcher);
+    link_to_notify = PublishInboundQueueState();
+  }
+
+  if (link_to_notify) {
+    link_to_notify->NotifyDataConsumed(context);
   }
 
   if (parcel) {
@@ -563,6 +728,85 @@ IpczResult Router::Get(IpczGetFlags flags,
   return IPCZ_RESULT_OK;
 }
 
+IpczResult Router::GetMany(IpczGetManyFlags flags,
+                           absl::Span<IpczGetParcel> parcels,
+                           size_t& num_parcels) {
+  const OperationContext context{OperationContext::kAPICall};
+  const bool as_parcels = (flags & IPCZ_GET_MANY_AS_PARCELS) != 0;
+  TrapEventDispatcher dispatcher;
+  absl::InlinedVector<std::unique_ptr<Parcel>, 16> consumed_parcels;
+  Ref<RouterLink> link_to_notify;
+  {
+    absl::MutexLock lock(&mutex_);
+    PollInboundFastPath();
+    if (inbound_parcels_.IsSequenceFullyConsumed()) {
+      return IPCZ_RESULT_NOT_FOUND;
+    }
+    if (!inbound_parcels_.HasNextElement()) {
+      return IPCZ_RESULT_UNAVAILABLE;
+    }
+    if (pending_gets_ && !pending_gets_->empty() && is_pending_get_exclusive_) {
+      return IPCZ_RESULT_ALREADY_EXISTS;
+    }
+
+    while (consumed_parcels.size() < parcels.size() &&
+           inbound_parcels_.HasNextElement()) {
+      IpczGetParcel& out = parcels[consumed_parcels.size()];
+      const Parcel& p = *inbound_parcels_.NextElement();
+      const size_t data_size = p.data_size();
+      const size_t num_objects = p.num_objects();
+      if (!as_parcels) {
+        if (data_size > out.num_bytes || num_objects > out.num_handles) {
+          if (consumed_parcels.empty()) {
+            out.num_bytes = data_size;
+            out.num_handles = num_objects;
+            return IPCZ_RESULT_RESOURCE_EXHAUSTED;
+          }
+          break;
+        }
+        if (data_size > 0) {
+          memcpy(out.data, p.data_view().data(), data_size);
+        }
+      }
+      out.num_bytes = data_size;
+      out.num_handles = num_objects;
+
+      std::unique_ptr<Parcel>& consumed = consumed_parcels.emplace_back();
+      const bool ok = inbound_parcels_.Pop(consumed);
+      ABSL_ASSERT(ok);
+      if (!as_parcels) {
+        consumed->ConsumeHandles(absl::MakeSpan(out.handles, num_objects));
+      }
+    }
+
+    // Traps and the shared queue state are only updated once for the whole
+    // batch.
+    if (inbound_parcels_.IsSequenceFullyConsumed()) {
+      status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
+    }
+    if (!traps_.empty()) {
+      traps_.NotifyLocalParcelConsumed(context, GetStatusForTraps(),
+                                       dispatcher);
+    }
+    NotifyWaiters(dispatcher);
+    link_to_notify = PublishInboundQueueState();
+  }
+
+  if (link_to_notify) {
+    link_to_notify->NotifyDataConsumed(context);
+  }
+
+  if (as_parcels) {
+    for (size_t i = 0; i < consumed_parcels.size(); ++i) {
+      parcels[i].parcel = ParcelWrapper::ReleaseAsHandle(
+          MakeRefCounted<ParcelWrapper>(std::move(consumed_parcels[i])));
+    }
+  }
+
+  num_parcels = consumed_parcels.size();
+  return IPCZ_RESULT_OK;
+}
+
 IpczResult Router::BeginGet(IpczBeginGetFlags flags,
                             const volatile void** data,
                             size_t* num_bytes,
@@ -571,11 +815,13 @@ IpczResult Router::BeginGet(IpczBeginGetFlags flags,
                             IpczTransaction* transaction) {
   const OperationContext context{OperationContext::kAPICall};
   TrapEventDispatcher dispatcher;
-  absl::MutexLock lock(&mutex_);
+  absl::ReleasableMutexLock lock(&mutex_);
   if (!transaction || inward_edge_) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
 
+  PollInboundFastPath();
+
   if (num_handles && *num_handles && !handles) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
@@ -620,12 +866,17 @@ IpczResult Router::BeginGet(IpczBeginGetFlags flags,
     pending_gets_ = std::make_unique<PendingTransactionSet>();
   }
 
-  if (overlapped) {
-    *transaction =
-        pending_gets_->Add(TakeNextInboundParcel(context, dispatcher));
-  } else {
+  if (!overlapped) {
     *transaction = pending_gets_->Add(std::move(p));
     is_pending_get_exclusive_ = true;
+    return IPCZ_RESULT_OK;
+  }
+
+  *transaction = pending_gets_->Add(TakeNextInboundParcel(context, dispatcher));
+  Ref<RouterLink> link_to_notify = PublishInboundQueueState();
+  lock.Release();
+  if (link_to_notify) {
+    link_to_notify->NotifyDataConsumed(context);
   }
   return IPCZ_RESULT_OK;
 }
@@ -635,7 +886,8 @@ IpczResult Router::EndGet(IpczTransaction transaction,
                           IpczHandle* parcel_handle) {
   const OperationContext context{OperationContext::kAPICall};
   TrapEventDispatcher dispatcher;
-  absl::MutexLock lock(&mutex_);
+  Ref<RouterLink> link_to_notify;
+  absl::ReleasableMutexLock lock(&mutex_);
   if (!pending_gets_) {
     return IPCZ_RESULT_INVALID_ARGUMENT;
   }
@@ -653,14 +905,19 @@ IpczResult Router::EndGet(IpczTransaction transaction,
     inbound_parcels_.NextElement() = std::move(parcel);
     if (!aborted) {
       parcel = TakeNextInboundParcel(context, dispatcher);
+      link_to_notify = PublishInboundQueueState();
     }
     is_pending_get_exclusive_ = false;
   }
+  lock.Release();
 
   if (!aborted && parcel_handle) {
     *parcel_handle = APIObject::ReleaseAsHandle(
         MakeRefCounted<ParcelWrapper>(std::move(parcel)));
   }
+  if (link_to_notify) {
+    link_to_notify->NotifyDataConsumed(context);
+  }
 
   return IPCZ_RESULT_OK;
 }
@@ -668,11 +925,142 @@ IpczResult Router::EndGet(IpczTransaction transaction,
 IpczResult Router::Trap(const IpczTrapConditions& conditions,
                         IpczTrapEventHandler handler,
                         uint64_t context,
+                        IpczTrapFlags flags,
+                        IpczTrapConditionFlags* satisfied_condition_flags,
+                        IpczPortalStatus* status) {
+  absl::MutexLock lock(&mutex_);
+
+  // Traps must observe every new parcel, so parcels stop taking the fast path
+  // as soon as any trap is installed.
+  PollInboundFastPath(/*allow_fast_path=*/false);
+
+  // If the new trap watches the remote queue, start monitoring before its
+  // conditions are first evaluated. Otherwise the peer might consume parcels
+  // between evaluation and monitoring without ever notifying us.
+  const IpczPortalStatus current_status = GetStatus({
+      .monitor_parcels =
+          traps_.need_remote_parcels() ||
+          (conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS) != 0,
+      .monitor_bytes =
+          traps_.need_remote_bytes() ||
+          (conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES) != 0,
+  });
+  return traps_.Add(conditions, handler, context,
+                    (flags & IPCZ_TRAP_PERSISTENT) != 0, current_status,
+                    satisfied_condition_flags, status);
+}
+
+IpczResult Router::EnableTrap(uintptr_t context) {
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&mutex_);
+  return traps_.Enable(context, GetStatusForTraps(), dispatcher);
+}
+
+IpczResult Router::RemoveTrap(uintptr_t context) {
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&mutex_);
+  return traps_.Remove(context, dispatcher);
+}
+
+IpczResult Router::Wait(const IpczTrapConditions& conditions,
+                        absl::Time deadline,
+                        size_t spin_count,
                         IpczTrapConditionFlags* satisfied_condition_flags,
                         IpczPortalStatus* status) {
+  const AtomicQueueState::MonitorSelection monitors = {
+      .monitor_parcels =
+          (conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS) != 0,
+      .monitor_bytes =
+          (conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES) != 0,
+  };
+
+  SequenceNumber initial_sequence_length;
+  {
+    absl::MutexLock lock(&mutex_);
+    if (are_waits_cancelled_) {
+      return IPCZ_RESULT_CANCELLED;
+    }
+
+    // Parcels may no longer bypass `mutex_` once we're waiting, since only
+    // the slow path wakes waiters.
+    ++num_waiters_;
+    PollInboundFastPath(/*allow_fast_path=*/false);
+    initial_sequence_length = inbound_parcels_.GetCurrentSequenceLength();
+  }
+
+  for (;;) {
+    // The futex is sampled before conditions are evaluated, so any change
+    // which happens after evaluation will prevent us from blocking below.
+    const uint32_t epoch = wait_futex_.Load();
+    {
+      absl::MutexLock lock(&mutex_);
+      IpczResult result = IPCZ_RESULT_OK;
+      IpczTrapConditionFlags flags = 0;
+      IpczPortalStatus current_status = {.size = sizeof(current_status)};
+      if (are_waits_cancelled_) {
+        result = IPCZ_RESULT_CANCELLED;
+      } else {
+        current_status = GetStatus(monitors);
+        flags = TrapSet::GetSatisfiedConditions(conditions, current_status);
+        if ((conditions.flags & IPCZ_TRAP_NEW_LOCAL_PARCEL) &&
+            inbound_parcels_.GetCurrentSequenceLength() >
+                initial_sequence_length) {
+          flags |= IPCZ_TRAP_NEW_LOCAL_PARCEL;
+        }
+        if (!flags) {
+          result = absl::Now() < deadline ? IPCZ_RESULT_UNAVAILABLE
+                                          : IPCZ_RESULT_DEADLINE_EXCEEDED;
+        }
+      }
+
+      if (result != IPCZ_RESULT_UNAVAILABLE) {
+        --num_waiters_;
+        if (result == IPCZ_RESULT_OK) {
+          if (satisfied_condition_flags) {
+            *satisfied_condition_flags = flags;
+          }
+          if (status) {
+            const size_t size = std::min(status->size, sizeof(*status));
+            *status = current_status;
+            status->size = size;
+          }
+        }
+        return result;
+      }
+    }
+
+    for (size_t i = 0; i < spin_count && wait_futex_.Load() == epoch; ++i) {
+    }
+    if (wait_futex_.Load() == epoch) {
+      wait_futex_.Wait(epoch, deadline);
+    }
+  }
+}
+
+bool Router::AddWaitSetMember(Ref<WaitSet::Member> member) {
+  TrapEventDispatcher dispatcher;
+  absl::MutexLock lock(&mutex_);
+  if (are_waits_cancelled_ || inward_edge_) {
+    return false;
+  }
+
+  // Like traps, WaitSet members must observe every new parcel.
+  PollInboundFastPath(/*allow_fast_path=*/false);
+  member->Activate(inbound_parcels_.GetCurrentSequenceLength());
+  wait_set_members_.push_back(std::move(member));
+  UpdateWaitSetMembers(dispatcher);
+  return true;
+}
+
+void Router::RemoveWaitSetMember(WaitSet::Member& member) {
   absl::MutexLock lock(&mutex_);
-  return traps_.Add(conditions, handler, context, status_flags_,
-                    inbound_parcels_, satisfied_condition_flags, status);
+  for (auto it = wait_set_members_.begin(); it != wait_set_members_.end();
+       ++it) {
+    if (it->get() == &member) {
+      wait_set_members_.erase(it);
+      return;
+    }
+  }
 }
 
 IpczResult Router::MergeRoute(const Ref<Router>& other) {
@@ -713,6 +1101,7 @@ IpczResult Router::MergeRoute(const Ref<Router>& other) {
 
 // static
 Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
+                                const RouterByteTotals* byte_totals,
                                 NodeLink& from_node_link) {
   // All Router deserialization occurs as a direct result of some transport
   // notification.
@@ -723,10 +1112,16 @@ Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
   Ref<RemoteRouterLink> new_outward_link;
   {
     absl::MutexLock lock(&router->mutex_);
+    router->are_byte_totals_known_ =
+        byte_totals &&
+        byte_totals->num_bytes_produced != RouterByteTotals::kUnknown &&
+        byte_totals->num_bytes_consumed != RouterByteTotals::kUnknown;
     router->outbound_parcels_.ResetSequence(
-        descriptor.next_outgoing_sequence_number);
+        descriptor.next_outgoing_sequence_number,
+        router->are_byte_totals_known_ ? byte_totals->num_bytes_produced : 0);
     router->inbound_parcels_.ResetSequence(
-        descriptor.next_incoming_sequence_number);
+        descriptor.next_incoming_sequence_number,
+        router->are_byte_totals_known_ ? byte_totals->num_bytes_consumed : 0);
     if (descriptor.peer_closed) {
       router->is_peer_closed_ = true;
       if (!router->inbound_parcels_.SetFinalSequenceLength(
@@ -825,32 +1220,44 @@ Ref<Router> Router::Deserialize(const RouterDescriptor& descriptor,
 
 void Router::SerializeNewRouter(const OperationContext& context,
                                 NodeLink& to_node_link,
-                                RouterDescriptor& descriptor) {
+                                RouterDescriptor& descriptor,
+                                RouterByteTotals& byte_totals) {
   TrapEventDispatcher dispatcher;
   Ref<Router> local_peer;
   bool initiate_proxy_bypass = false;
+  WaitSetMemberList wait_set_members;
   {
     absl::MutexLock lock(&mutex_);
     traps_.RemoveAll(context, dispatcher);
+    are_waits_cancelled_ = true;
+    wait_set_members.swap(wait_set_members_);
+    NotifyWaiters(dispatcher);
+    PollInboundFastPath(/*allow_fast_path=*/false);
     local_peer = outward_edge_.GetLocalPeer();
     initiate_proxy_bypass = outward_edge_.primary_link() &&
                             outward_edge_.primary_link()->TryLockForBypass(
                                 to_node_link.remote_node_name());
   }
 
+  // WaitSet registrations don't follow a portal to its new node.
+  for (const Ref<WaitSet::Member>& member : wait_set_members) {
+    member->wait_set().ForgetMember(*member);
+  }
+
   if (local_peer && initiate_proxy_bypass &&
       SerializeNewRouterWithLocalPeer(context, to_node_link, descriptor,
-                                      local_peer)) {
+                                      byte_totals, local_peer)) {
     return;
   }
 
   SerializeNewRouterAndConfigureProxy(context, to_node_link, descriptor,
-                                      initiate_proxy_bypass);
+                                      byte_totals, initiate_proxy_bypass);
 }
 
 bool Router::SerializeNewRouterWithLocalPeer(const OperationContext& context,
                                              NodeLink& to_node_link,
                                              RouterDescriptor& descriptor,
+                                             RouterByteTotals& byte_totals,
                                              Ref<Router> local_peer) {
   MultiMutexLock lock(&mutex_, &local_peer->mutex_);
   if (local_peer->outward_edge_.GetLocalPeer() != this) {
@@ -871,8 +1278,12 @@ bool Router::SerializeNewRouterWithLocalPeer(const OperationContext& context,
 
   // The local peer no longer needs its link to us. We'll give it a new
   // outward link in BeginProxyingToNewRouter() after this descriptor is
-  // transmitted.
+  // transmitted. Anything we already sent it over the fast path must be taken
+  // off the link first. Our own side of the link stays until then, but must
+  // not take the fast path again either.
+  local_peer->PollInboundFastPath(/*allow_fast_path=*/false);
   local_peer->outward_edge_.ReleasePrimaryLink();
+  PollInboundFastPath(/*allow_fast_path=*/false);
 
   // The primary new sublink to the destination node will act as the route's
   // new central link between our local peer and the new remote router.
@@ -904,6 +1315,7 @@ bool Router::SerializeNewRouterWithLocalPeer(const OperationContext& context,
   descriptor.next_incoming_sequence_number =
       inbound_parcels_.current_sequence_number();
   descriptor.decaying_incoming_sequence_length = proxy_inbound_sequence_length;
+  byte_totals = GetByteTotals();
 
   DVLOG(4) << "Splitting local pair to move router with outbound sequence "
            << "length " << descriptor.next_outgoing_sequence_number
@@ -930,6 +1342,7 @@ void Router::SerializeNewRouterAndConfigureProxy(
     const OperationContext& context,
     NodeLink& to_node_link,
     RouterDescriptor& descriptor,
+    RouterByteTotals& byte_totals,
     bool initiate_proxy_bypass) {
   const SublinkId new_sublink = to_node_link.memory().AllocateSublinkIds(1);
 
@@ -941,6 +1354,7 @@ void Router::SerializeNewRouterAndConfigureProxy(
       outbound_parcels_.GetCurrentSequenceLength();
   descriptor.next_incoming_sequence_number =
       inbound_parcels_.current_sequence_number();
+  byte_totals = GetByteTotals();
 
   // Initialize an inward edge but with no link yet. This ensures that we
   // don't look like a terminal router while waiting for a link to be set,
@@ -1431,10 +1845,15 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
   bool outward_link_decayed = false;
   bool dropped_last_decaying_link = false;
   ParcelsToFlush parcels_to_flush;
+  Ref<RouterLink> link_to_notify;
   TrapEventDispatcher dispatcher;
   {
     absl::MutexLock lock(&mutex_);
 
+    // Parcels may have arrived on the fast path since we last looked, and any
+    // change in our links or traps may have made the fast path unusable.
+    PollInboundFastPath();
+
     // Acquire stack references to all links we might want to use, so it's safe
     // to acquire additional (unmanaged) references per ParcelToFlush.
     outward_link = outward_edge_.primary_link();
@@ -1503,8 +1922,25 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
       // the peer is actually closed and there are no more inbound parcels in
       // flight towards us.
       status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED;
-      traps_.NotifyPeerClosed(context, status_flags_, inbound_parcels_,
-                              dispatcher);
+      if (!traps_.empty()) {
+        traps_.NotifyPeerClosed(context, GetStatusForTraps(), dispatcher);
+      }
+      NotifyWaiters(dispatcher);
+    }
+
+    // Any parcels forwarded inward above count as consumed, and if the outward
+    // link is new (or only just acquired its RouterLinkState) its queue state
+    // for our side needs to catch up with the route.
+    link_to_notify = PublishInboundQueueState();
+
+    // Similarly, a new outward link may change our view of the remote queue.
+    // This also ensures that any traps watching it are monitoring the right
+    // queue state. Waiters re-query the remote queue for themselves.
+    if (!inward_edge_) {
+      if (traps_.need_remote_parcels() || traps_.need_remote_bytes()) {
+        traps_.NotifyRemoteActivity(context, GetStatusForTraps(), dispatcher);
+      }
+      NotifyWaiters(dispatcher);
     }
 
     // If we're dropping the last of our decaying links, our outward link may
@@ -1559,6 +1995,10 @@ void Router::Flush(const OperationContext& context, FlushBehavior behavior) {
     parcel.link->AcceptParcel(context, std::move(parcel.parcel));
   }
 
+  if (link_to_notify) {
+    link_to_notify->NotifyDataConsumed(context);
+  }
+
   if (outward_link_decayed) {
     decaying_outward_link->Deactivate();
   }
@@ -2169,6 +2609,188 @@ bool Router::BypassPeerWithNewLocalLink(const OperationContext& context,
   return true;
 }
 
+IpczPortalStatus Router::GetStatus(
+    const AtomicQueueState::MonitorSelection& monitors) {
+  IpczPortalStatus status = {
+      .size = sizeof(status),
+      .flags = status_flags_,
+      .num_local_parcels = inbound_parcels_.GetNumAvailableElements(),
+      .num_local_bytes = inbound_parcels_.GetTotalAvailableElementSize(),
+  };
+
+  const Ref<RouterLink>& link = outward_edge_.primary_link();
+  AtomicQueueState* peer_state = link ? link->GetPeerQueueState() : nullptr;
+  if (!peer_state) {
+    // Without any state from the other side, only parcels still queued here
+    // are known to be unconsumed.
+    status.num_remote_parcels = outbound_parcels_.GetNumAvailableElements();
+    status.num_remote_bytes = outbound_parcels_.GetTotalAvailableElementSize();
+    return status;
+  }
+
+  // The other side's state may be written by another node, so it's not
+  // trusted to stay behind what we've actually produced.
+  const AtomicQueueState::QueryResult consumed = peer_state->Query(monitors);
+  const uint64_t num_parcels_produced =
+      outbound_parcels_.GetCurrentSequenceLength().value();
+  const uint64_t num_bytes_produced =
+      outbound_parcels_.total_consumed_element_size() +
+      outbound_parcels_.GetTotalAvailableElementSize();
+  const uint64_t num_parcels_consumed =
+      std::min(consumed.num_parcels_consumed.value, num_parcels_produced);
+  const uint64_t num_bytes_consumed =
+      std::min(consumed.num_bytes_consumed.value, num_bytes_produced);
+  status.num_remote_parcels = saturated_cast<size_t>(num_parcels_produced -
+                                                     num_parcels_consumed);
+  if (are_byte_totals_known_) {
+    status.num_remote_bytes =
+        saturated_cast<size_t>(num_bytes_produced - num_bytes_consumed);
+  } else {
+    // Our produced byte total isn't comparable to the other side's, so as
+    // above, count only what's still queued here.
+    status.num_remote_bytes = outbound_parcels_.GetTotalAvailableElementSize();
+  }
+  return status;
+}
+
+IpczPortalStatus Router::GetStatusForTraps() {
+  return GetStatus({
+      .monitor_parcels = traps_.need_remote_parcels(),
+      .monitor_bytes = traps_.need_remote_bytes(),
+  });
+}
+
+std::optional<size_t> Router::GetPutCapacity(const IpczPutLimits& limits,
+                                             size_t num_parcels) {
+  absl::MutexLock lock(&mutex_);
+  const IpczPortalStatus status =
+      GetStatus({.monitor_parcels = false, .monitor_bytes = false});
+  if (num_parcels > limits.max_queued_parcels ||
+      status.num_remote_parcels > limits.max_queued_parcels - num_parcels) {
+    return std::nullopt;
+  }
+  if (status.num_remote_bytes >= limits.max_queued_bytes) {
+    return 0;
+  }
+  return limits.max_queued_bytes - status.num_remote_bytes;
+}
+
+Ref<RouterLink> Router::PublishInboundQueueState() {
+  const Ref<RouterLink>& link = outward_edge_.primary_link();
+  AtomicQueueState* state = link ? link->GetLocalQueueState() : nullptr;
+  if (!state) {
+    return nullptr;
+  }
+
+  // If our consumed byte total isn't comparable to the other side's, publish
+  // the largest possible total. The other side won't trust it beyond what it
+  // has actually produced, so it will consider all of its bytes consumed.
+  const uint64_t num_parcels_consumed =
+      inbound_parcels_.current_sequence_number().value();
+  const uint64_t num_bytes_consumed =
+      are_byte_totals_known_ ? inbound_parcels_.total_consumed_element_size()
+                             : MonitoredAtomic<uint64_t>::kMaxValue;
+  const AtomicQueueState::QueryResult published =
+      state->Query({.monitor_parcels = false, .monitor_bytes = false});
+  if (published.num_parcels_consumed.value == num_parcels_consumed &&
+      published.num_bytes_consumed.value == num_bytes_consumed) {
+    return nullptr;
+  }
+
+  if (!state->Update({
+          .num_parcels_consumed = num_parcels_consumed,
+          .num_bytes_consumed = num_bytes_consumed,
+      })) {
+    return nullptr;
+  }
+  return link;
+}
+
+RouterByteTotals Router::GetByteTotals() {
+  if (!are_byte_totals_known_) {
+    return {
+        .num_bytes_produced = RouterByteTotals::kUnknown,
+        .num_bytes_consumed = RouterByteTotals::kUnknown,
+    };
+  }
+
+  return {
+      .num_bytes_produced = outbound_parcels_.total_consumed_element_size() +
+                            outbound_parcels_.GetTotalAvailableElementSize(),
+      .num_bytes_consumed = inbound_parcels_.total_consumed_element_size(),
+  };
+}
+
+void Router::NotifyWaiters(TrapEventDispatcher& dispatcher) {
+  if (num_waiters_ > 0) {
+    dispatcher.DeferWake(wait_futex_);
+  }
+  UpdateWaitSetMembers(dispatcher);
+}
+
+void Router::UpdateWaitSetMembers(TrapEventDispatcher& dispatcher) {
+  if (wait_set_members_.empty()) {
+    return;
+  }
+
+  AtomicQueueState::MonitorSelection monitors = {
+      .monitor_parcels = false,
+      .monitor_bytes = false,
+  };
+  for (const Ref<WaitSet::Member>& member : wait_set_members_) {
+    const IpczTrapConditionFlags flags = member->conditions().flags;
+    if (flags & IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS) {
+      monitors.monitor_parcels = true;
+    }
+    if (flags & IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES) {
+      monitors.monitor_bytes = true;
+    }
+  }
+
+  const IpczPortalStatus status = GetStatus(monitors);
+  const SequenceNumber sequence_length =
+      inbound_parcels_.GetCurrentSequenceLength();
+  for (const Ref<WaitSet::Member>& member : wait_set_members_) {
+    member->Update(status, sequence_length, dispatcher);
+  }
+}
+
+void Router::PollInboundFastPath(bool allow_fast_path) {
+  if (RouterLink* decaying_link = outward_edge_.decaying_link()) {
+    // Nothing new should be sent over a decaying link, but it may still hold
+    // parcels which were sent before decay began.
+    decaying_link->SetFastPathEnabled(false);
+    while (std::unique_ptr<Parcel> parcel =
+               decaying_link->TakeFastPathParcel()) {
+      const SequenceNumber sequence_number = parcel->sequence_number();
+      inbound_parcels_.Push(sequence_number, std::move(parcel));
+    }
+  }
+
+  const Ref<RouterLink>& link = outward_edge_.primary_link();
+  if (!link) {
+    return;
+  }
+
+  const RouterLinkState* link_state = link->GetLinkState();
+  const bool is_link_stable =
+      link_state && (link_state->status.load(std::memory_order_relaxed) &
+                     RouterLinkState::kStable) == RouterLinkState::kStable;
+  link->SetFastPathEnabled(
+      allow_fast_path && !inward_edge_ && !bridge_ && traps_.empty() &&
+      num_waiters_ == 0 && wait_set_members_.empty() && !is_disconnected_ &&
+      outward_edge_.is_stable() && is_link_stable &&
+      link->GetType().is_central() &&
+      !inbound_parcels_.final_sequence_length());
+
+  // Like AcceptInboundParcel(), this quietly discards parcels beyond the end of
+  // a prematurely terminated sequence.
+  while (std::unique_ptr<Parcel> parcel = link->TakeFastPathParcel()) {
+    const SequenceNumber sequence_number = parcel->sequence_number();
+    inbound_parcels_.Push(sequence_number, std::move(parcel));
+  }
+}
+
 std::unique_ptr<Parcel> Router::TakeNextInboundParcel(
     const OperationContext& context,
     TrapEventDispatcher& dispatcher) {
@@ -2177,8 +2799,10 @@ std::unique_ptr<Parcel> Router::TakeNextInboundParcel(
   if (inbound_parcels_.IsSequenceFullyConsumed()) {
     status_flags_ |= IPCZ_PORTAL_STATUS_PEER_CLOSED | IPCZ_PORTAL_STATUS_DEAD;
   }
-  traps_.NotifyLocalParcelConsumed(context, status_flags_, inbound_parcels_,
-                                   dispatcher);
+  if (!traps_.empty()) {
+    traps_.NotifyLocalParcelConsumed(context, GetStatusForTraps(), dispatcher);
+  }
+  NotifyWaiters(dispatcher);
   return parcel;
 }
 
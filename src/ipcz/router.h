@@ -6,8 +6,10 @@
 #define IPCZ_SRC_IPCZ_ROUTER_H_
 
 #include <cstdint>
+#include <optional>
 #include <utility>
 
+#include "ipcz/atomic_queue_state.h"
 #include "ipcz/fragment_ref.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/operation_context.h"
@@ -19,8 +21,12 @@
 #include "ipcz/sequence_number.h"
 #include "ipcz/sublink_id.h"
 #include "ipcz/trap_set.h"
+#include "ipcz/wait_set.h"
 #include "third_party/abseil-cpp/absl/base/thread_annotations.h"
+#include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 #include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "util/futex.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
@@ -64,10 +70,18 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   IpczResult Close() override;
   bool CanSendFrom(Router& sender) override;
 
-  // *Put/*Get APIs exposed through the ipcz API via portal handles.
+  // *Put/*Get APIs exposed through the ipcz API via portal handles. `limits`
+  // may be null.
   IpczResult Put(absl::Span<const uint8_t> data,
-                 absl::Span<const IpczHandle> handles);
+                 absl::Span<const IpczHandle> handles,
+                 const IpczPutLimits* limits);
+  IpczResult PutMany(absl::Span<const IpczPutParcel> parcels,
+                     const IpczPutLimits* limits);
+  IpczResult PutSegments(absl::Span<const IpczPutSegment> segments,
+                         absl::Span<const IpczHandle> handles,
+                         const IpczPutLimits* limits);
   IpczResult BeginPut(IpczBeginPutFlags flags,
+                      const IpczPutLimits* limits,
                       volatile void** data,
                       size_t* num_bytes,
                       IpczTransaction* transaction);
@@ -81,6 +95,9 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
                  IpczHandle* handles,
                  size_t* num_handles,
                  IpczHandle* parcel);
+  IpczResult GetMany(IpczGetManyFlags flags,
+                     absl::Span<IpczGetParcel> parcels,
+                     size_t& num_parcels);
   IpczResult BeginGet(IpczBeginGetFlags flags,
                       const volatile void** data,
                       size_t* num_data_bytes,
@@ -109,6 +126,11 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // Router.
   void QueryStatus(IpczPortalStatus& status);
 
+  // Notifies this Router that the Router on the other side of its outward link
+  // has consumed inbound parcels while this Router was monitoring its queue
+  // state. This may fire traps watching the remote queue.
+  void NotifyPeerConsumedData(const OperationContext& context);
+
   // Returns true iff this Router's outward link is a LocalRouterLink between
   // `this` and `router`.
   bool HasLocalPeer(Router& router);
@@ -165,9 +187,35 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   IpczResult Trap(const IpczTrapConditions& conditions,
                   IpczTrapEventHandler handler,
                   uint64_t context,
+                  IpczTrapFlags flags,
+                  IpczTrapConditionFlags* satisfied_condition_flags,
+                  IpczPortalStatus* status);
+
+  // Re-enables the persistent trap installed on this Router with `context`.
+  // Implements the ipcz EnableTrap() API.
+  IpczResult EnableTrap(uintptr_t context);
+
+  // Removes any traps installed on this Router with `context`. Implements the
+  // ipcz RemoveTrap() API.
+  IpczResult RemoveTrap(uintptr_t context);
+
+  // Blocks the calling thread until one or more conditions in `conditions` is
+  // met, or until `deadline`. Before blocking, the thread spins for up to
+  // `spin_count` iterations waiting for any change in this Router's state.
+  // This method effectively implements the ipcz Wait() API. See its
+  // description in ipcz.h for details.
+  IpczResult Wait(const IpczTrapConditions& conditions,
+                  absl::Time deadline,
+                  size_t spin_count,
                   IpczTrapConditionFlags* satisfied_condition_flags,
                   IpczPortalStatus* status);
 
+  // Registers or unregisters `member` to be updated by this Router on every
+  // interesting state change, on behalf of a WaitSet. AddWaitSetMember() fails
+  // and returns false if this Router has already been closed or transferred.
+  bool AddWaitSetMember(Ref<WaitSet::Member> member);
+  void RemoveWaitSetMember(WaitSet::Member& member);
+
   // Attempts to merge this Router's route with the route terminated by `other`.
   // Both `other` and this Router must be terminal routers on their own separate
   // routes, and neither Router must have transmitted or retreived any parcels
@@ -175,15 +223,19 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   IpczResult MergeRoute(const Ref<Router>& other);
 
   // Deserializes a new Router from `descriptor` received over `from_node_link`.
+  // `byte_totals` is null if the descriptor was received without any.
   static Ref<Router> Deserialize(const RouterDescriptor& descriptor,
+                                 const RouterByteTotals* byte_totals,
                                  NodeLink& from_node_link);
 
   // Serializes a description of a new Router which will be used to extend this
   // Router's route across `to_node_link` by introducing a new Router on the
-  // remote node.
+  // remote node. `byte_totals` is populated alongside `descriptor`, to be sent
+  // only if `to_node_link` supports remote queue state.
   void SerializeNewRouter(const OperationContext& context,
                           NodeLink& to_node_link,
-                          RouterDescriptor& descriptor);
+                          RouterDescriptor& descriptor,
+                          RouterByteTotals& byte_totals);
 
   // Configures this Router to begin proxying incoming parcels toward (and
   // outgoing parcels from) the Router described by `descriptor`, living on the
@@ -340,6 +392,12 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // portal.
   IpczResult SendOutboundParcel(std::unique_ptr<Parcel> parcel);
 
+  // Like SendOutboundParcel(), but for a batch of parcels from PutMany(). The
+  // parcels are assigned consecutive SequenceNumbers under a single lock and
+  // are passed to the outward link together when possible. Every element of
+  // `parcels` is consumed on success.
+  IpczResult SendOutboundParcels(absl::Span<std::unique_ptr<Parcel>> parcels);
+
   // Attempts to initiate bypass of this router by its peers, and ultimately to
   // remove this router from its route.
   //
@@ -408,6 +466,7 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   bool SerializeNewRouterWithLocalPeer(const OperationContext& context,
                                        NodeLink& to_node_link,
                                        RouterDescriptor& descriptor,
+                                       RouterByteTotals& byte_totals,
                                        Ref<Router> local_peer);
 
   // Default Router serialization case when the serializing Router must stay
@@ -419,12 +478,57 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   void SerializeNewRouterAndConfigureProxy(const OperationContext& context,
                                            NodeLink& to_node_link,
                                            RouterDescriptor& descriptor,
+                                           RouterByteTotals& byte_totals,
                                            bool initiate_proxy_bypass);
 
+  // Wakes any threads blocked in Wait() on this Router once `dispatcher`
+  // dispatches its events, so they can re-evaluate their conditions. Also
+  // updates any WaitSet members with this Router's current status.
+  void NotifyWaiters(TrapEventDispatcher& dispatcher)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void UpdateWaitSetMembers(TrapEventDispatcher& dispatcher)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Moves any parcels which bypassed `mutex_` via the fast path of this
+  // Router's outward links into `inbound_parcels_`. The primary link's fast
+  // path is then left enabled only if this is a terminal Router with no traps,
+  // waiters or WaitSet members, on a stable central link which may still carry
+  // more inbound parcels. If `allow_fast_path` is false, the fast path is
+  // disabled regardless.
+  void PollInboundFastPath(bool allow_fast_path = true)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   std::unique_ptr<Parcel> TakeNextInboundParcel(const OperationContext& context,
                                                 TrapEventDispatcher& dispatcher)
       ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Returns the current status of this Router's portal. The remote queue is
+  // measured from the AtomicQueueState published by the other side of the
+  // outward link, and `monitors` selects which of its fields the other side
+  // should notify us about when they change.
+  IpczPortalStatus GetStatus(const AtomicQueueState::MonitorSelection& monitors)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Same as above, monitoring only what's needed by any installed traps.
+  IpczPortalStatus GetStatusForTraps() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Returns the number of data bytes which can still be put into the portal
+  // within `limits` by `num_parcels` new parcels, or null if that many more
+  // parcels don't fit at all.
+  std::optional<size_t> GetPutCapacity(const IpczPutLimits& limits,
+                                       size_t num_parcels = 1);
+
+  // Publishes how much of `inbound_parcels_` has been consumed so far to the
+  // AtomicQueueState for this side of the outward link, if there is one. If
+  // the other side was monitoring that state, this returns the link over which
+  // the caller must call NotifyDataConsumed() once `mutex_` is released.
+  Ref<RouterLink> PublishInboundQueueState()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Returns the route-wide data byte totals to serialize for a new Router which
+  // continues this one's parcel sequences.
+  RouterByteTotals GetByteTotals() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   absl::Mutex mutex_;
 
   // Indicates whether the opposite end of the route has been closed. This is
@@ -451,6 +555,19 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // traps are notified about any interesting state changes within the router.
   TrapSet traps_ ABSL_GUARDED_BY(mutex_);
 
+  // The number of threads currently inside Wait() on this router, and whether
+  // they should give up because the portal has been closed or transferred.
+  size_t num_waiters_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool are_waits_cancelled_ ABSL_GUARDED_BY(mutex_) = false;
+
+  // Registrations of this router's portal with any WaitSets.
+  using WaitSetMemberList = absl::InlinedVector<Ref<WaitSet::Member>, 1>;
+  WaitSetMemberList wait_set_members_ ABSL_GUARDED_BY(mutex_);
+
+  // Incremented and woken by NotifyWaiters() whenever something changes which
+  // may satisfy the conditions of a thread blocked in Wait().
+  Futex wait_futex_;
+
   // The edge connecting this router outward to another, toward the portal on
   // the other side of the route.
   RouteEdge outward_edge_ ABSL_GUARDED_BY(mutex_);
@@ -476,6 +593,12 @@ class Router : public APIObjectImpl<Router, APIObject::kPortal> {
   // `outward_edge_` as soon as possible.
   ParcelQueue outbound_parcels_ ABSL_GUARDED_BY(mutex_);
 
+  // Whether the total data sizes tracked by `inbound_parcels_` and
+  // `outbound_parcels_` are route-wide totals. This is false if this Router was
+  // deserialized without any RouterByteTotals, in which case only parcel counts
+  // are exchanged through AtomicQueueState.
+  bool are_byte_totals_known_ ABSL_GUARDED_BY(mutex_) = true;
+
   // The set of pending get transactions in progress on this router.
   std::unique_ptr<PendingTransactionSet> pending_gets_ ABSL_GUARDED_BY(mutex_);
 
@@ -5,6 +5,8 @@
 #ifndef IPCZ_SRC_IPCZ_ROUTER_DESCRIPTOR_H_
 #define IPCZ_SRC_IPCZ_ROUTER_DESCRIPTOR_H_
 
+#include <cstdint>
+#include <limits>
 #include <type_traits>
 
 #include "ipcz/fragment_descriptor.h"
@@ -94,6 +96,28 @@ struct IPCZ_ALIGN(8) RouterDescriptor {
 static_assert(std::is_trivially_copyable_v<RouterDescriptor>,
               "RouterDescriptor must be trivially copyable");
 
+// Route-wide data byte totals of a serialized Router, sent alongside its
+// RouterDescriptor only over NodeLinks which support remote queue state. These
+// allow the new router to continue publishing and interpreting route-wide queue
+// state (see AtomicQueueState) where its predecessor left off.
+//
+// NOTE: This is a wire structure and must remain backwards-compatible across
+// changes.
+struct IPCZ_ALIGN(8) RouterByteTotals {
+  // Used in place of both totals when the serialized Router doesn't know them,
+  // because it was itself deserialized without any.
+  static constexpr uint64_t kUnknown = std::numeric_limits<uint64_t>::max();
+
+  // The total number of data bytes across all parcels before
+  // `next_outgoing_sequence_number` and `next_incoming_sequence_number` in the
+  // corresponding RouterDescriptor, respectively.
+  uint64_t num_bytes_produced;
+  uint64_t num_bytes_consumed;
+};
+
+static_assert(std::is_trivially_copyable_v<RouterByteTotals>,
+              "RouterByteTotals must be trivially copyable");
+
 }  // namespace ipcz
 
 #endif  // IPCZ_SRC_IPCZ_ROUTER_DESCRIPTOR_H_
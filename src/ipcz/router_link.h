@@ -11,6 +11,7 @@
 #include <string>
 #include <utility>
 
+#include "ipcz/atomic_queue_state.h"
 #include "ipcz/fragment_ref.h"
 #include "ipcz/link_type.h"
 #include "ipcz/node_name.h"
@@ -18,6 +19,7 @@
 #include "ipcz/router_link_state.h"
 #include "ipcz/sequence_number.h"
 #include "ipcz/sublink_id.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
@@ -50,6 +52,12 @@ class RouterLink : public RefCounted<RouterLink> {
   // link already has a RouterLinkState then `callback` is invoked immediately.
   virtual void WaitForLinkStateAsync(std::function<void()> callback) = 0;
 
+  // Returns the AtomicQueueState published by the Router on this side or the
+  // other side of the link, respectively. These live within the link's
+  // RouterLinkState and are null if the link doesn't have one (yet).
+  virtual AtomicQueueState* GetLocalQueueState() = 0;
+  virtual AtomicQueueState* GetPeerQueueState() = 0;
+
   // Returns the Router on the other end of this link, if this is a
   // LocalRouterLink. Otherwise returns null.
   virtual Ref<Router> GetLocalPeer() = 0;
@@ -73,6 +81,31 @@ class RouterLink : public RefCounted<RouterLink> {
   virtual void AcceptParcel(const OperationContext& context,
                             std::unique_ptr<Parcel> parcel) = 0;
 
+  // Passes a batch of parcels with consecutive SequenceNumbers to the Router on
+  // the other side of this link. Equivalent to calling AcceptParcel() for each
+  // element of `parcels` in order, but links may transmit the batch more
+  // efficiently. Every element of `parcels` is consumed.
+  virtual void AcceptParcels(const OperationContext& context,
+                             absl::Span<std::unique_ptr<Parcel>> parcels) = 0;
+
+  // Enables or disables the lock-free fast path for parcels sent to this side
+  // of the link. While enabled, parcels from the other side may be queued
+  // directly on the link instead of being passed to the Router on this side,
+  // which must retrieve them with TakeFastPathParcel(). Disabling waits for any
+  // in-progress fast path delivery to complete. Only called by the Router on
+  // this side of the link while holding its own lock. Links which don't
+  // support a fast path ignore this.
+  virtual void SetFastPathEnabled(bool enabled) = 0;
+
+  // Returns the next parcel queued for this side of the link by the fast path,
+  // or null if there are none.
+  virtual std::unique_ptr<Parcel> TakeFastPathParcel() = 0;
+
+  // Notifies the Router on the other side of the link that the Router on this
+  // side has consumed inbound parcels while the other side was monitoring its
+  // queue state. Only called when GetLocalQueueState() is non-null.
+  virtual void NotifyDataConsumed(const OperationContext& context) = 0;
+
   // Notifies the Router on the other side of the link that the route has been
   // closed from this side. `sequence_length` is the total number of parcels
   // transmitted from the closed side before it was closed.
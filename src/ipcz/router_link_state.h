@@ -9,6 +9,7 @@
 #include <cstdint>
 #include <type_traits>
 
+#include "ipcz/atomic_queue_state.h"
 #include "ipcz/ipcz.h"
 #include "ipcz/link_side.h"
 #include "ipcz/node_name.h"
@@ -71,8 +72,14 @@ struct IPCZ_ALIGN(8) RouterLinkState : public RefCountedFragment {
   // validate that C is an appropriate source of such a bypass request.
   NodeName allowed_bypass_request_source;
 
-  // More reserved slots, padding out this structure to 64 bytes.
-  uint32_t reserved1[10] = {0};
+  // More reserved slots, aligning the queue states below.
+  uint32_t reserved1[2] = {0};
+
+  // Each side of the link publishes how much of its inbound parcel queue has
+  // been consumed so far, so that the other side can determine how much of
+  // what it has sent remains unconsumed without any round-trip messaging.
+  AtomicQueueState side_a_queue_state;
+  AtomicQueueState side_b_queue_state;
 
   bool is_locked_by(LinkSide side) const {
     Status s = status.load(std::memory_order_relaxed);
@@ -82,6 +89,11 @@ struct IPCZ_ALIGN(8) RouterLinkState : public RefCountedFragment {
     return (s & kLockedBySideB) != 0;
   }
 
+  // Returns the queue state published by the given `side` of the link.
+  AtomicQueueState& GetQueueState(LinkSide side) {
+    return side.is_side_a() ? side_a_queue_state : side_b_queue_state;
+  }
+
   // Updates the status to reflect that the given `side` is stable, meaning that
   // it's no longer holding onto any decaying links.
   void SetSideStable(LinkSide side);
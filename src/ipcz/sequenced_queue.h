@@ -102,6 +102,15 @@ class SequencedQueue {
     return entries_[front_index_]->total_span_size;
   }
 
+  // Returns the total size of all elements popped or skipped from this queue
+  // so far, plus the value given to the most recent ResetSequence() call if
+  // any. This is the sum of ElementTraits::GetElementSize() for each element
+  // consumed, and like the sequence number it can be carried across queues
+  // which continue the same logical sequence.
+  uint64_t total_consumed_element_size() const {
+    return total_consumed_element_size_;
+  }
+
   // Returns the total length of the contiguous sequence already pushed and/or
   // popped from this queue so far. This is essentially
   // `current_sequence_number()` plus `GetNumAvailableElements()`. If
@@ -201,9 +210,12 @@ class SequencedQueue {
   // length `n` has already been pushed and popped from the queue. Must be
   // called only on an empty queue and only when the caller can be sure they
   // won't want to push any elements with a SequenceNumber below `n`.
-  void ResetSequence(SequenceNumber n) {
+  // `total_consumed_element_size` is the total size of those elements.
+  void ResetSequence(SequenceNumber n,
+                     uint64_t total_consumed_element_size = 0) {
     ABSL_ASSERT(entries_.empty());
     base_sequence_number_ = n;
+    total_consumed_element_size_ = total_consumed_element_size;
     is_final_length_known_ = false;
     ResetAndReleaseStorage();
   }
@@ -215,8 +227,9 @@ class SequencedQueue {
   // This can only succeed when `current_sequence_number()` is equal to `n`, no
   // entry for SequenceNumber `n` is already in the queue, and `n` is less than
   // the final sequence length if applicable. Success is equivalent to pushing
-  // and immediately popping element `n`.
-  bool SkipElement(SequenceNumber n) {
+  // and immediately popping element `n`, whose size is given by
+  // `element_size`.
+  bool SkipElement(SequenceNumber n, size_t element_size = 0) {
     if (base_sequence_number_ != n || HasNextElement()) {
       return false;
     }
@@ -227,6 +240,7 @@ class SequencedQueue {
     }
 
     base_sequence_number_ = NextSequenceNumber(n);
+    total_consumed_element_size_ += element_size;
     if (entries_.empty()) {
       // Nothing else needs to change if storage is unoccupied.
       ABSL_ASSERT(front_index_ == 0);
@@ -286,6 +300,7 @@ class SequencedQueue {
 
     // Make sure the next queued entry has up-to-date accounting, if present.
     const size_t element_size = ElementTraits::GetElementSize(element);
+    total_consumed_element_size_ += element_size;
     const size_t next_index = front_index_ + 1;
     if (next_index < entries_.size() && entries_[next_index]) {
       Entry& next = *entries_[next_index];
@@ -513,6 +528,10 @@ class SequencedQueue {
   // may or may not yet be occupied. If `entries_` is non-empty, storage for
   // this entry is always at `entries_[front_index_]`.
   SequenceNumber base_sequence_number_{0};
+
+  // The total size of all elements consumed from this queue so far. See
+  // total_consumed_element_size().
+  uint64_t total_consumed_element_size_ = 0;
 };
 
 }  // namespace ipcz
@@ -229,6 +229,34 @@ TEST(SequencedQueueTest, SkipElement) {
   EXPECT_FALSE(q.SkipElement(SequenceNumber(6)));
 }
 
+TEST(SequencedQueueTest, ConsumedElementSize) {
+  TestQueueWithSize q;
+  EXPECT_EQ(0u, q.total_consumed_element_size());
+
+  // Queued elements are not consumed until popped.
+  EXPECT_TRUE(q.Push(SequenceNumber(0), "hello"));
+  EXPECT_TRUE(q.Push(SequenceNumber(1), "hi"));
+  EXPECT_EQ(0u, q.total_consumed_element_size());
+
+  std::string s;
+  EXPECT_TRUE(q.Pop(s));
+  EXPECT_EQ(5u, q.total_consumed_element_size());
+  EXPECT_TRUE(q.Pop(s));
+  EXPECT_EQ(7u, q.total_consumed_element_size());
+
+  // Skipped elements count toward the total with their explicit size.
+  EXPECT_TRUE(q.SkipElement(SequenceNumber(2), 3));
+  EXPECT_EQ(10u, q.total_consumed_element_size());
+
+  // A reset sequence continues from whatever total it's given.
+  TestQueueWithSize continued;
+  continued.ResetSequence(q.current_sequence_number(),
+                          q.total_consumed_element_size());
+  EXPECT_TRUE(continued.Push(SequenceNumber(3), "woot"));
+  EXPECT_TRUE(continued.Pop(s));
+  EXPECT_EQ(14u, continued.total_consumed_element_size());
+}
+
 TEST(SequencedQueueTest, Accounting) {
   TestQueueWithSize q;
 
@@ -0,0 +1,71 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/spsc_parcel_queue.h"
+
+#include <thread>
+#include <utility>
+
+namespace ipcz {
+
+SpscParcelQueue::SpscParcelQueue() = default;
+
+SpscParcelQueue::~SpscParcelQueue() = default;
+
+void SpscParcelQueue::Enable() {
+  // Only the consumer changes kEnabled, so this check can't race with Disable().
+  if (!(state_.load(std::memory_order_relaxed) & kEnabled)) {
+    state_.fetch_or(kEnabled, std::memory_order_relaxed);
+  }
+}
+
+void SpscParcelQueue::Disable() {
+  if (!(state_.load(std::memory_order_relaxed) & kEnabled)) {
+    // Any push which could have started was already waited out by whichever
+    // call disabled the queue.
+    return;
+  }
+
+  state_.fetch_and(~kEnabled, std::memory_order_acq_rel);
+
+  // Any push still in progress started before the queue was disabled. It only
+  // spans a few instructions, so just wait for it.
+  while (state_.load(std::memory_order_acquire) & kPushing) {
+    std::this_thread::yield();
+  }
+}
+
+bool SpscParcelQueue::TryPush(std::unique_ptr<Parcel>& parcel) {
+  // Concurrent producers are tolerated but never queue in parallel: only one
+  // may hold kPushing at a time, and any other fails over to the slow path.
+  uint32_t state = kEnabled;
+  if (!state_.compare_exchange_strong(state, kEnabled | kPushing,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+    return false;
+  }
+
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  const bool full = tail - head_.load(std::memory_order_acquire) == kCapacity;
+  if (!full) {
+    slots_[tail % kCapacity] = std::move(parcel);
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  state_.fetch_and(~kPushing, std::memory_order_release);
+  return !full;
+}
+
+std::unique_ptr<Parcel> SpscParcelQueue::Pop() {
+  const size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+
+  std::unique_ptr<Parcel> parcel = std::move(slots_[head % kCapacity]);
+  head_.store(head + 1, std::memory_order_release);
+  return parcel;
+}
+
+}  // namespace ipcz
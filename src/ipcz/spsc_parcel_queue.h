@@ -0,0 +1,78 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_SPSC_PARCEL_QUEUE_H_
+#define IPCZ_SRC_IPCZ_SPSC_PARCEL_QUEUE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "ipcz/parcel.h"
+
+namespace ipcz {
+
+// SpscParcelQueue is a bounded, lock-free, single-producer single-consumer
+// queue of parcels. Each LocalRouterLink pair uses one in each direction to
+// pass parcels between terminal Routers without either side acquiring the
+// other's lock.
+//
+// The consumer controls whether the queue accepts new parcels at all. When it
+// needs to observe every incoming parcel on its slower path (for example to
+// notify traps, or to forward parcels as a proxy), it calls Disable() and then
+// drains whatever was already pushed.
+//
+// Pushes never block. If the queue is disabled or full, or if another thread
+// is pushing concurrently, TryPush() fails and the producer must deliver the
+// parcel some other way. Because parcels carry
+// their own sequence numbers, the consumer can reorder them with any parcels
+// which were delivered by other means.
+class SpscParcelQueue {
+ public:
+  // The maximum number of parcels which can be queued at once.
+  static constexpr size_t kCapacity = 256;
+
+  SpscParcelQueue();
+  SpscParcelQueue(const SpscParcelQueue&) = delete;
+  SpscParcelQueue& operator=(const SpscParcelQueue&) = delete;
+  ~SpscParcelQueue();
+
+  // Allows subsequent TryPush() calls to succeed. Consumer only.
+  void Enable();
+
+  // Causes all subsequent TryPush() calls to fail, and waits for any push
+  // which is already in progress on another thread to complete. Once this
+  // returns, Pop() will yield every parcel that was successfully pushed.
+  // Consumer only.
+  void Disable();
+
+  // Attempts to push `parcel` onto the queue. Returns false and leaves
+  // `parcel` intact if the queue is disabled, full, or busy. Producer only.
+  bool TryPush(std::unique_ptr<Parcel>& parcel);
+
+  // Pops the next parcel from the queue, or returns null if the queue is
+  // empty. Consumer only.
+  std::unique_ptr<Parcel> Pop();
+
+ private:
+  static constexpr uint32_t kEnabled = 1 << 0;
+  static constexpr uint32_t kPushing = 1 << 1;
+
+  // The consumer's read position, and the producer's write position. These
+  // increase monotonically and are reduced modulo kCapacity to index `slots_`.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+
+  // A combination of kEnabled, which is only changed by the consumer, and
+  // kPushing, which is only changed by the producer.
+  std::atomic<uint32_t> state_{0};
+
+  std::array<std::unique_ptr<Parcel>, kCapacity> slots_;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_SPSC_PARCEL_QUEUE_H_
@@ -0,0 +1,123 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/spsc_parcel_queue.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ipcz/parcel.h"
+#include "ipcz/sequence_number.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+std::unique_ptr<Parcel> MakeParcel(uint64_t n) {
+  return std::make_unique<Parcel>(SequenceNumber(n));
+}
+
+TEST(SpscParcelQueueTest, DisabledByDefault) {
+  SpscParcelQueue queue;
+  std::unique_ptr<Parcel> parcel = MakeParcel(0);
+  EXPECT_FALSE(queue.TryPush(parcel));
+  EXPECT_TRUE(parcel);
+  EXPECT_FALSE(queue.Pop());
+}
+
+TEST(SpscParcelQueueTest, PushAndPop) {
+  SpscParcelQueue queue;
+  queue.Enable();
+  for (uint64_t i = 0; i < 3; ++i) {
+    std::unique_ptr<Parcel> parcel = MakeParcel(i);
+    EXPECT_TRUE(queue.TryPush(parcel));
+    EXPECT_FALSE(parcel);
+  }
+
+  for (uint64_t i = 0; i < 3; ++i) {
+    std::unique_ptr<Parcel> parcel = queue.Pop();
+    ASSERT_TRUE(parcel);
+    EXPECT_EQ(SequenceNumber(i), parcel->sequence_number());
+  }
+  EXPECT_FALSE(queue.Pop());
+}
+
+TEST(SpscParcelQueueTest, Full) {
+  SpscParcelQueue queue;
+  queue.Enable();
+  for (size_t i = 0; i < SpscParcelQueue::kCapacity; ++i) {
+    std::unique_ptr<Parcel> parcel = MakeParcel(i);
+    EXPECT_TRUE(queue.TryPush(parcel));
+  }
+
+  std::unique_ptr<Parcel> parcel = MakeParcel(SpscParcelQueue::kCapacity);
+  EXPECT_FALSE(queue.TryPush(parcel));
+  EXPECT_TRUE(parcel);
+
+  // Popping one parcel frees up space for another.
+  EXPECT_TRUE(queue.Pop());
+  EXPECT_TRUE(queue.TryPush(parcel));
+}
+
+TEST(SpscParcelQueueTest, DisableKeepsQueuedParcels) {
+  SpscParcelQueue queue;
+  queue.Enable();
+  std::unique_ptr<Parcel> parcel = MakeParcel(0);
+  EXPECT_TRUE(queue.TryPush(parcel));
+
+  // Once disabled, new pushes fail but earlier ones can still be popped.
+  queue.Disable();
+  parcel = MakeParcel(1);
+  EXPECT_FALSE(queue.TryPush(parcel));
+  parcel = queue.Pop();
+  ASSERT_TRUE(parcel);
+  EXPECT_EQ(SequenceNumber(0), parcel->sequence_number());
+  EXPECT_FALSE(queue.Pop());
+}
+
+TEST(SpscParcelQueueTest, ConcurrentPushAndDisable) {
+  constexpr uint64_t kNumParcels = 100000;
+  SpscParcelQueue queue;
+  queue.Enable();
+
+  // Every parcel either goes through the queue or is handed back to the
+  // producer, regardless of when the consumer disables the queue.
+  std::atomic<uint64_t> num_rejected{0};
+  std::thread producer([&] {
+    for (uint64_t i = 0; i < kNumParcels; ++i) {
+      std::unique_ptr<Parcel> parcel = MakeParcel(i);
+      if (!queue.TryPush(parcel)) {
+        ASSERT_TRUE(parcel);
+        num_rejected.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  });
+
+  uint64_t num_popped = 0;
+  uint64_t next_sequence_number = 0;
+  auto pop_all = [&] {
+    while (std::unique_ptr<Parcel> parcel = queue.Pop()) {
+      EXPECT_LE(SequenceNumber(next_sequence_number),
+                parcel->sequence_number());
+      next_sequence_number = parcel->sequence_number().value() + 1;
+      ++num_popped;
+    }
+  };
+  while (num_popped + num_rejected.load(std::memory_order_relaxed) <
+         kNumParcels / 2) {
+    pop_all();
+  }
+  queue.Disable();
+  pop_all();
+  producer.join();
+  pop_all();
+
+  EXPECT_EQ(kNumParcels, num_popped + num_rejected.load());
+}
+
+}  // namespace
+}  // namespace ipcz
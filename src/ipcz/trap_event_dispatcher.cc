@@ -4,8 +4,40 @@
 
 #include "ipcz/trap_event_dispatcher.h"
 
+#include <utility>
+
+#include "ipcz/router.h"
+#include "ipcz/wait_set.h"
+#include "third_party/abseil-cpp/absl/base/attributes.h"
+
 namespace ipcz {
 
+namespace {
+
+// The dispatcher owned by the active Batch on the current thread, if any.
+ABSL_CONST_INIT thread_local TrapEventDispatcher* current_batch = nullptr;
+
+}  // namespace
+
+TrapEventDispatcher::Batch::Batch() {
+  if (!current_batch) {
+    dispatcher_ = std::make_unique<TrapEventDispatcher>();
+    dispatcher_->is_batch_ = true;
+    current_batch = dispatcher_.get();
+  }
+}
+
+TrapEventDispatcher::Batch::~Batch() {
+  if (!dispatcher_) {
+    return;
+  }
+
+  // Handlers may re-enter ipcz, and anything they trigger is dispatched
+  // directly rather than joining this Batch.
+  current_batch = nullptr;
+  dispatcher_.reset();
+}
+
 TrapEventDispatcher::TrapEventDispatcher() = default;
 
 TrapEventDispatcher::~TrapEventDispatcher() {
@@ -15,12 +47,84 @@ TrapEventDispatcher::~TrapEventDispatcher() {
 void TrapEventDispatcher::DeferEvent(IpczTrapEventHandler handler,
                                      uintptr_t context,
                                      IpczTrapConditionFlags flags,
-                                     const IpczPortalStatus& status) {
-  events_.emplace_back(handler, context, flags, status);
+                                     const IpczPortalStatus& status,
+                                     uint64_t trap_id,
+                                     Router* source) {
+  DeferEvent(Event(handler, context, flags, status, trap_id,
+                   WrapRefCounted(source)));
+}
+
+void TrapEventDispatcher::DeferEvent(Event event) {
+  if (!is_batch_ || !event.trap_id) {
+    events_.push_back(std::move(event));
+    return;
+  }
+
+  // IPCZ_TRAP_REMOVED must be the last event a trap sees, so a removal event
+  // is never merged into an earlier one, and nothing after it is merged into
+  // anything queued before it.
+  if (event.flags & IPCZ_TRAP_REMOVED) {
+    coalescable_events_.erase(event.trap_id);
+    events_.push_back(std::move(event));
+    return;
+  }
+
+  auto [it, inserted] =
+      coalescable_events_.try_emplace(event.trap_id, events_.size());
+  if (inserted) {
+    events_.push_back(std::move(event));
+    return;
+  }
+
+  Event& existing = events_[it->second];
+  existing.flags |= event.flags;
+  existing.status = event.status;
+  existing.source = std::move(event.source);
+}
+
+void TrapEventDispatcher::DeferWake(Futex& futex) {
+  futexes_to_wake_.push_back(&futex);
+}
+
+void TrapEventDispatcher::DeferWake(Ref<WaitSet> wait_set) {
+  wait_sets_to_wake_.push_back(std::move(wait_set));
 }
 
 void TrapEventDispatcher::DispatchAll() {
-  for (const Event& event : events_) {
+  for (Futex* futex : futexes_to_wake_) {
+    futex->IncrementAndWakeAll();
+  }
+  futexes_to_wake_.clear();
+  for (const Ref<WaitSet>& wait_set : wait_sets_to_wake_) {
+    wait_set->WakeWaiters();
+  }
+  wait_sets_to_wake_.clear();
+
+  if (events_.empty()) {
+    return;
+  }
+
+  if (current_batch && current_batch != this) {
+    for (Event& event : events_) {
+      current_batch->DeferEvent(std::move(event));
+    }
+    events_.clear();
+    return;
+  }
+
+  // Take the events out first, so each one is dispatched only once even if
+  // DispatchAll() is called again.
+  DeferredEventQueue events;
+  events.swap(events_);
+  coalescable_events_.clear();
+  for (Event& event : events) {
+    if (is_batch_ && event.source) {
+      // The portal may have changed since this event was deferred, e.g. if
+      // more parcels arrived later in the same batch.
+      event.status.size = sizeof(event.status);
+      event.source->QueryStatus(event.status);
+    }
+
     const IpczTrapEvent trap_event = {
         .size = sizeof(trap_event),
         .context = event.context,
@@ -36,13 +140,20 @@ TrapEventDispatcher::Event::Event() = default;
 TrapEventDispatcher::Event::Event(IpczTrapEventHandler handler,
                                   uintptr_t context,
                                   IpczTrapConditionFlags flags,
-                                  IpczPortalStatus status)
-    : handler(handler), context(context), flags(flags), status(status) {}
+                                  IpczPortalStatus status,
+                                  uint64_t trap_id,
+                                  Ref<Router> source)
+    : handler(handler),
+      context(context),
+      flags(flags),
+      status(status),
+      trap_id(trap_id),
+      source(std::move(source)) {}
 
-TrapEventDispatcher::Event::Event(const Event&) = default;
+TrapEventDispatcher::Event::Event(Event&&) = default;
 
-TrapEventDispatcher::Event& TrapEventDispatcher::Event::operator=(
-    const Event&) = default;
+TrapEventDispatcher::Event& TrapEventDispatcher::Event::operator=(Event&&) =
+    default;
 
 TrapEventDispatcher::Event::~Event() = default;
 
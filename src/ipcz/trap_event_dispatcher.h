@@ -6,13 +6,19 @@
 #define IPCZ_SRC_IPCZ_TRAP_EVENT_DISPATCHER_H_
 
 #include <cstdint>
+#include <memory>
 
 #include "ipcz/ipcz.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
+#include "util/futex.h"
 #include "util/ref_counted.h"
 
 namespace ipcz {
 
+class Router;
+class WaitSet;
+
 // Accumulates IpczTrapEvent dispatches to specific handlers. Handler invocation
 // is deferred until DispatchAll() is called or the TrapEventDispatcher is
 // destroyed. This allows event dispatches to be accumulated while e.g. Node and
@@ -22,6 +28,25 @@ namespace ipcz {
 // passed into whatever might want to accumulate events for dispatch.
 class TrapEventDispatcher {
  public:
+  // While a Batch is alive on some thread, any TrapEventDispatcher on that
+  // thread hands its events to the Batch instead of dispatching them. The Batch
+  // coalesces events from the same trap and dispatches them when destroyed,
+  // after refreshing each event's portal status. This is used to scope a single
+  // driver transport notification, which may carry many parcels for the same
+  // portal. Batches do not nest: any Batch created on a thread which already
+  // has one is inert.
+  class Batch {
+   public:
+    Batch();
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+    ~Batch();
+
+   private:
+    // Null if this Batch is inert.
+    std::unique_ptr<TrapEventDispatcher> dispatcher_;
+  };
+
   TrapEventDispatcher();
   TrapEventDispatcher(const TrapEventDispatcher&) = delete;
   TrapEventDispatcher& operator=(const TrapEventDispatcher&) = delete;
@@ -29,12 +54,31 @@ class TrapEventDispatcher {
 
   // Schedules a new event for dispatch by this object as soon as DispatchAll()
   // is explicitly called or the TrapEventDispatcher is destroyed.
+  //
+  // `trap_id` uniquely identifies the trap which produced the event, or is zero
+  // if the event can't be attributed to a single trap. Within a Batch, an event
+  // with the same nonzero `trap_id` as one already scheduled is coalesced into
+  // it, carrying both events' flags and the newer `status`. If `source` is
+  // non-null, it's the Router whose portal `status` describes; a Batch uses it
+  // to refresh the status before dispatch.
   void DeferEvent(IpczTrapEventHandler handler,
                   uintptr_t context,
                   IpczTrapConditionFlags flags,
-                  const IpczPortalStatus& status);
+                  const IpczPortalStatus& status,
+                  uint64_t trap_id = 0,
+                  Router* source = nullptr);
+
+  // Schedules `futex` to be incremented and woken by this object along with
+  // any deferred events. The Futex must outlive this object.
+  void DeferWake(Futex& futex);
 
-  // Dispatches any events deferred by DeferEvent() above.
+  // Schedules threads waiting on `wait_set` to be woken by this object along
+  // with any deferred events.
+  void DeferWake(Ref<WaitSet> wait_set);
+
+  // Dispatches any events deferred by DeferEvent() above, and wakes anything
+  // given to DeferWake(). If a Batch is alive on the calling thread, events are
+  // handed off to it instead.
   void DispatchAll();
 
  private:
@@ -44,21 +88,39 @@ class TrapEventDispatcher {
     Event(IpczTrapEventHandler handler,
           uintptr_t context,
           IpczTrapConditionFlags flags,
-          IpczPortalStatus status);
-    Event(const Event&);
-    Event& operator=(const Event&);
+          IpczPortalStatus status,
+          uint64_t trap_id,
+          Ref<Router> source);
+    Event(Event&&);
+    Event& operator=(Event&&);
     ~Event();
 
     IpczTrapEventHandler handler;
     uintptr_t context;
     IpczTrapConditionFlags flags;
     IpczPortalStatus status;
+    uint64_t trap_id;
+    Ref<Router> source;
   };
 
+  // Schedules `event`, coalescing it with any event already scheduled by the
+  // same trap if this is a Batch.
+  void DeferEvent(Event event);
+
   // Space for four events should avoid heap allocations in the vast majority of
   // cases where we accumulate events for imminent dispatch.
   using DeferredEventQueue = absl::InlinedVector<Event, 4>;
   DeferredEventQueue events_;
+
+  // Whether this is the dispatcher owned by an active Batch.
+  bool is_batch_ = false;
+
+  // Only used by a Batch. Maps each trap ID to the index of its pending event
+  // in `events_`, if that event may still absorb later events from the trap.
+  absl::flat_hash_map<uint64_t, size_t> coalescable_events_;
+
+  absl::InlinedVector<Futex*, 1> futexes_to_wake_;
+  absl::InlinedVector<Ref<WaitSet>, 1> wait_sets_to_wake_;
 };
 
 }  // namespace ipcz
@@ -0,0 +1,112 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/trap_event_dispatcher.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+struct ObservedEvent {
+  IpczTrapConditionFlags flags;
+  size_t num_local_parcels;
+};
+
+// Handler for events whose context is a vector of ObservedEvents.
+void IPCZ_API RecordEvent(const IpczTrapEvent* event) {
+  auto& events = *reinterpret_cast<std::vector<ObservedEvent>*>(event->context);
+  events.push_back({event->condition_flags, event->status->num_local_parcels});
+}
+
+IpczPortalStatus MakeStatus(size_t num_local_parcels) {
+  return {.size = sizeof(IpczPortalStatus),
+          .num_local_parcels = num_local_parcels};
+}
+
+TEST(TrapEventDispatcherTest, NoCoalescingOutsideBatch) {
+  std::vector<ObservedEvent> events;
+  const auto context = reinterpret_cast<uintptr_t>(&events);
+  {
+    TrapEventDispatcher dispatcher;
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_NEW_LOCAL_PARCEL,
+                          MakeStatus(1), /*trap_id=*/1);
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_NEW_LOCAL_PARCEL,
+                          MakeStatus(2), /*trap_id=*/1);
+  }
+  EXPECT_EQ(2u, events.size());
+}
+
+TEST(TrapEventDispatcherTest, BatchCoalescesPerTrap) {
+  std::vector<ObservedEvent> events;
+  const auto context = reinterpret_cast<uintptr_t>(&events);
+  {
+    TrapEventDispatcher::Batch batch;
+    for (size_t i = 1; i <= 3; ++i) {
+      TrapEventDispatcher dispatcher;
+      dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_NEW_LOCAL_PARCEL,
+                            MakeStatus(i), /*trap_id=*/1);
+    }
+
+    // A different trap with the same handler and context is never merged with
+    // the first, nor is an event which can't be attributed to any trap.
+    TrapEventDispatcher dispatcher;
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_PEER_CLOSED,
+                          MakeStatus(4), /*trap_id=*/2);
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_PEER_CLOSED,
+                          MakeStatus(5));
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_PEER_CLOSED,
+                          MakeStatus(6));
+    dispatcher.DispatchAll();
+
+    // A nested Batch doesn't flush anything on its own.
+    { TrapEventDispatcher::Batch nested_batch; }
+    EXPECT_TRUE(events.empty());
+  }
+
+  ASSERT_EQ(4u, events.size());
+  EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL, events[0].flags);
+  EXPECT_EQ(3u, events[0].num_local_parcels);
+  EXPECT_EQ(IPCZ_TRAP_PEER_CLOSED, events[1].flags);
+  EXPECT_EQ(4u, events[1].num_local_parcels);
+  EXPECT_EQ(5u, events[2].num_local_parcels);
+  EXPECT_EQ(6u, events[3].num_local_parcels);
+
+  // Once the batch is gone, events are dispatched immediately again.
+  {
+    TrapEventDispatcher dispatcher;
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_NEW_LOCAL_PARCEL,
+                          MakeStatus(7), /*trap_id=*/1);
+  }
+  EXPECT_EQ(5u, events.size());
+}
+
+TEST(TrapEventDispatcherTest, BatchKeepsRemovalLast) {
+  std::vector<ObservedEvent> events;
+  const auto context = reinterpret_cast<uintptr_t>(&events);
+  {
+    TrapEventDispatcher::Batch batch;
+    TrapEventDispatcher dispatcher;
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_NEW_LOCAL_PARCEL,
+                          MakeStatus(1), /*trap_id=*/1);
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_REMOVED,
+                          MakeStatus(0), /*trap_id=*/1);
+
+    // Nothing which follows a removal may be merged ahead of it.
+    dispatcher.DeferEvent(&RecordEvent, context, IPCZ_TRAP_PEER_CLOSED,
+                          MakeStatus(2), /*trap_id=*/1);
+  }
+
+  ASSERT_EQ(3u, events.size());
+  EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL, events[0].flags);
+  EXPECT_EQ(IPCZ_TRAP_REMOVED, events[1].flags);
+  EXPECT_EQ(IPCZ_TRAP_PEER_CLOSED, events[2].flags);
+}
+
+}  // namespace
+}  // namespace ipcz
@@ -5,6 +5,7 @@
 #include "ipcz/trap_set.h"
 
 #include <algorithm>
+#include <atomic>
 #include <utility>
 
 #include "ipcz/ipcz.h"
@@ -15,22 +16,46 @@
 
 namespace ipcz {
 
+namespace {
+
+// Trap IDs start at 1, since zero means no trap to TrapEventDispatcher.
+std::atomic<uint64_t> g_next_trap_id{1};
+
+}  // namespace
+
 TrapSet::TrapSet() = default;
 
+TrapSet::TrapSet(Router& router) : router_(&router) {}
+
 TrapSet::~TrapSet() {
   ABSL_ASSERT(empty());
 }
 
+bool TrapSet::need_remote_parcels() const {
+  return std::any_of(traps_.begin(), traps_.end(), [](const Trap& trap) {
+    return (trap.conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS) != 0;
+  });
+}
+
+bool TrapSet::need_remote_bytes() const {
+  return std::any_of(traps_.begin(), traps_.end(), [](const Trap& trap) {
+    return (trap.conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES) != 0;
+  });
+}
+
 IpczResult TrapSet::Add(const IpczTrapConditions& conditions,
                         IpczTrapEventHandler handler,
                         uintptr_t context,
-                        IpczPortalStatusFlags status_flags,
-                        ParcelQueue& inbound_parcel_queue,
+                        bool is_persistent,
+                        const IpczPortalStatus& current_status,
                         IpczTrapConditionFlags* satisfied_condition_flags,
                         IpczPortalStatus* status) {
+  if (is_persistent && FindPersistentTrap(context)) {
+    return IPCZ_RESULT_ALREADY_EXISTS;
+  }
+
   IpczTrapConditionFlags flags = GetSatisfiedConditionsForUpdate(
-      conditions, status_flags, inbound_parcel_queue,
-      UpdateReason::kInstallTrap);
+      conditions, current_status, UpdateReason::kInstallTrap);
   if (flags != 0) {
     if (satisfied_condition_flags) {
       *satisfied_condition_flags = flags;
@@ -38,43 +63,93 @@ IpczResult TrapSet::Add(const IpczTrapConditions& conditions,
     if (status) {
       // The `size` field is updated to reflect how many bytes are actually
       // meaningful here.
-      const uint32_t size = std::min(status->size, sizeof(IpczPortalStatus));
+      const size_t size = std::min(status->size, sizeof(IpczPortalStatus));
+      *status = current_status;
       status->size = size;
-      status->flags = status_flags;
-      status->num_local_parcels =
-          inbound_parcel_queue.GetNumAvailableElements();
-      status->num_local_bytes =
-          inbound_parcel_queue.GetTotalAvailableElementSize();
     }
     return IPCZ_RESULT_FAILED_PRECONDITION;
   }
 
-  traps_.emplace_back(conditions, handler, context);
+  traps_.emplace_back(conditions, handler, context, is_persistent);
   return IPCZ_RESULT_OK;
 }
 
 void TrapSet::NotifyNewLocalParcel(const OperationContext& context,
-                                   IpczPortalStatusFlags status_flags,
-                                   ParcelQueue& inbound_parcel_queue,
+                                   const IpczPortalStatus& status,
                                    TrapEventDispatcher& dispatcher) {
-  UpdatePortalStatus(context, status_flags, inbound_parcel_queue,
-                     UpdateReason::kNewLocalParcel, dispatcher);
+  UpdatePortalStatus(context, status, UpdateReason::kNewLocalParcel,
+                     dispatcher);
 }
 
 void TrapSet::NotifyLocalParcelConsumed(const OperationContext& context,
-                                        IpczPortalStatusFlags status_flags,
-                                        ParcelQueue& inbound_parcel_queue,
+                                        const IpczPortalStatus& status,
                                         TrapEventDispatcher& dispatcher) {
-  UpdatePortalStatus(context, status_flags, inbound_parcel_queue,
-                     UpdateReason::kLocalParcelConsumed, dispatcher);
+  UpdatePortalStatus(context, status, UpdateReason::kLocalParcelConsumed,
+                     dispatcher);
+}
+
+void TrapSet::NotifyRemoteActivity(const OperationContext& context,
+                                   const IpczPortalStatus& status,
+                                   TrapEventDispatcher& dispatcher) {
+  UpdatePortalStatus(context, status, UpdateReason::kRemoteActivity,
+                     dispatcher);
 }
 
 void TrapSet::NotifyPeerClosed(const OperationContext& context,
-                               IpczPortalStatusFlags status_flags,
-                               ParcelQueue& inbound_parcel_queue,
+                               const IpczPortalStatus& status,
                                TrapEventDispatcher& dispatcher) {
-  UpdatePortalStatus(context, status_flags, inbound_parcel_queue,
-                     UpdateReason::kPeerClosed, dispatcher);
+  UpdatePortalStatus(context, status, UpdateReason::kPeerClosed, dispatcher);
+}
+
+IpczResult TrapSet::Enable(uintptr_t context,
+                           const IpczPortalStatus& current_status,
+                           TrapEventDispatcher& dispatcher) {
+  Trap* trap = FindPersistentTrap(context);
+  if (!trap) {
+    return IPCZ_RESULT_NOT_FOUND;
+  }
+  if (trap->is_enabled) {
+    return IPCZ_RESULT_OK;
+  }
+
+  const IpczTrapConditionFlags flags =
+      GetSatisfiedConditions(trap->conditions, current_status) |
+      trap->missed_flags;
+  trap->missed_flags = 0;
+  if (!flags) {
+    trap->is_enabled = true;
+    return IPCZ_RESULT_OK;
+  }
+
+  dispatcher.DeferEvent(trap->handler, trap->context,
+                        flags | IPCZ_TRAP_WITHIN_API_CALL, current_status,
+                        trap->id, router_);
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult TrapSet::Remove(uintptr_t context,
+                           TrapEventDispatcher& dispatcher) {
+  const IpczPortalStatus status{
+      .size = sizeof(status),
+      .flags = IPCZ_NO_FLAGS,
+      .num_local_parcels = 0,
+      .num_local_bytes = 0,
+      .num_remote_parcels = 0,
+      .num_remote_bytes = 0,
+  };
+  const size_t num_traps = traps_.size();
+  for (auto it = traps_.begin(); it != traps_.end();) {
+    if (it->context != context) {
+      ++it;
+      continue;
+    }
+
+    dispatcher.DeferEvent(it->handler, it->context,
+                          IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL,
+                          status, it->id);
+    it = traps_.erase(it);
+  }
+  return traps_.size() < num_traps ? IPCZ_RESULT_OK : IPCZ_RESULT_NOT_FOUND;
 }
 
 void TrapSet::RemoveAll(const OperationContext& context,
@@ -91,37 +166,53 @@ void TrapSet::RemoveAll(const OperationContext& context,
       .flags = IPCZ_NO_FLAGS,
       .num_local_parcels = 0,
       .num_local_bytes = 0,
+      .num_remote_parcels = 0,
+      .num_remote_bytes = 0,
   };
   for (const Trap& trap : traps_) {
-    dispatcher.DeferEvent(trap.handler, trap.context, flags, status);
+    dispatcher.DeferEvent(trap.handler, trap.context, flags, status, trap.id);
   }
   traps_.clear();
 }
 
-IpczTrapConditionFlags TrapSet::GetSatisfiedConditionsForUpdate(
+// static
+IpczTrapConditionFlags TrapSet::GetSatisfiedConditions(
     const IpczTrapConditions& conditions,
-    IpczPortalStatusFlags status_flags,
-    ParcelQueue& inbound_parcel_queue,
-    UpdateReason reason) {
+    const IpczPortalStatus& status) {
   IpczTrapConditionFlags event_flags = 0;
   if ((conditions.flags & IPCZ_TRAP_PEER_CLOSED) &&
-      (status_flags & IPCZ_PORTAL_STATUS_PEER_CLOSED)) {
+      (status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED)) {
     event_flags |= IPCZ_TRAP_PEER_CLOSED;
   }
   if ((conditions.flags & IPCZ_TRAP_DEAD) &&
-      (status_flags & IPCZ_PORTAL_STATUS_DEAD)) {
+      (status.flags & IPCZ_PORTAL_STATUS_DEAD)) {
     event_flags |= IPCZ_TRAP_DEAD;
   }
   if ((conditions.flags & IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS) &&
-      inbound_parcel_queue.GetNumAvailableElements() >
-          conditions.min_local_parcels) {
+      status.num_local_parcels > conditions.min_local_parcels) {
     event_flags |= IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS;
   }
   if ((conditions.flags & IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES) &&
-      inbound_parcel_queue.GetTotalAvailableElementSize() >
-          conditions.min_local_bytes) {
+      status.num_local_bytes > conditions.min_local_bytes) {
     event_flags |= IPCZ_TRAP_ABOVE_MIN_LOCAL_BYTES;
   }
+  if ((conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS) &&
+      status.num_remote_parcels < conditions.max_remote_parcels) {
+    event_flags |= IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS;
+  }
+  if ((conditions.flags & IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES) &&
+      status.num_remote_bytes < conditions.max_remote_bytes) {
+    event_flags |= IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES;
+  }
+  return event_flags;
+}
+
+IpczTrapConditionFlags TrapSet::GetSatisfiedConditionsForUpdate(
+    const IpczTrapConditions& conditions,
+    const IpczPortalStatus& status,
+    UpdateReason reason) {
+  IpczTrapConditionFlags event_flags =
+      GetSatisfiedConditions(conditions, status);
   if ((conditions.flags & IPCZ_TRAP_NEW_LOCAL_PARCEL) &&
       reason == UpdateReason::kNewLocalParcel) {
     event_flags |= IPCZ_TRAP_NEW_LOCAL_PARCEL;
@@ -130,38 +221,57 @@ IpczTrapConditionFlags TrapSet::GetSatisfiedConditionsForUpdate(
 }
 
 void TrapSet::UpdatePortalStatus(const OperationContext& context,
-                                 IpczPortalStatusFlags status_flags,
-                                 ParcelQueue& inbound_parcel_queue,
+                                 const IpczPortalStatus& status,
                                  UpdateReason reason,
                                  TrapEventDispatcher& dispatcher) {
   for (auto it = traps_.begin(); it != traps_.end();) {
-    const Trap& trap = *it;
-    IpczTrapConditionFlags flags = GetSatisfiedConditionsForUpdate(
-        trap.conditions, status_flags, inbound_parcel_queue, reason);
+    Trap& trap = *it;
+    IpczTrapConditionFlags flags =
+        GetSatisfiedConditionsForUpdate(trap.conditions, status, reason);
     if (!flags) {
       ++it;
       continue;
     }
 
+    if (!trap.is_enabled) {
+      // Level-triggered conditions are re-evaluated when the trap is enabled
+      // again, but edges would otherwise be lost.
+      trap.missed_flags |= flags & IPCZ_TRAP_NEW_LOCAL_PARCEL;
+      ++it;
+      continue;
+    }
+
     if (context.is_api_call()) {
       flags |= IPCZ_TRAP_WITHIN_API_CALL;
     }
 
-    const IpczPortalStatus status{
-        .size = sizeof(status),
-        .flags = status_flags,
-        .num_local_parcels = inbound_parcel_queue.GetNumAvailableElements(),
-        .num_local_bytes = inbound_parcel_queue.GetTotalAvailableElementSize(),
-    };
-    dispatcher.DeferEvent(trap.handler, trap.context, flags, status);
-    it = traps_.erase(it);
+    dispatcher.DeferEvent(trap.handler, trap.context, flags, status, trap.id,
+                          router_);
+    if (trap.is_persistent) {
+      trap.is_enabled = false;
+      ++it;
+    } else {
+      it = traps_.erase(it);
+    }
   }
 }
 
+TrapSet::Trap* TrapSet::FindPersistentTrap(uintptr_t context) {
+  auto it = std::find_if(traps_.begin(), traps_.end(), [&](const Trap& trap) {
+    return trap.is_persistent && trap.context == context;
+  });
+  return it == traps_.end() ? nullptr : &*it;
+}
+
 TrapSet::Trap::Trap(IpczTrapConditions conditions,
                     IpczTrapEventHandler handler,
-                    uintptr_t context)
-    : conditions(conditions), handler(handler), context(context) {}
+                    uintptr_t context,
+                    bool is_persistent)
+    : conditions(conditions),
+      handler(handler),
+      context(context),
+      is_persistent(is_persistent),
+      id(g_next_trap_id.fetch_add(1, std::memory_order_relaxed)) {}
 
 TrapSet::Trap::~Trap() = default;
 
@@ -9,17 +9,22 @@
 
 #include "ipcz/ipcz.h"
 #include "ipcz/operation_context.h"
-#include "ipcz/parcel_queue.h"
 #include "third_party/abseil-cpp/absl/container/inlined_vector.h"
 
 namespace ipcz {
 
+class Router;
 class TrapEventDispatcher;
 
 // A set of traps installed on a portal.
 class TrapSet {
  public:
   TrapSet();
+
+  // Constructs a TrapSet for the portal routed by `router`. Events from the set
+  // identify `router` as their source, so their status can be refreshed if
+  // they're coalesced by a TrapEventDispatcher::Batch.
+  explicit TrapSet(Router& router);
   TrapSet(const TrapSet&) = delete;
   TrapSet& operator=(const TrapSet&) = delete;
 
@@ -28,46 +33,81 @@ class TrapSet {
 
   bool empty() const { return traps_.empty(); }
 
+  // Returns the subset of level-triggered flags in `conditions` which are
+  // satisfied by a portal with the given `status`. Edge-triggered conditions
+  // like IPCZ_TRAP_NEW_LOCAL_PARCEL are never included.
+  static IpczTrapConditionFlags GetSatisfiedConditions(
+      const IpczTrapConditions& conditions,
+      const IpczPortalStatus& status);
+
+  // Indicates whether any trap in the set watches the number of parcels or
+  // bytes in the remote queue, respectively. If so, the status given to each
+  // method below should reflect a current snapshot of the remote queue, and the
+  // portal must be notified of any further remote consumption.
+  bool need_remote_parcels() const;
+  bool need_remote_bytes() const;
+
   // Attempts to install a new trap in the set. This effectively implements
-  // the ipcz Trap() API. `status_flags`, `num_local_parcels`, and
-  // `num_local_bytes` convey the current status of the portal. If `conditions`
-  // are already met, returns IPCZ_RESULT_FAILED_PRECONDITION and populates
-  // `satisfied_condition_flags` and/or `status` if non-null.
+  // the ipcz Trap() API. `current_status` conveys the current status of the
+  // portal. If `conditions` are already met, returns
+  // IPCZ_RESULT_FAILED_PRECONDITION and populates `satisfied_condition_flags`
+  // and/or `status` if non-null. If `is_persistent` is true, the trap is
+  // disabled rather than removed when it fires.
   IpczResult Add(const IpczTrapConditions& conditions,
                  IpczTrapEventHandler handler,
                  uintptr_t context,
-                 IpczPortalStatusFlags status_flags,
-                 ParcelQueue& inbound_parcel_queue,
+                 bool is_persistent,
+                 const IpczPortalStatus& current_status,
                  IpczTrapConditionFlags* satisfied_condition_flags,
                  IpczPortalStatus* status);
 
   // Notifies the TrapSet that a new local parcel has arrived on its portal.
   // Any trap interested in this is removed from the set, and its event handler
-  // invocation is appended to `dispatcher`. `status_flags`, `num_local_parcels`
-  // and `num_local_bytes` convey the new status of the portal.
+  // invocation is appended to `dispatcher`. `status` conveys the new status of
+  // the portal.
   void NotifyNewLocalParcel(const OperationContext& context,
-                            IpczPortalStatusFlags status_flags,
-                            ParcelQueue& inbound_parcel_queue,
+                            const IpczPortalStatus& status,
                             TrapEventDispatcher& dispatcher);
 
   // Notifies the TrapSet that a local parcel has been consumed from its portal.
   // Any trap interested in this is removed from the set, and its event handler
-  // invocation is appended to `dispatcher`. `status_flags`, `num_local_parcels`
-  // and `num_local_bytes` convey the new status of the portal.
+  // invocation is appended to `dispatcher`. `status` conveys the new status of
+  // the portal.
   void NotifyLocalParcelConsumed(const OperationContext& context,
-                                 IpczPortalStatusFlags status_flags,
-                                 ParcelQueue& inbound_parcel_queue,
+                                 const IpczPortalStatus& status,
                                  TrapEventDispatcher& dispatcher);
 
+  // Notifies the TrapSet that parcels may have been consumed from the remote
+  // queue, or that the portal's view of the remote queue has otherwise changed.
+  // Any trap interested in this is removed from the set, and its event handler
+  // invocation is appended to `dispatcher`. `status` conveys the new status of
+  // the portal.
+  void NotifyRemoteActivity(const OperationContext& context,
+                            const IpczPortalStatus& status,
+                            TrapEventDispatcher& dispatcher);
+
   // Notifies the TrapSet that its portal's peer has been closed. Any trap
   // interested in this is removed from the set, and its event handler
-  // invocation is appended to `dispatcher`. `status_flags` conveys the new
-  // status of the portal.
+  // invocation is appended to `dispatcher`. `status` conveys the new status of
+  // the portal.
   void NotifyPeerClosed(const OperationContext& context,
-                        IpczPortalStatusFlags status_flags,
-                        ParcelQueue& inbound_parcel_queue,
+                        const IpczPortalStatus& status,
                         TrapEventDispatcher& dispatcher);
 
+  // Re-enables the disabled persistent trap identified by `context`. If any of
+  // its conditions were met while it was disabled or are met by
+  // `current_status`, the trap fires again immediately by appending an event
+  // to `dispatcher`, and it stays disabled. This effectively implements the
+  // ipcz EnableTrap() API.
+  IpczResult Enable(uintptr_t context,
+                    const IpczPortalStatus& current_status,
+                    TrapEventDispatcher& dispatcher);
+
+  // Removes every trap identified by `context`, appending an IPCZ_TRAP_REMOVED
+  // event for each one to `dispatcher`. This effectively implements the ipcz
+  // RemoveTrap() API.
+  IpczResult Remove(uintptr_t context, TrapEventDispatcher& dispatcher);
+
   // Immediately removes all traps from the set. Every trap present appends an
   // IPCZ_TRAP_REMOVED event to `dispatcher` before removal.
   void RemoveAll(const OperationContext& context,
@@ -77,12 +117,24 @@ class TrapSet {
   struct Trap {
     Trap(IpczTrapConditions conditions,
          IpczTrapEventHandler handler,
-         uintptr_t context);
+         uintptr_t context,
+         bool is_persistent);
     ~Trap();
 
     IpczTrapConditions conditions;
     IpczTrapEventHandler handler;
     uintptr_t context;
+    bool is_persistent;
+
+    // Unique among all traps in the process, so a TrapEventDispatcher::Batch
+    // can tell which events came from the same trap.
+    uint64_t id;
+
+    // Only persistent traps are ever disabled. A disabled trap accumulates any
+    // edge-triggered conditions it observes in `missed_flags`, to be reported
+    // once it's enabled again.
+    bool is_enabled = true;
+    IpczTrapConditionFlags missed_flags = 0;
   };
 
   // The reason for each status update when something happens that might
@@ -100,23 +152,30 @@ class TrapSet {
     // A previously queued inbound parcel has been fully or partially retrieved
     // by the application.
     kLocalParcelConsumed,
+
+    // The remote queue may have shrunk.
+    kRemoteActivity,
   };
 
   // Determines which trap condition flags would be set if an event fired for
   // a trap watching the given `conditions`, given the most recent state change.
   IpczTrapConditionFlags GetSatisfiedConditionsForUpdate(
       const IpczTrapConditions& conditions,
-      IpczPortalStatusFlags status_flags,
-      ParcelQueue& inbound_parcel_queue,
+      const IpczPortalStatus& status,
       UpdateReason reason);
 
   // Helper used by Notify* methods to carry out common update work.
   void UpdatePortalStatus(const OperationContext& context,
-                          IpczPortalStatusFlags status_flags,
-                          ParcelQueue& inbound_parcel_queue,
+                          const IpczPortalStatus& status,
                           UpdateReason reason,
                           TrapEventDispatcher& dispatcher);
 
+  // Returns the persistent trap identified by `context`, or null if there is
+  // no such trap.
+  Trap* FindPersistentTrap(uintptr_t context);
+
+  Router* const router_ = nullptr;
+
   using TrapList = std::vector<Trap>;
   TrapList traps_;
 };
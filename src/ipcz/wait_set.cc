@@ -0,0 +1,242 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "ipcz/wait_set.h"
+
+#include <utility>
+
+#include "ipcz/router.h"
+#include "ipcz/trap_event_dispatcher.h"
+#include "ipcz/trap_set.h"
+#include "third_party/abseil-cpp/absl/container/inlined_vector.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+
+namespace ipcz {
+
+WaitSet::Member::Member(Ref<WaitSet> wait_set,
+                        Ref<Router> router,
+                        const IpczTrapConditions& conditions,
+                        uintptr_t context)
+    : wait_set_(std::move(wait_set)),
+      router_(std::move(router)),
+      conditions_(conditions),
+      context_(context) {}
+
+WaitSet::Member::~Member() = default;
+
+void WaitSet::Member::Activate(SequenceNumber inbound_sequence_length) {
+  absl::MutexLock lock(&mutex_);
+  sequence_length_ = inbound_sequence_length;
+  reported_sequence_length_ = inbound_sequence_length;
+}
+
+void WaitSet::Member::Update(const IpczPortalStatus& status,
+                             SequenceNumber inbound_sequence_length,
+                             TrapEventDispatcher& dispatcher) {
+  {
+    absl::MutexLock lock(&mutex_);
+    status_ = status;
+    sequence_length_ = inbound_sequence_length;
+    if (is_queued_ || is_removed_ || !GetSatisfiedConditions()) {
+      return;
+    }
+    is_queued_ = true;
+  }
+
+  if (wait_set_->PushReady(*this)) {
+    dispatcher.DeferWake(wait_set_);
+  }
+}
+
+IpczTrapConditionFlags WaitSet::Member::GetSatisfiedConditions() {
+  IpczTrapConditionFlags flags =
+      TrapSet::GetSatisfiedConditions(conditions_, status_);
+  if ((conditions_.flags & IPCZ_TRAP_NEW_LOCAL_PARCEL) &&
+      sequence_length_ > reported_sequence_length_) {
+    flags |= IPCZ_TRAP_NEW_LOCAL_PARCEL;
+  }
+  return flags;
+}
+
+WaitSet::WaitSet() = default;
+
+WaitSet::~WaitSet() {
+  DiscardReadyMembers();
+}
+
+IpczResult WaitSet::Close() {
+  {
+    absl::MutexLock lock(&mutex_);
+    is_closed_ = true;
+    pending_.clear();
+    for (const auto& [router, member] : members_) {
+      {
+        absl::MutexLock member_lock(&member->mutex_);
+        member->is_removed_ = true;
+      }
+      router->RemoveWaitSetMember(*member);
+    }
+    members_.clear();
+  }
+
+  // No Router can queue a member once it's been removed above, so this leaves
+  // the ready stack empty for good.
+  DiscardReadyMembers();
+  ready_futex_.IncrementAndWakeAll();
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult WaitSet::Add(Ref<Router> router,
+                        const IpczTrapConditions& conditions,
+                        uintptr_t context) {
+  absl::MutexLock lock(&mutex_);
+  if (is_closed_) {
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+
+  auto [it, inserted] = members_.try_emplace(router.get());
+  if (!inserted) {
+    return IPCZ_RESULT_ALREADY_EXISTS;
+  }
+
+  // Note that `mutex_` is held while the Router is locked here, so a portal
+  // can't be removed again before it's fully added.
+  auto member = MakeRefCounted<Member>(WrapRefCounted(this), router,
+                                       conditions, context);
+  if (!router->AddWaitSetMember(member)) {
+    members_.erase(it);
+    return IPCZ_RESULT_INVALID_ARGUMENT;
+  }
+  it->second = std::move(member);
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult WaitSet::Remove(Router& router) {
+  absl::MutexLock lock(&mutex_);
+  auto it = members_.find(&router);
+  if (it == members_.end()) {
+    return IPCZ_RESULT_NOT_FOUND;
+  }
+
+  const Ref<Member> member = std::move(it->second);
+  members_.erase(it);
+  {
+    absl::MutexLock member_lock(&member->mutex_);
+    member->is_removed_ = true;
+  }
+  router.RemoveWaitSetMember(*member);
+  return IPCZ_RESULT_OK;
+}
+
+IpczResult WaitSet::WaitForEvents(absl::Time deadline,
+                                  size_t spin_count,
+                                  absl::Span<IpczWaitSetEvent> events,
+                                  size_t& num_events) {
+  for (;;) {
+    // As in Router::Wait(), the futex is sampled before looking for ready
+    // members so that any member queued afterward prevents us from blocking.
+    const uint32_t epoch = ready_futex_.Load();
+    {
+      absl::MutexLock lock(&mutex_);
+      if (is_closed_) {
+        return IPCZ_RESULT_CANCELLED;
+      }
+
+      TakeReadyMembers();
+      num_events = 0;
+      while (num_events < events.size() && !pending_.empty()) {
+        const Ref<Member> member = std::move(pending_.front());
+        pending_.pop_front();
+
+        // A member's portal may have changed since it was queued, so only its
+        // latest status is reported, and only if that still satisfies some of
+        // its conditions.
+        absl::MutexLock member_lock(&member->mutex_);
+        member->is_queued_ = false;
+        if (member->is_removed_) {
+          continue;
+        }
+        const IpczTrapConditionFlags flags = member->GetSatisfiedConditions();
+        if (!flags) {
+          continue;
+        }
+        events[num_events++] = {
+            .size = sizeof(IpczWaitSetEvent),
+            .context = member->context_,
+            .condition_flags = flags,
+            .status = member->status_,
+        };
+        member->reported_sequence_length_ = member->sequence_length_;
+      }
+
+      if (num_events > 0) {
+        return IPCZ_RESULT_OK;
+      }
+      if (absl::Now() >= deadline) {
+        return IPCZ_RESULT_DEADLINE_EXCEEDED;
+      }
+    }
+
+    for (size_t i = 0; i < spin_count && ready_futex_.Load() == epoch; ++i) {
+    }
+    if (ready_futex_.Load() == epoch) {
+      ready_futex_.Wait(epoch, deadline);
+    }
+  }
+}
+
+void WaitSet::ForgetMember(Member& member) {
+  absl::MutexLock lock(&mutex_);
+  {
+    absl::MutexLock member_lock(&member.mutex_);
+    member.is_removed_ = true;
+  }
+  auto it = members_.find(&member.router());
+  if (it != members_.end() && it->second == &member) {
+    members_.erase(it);
+  }
+}
+
+bool WaitSet::PushReady(Member& member) {
+  // The stack's reference is adopted again by TakeReadyMembers() or
+  // DiscardReadyMembers().
+  member.AcquireRef();
+  Member* head = ready_head_.load(std::memory_order_relaxed);
+  do {
+    member.next_ready_ = head;
+  } while (!ready_head_.compare_exchange_weak(
+      head, &member, std::memory_order_release, std::memory_order_relaxed));
+  return head == nullptr;
+}
+
+void WaitSet::TakeReadyMembers() {
+  Member* head = ready_head_.exchange(nullptr, std::memory_order_acquire);
+  if (!head) {
+    return;
+  }
+
+  // The stack is LIFO, so reverse it to report portals in the order they
+  // became ready.
+  absl::InlinedVector<Member*, 16> members;
+  for (Member* member = head; member; member = member->next_ready_) {
+    members.push_back(member);
+  }
+  for (auto it = members.rbegin(); it != members.rend(); ++it) {
+    pending_.push_back(AdoptRef(*it));
+  }
+}
+
+void WaitSet::DiscardReadyMembers() {
+  Member* member = ready_head_.exchange(nullptr, std::memory_order_acquire);
+  while (member) {
+    const Ref<Member> ref = AdoptRef(member);
+    {
+      absl::MutexLock lock(&member->mutex_);
+      member->is_queued_ = false;
+    }
+    member = member->next_ready_;
+  }
+}
+
+}  // namespace ipcz
@@ -0,0 +1,159 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_IPCZ_WAIT_SET_H_
+#define IPCZ_SRC_IPCZ_WAIT_SET_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+#include "ipcz/api_object.h"
+#include "ipcz/ipcz.h"
+#include "ipcz/sequence_number.h"
+#include "third_party/abseil-cpp/absl/base/thread_annotations.h"
+#include "third_party/abseil-cpp/absl/container/flat_hash_map.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/futex.h"
+#include "util/ref_counted.h"
+
+namespace ipcz {
+
+class Router;
+class TrapEventDispatcher;
+
+// A WaitSet watches any number of portals for persistent sets of conditions.
+// Unlike traps, a portal's registration is never consumed by the events it
+// produces. Instead each Router pushes its registration onto the WaitSet's
+// lock-free ready stack whenever a state change leaves its conditions met, and
+// the owner drains ready portals in batches with WaitForEvents().
+class WaitSet : public APIObjectImpl<WaitSet, APIObject::kWaitSet> {
+ public:
+  // A single portal's registration with a WaitSet. Members are owned jointly by
+  // the WaitSet and the portal's Router until either one removes it, and
+  // additionally by the ready stack while queued there.
+  class Member : public RefCounted<Member> {
+   public:
+    Member(Ref<WaitSet> wait_set,
+           Ref<Router> router,
+           const IpczTrapConditions& conditions,
+           uintptr_t context);
+
+    WaitSet& wait_set() const { return *wait_set_; }
+    Router& router() const { return *router_; }
+    const IpczTrapConditions& conditions() const { return conditions_; }
+
+    // Called by the Router once when this member is added to it, so that only
+    // parcels arriving afterward satisfy IPCZ_TRAP_NEW_LOCAL_PARCEL.
+    void Activate(SequenceNumber inbound_sequence_length);
+
+    // Records the latest status of this member's portal, along with the
+    // current length of its inbound parcel sequence. If that leaves any of
+    // this member's conditions satisfied, the member is queued on its WaitSet
+    // unless it's already there. Called by the Router with its lock held.
+    void Update(const IpczPortalStatus& status,
+                SequenceNumber inbound_sequence_length,
+                TrapEventDispatcher& dispatcher);
+
+   private:
+    friend class RefCounted<Member>;
+    friend class WaitSet;
+
+    ~Member();
+
+    IpczTrapConditionFlags GetSatisfiedConditions()
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+    const Ref<WaitSet> wait_set_;
+    const Ref<Router> router_;
+    const IpczTrapConditions conditions_;
+    const uintptr_t context_;
+
+    absl::Mutex mutex_;
+    IpczPortalStatus status_ ABSL_GUARDED_BY(mutex_) = {
+        .size = sizeof(status_),
+    };
+
+    // The inbound sequence length as of the last Update(), and as of the last
+    // event reported for this member. IPCZ_TRAP_NEW_LOCAL_PARCEL is satisfied
+    // whenever the former exceeds the latter.
+    SequenceNumber sequence_length_ ABSL_GUARDED_BY(mutex_);
+    SequenceNumber reported_sequence_length_ ABSL_GUARDED_BY(mutex_);
+
+    bool is_queued_ ABSL_GUARDED_BY(mutex_) = false;
+    bool is_removed_ ABSL_GUARDED_BY(mutex_) = false;
+
+    // Links this member to the next one in its WaitSet's ready stack.
+    Member* next_ready_ = nullptr;
+  };
+
+  WaitSet();
+
+  // APIObject:
+  IpczResult Close() override;
+
+  // Registers the portal routed by `router` with this WaitSet, to be reported
+  // as ready whenever any of `conditions` is met. Events for the portal carry
+  // `context`. Implements the AddToWaitSet() API.
+  IpczResult Add(Ref<Router> router,
+                 const IpczTrapConditions& conditions,
+                 uintptr_t context);
+
+  // Unregisters the portal routed by `router`. Implements the
+  // RemoveFromWaitSet() API.
+  IpczResult Remove(Router& router);
+
+  // Fills `events` with ready portals, blocking until at least one is ready
+  // or until `deadline`. On success `num_events` is the number of events
+  // stored. Implements the WaitForReadyPortals() API.
+  IpczResult WaitForEvents(absl::Time deadline,
+                           size_t spin_count,
+                           absl::Span<IpczWaitSetEvent> events,
+                           size_t& num_events);
+
+  // Called by a Router which has dropped `member` because its portal was closed
+  // or transferred elsewhere.
+  void ForgetMember(Member& member);
+
+  // Wakes any threads blocked in WaitForEvents() so they can pick up newly
+  // ready members. Called by TrapEventDispatcher.
+  void WakeWaiters() { ready_futex_.IncrementAndWakeAll(); }
+
+ private:
+  ~WaitSet() override;
+
+  // Pushes `member` onto the ready stack. This is lock-free and may be called
+  // from any thread. Returns true if the stack was previously empty.
+  bool PushReady(Member& member);
+
+  // Moves everything on the ready stack to the end of `pending_`, in the order
+  // they were pushed.
+  void TakeReadyMembers() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Releases everything on the ready stack.
+  void DiscardReadyMembers();
+
+  // Head of an intrusive stack of members whose portals have become ready.
+  // Each entry owns a reference to its member.
+  std::atomic<Member*> ready_head_{nullptr};
+
+  // Woken whenever the ready stack goes from empty to non-empty, or when this
+  // WaitSet is closed.
+  Futex ready_futex_;
+
+  absl::Mutex mutex_;
+  bool is_closed_ ABSL_GUARDED_BY(mutex_) = false;
+  absl::flat_hash_map<Router*, Ref<Member>> members_ ABSL_GUARDED_BY(mutex_);
+
+  // Members taken from the ready stack which have yet to be reported by
+  // WaitForEvents(), in FIFO order.
+  std::deque<Ref<Member>> pending_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_IPCZ_WAIT_SET_H_
@@ -8,6 +8,8 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <cstdint>
+#include <tuple>
 #include <utility>
 
 #include "third_party/abseil-cpp/absl/base/macros.h"
@@ -73,10 +75,45 @@ MemfdMemory MemfdMemory::Clone() {
 }
 
 MemfdMemory::Mapping MemfdMemory::Map() {
+  return Map(MapOptions());
+}
+
+MemfdMemory::Mapping MemfdMemory::Map(const MapOptions& options) {
   ABSL_ASSERT(is_valid());
+
+  // Huge page advice must be given before any pages are faulted in, so in that
+  // case prefaulting is deferred until after the madvise() below.
+  int flags = MAP_SHARED;
+  if (options.prefault && !options.use_huge_pages) {
+    flags |= MAP_POPULATE;
+  }
   void* addr =
-      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.get(), 0);
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, flags, fd_.get(), 0);
   ABSL_ASSERT(addr && addr != MAP_FAILED);
+  if (!options.use_huge_pages) {
+    return Mapping(addr, size_);
+  }
+
+  // Both of these are best-effort hints, and failure is harmless.
+  std::ignore = madvise(addr, size_, MADV_HUGEPAGE);
+  if (options.prefault) {
+#if defined(MADV_POPULATE_WRITE)
+    if (madvise(addr, size_, MADV_POPULATE_WRITE) == 0) {
+      return Mapping(addr, size_);
+    }
+#endif
+    // Older kernels can't populate an existing mapping, so read every page
+    // instead. Since this is a writable shared mapping of shmem, read faults
+    // allocate the pages and map them writable. Reads are used because other
+    // processes may already be writing to the memory.
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const volatile uint8_t* bytes = static_cast<const volatile uint8_t*>(addr);
+    uint8_t sum = 0;
+    for (size_t offset = 0; offset < size_; offset += page_size) {
+      sum += bytes[offset];
+    }
+    std::ignore = sum;
+  }
   return Mapping(addr, size_);
 }
 
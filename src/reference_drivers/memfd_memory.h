@@ -47,6 +47,18 @@ class MemfdMemory {
     size_t size_ = 0;
   };
 
+  // Options controlling how the pages of a new Mapping are provisioned.
+  struct MapOptions {
+    // If true, every page of the mapping is faulted in before Map() returns,
+    // rather than on first access.
+    bool prefault = false;
+
+    // If true, the kernel is advised to back the mapping with transparent huge
+    // pages where possible. This has no effect unless the system enables huge
+    // pages for shared memory (see /sys/kernel/mm/transparent_hugepage).
+    bool use_huge_pages = false;
+  };
+
   // Constructs an invalid MemfdMemory object which cannot be mapped.
   MemfdMemory();
 
@@ -86,6 +98,7 @@ class MemfdMemory {
   // Must only be called on a valid MemfdMemory object (i.e. is_valid() must be
   // true.)
   Mapping Map();
+  Mapping Map(const MapOptions& options);
 
  private:
   FileDescriptor fd_;
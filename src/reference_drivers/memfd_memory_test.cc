@@ -4,7 +4,11 @@
 
 #include "reference_drivers/memfd_memory.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <tuple>
+#include <vector>
 
 #include "testing/gtest/include/gtest/gtest.h"
 
@@ -13,6 +17,23 @@ namespace {
 
 using MemfdMemoryTest = testing::Test;
 
+// Returns the number of pages in `mapping` which are resident in memory, i.e.
+// which can be accessed without a major or minor page fault.
+size_t CountResidentPages(const MemfdMemory::Mapping& mapping) {
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  std::vector<unsigned char> residency((mapping.size() + page_size - 1) /
+                                       page_size);
+  if (mincore(mapping.base(), mapping.size(), residency.data()) != 0) {
+    return 0;
+  }
+
+  size_t num_resident_pages = 0;
+  for (unsigned char page : residency) {
+    num_resident_pages += page & 1;
+  }
+  return num_resident_pages;
+}
+
 TEST_F(MemfdMemoryTest, CreateAndMap) {
   MemfdMemory memory(64);
 
@@ -66,5 +87,38 @@ TEST_F(MemfdMemoryTest, CreateCloneMapClose) {
   EXPECT_EQ(42, data1[0]);
 }
 
+TEST_F(MemfdMemoryTest, Prefault) {
+  constexpr size_t kSize = 1024 * 1024;
+  const size_t num_pages = kSize / static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+  // By default, pages are only faulted in on first access.
+  MemfdMemory memory(kSize);
+  MemfdMemory::Mapping mapping = memory.Map();
+  EXPECT_EQ(0u, CountResidentPages(mapping));
+
+  MemfdMemory prefaulted_memory(kSize);
+  MemfdMemory::Mapping prefaulted_mapping =
+      prefaulted_memory.Map({.prefault = true});
+  EXPECT_EQ(num_pages, CountResidentPages(prefaulted_mapping));
+}
+
+TEST_F(MemfdMemoryTest, HugePages) {
+  // Whether huge pages are actually used depends on system configuration, but
+  // the mapping must work either way and prefaulting must still be honored.
+  constexpr size_t kSize = 4 * 1024 * 1024;
+  const size_t num_pages = kSize / static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  MemfdMemory memory(kSize);
+  MemfdMemory::Mapping mapping0 =
+      memory.Map({.prefault = true, .use_huge_pages = true});
+  MemfdMemory::Mapping mapping1 = memory.Map({.use_huge_pages = true});
+  EXPECT_EQ(num_pages, CountResidentPages(mapping0));
+
+  int* data0 = mapping0.As<int>();
+  int* data1 = mapping1.As<int>();
+  data1[0] = 0;
+  data0[0] = 42;
+  EXPECT_EQ(42, data1[0]);
+}
+
 }  // namespace
 }  // namespace ipcz::reference_drivers
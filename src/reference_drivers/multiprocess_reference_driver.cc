@@ -4,6 +4,7 @@
 
 #include "reference_drivers/multiprocess_reference_driver.h"
 
+#include <atomic>
 #include <cstring>
 #include <limits>
 #include <memory>
@@ -25,6 +26,10 @@ namespace ipcz::reference_drivers {
 
 namespace {
 
+// See SetSharedMemoryMappingPolicy().
+std::atomic<size_t> g_prefault_threshold{std::numeric_limits<size_t>::max()};
+std::atomic<size_t> g_huge_page_threshold{std::numeric_limits<size_t>::max()};
+
 // A transport implementation based on a SocketTransport.
 class MultiprocessTransport
     : public ObjectImpl<MultiprocessTransport, Object::kTransport> {
@@ -151,7 +156,14 @@ class MultiprocessMemory
   }
 
   Ref<MultiprocessMemoryMapping> Map() {
-    return MakeRefCounted<MultiprocessMemoryMapping>(memory_.Map());
+    const size_t size = memory_.size();
+    const MemfdMemory::MapOptions options = {
+        .prefault =
+            size >= g_prefault_threshold.load(std::memory_order_relaxed),
+        .use_huge_pages =
+            size >= g_huge_page_threshold.load(std::memory_order_relaxed),
+    };
+    return MakeRefCounted<MultiprocessMemoryMapping>(memory_.Map(options));
   }
 
   FileDescriptor TakeDescriptor() { return memory_.TakeDescriptor(); }
@@ -413,6 +425,13 @@ const IpczDriver kMultiprocessReferenceDriver = {
     GenerateRandomBytes,
 };
 
+void SetSharedMemoryMappingPolicy(const SharedMemoryMappingPolicy& policy) {
+  g_prefault_threshold.store(policy.prefault_threshold,
+                             std::memory_order_relaxed);
+  g_huge_page_threshold.store(policy.huge_page_threshold,
+                              std::memory_order_relaxed);
+}
+
 IpczDriverHandle CreateMultiprocessTransport(Ref<SocketTransport> transport) {
   return Object::ReleaseAsHandle(
       MakeRefCounted<MultiprocessTransport>(std::move(transport)));
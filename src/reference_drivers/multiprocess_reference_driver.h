@@ -5,6 +5,9 @@
 #ifndef IPCZ_SRC_REFERENCE_DRIVERS_MULTIPROCESS_REFERENCE_DRIVER_H_
 #define IPCZ_SRC_REFERENCE_DRIVERS_MULTIPROCESS_REFERENCE_DRIVER_H_
 
+#include <cstddef>
+#include <limits>
+
 #include "ipcz/ipcz.h"
 #include "reference_drivers/file_descriptor.h"
 #include "reference_drivers/socket_transport.h"
@@ -20,6 +23,22 @@ extern const IpczDriver kMultiprocessReferenceDriver;
 // endpoint and returns an IpczDriverHandle to reference it.
 IpczDriverHandle CreateMultiprocessTransport(Ref<SocketTransport> transport);
 
+// Controls how kMultiprocessReferenceDriver maps shared memory regions, based
+// on the size of each region. By default neither option is used.
+struct SharedMemoryMappingPolicy {
+  // Regions of at least this many bytes are prefaulted when mapped, so that
+  // first access to their pages doesn't incur page faults.
+  size_t prefault_threshold = std::numeric_limits<size_t>::max();
+
+  // Regions of at least this many bytes request transparent huge page backing
+  // when mapped, reducing TLB pressure for large buffers.
+  size_t huge_page_threshold = std::numeric_limits<size_t>::max();
+};
+
+// Sets the SharedMemoryMappingPolicy for all subsequent mappings created by
+// kMultiprocessReferenceDriver within the calling process.
+void SetSharedMemoryMappingPolicy(const SharedMemoryMappingPolicy& policy);
+
 // Extracts the underlying file descriptor from a socket-based multiprocess
 // driver transport. `transport` is effectively consumed and invalidated by this
 // call.
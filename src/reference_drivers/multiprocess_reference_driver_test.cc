@@ -4,8 +4,12 @@
 
 #include "reference_drivers/multiprocess_reference_driver.h"
 
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include <vector>
 
 #include "ipcz/ipcz.h"
 #include "reference_drivers/file_descriptor.h"
@@ -53,5 +57,39 @@ TEST(MultiprocessReferenceDriverTest, SendDeactivated) {
   EXPECT_EQ(IPCZ_RESULT_OK, driver.Close(b, IPCZ_NO_FLAGS, nullptr));
 }
 
+TEST(MultiprocessReferenceDriverTest, SharedMemoryMappingPolicy) {
+  // Only regions at or above the configured threshold are prefaulted.
+  const IpczDriver& driver = kMultiprocessReferenceDriver;
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t kThreshold = 64 * page_size;
+  SetSharedMemoryMappingPolicy({.prefault_threshold = kThreshold});
+
+  auto count_resident_pages_after_mapping = [&](size_t size) {
+    IpczDriverHandle memory, mapping;
+    volatile void* address;
+    EXPECT_EQ(IPCZ_RESULT_OK, driver.AllocateSharedMemory(size, IPCZ_NO_FLAGS,
+                                                          nullptr, &memory));
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              driver.MapSharedMemory(memory, IPCZ_NO_FLAGS, nullptr, &address,
+                                     &mapping));
+    std::vector<unsigned char> residency(size / page_size);
+    EXPECT_EQ(0, mincore(const_cast<void*>(address), size, residency.data()));
+    size_t num_resident_pages = 0;
+    for (unsigned char page : residency) {
+      num_resident_pages += page & 1;
+    }
+    EXPECT_EQ(IPCZ_RESULT_OK, driver.Close(mapping, IPCZ_NO_FLAGS, nullptr));
+    EXPECT_EQ(IPCZ_RESULT_OK, driver.Close(memory, IPCZ_NO_FLAGS, nullptr));
+    return num_resident_pages;
+  };
+
+  EXPECT_EQ(0u, count_resident_pages_after_mapping(kThreshold / 2));
+  EXPECT_EQ(kThreshold / page_size,
+            count_resident_pages_after_mapping(kThreshold));
+
+  SetSharedMemoryMappingPolicy({});
+  EXPECT_EQ(0u, count_resident_pages_after_mapping(kThreshold));
+}
+
 }  // namespace
 }  // namespace ipcz::reference_drivers
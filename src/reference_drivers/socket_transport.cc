@@ -169,17 +169,18 @@ bool SocketTransport::Send(Message message) {
       return true;
     }
 
+    size_t data_bytes_sent = 0;
     if (*bytes_sent < header_bytes.size()) {
       header_bytes.remove_prefix(*bytes_sent);
     } else {
-      *bytes_sent -= header_bytes.size();
+      data_bytes_sent = *bytes_sent - header_bytes.size();
       header_bytes = {};
     }
 
     outgoing_queue_.emplace_back(
         header_bytes,
         Message{
-            .data = message.data.subspan(*bytes_sent),
+            .data = message.data.subspan(data_bytes_sent),
 
             // sendmsg() on Linux will return EAGAIN/EWOULDBLOCK if there's not
             // enough socket capacity to convey at least one byte of message
@@ -454,9 +455,16 @@ void SocketTransport::TryFlushingOutgoingQueue() {
       }
 
       if (*bytes_sent < m.data.size()) {
-        // Still at least partially blocked.
+        // Still at least partially blocked. Retain only the unsent remainder of
+        // the message. As in Send(), any sent data implies that all
+        // descriptors were also sent.
         absl::MutexLock lock(&queue_mutex_);
-        outgoing_queue_[i] = DeferredMessage({}, m);
+        outgoing_queue_[i] = DeferredMessage(
+            {}, Message{
+                    .data = m.data.subspan(*bytes_sent),
+                    .descriptors = *bytes_sent ? absl::Span<FileDescriptor>()
+                                               : m.descriptors,
+                });
         break;
       }
     }
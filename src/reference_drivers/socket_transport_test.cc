@@ -4,6 +4,9 @@
 
 #include "reference_drivers/socket_transport.h"
 
+#include <sys/socket.h>
+
+#include <cstdint>
 #include <string_view>
 #include <tuple>
 #include <vector>
@@ -196,5 +199,45 @@ TEST_F(SocketTransportTest, ReadWriteWithFileDescriptor) {
   DeactivateSync(*b);
 }
 
+TEST_F(SocketTransportTest, PartialSend) {
+  // Messages much larger than the socket's send buffer can only be sent a piece
+  // at a time. Every message must still arrive intact and exactly once.
+  auto [a, b] = SocketTransport::CreatePair();
+  FileDescriptor fd = a->TakeDescriptor();
+  const int kBufferSize = 4096;
+  ASSERT_EQ(0, setsockopt(fd.get(), SOL_SOCKET, SO_SNDBUF, &kBufferSize,
+                          sizeof(kBufferSize)));
+  a = MakeRefCounted<SocketTransport>(std::move(fd));
+
+  constexpr size_t kNumMessages = 3;
+  constexpr size_t kMessageSize = 1024 * 1024;
+  std::vector<std::vector<uint8_t>> messages(kNumMessages);
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    messages[i].resize(kMessageSize);
+    for (size_t j = 0; j < kMessageSize; ++j) {
+      messages[i][j] = static_cast<uint8_t>(i * 7 + j * 13);
+    }
+  }
+
+  size_t num_received = 0;
+  absl::Notification b_finished;
+  a->Activate();
+  b->Activate([&](SocketTransport::Message message) {
+    EXPECT_TRUE(message.data == absl::MakeSpan(messages[num_received]));
+    if (++num_received == kNumMessages) {
+      b_finished.Notify();
+    }
+    return true;
+  });
+
+  for (const auto& message : messages) {
+    a->Send({.data = absl::MakeSpan(message)});
+  }
+
+  b_finished.WaitForNotification();
+  DeactivateSync(*b);
+  DeactivateSync(*a);
+}
+
 }  // namespace
 }  // namespace ipcz::reference_drivers
@@ -2,9 +2,13 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <cstring>
+#include <iterator>
+#include <limits>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include "build/build_config.h"
 #include "ipcz/ipcz.h"
@@ -66,6 +70,212 @@ MULTINODE_TEST(RemotePortalTest, PortalTransfer) {
   CloseAll({q, c});
 }
 
+// Parcels large enough to require allocation from large buffers rather than
+// block buffers when link memory supports it.
+constexpr size_t kLargeParcelSizes[] = {2 * 1024 * 1024, 4 * 1024 * 1024,
+                                        3 * 1024 * 1024, 4 * 1024 * 1024};
+
+std::string MakeLargeParcelData(size_t size, char seed) {
+  std::string data(size, 0);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>(seed + i % 251);
+  }
+  return data;
+}
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, LargeParcelsClient) {
+  IpczHandle b = ConnectToBroker();
+
+  char seed = 0;
+  for (size_t size : kLargeParcelSizes) {
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message));
+    EXPECT_TRUE(message == MakeLargeParcelData(size, seed++));
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(b, message));
+  }
+
+  // Wait for the broker to receive everything before we exit, since the last
+  // reply may still be queued for transmission.
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(RemotePortalTest, LargeParcels) {
+  IpczHandle c = SpawnTestNode<LargeParcelsClient>();
+
+  char seed = 0;
+  for (size_t size : kLargeParcelSizes) {
+    const std::string data = MakeLargeParcelData(size, seed++);
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(c, data));
+
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c, &message));
+    EXPECT_TRUE(message == data);
+  }
+
+  Close(c);
+}
+
+constexpr size_t kFlowControlNumParcels = 200;
+constexpr size_t kFlowControlMaxQueuedParcels = 4;
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, FlowControlClient) {
+  IpczHandle b = ConnectToBroker();
+  for (size_t i = 0; i < kFlowControlNumParcels; ++i) {
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message));
+    EXPECT_EQ(std::to_string(i), message);
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, kTestMessage1));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(RemotePortalTest, FlowControl) {
+  IpczHandle c = SpawnTestNode<FlowControlClient>();
+
+  // Never let more than a few parcels queue up on the other side, waiting for
+  // it to catch up whenever necessary.
+  const IpczPutLimits limits = {
+      .size = sizeof(limits),
+      .max_queued_parcels = kFlowControlMaxQueuedParcels,
+      .max_queued_bytes = std::numeric_limits<size_t>::max(),
+  };
+  const IpczPutOptions options = {.size = sizeof(options), .limits = &limits};
+  const IpczTrapConditions below_limit = {
+      .size = sizeof(below_limit),
+      .flags = IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS,
+      .max_remote_parcels = kFlowControlMaxQueuedParcels,
+  };
+  for (size_t i = 0; i < kFlowControlNumParcels;) {
+    const std::string message = std::to_string(i);
+    const IpczResult result =
+        ipcz().Put(c, message.data(), message.size(), nullptr, 0,
+                   IPCZ_NO_FLAGS, &options);
+    if (result == IPCZ_RESULT_RESOURCE_EXHAUSTED) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditions(c, below_limit));
+      continue;
+    }
+    ASSERT_EQ(IPCZ_RESULT_OK, result);
+    ++i;
+  }
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(c, &message));
+  EXPECT_EQ(kTestMessage1, message);
+
+  // Everything has been consumed by now.
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryPortalStatus(c, IPCZ_NO_FLAGS, nullptr, &status));
+  EXPECT_EQ(0u, status.num_remote_parcels);
+  EXPECT_EQ(0u, status.num_remote_bytes);
+  Close(c);
+}
+
+constexpr size_t kPutManyNumParcels = 100;
+constexpr size_t kPutManyPortalIndex = 50;
+
+// Returns distinct contents of varying size for each parcel in a batch.
+std::string GetPutManyMessage(size_t i) {
+  return std::string((i * 37) % 1024, static_cast<char>('a' + i % 26));
+}
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, PutManyClient) {
+  IpczHandle b = ConnectToBroker();
+  WaitForPingAndReply(b);
+
+  IpczHandle p = IPCZ_INVALID_HANDLE;
+  for (size_t i = 0; i < kPutManyNumParcels; ++i) {
+    std::string message;
+    if (i == kPutManyPortalIndex) {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message, {&p, 1}));
+    } else {
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, &message));
+    }
+    EXPECT_EQ(GetPutManyMessage(i), message);
+  }
+
+  EXPECT_EQ(kTestMessage1, WaitToGetString(p));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, kTestMessage2));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  CloseAll({p, b});
+}
+
+MULTINODE_TEST(RemotePortalTest, PutMany) {
+  IpczHandle c = SpawnTestNode<PutManyClient>();
+
+  // Ensure the route is fully established so that the batch is transmitted
+  // directly rather than queued.
+  PingPong(c);
+
+  auto [q, p] = OpenPortals();
+  std::vector<std::string> messages(kPutManyNumParcels);
+  std::vector<IpczPutParcel> parcels(kPutManyNumParcels);
+  for (size_t i = 0; i < kPutManyNumParcels; ++i) {
+    messages[i] = GetPutManyMessage(i);
+    parcels[i] = {
+        .size = sizeof(IpczPutParcel),
+        .data = messages[i].data(),
+        .num_bytes = messages[i].size(),
+    };
+  }
+  parcels[kPutManyPortalIndex].handles = &p;
+  parcels[kPutManyPortalIndex].num_handles = 1;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutMany(c, parcels.data(), parcels.size(), IPCZ_NO_FLAGS,
+                           nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(q, kTestMessage1));
+
+  EXPECT_EQ(kTestMessage2, WaitToGetString(c));
+  CloseAll({q, c});
+}
+
+constexpr std::string_view kPutSegmentsHeader = "header:";
+constexpr size_t kPutSegmentsPayloadSize = 4096;
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, PutSegmentsClient) {
+  IpczHandle b = ConnectToBroker();
+  std::string expected_message(kPutSegmentsHeader);
+  expected_message.append(kPutSegmentsPayloadSize, '!');
+  expected_message.append(kTestMessage1);
+  EXPECT_EQ(expected_message, WaitToGetString(b));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, kTestMessage2));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  Close(b);
+}
+
+MULTINODE_TEST(RemotePortalTest, PutSegments) {
+  IpczHandle c = SpawnTestNode<PutSegmentsClient>();
+
+  // The parcel is large enough to be placed in shared memory when possible,
+  // in which case each segment is copied directly into the fragment.
+  const std::string payload(kPutSegmentsPayloadSize, '!');
+  const IpczPutSegment segments[] = {
+      {
+          .size = sizeof(IpczPutSegment),
+          .data = kPutSegmentsHeader.data(),
+          .num_bytes = kPutSegmentsHeader.size(),
+      },
+      {
+          .size = sizeof(IpczPutSegment),
+          .data = payload.data(),
+          .num_bytes = payload.size(),
+      },
+      {
+          .size = sizeof(IpczPutSegment),
+          .data = kTestMessage1.data(),
+          .num_bytes = kTestMessage1.size(),
+      },
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutSegments(c, segments, std::size(segments), nullptr, 0,
+                               IPCZ_NO_FLAGS, nullptr));
+
+  EXPECT_EQ(kTestMessage2, WaitToGetString(c));
+  Close(c);
+}
+
 constexpr size_t kMultipleHopsNumIterations = 100;
 
 MULTINODE_TEST_NODE(RemotePortalTestNode, MultipleHopsClient1) {
@@ -123,6 +333,87 @@ MULTINODE_TEST(RemotePortalTest, MultipleHops) {
   CloseAll({c1, c2});
 }
 
+constexpr size_t kMigratedParcelDataSize = 256;
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, MigrateParcelDataClient1) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle p;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&p, 1}));
+  WaitForDirectRemoteLink(p);
+
+  // Forward `p` on to the other client.
+  IpczHandle x;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&x, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(x, "", {&p, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  CloseAll({x, b});
+}
+
+MULTINODE_TEST_NODE(RemotePortalTestNode, MigrateParcelDataClient2) {
+  IpczHandle b = ConnectToBroker();
+  IpczHandle y;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(b, nullptr, {&y, 1}));
+  IpczHandle p;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(y, nullptr, {&p, 1}));
+  WaitForDirectRemoteLink(p);
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(p, &message));
+  EXPECT_EQ(std::string(kMigratedParcelDataSize, '!'), message);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, "ok"));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(b, IPCZ_TRAP_PEER_CLOSED));
+  CloseAll({p, y, b});
+}
+
+MULTINODE_TEST(RemotePortalTest, MigrateParcelData) {
+  IpczHandle c1 = SpawnTestNode<MigrateParcelDataClient1>();
+  IpczHandle c2 = SpawnTestNode<MigrateParcelDataClient2>();
+
+  // Route `q` directly to `p` on the first client, and begin a put which
+  // allocates its data from our link to that client.
+  auto [q, p] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c1, "", {&p, 1}));
+  WaitForDirectRemoteLink(q);
+
+  volatile void* data;
+  size_t num_bytes = kMigratedParcelDataSize;
+  IpczTransaction transaction;
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().BeginPut(q, IPCZ_NO_FLAGS, nullptr, &data,
+                                            &num_bytes, &transaction));
+  ASSERT_EQ(kMigratedParcelDataSize, num_bytes);
+  memset(const_cast<void*>(data), '!', num_bytes);
+
+  // Have the first client forward `p` to the second, and wait for `q` to
+  // bypass the first client entirely.
+  auto [x, y] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c1, "", {&x, 1}));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c2, "", {&y, 1}));
+  WaitForDirectRemoteLink(q);
+
+  // The parcel goes out over our link to the second client, so its data must
+  // be moved there from our link to the first client.
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().EndPut(q, transaction, num_bytes, nullptr,
+                                          0, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ("ok", WaitToGetString(c2));
+
+  IpczNodeLinkMemoryStats stats[2];
+  for (IpczNodeLinkMemoryStats& link_stats : stats) {
+    link_stats.size = sizeof(link_stats);
+  }
+  size_t num_links = std::size(stats);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().QueryNodeMemoryStats(node(), IPCZ_NO_FLAGS, nullptr, stats,
+                                        &num_links));
+  size_t num_parcels_with_migrated_fragment_data = 0;
+  for (size_t i = 0; i < num_links; ++i) {
+    num_parcels_with_migrated_fragment_data +=
+        stats[i].num_parcels_with_migrated_fragment_data;
+  }
+  EXPECT_GE(num_parcels_with_migrated_fragment_data, 1u);
+
+  CloseAll({q, c1, c2});
+}
+
 constexpr size_t kTransferBackAndForthNumIterations = 100;
 
 MULTINODE_TEST_NODE(RemotePortalTestNode, TransferBackAndForthClient) {
@@ -4,6 +4,7 @@
 
 #include "test/multinode_test.h"
 
+#include <algorithm>
 #include <cstring>
 #include <map>
 #include <optional>
@@ -50,6 +51,10 @@ const TestFeatureSetMap& GetTestFeatureSets() {
   static const std::pair<std::string_view, FeatureList> feature_lists[] = {
       {"Default", {}},
       {"MemV2", {IPCZ_FEATURE_MEM_V2}},
+      {"Latest",
+       {IPCZ_FEATURE_MEM_V2, IPCZ_FEATURE_MESSAGE_RINGS,
+        IPCZ_FEATURE_REMOTE_QUEUE_STATE, IPCZ_FEATURE_BATCHED_PARCELS,
+        IPCZ_FEATURE_EMBEDDED_SUBPARCELS}},
   };
   static const TestFeatureSetMap map{std::begin(feature_lists),
                                      std::end(feature_lists)};
@@ -345,6 +350,14 @@ const IpczDriver& TestNode::GetDriver() const {
   return test_driver_->GetIpczDriver();
 }
 
+bool TestNode::IsFeatureEnabled(IpczFeature feature) const {
+  const auto& feature_sets = GetTestFeatureSets();
+  auto it = feature_sets.find(feature_set_);
+  return it != feature_sets.end() &&
+         std::find(it->second.begin(), it->second.end(), feature) !=
+             it->second.end();
+}
+
 void TestNode::Initialize(TestDriver* test_driver,
                           const std::string& feature_set) {
   test_driver_ = test_driver;
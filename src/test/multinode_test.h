@@ -135,6 +135,10 @@ class TestNode : public internal::TestBase {
   // The ipcz driver currently in use, as specified by the active TestDriver.
   const IpczDriver& GetDriver() const;
 
+  // Indicates whether `feature` is enabled on this node by the active test
+  // feature set. Every node in a test uses the same feature set.
+  bool IsFeatureEnabled(IpczFeature feature) const;
+
   // One-time initialization. Called internally during test setup. Should never
   // be called by individual test code.
   void Initialize(TestDriver* test_driver, const std::string& feature_set);
@@ -0,0 +1,264 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "reference_drivers/async_reference_driver.h"
+#include "test/test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+
+namespace ipcz {
+namespace {
+
+// Counts every transmission through the async reference driver. With a real
+// driver, each transmission costs the sender at least one system call and
+// typically wakes a receiving thread.
+std::atomic<size_t> g_num_transmissions{0};
+
+IpczResult IPCZ_API CountingTransmit(IpczDriverHandle transport,
+                                     const void* data,
+                                     size_t num_bytes,
+                                     const IpczDriverHandle* handles,
+                                     size_t num_handles,
+                                     uint32_t flags,
+                                     const void* options) {
+  g_num_transmissions.fetch_add(1, std::memory_order_relaxed);
+  return reference_drivers::kAsyncReferenceDriver.Transmit(
+      transport, data, num_bytes, handles, num_handles, flags, options);
+}
+
+// The async reference driver is itself dynamically initialized, so this can't
+// be a global constant.
+const IpczDriver& GetCountingDriver() {
+  static const IpczDriver driver = [] {
+    IpczDriver driver = reference_drivers::kAsyncReferenceDriver;
+    driver.Transmit = CountingTransmit;
+    return driver;
+  }();
+  return driver;
+}
+
+class TransportWakeupTest : public test::Test {
+ protected:
+  struct Connection {
+    IpczHandle broker;
+    IpczHandle non_broker;
+    IpczHandle sender;
+    IpczHandle receiver;
+  };
+
+  // Connects a new broker and non-broker with the given features enabled.
+  // Parcels put into the returned `sender` portal on the broker arrive at the
+  // `receiver` portal on the non-broker. The connection is fully established
+  // by the time this returns.
+  Connection Connect(absl::Span<const IpczFeature> features) {
+    const IpczCreateNodeOptions options = {
+        .size = sizeof(options),
+        .enabled_features = features.data(),
+        .num_enabled_features = features.size(),
+    };
+    Connection connection;
+    const IpczDriver& driver = GetCountingDriver();
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().CreateNode(&driver, IPCZ_CREATE_NODE_AS_BROKER, &options,
+                                &connection.broker));
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().CreateNode(&driver, IPCZ_NO_FLAGS, &options,
+                                &connection.non_broker));
+
+    const reference_drivers::AsyncTransportPair transports =
+        reference_drivers::CreateAsyncTransportPair();
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().ConnectNode(connection.broker, transports.broker, 1,
+                                 IPCZ_NO_FLAGS, nullptr, &connection.sender));
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().ConnectNode(connection.non_broker, transports.non_broker,
+                                 1, IPCZ_CONNECT_NODE_TO_BROKER, nullptr,
+                                 &connection.receiver));
+
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(connection.sender, {}));
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(connection.receiver));
+    return connection;
+  }
+
+  void CloseConnection(const Connection& connection) {
+    CloseAll({connection.sender, connection.receiver, connection.non_broker,
+              connection.broker});
+  }
+
+  // Connects a new broker and non-broker with the given features enabled,
+  // then floods parcels from the broker while the non-broker drains them in a
+  // busy receive loop. Returns the average number of driver transmissions per
+  // parcel.
+  double MeasureTransmissionsPerParcel(
+      absl::Span<const IpczFeature> features) {
+    const Connection connection = Connect(features);
+    const IpczHandle sender = connection.sender;
+    const IpczHandle receiver = connection.receiver;
+
+    constexpr size_t kNumParcels = 20000;
+    const std::string kParcel(64, '!');
+    const size_t num_transmissions_before =
+        g_num_transmissions.load(std::memory_order_relaxed);
+    std::thread sender_thread([&] {
+      for (size_t i = 0; i < kNumParcels; ++i) {
+        EXPECT_EQ(IPCZ_RESULT_OK, Put(sender, kParcel));
+      }
+    });
+
+    size_t num_received = 0;
+    while (num_received < kNumParcels) {
+      std::string parcel;
+      const IpczResult result = Get(receiver, &parcel);
+      if (result == IPCZ_RESULT_UNAVAILABLE) {
+        continue;
+      }
+      EXPECT_EQ(IPCZ_RESULT_OK, result);
+      EXPECT_EQ(kParcel, parcel);
+      ++num_received;
+    }
+    sender_thread.join();
+
+    const size_t num_transmissions =
+        g_num_transmissions.load(std::memory_order_relaxed) -
+        num_transmissions_before;
+    CloseConnection(connection);
+    return static_cast<double>(num_transmissions) / kNumParcels;
+  }
+
+  // Receives `num_parcels` parcels of `expected_contents` from `receiver`.
+  void ReceiveParcels(IpczHandle receiver,
+                      size_t num_parcels,
+                      const std::string& expected_contents) {
+    for (size_t i = 0; i < num_parcels; ++i) {
+      std::string parcel;
+      EXPECT_EQ(IPCZ_RESULT_OK, WaitToGet(receiver, &parcel));
+      EXPECT_EQ(expected_contents, parcel);
+    }
+  }
+};
+
+TEST_F(TransportWakeupTest, TransmissionsPerParcel) {
+  // Without message rings, every parcel needs its own driver transmission.
+  const IpczFeature kBaseline[] = {IPCZ_FEATURE_MEM_V2};
+  const double baseline = MeasureTransmissionsPerParcel(kBaseline);
+  RecordProperty("baseline_transmissions_per_parcel", std::to_string(baseline));
+  EXPECT_GE(baseline, 1.0);
+
+  // With message rings, the sender only transmits to wake an idle receiver,
+  // and any parcels sent while the receiver is actively draining the ring cost
+  // nothing extra. How often the receiver goes idle depends on scheduling, so
+  // the exact ratio is reported rather than enforced.
+  const IpczFeature kMessageRings[] = {IPCZ_FEATURE_MEM_V2,
+                                       IPCZ_FEATURE_MESSAGE_RINGS};
+  const double with_rings = MeasureTransmissionsPerParcel(kMessageRings);
+  RecordProperty("message_ring_transmissions_per_parcel",
+                 std::to_string(with_rings));
+  EXPECT_LE(with_rings, baseline);
+}
+
+TEST_F(TransportWakeupTest, PutManyTransmissions) {
+  // Compares the cost of putting many small parcels one at a time against
+  // putting them all with a single PutMany(). Message rings are left disabled
+  // so that every message costs a driver transmission.
+  const IpczFeature kFeatures[] = {IPCZ_FEATURE_MEM_V2,
+                                   IPCZ_FEATURE_BATCHED_PARCELS};
+  const Connection connection = Connect(kFeatures);
+
+  constexpr size_t kNumParcels = 1000;
+  const std::string kParcel(16, '!');
+  const std::vector<IpczPutParcel> parcels(
+      kNumParcels, {
+                       .size = sizeof(IpczPutParcel),
+                       .data = kParcel.data(),
+                       .num_bytes = kParcel.size(),
+                   });
+
+  size_t num_transmissions_before =
+      g_num_transmissions.load(std::memory_order_relaxed);
+  auto start_time = std::chrono::steady_clock::now();
+  for (const IpczPutParcel& parcel : parcels) {
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().Put(connection.sender, parcel.data, parcel.num_bytes,
+                         nullptr, 0, IPCZ_NO_FLAGS, nullptr));
+  }
+  const auto put_duration = std::chrono::steady_clock::now() - start_time;
+  const size_t put_transmissions =
+      g_num_transmissions.load(std::memory_order_relaxed) -
+      num_transmissions_before;
+  ReceiveParcels(connection.receiver, kNumParcels, kParcel);
+
+  num_transmissions_before =
+      g_num_transmissions.load(std::memory_order_relaxed);
+  start_time = std::chrono::steady_clock::now();
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutMany(connection.sender, parcels.data(), parcels.size(),
+                           IPCZ_NO_FLAGS, nullptr));
+  const auto put_many_duration = std::chrono::steady_clock::now() - start_time;
+  const size_t put_many_transmissions =
+      g_num_transmissions.load(std::memory_order_relaxed) -
+      num_transmissions_before;
+  ReceiveParcels(connection.receiver, kNumParcels, kParcel);
+
+  RecordProperty("put_transmissions", std::to_string(put_transmissions));
+  RecordProperty("put_many_transmissions",
+                 std::to_string(put_many_transmissions));
+  using std::chrono::microseconds;
+  RecordProperty(
+      "put_microseconds",
+      std::to_string(
+          std::chrono::duration_cast<microseconds>(put_duration).count()));
+  RecordProperty(
+      "put_many_microseconds",
+      std::to_string(
+          std::chrono::duration_cast<microseconds>(put_many_duration).count()));
+
+  // Each Put() needs its own transmission, while the whole PutMany() batch
+  // shares one. Memory management may add a few more transmissions to either,
+  // so timings are only reported.
+  EXPECT_GE(put_transmissions, kNumParcels);
+  EXPECT_LT(put_many_transmissions, kNumParcels / 10);
+
+  CloseConnection(connection);
+}
+
+TEST_F(TransportWakeupTest, PutManyWithoutBatchedParcels) {
+  // Without IPCZ_FEATURE_BATCHED_PARCELS, PutMany() still works but each parcel
+  // is transmitted individually.
+  const IpczFeature kFeatures[] = {IPCZ_FEATURE_MEM_V2};
+  const Connection connection = Connect(kFeatures);
+
+  constexpr size_t kNumParcels = 100;
+  const std::string kParcel(16, '!');
+  const std::vector<IpczPutParcel> parcels(
+      kNumParcels, {
+                       .size = sizeof(IpczPutParcel),
+                       .data = kParcel.data(),
+                       .num_bytes = kParcel.size(),
+                   });
+
+  const size_t num_transmissions_before =
+      g_num_transmissions.load(std::memory_order_relaxed);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().PutMany(connection.sender, parcels.data(), parcels.size(),
+                           IPCZ_NO_FLAGS, nullptr));
+  const size_t put_many_transmissions =
+      g_num_transmissions.load(std::memory_order_relaxed) -
+      num_transmissions_before;
+  ReceiveParcels(connection.receiver, kNumParcels, kParcel);
+  EXPECT_GE(put_many_transmissions, kNumParcels);
+
+  CloseConnection(connection);
+}
+
+}  // namespace
+}  // namespace ipcz
@@ -2,14 +2,19 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string>
 #include <tuple>
+#include <vector>
 #include <utility>
 
 #include "ipcz/ipcz.h"
 #include "reference_drivers/sync_reference_driver.h"
+#include "test/multinode_test.h"
 #include "test/test.h"
 #include "testing/gtest/include/gtest/gtest.h"
 #include "third_party/abseil-cpp/absl/memory/memory.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/synchronization/notification.h"
 
 namespace ipcz {
 namespace {
@@ -26,6 +31,19 @@ class TrapTest : public test::Test {
   const IpczHandle node_{CreateNode(reference_drivers::kSyncReferenceDriver)};
 };
 
+// Records events from a trap installed directly through the ipcz Trap() API,
+// since TestBase::Trap() only supports one-shot traps.
+struct TrapEventLog {
+  static void IPCZ_API Handler(const IpczTrapEvent* event) {
+    auto& log = *reinterpret_cast<TrapEventLog*>(event->context);
+    log.last_flags = event->condition_flags;
+    ++log.num_events;
+  }
+
+  IpczTrapConditionFlags last_flags = IPCZ_NO_FLAGS;
+  size_t num_events = 0;
+};
+
 TEST_F(TrapTest, RemoveOnClose) {
   auto [a, b] = OpenPortals();
 
@@ -184,6 +202,92 @@ TEST_F(TrapTest, MinLocalBytes) {
   CloseAll({a, b});
 }
 
+TEST_F(TrapTest, MaxRemoteParcels) {
+  auto [a, b] = OpenPortals();
+
+  IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS,
+      .max_remote_parcels = 2,
+  };
+
+  // Nothing has been put into `a` yet, so the condition is already met.
+  IpczTrapConditionFlags flags = IPCZ_NO_FLAGS;
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_FAILED_PRECONDITION,
+            Trap(
+                a, conditions, [&](const IpczTrapEvent&) {}, &flags, &status));
+  EXPECT_EQ(IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS, flags);
+  EXPECT_EQ(0u, status.num_remote_parcels);
+
+  Put(a, "x");
+  Put(a, "y");
+  bool received_event = false;
+  EXPECT_EQ(IPCZ_RESULT_OK, Trap(a, conditions, [&](const IpczTrapEvent& e) {
+              EXPECT_EQ(IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS |
+                            IPCZ_TRAP_WITHIN_API_CALL,
+                        e.condition_flags);
+              EXPECT_EQ(1u, e.status->num_remote_parcels);
+              received_event = true;
+            }));
+
+  // Putting more parcels doesn't satisfy the condition, but retrieving them
+  // from the other side eventually does.
+  Put(a, "z");
+  EXPECT_FALSE(received_event);
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_FALSE(received_event);
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_TRUE(received_event);
+
+  CloseAll({a, b});
+}
+
+TEST_F(TrapTest, MaxRemoteBytes) {
+  auto [a, b] = OpenPortals();
+
+  IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES,
+      .max_remote_bytes = 4,
+  };
+
+  Put(a, "hello");
+  bool received_event = false;
+  EXPECT_EQ(IPCZ_RESULT_OK, Trap(a, conditions, [&](const IpczTrapEvent& e) {
+              EXPECT_EQ(
+                  IPCZ_TRAP_BELOW_MAX_REMOTE_BYTES | IPCZ_TRAP_WITHIN_API_CALL,
+                  e.condition_flags);
+              EXPECT_EQ(0u, e.status->num_remote_bytes);
+              received_event = true;
+            }));
+
+  EXPECT_FALSE(received_event);
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_TRUE(received_event);
+
+  // Two-phase retrieval also counts as consumption.
+  Put(a, "goodbye");
+  received_event = false;
+  EXPECT_EQ(IPCZ_RESULT_OK, Trap(a, conditions, [&](const IpczTrapEvent&) {
+              received_event = true;
+            }));
+  const volatile void* data;
+  size_t num_bytes;
+  IpczTransaction transaction;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().BeginGet(b, IPCZ_NO_FLAGS, nullptr, &data, &num_bytes,
+                            nullptr, nullptr, &transaction));
+  EXPECT_FALSE(received_event);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EndGet(b, transaction, IPCZ_NO_FLAGS, nullptr, nullptr));
+  EXPECT_TRUE(received_event);
+
+  CloseAll({a, b});
+}
+
 TEST_F(TrapTest, NewLocalParcel) {
   auto [a, b] = OpenPortals();
 
@@ -306,5 +410,208 @@ TEST_F(TrapTest, MultipleTraps) {
   Close(b);
 }
 
+TEST_F(TrapTest, PersistentNewLocalParcel) {
+  auto [a, b] = OpenPortals();
+
+  TrapEventLog log;
+  const uintptr_t context = reinterpret_cast<uintptr_t>(&log);
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Trap(b, &conditions, &TrapEventLog::Handler, context,
+                        IPCZ_TRAP_PERSISTENT, nullptr, nullptr, nullptr));
+
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "1"));
+  EXPECT_EQ(1u, log.num_events);
+  EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL | IPCZ_TRAP_WITHIN_API_CALL,
+            log.last_flags);
+
+  // The trap stays disabled until it's re-enabled, but it remembers that a new
+  // parcel arrived in the meantime and fires again as soon as it's enabled.
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "2"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "3"));
+  EXPECT_EQ(1u, log.num_events);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EnableTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(2u, log.num_events);
+  EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL | IPCZ_TRAP_WITHIN_API_CALL,
+            log.last_flags);
+
+  // With nothing new, enabling the trap arms it for the next parcel.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EnableTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(2u, log.num_events);
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EnableTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "4"));
+  EXPECT_EQ(3u, log.num_events);
+
+  // Like any other trap, a persistent trap is removed when its portal is
+  // closed.
+  Close(b);
+  EXPECT_EQ(4u, log.num_events);
+  EXPECT_EQ(IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL, log.last_flags);
+  Close(a);
+}
+
+TEST_F(TrapTest, PersistentLevelTriggered) {
+  auto [a, b] = OpenPortals();
+
+  TrapEventLog log;
+  const uintptr_t context = reinterpret_cast<uintptr_t>(&log);
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+      .min_local_parcels = 0,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Trap(b, &conditions, &TrapEventLog::Handler, context,
+                        IPCZ_TRAP_PERSISTENT, nullptr, nullptr, nullptr));
+
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  EXPECT_EQ(1u, log.num_events);
+
+  // Level-triggered conditions are re-evaluated when the trap is enabled.
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EnableTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(2u, log.num_events);
+  EXPECT_EQ(IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS | IPCZ_TRAP_WITHIN_API_CALL,
+            log.last_flags);
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().EnableTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(2u, log.num_events);
+
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  EXPECT_EQ(3u, log.num_events);
+
+  CloseAll({a, b});
+}
+
+TEST_F(TrapTest, RemovePersistentTrap) {
+  auto [a, b] = OpenPortals();
+
+  TrapEventLog log;
+  const uintptr_t context = reinterpret_cast<uintptr_t>(&log);
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().Trap(b, &conditions, &TrapEventLog::Handler, context,
+                        IPCZ_TRAP_PERSISTENT, nullptr, nullptr, nullptr));
+
+  // Persistent traps must have unique contexts.
+  EXPECT_EQ(IPCZ_RESULT_ALREADY_EXISTS,
+            ipcz().Trap(b, &conditions, &TrapEventLog::Handler, context,
+                        IPCZ_TRAP_PERSISTENT, nullptr, nullptr, nullptr));
+
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            ipcz().RemoveTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(1u, log.num_events);
+  EXPECT_EQ(IPCZ_TRAP_REMOVED | IPCZ_TRAP_WITHIN_API_CALL, log.last_flags);
+
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().RemoveTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND,
+            ipcz().EnableTrap(b, context, IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  EXPECT_EQ(1u, log.num_events);
+
+  CloseAll({a, b});
+}
+
+using TrapTestNode = test::TestNode;
+using TrapMultinodeTest = test::MultinodeTest<TrapTestNode>;
+
+constexpr size_t kBurstSize = 8;
+
+// A typical consumer, which reinstalls its one-shot trap after each event.
+struct BurstConsumer {
+  static void IPCZ_API Handler(const IpczTrapEvent* event) {
+    if (event->condition_flags & IPCZ_TRAP_REMOVED) {
+      return;
+    }
+
+    auto& consumer = *reinterpret_cast<BurstConsumer*>(event->context);
+    {
+      absl::MutexLock lock(&consumer.mutex);
+      ++consumer.num_events;
+    }
+    consumer.InstallTrap();
+    if (event->status->num_local_parcels == kBurstSize) {
+      consumer.received_burst.Notify();
+    }
+  }
+
+  void InstallTrap() {
+    const IpczTrapConditions conditions = {
+        .size = sizeof(conditions),
+        .flags = IPCZ_TRAP_NEW_LOCAL_PARCEL,
+    };
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              api->Trap(portal, &conditions, &Handler,
+                        reinterpret_cast<uintptr_t>(this), IPCZ_NO_FLAGS,
+                        nullptr, nullptr, nullptr));
+  }
+
+  const IpczAPI* api;
+  IpczHandle portal;
+  absl::Mutex mutex;
+  size_t num_events ABSL_GUARDED_BY(mutex) = 0;
+  absl::Notification received_burst;
+};
+
+MULTINODE_TEST_NODE(TrapTestNode, CoalesceBurstClient) {
+  IpczHandle b = ConnectToBroker();
+  WaitForPingAndReply(b);
+
+  BurstConsumer consumer{.api = &ipcz(), .portal = b};
+  consumer.InstallTrap();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, "ready"));
+
+  // With batched parcels, the whole burst arrives in one transport
+  // notification, so the trap fires only once and sees every parcel, even
+  // though it's reinstalled each time. Otherwise each parcel arrives in its own
+  // message and may fire the trap separately.
+  consumer.received_burst.WaitForNotification();
+  {
+    absl::MutexLock lock(&consumer.mutex);
+    if (IsFeatureEnabled(IPCZ_FEATURE_BATCHED_PARCELS)) {
+      EXPECT_EQ(1u, consumer.num_events);
+    } else {
+      EXPECT_GE(kBurstSize, consumer.num_events);
+    }
+  }
+
+  for (size_t i = 0; i < kBurstSize; ++i) {
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  }
+  Close(b);
+}
+
+MULTINODE_TEST(TrapMultinodeTest, CoalesceBurst) {
+  IpczHandle c = SpawnTestNode<CoalesceBurstClient>();
+  PingPong(c);
+  EXPECT_EQ("ready", WaitToGetString(c));
+
+  const std::string message = "!";
+  std::vector<IpczPutParcel> parcels(kBurstSize,
+                                     {
+                                         .size = sizeof(IpczPutParcel),
+                                         .data = message.data(),
+                                         .num_bytes = message.size(),
+                                     });
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().PutMany(c, parcels.data(), parcels.size(),
+                                           IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForConditionFlags(c, IPCZ_TRAP_PEER_CLOSED));
+  Close(c);
+}
+
 }  // namespace
 }  // namespace ipcz
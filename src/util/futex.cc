@@ -0,0 +1,118 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/futex.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include "build/build_config.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+
+#if BUILDFLAG(IS_LINUX) || BUILDFLAG(IS_CHROMEOS) || BUILDFLAG(IS_ANDROID)
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#define IPCZ_HAS_OS_FUTEX 1
+#else
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#endif
+
+namespace ipcz {
+
+namespace {
+
+#if defined(IPCZ_HAS_OS_FUTEX)
+
+bool WaitOnAddress(std::atomic<uint32_t>& word,
+                   uint32_t expected_value,
+                   absl::Time deadline) {
+  timespec timeout;
+  timespec* timeout_ptr = nullptr;
+  if (deadline != absl::InfiniteFuture()) {
+    const absl::Duration remaining = deadline - absl::Now();
+    if (remaining <= absl::ZeroDuration()) {
+      return false;
+    }
+    timeout = absl::ToTimespec(remaining);
+    timeout_ptr = &timeout;
+  }
+
+  const long result =
+      syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+              FUTEX_WAIT_PRIVATE, expected_value, timeout_ptr, nullptr, 0);
+  return result == 0 || errno != ETIMEDOUT;
+}
+
+void WakeAllOnAddress(std::atomic<uint32_t>& word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+          INT32_MAX, nullptr, nullptr, 0);
+}
+
+#else
+
+// Without an OS futex, blocked threads wait on one of a fixed set of condition
+// variables selected by the address of the word they're waiting on.
+struct WaitBucket {
+  absl::Mutex mutex;
+  absl::CondVar condition;
+};
+
+WaitBucket& GetWaitBucket(const std::atomic<uint32_t>& word) {
+  constexpr size_t kNumBuckets = 64;
+  static WaitBucket* buckets = new WaitBucket[kNumBuckets];
+  return buckets[(reinterpret_cast<uintptr_t>(&word) / sizeof(word)) %
+                 kNumBuckets];
+}
+
+bool WaitOnAddress(std::atomic<uint32_t>& word,
+                   uint32_t expected_value,
+                   absl::Time deadline) {
+  WaitBucket& bucket = GetWaitBucket(word);
+  absl::MutexLock lock(&bucket.mutex);
+  while (word.load(std::memory_order_acquire) == expected_value) {
+    if (bucket.condition.WaitWithDeadline(&bucket.mutex, deadline)) {
+      return word.load(std::memory_order_acquire) != expected_value;
+    }
+  }
+  return true;
+}
+
+void WakeAllOnAddress(std::atomic<uint32_t>& word) {
+  WaitBucket& bucket = GetWaitBucket(word);
+  absl::MutexLock lock(&bucket.mutex);
+  bucket.condition.SignalAll();
+}
+
+#endif
+
+}  // namespace
+
+Futex::Futex() = default;
+
+Futex::~Futex() = default;
+
+void Futex::IncrementAndWakeAll() {
+  // Sequentially consistent ordering between this increment and the load below
+  // pairs with the opposite ordering in Wait(), so that either we see a blocked
+  // thread or that thread sees the new value before it blocks.
+  value_.fetch_add(1, std::memory_order_seq_cst);
+  if (num_blocked_threads_.load(std::memory_order_seq_cst) > 0) {
+    WakeAllOnAddress(value_);
+  }
+}
+
+bool Futex::Wait(uint32_t expected_value, absl::Time deadline) {
+  num_blocked_threads_.fetch_add(1, std::memory_order_seq_cst);
+  bool woken = true;
+  if (value_.load(std::memory_order_seq_cst) == expected_value) {
+    woken = WaitOnAddress(value_, expected_value, deadline);
+  }
+  num_blocked_threads_.fetch_sub(1, std::memory_order_relaxed);
+  return woken;
+}
+
+}  // namespace ipcz
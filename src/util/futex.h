@@ -0,0 +1,48 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_UTIL_FUTEX_H_
+#define IPCZ_SRC_UTIL_FUTEX_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz {
+
+// Futex is a 32-bit counter which any number of threads can block on until it
+// changes. Where available this is backed by the OS futex facility, so waking
+// the counter is only a single atomic operation when no thread is blocked.
+// This class is thread-safe.
+class Futex {
+ public:
+  Futex();
+  Futex(const Futex&) = delete;
+  Futex& operator=(const Futex&) = delete;
+  ~Futex();
+
+  // Returns the current value of the counter.
+  uint32_t Load() const { return value_.load(std::memory_order_acquire); }
+
+  // Increments the counter and wakes every thread blocked in Wait().
+  void IncrementAndWakeAll();
+
+  // Blocks the calling thread for as long as the counter still equals
+  // `expected_value`, or until `deadline`. May return early for no reason, so
+  // callers must always re-check whatever they're waiting on. Returns false if
+  // and only if `deadline` passed.
+  bool Wait(uint32_t expected_value, absl::Time deadline);
+
+ private:
+  std::atomic<uint32_t> value_{0};
+
+  // The number of threads currently blocked in Wait(), which
+  // IncrementAndWakeAll() uses to avoid waking anyone unnecessarily.
+  std::atomic<uint32_t> num_blocked_threads_{0};
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_UTIL_FUTEX_H_
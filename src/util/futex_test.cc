@@ -0,0 +1,57 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/futex.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz {
+namespace {
+
+using FutexTest = testing::Test;
+
+TEST_F(FutexTest, IncrementWithoutWaiters) {
+  Futex futex;
+  EXPECT_EQ(0u, futex.Load());
+  futex.IncrementAndWakeAll();
+  futex.IncrementAndWakeAll();
+  EXPECT_EQ(2u, futex.Load());
+}
+
+TEST_F(FutexTest, WaitReturnsImmediatelyOnStaleValue) {
+  Futex futex;
+  futex.IncrementAndWakeAll();
+  EXPECT_TRUE(futex.Wait(0, absl::InfiniteFuture()));
+}
+
+TEST_F(FutexTest, WaitTimesOut) {
+  Futex futex;
+  EXPECT_FALSE(futex.Wait(0, absl::Now()));
+  EXPECT_FALSE(futex.Wait(0, absl::Now() + absl::Milliseconds(1)));
+}
+
+TEST_F(FutexTest, WakeAll) {
+  Futex futex;
+  std::vector<std::thread> waiters;
+  for (size_t i = 0; i < 4; ++i) {
+    waiters.emplace_back([&futex] {
+      while (futex.Load() == 0) {
+        futex.Wait(0, absl::InfiniteFuture());
+      }
+    });
+  }
+  futex.IncrementAndWakeAll();
+  for (std::thread& waiter : waiters) {
+    waiter.join();
+  }
+}
+
+}  // namespace
+}  // namespace ipcz
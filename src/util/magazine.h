@@ -0,0 +1,96 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_UTIL_MAGAZINE_H_
+#define IPCZ_SRC_UTIL_MAGAZINE_H_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+#include "third_party/abseil-cpp/absl/base/macros.h"
+#include "third_party/abseil-cpp/absl/synchronization/mutex.h"
+#include "third_party/abseil-cpp/absl/types/span.h"
+#include "util/thread_index.h"
+
+namespace ipcz {
+
+// A small cache of up to `kCapacity` items of type T, guarded by its own mutex.
+// Items are handed out in LIFO order, so the most recently cached (and likely
+// hottest) items are reused first. Each magazine is aligned to its own cache
+// line so that threads using different magazines don't contend.
+//
+// Every method requires `mutex` to be held.
+template <typename T, size_t kCapacity>
+struct alignas(64) Magazine {
+  bool empty() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) { return size == 0; }
+
+  // Adds `item` to the magazine, which must not be full.
+  void Push(const T& item) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+    ABSL_ASSERT(size < kCapacity);
+    items[size++] = item;
+  }
+
+  // Removes and returns the most recently cached item. The magazine must not
+  // be empty.
+  T Pop() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+    ABSL_ASSERT(size > 0);
+    return items[--size];
+  }
+
+  // Offers up to `count` free slots of an empty magazine to `fill`, which must
+  // populate a prefix of the span it's given and return the number of items
+  // populated. Returns that number.
+  template <typename Fill>
+  size_t Refill(size_t count, Fill fill) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+    ABSL_ASSERT(size == 0);
+    size = fill(absl::MakeSpan(items.data(), std::min(count, kCapacity)));
+    return size;
+  }
+
+  // Passes the `count` least recently cached items to `flush` and removes them
+  // from the magazine.
+  template <typename Flush>
+  void FlushOldest(size_t count, Flush flush)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+    ABSL_ASSERT(count <= size);
+    flush(absl::MakeConstSpan(items.data(), count));
+    std::move(items.begin() + count, items.begin() + size, items.begin());
+    size -= count;
+  }
+
+  // Passes every cached item to `flush` and empties the magazine.
+  template <typename Flush>
+  void FlushAll(Flush flush) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+    FlushOldest(size, flush);
+  }
+
+  absl::Mutex mutex;
+  size_t size ABSL_GUARDED_BY(mutex) = 0;
+  std::array<T, kCapacity> items ABSL_GUARDED_BY(mutex);
+};
+
+// A fixed set of Magazines shared by all threads. Threads are assigned
+// magazines round-robin in order of first use, so each thread's magazine lock
+// is uncontended until there are more threads than magazines.
+template <typename T, size_t kCapacity, size_t kNumMagazines>
+class MagazineSet {
+ public:
+  using MagazineType = Magazine<T, kCapacity>;
+
+  // Returns the magazine assigned to the calling thread.
+  MagazineType& ForCurrentThread() {
+    return magazines_[GetCurrentThreadIndex() % kNumMagazines];
+  }
+
+  auto begin() { return magazines_.begin(); }
+  auto end() { return magazines_.end(); }
+
+ private:
+  std::array<MagazineType, kNumMagazines> magazines_;
+};
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_UTIL_MAGAZINE_H_
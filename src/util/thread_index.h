@@ -0,0 +1,24 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IPCZ_SRC_UTIL_THREAD_INDEX_H_
+#define IPCZ_SRC_UTIL_THREAD_INDEX_H_
+
+#include <atomic>
+#include <cstddef>
+
+namespace ipcz {
+
+// Returns a small integer unique to the calling thread, assigned in order of
+// first use. Used to spread threads across a fixed set of per-thread caches.
+inline size_t GetCurrentThreadIndex() {
+  static std::atomic<size_t> next_index{0};
+  thread_local const size_t index =
+      next_index.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+}  // namespace ipcz
+
+#endif  // IPCZ_SRC_UTIL_THREAD_INDEX_H_
@@ -0,0 +1,240 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <iterator>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "ipcz/ipcz.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+namespace ipcz {
+namespace {
+
+class WaitSetTest : public test::Test {
+ public:
+  WaitSetTest() {
+    EXPECT_EQ(IPCZ_RESULT_OK,
+              ipcz().CreateWaitSet(IPCZ_NO_FLAGS, nullptr, &wait_set_));
+  }
+
+  ~WaitSetTest() override { CloseAll({wait_set_, node_}); }
+
+  IpczHandle wait_set() const { return wait_set_; }
+
+  std::pair<IpczHandle, IpczHandle> OpenPortals() {
+    return TestBase::OpenPortals(node_);
+  }
+
+  IpczResult Add(IpczHandle portal,
+                 IpczTrapConditionFlags flags,
+                 uintptr_t context) {
+    const IpczTrapConditions conditions = {
+        .size = sizeof(conditions),
+        .flags = flags,
+    };
+    return ipcz().AddToWaitSet(wait_set_, portal, &conditions, context,
+                               IPCZ_NO_FLAGS, nullptr);
+  }
+
+  IpczResult WaitForEvents(IpczWaitSetEvent* events,
+                           size_t& num_events,
+                           uint64_t timeout_microseconds = 0) {
+    const IpczWaitOptions options = {
+        .size = sizeof(options),
+        .timeout_microseconds = timeout_microseconds,
+    };
+    return ipcz().WaitForReadyPortals(wait_set_, IPCZ_NO_FLAGS, &options,
+                                      events, &num_events);
+  }
+
+ private:
+  const IpczHandle node_{CreateNode(reference_drivers::kSyncReferenceDriver)};
+  IpczHandle wait_set_ = IPCZ_INVALID_HANDLE;
+};
+
+TEST_F(WaitSetTest, ReportReadyPortals) {
+  auto [a, b] = OpenPortals();
+  auto [c, d] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(d, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 2));
+
+  IpczWaitSetEvent events[4];
+  size_t num_events = std::size(events);
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED, WaitForEvents(events, num_events));
+
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "hi"));
+  num_events = std::size(events);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(events, num_events));
+  ASSERT_EQ(1u, num_events);
+  EXPECT_EQ(2u, events[0].context);
+  EXPECT_EQ(IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, events[0].condition_flags);
+  EXPECT_EQ(1u, events[0].status.num_local_parcels);
+  EXPECT_EQ(2u, events[0].status.num_local_bytes);
+
+  CloseAll({a, b, c, d});
+}
+
+TEST_F(WaitSetTest, RegistrationPersists) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_NEW_LOCAL_PARCEL, 1));
+
+  // The portal is reported for every new parcel without being re-added.
+  IpczWaitSetEvent event;
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+    size_t num_events = 1;
+    EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(&event, num_events));
+    EXPECT_EQ(1u, num_events);
+    EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL, event.condition_flags);
+    EXPECT_EQ(i + 1, event.status.num_local_parcels);
+
+    num_events = 1;
+    EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED, WaitForEvents(&event, num_events));
+  }
+
+  CloseAll({a, b});
+}
+
+TEST_F(WaitSetTest, AlreadySatisfied) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+
+  // Parcels which arrived before the portal was added aren't new, but the
+  // portal is still immediately ready for its other conditions.
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b,
+                                IPCZ_TRAP_NEW_LOCAL_PARCEL |
+                                    IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+                                1));
+  IpczWaitSetEvent event;
+  size_t num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(&event, num_events));
+  EXPECT_EQ(IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, event.condition_flags);
+
+  CloseAll({a, b});
+}
+
+TEST_F(WaitSetTest, CoalesceChanges) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "a"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "b"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "c"));
+
+  // The portal is only queued once, and it's reported with its latest status.
+  IpczWaitSetEvent events[4];
+  size_t num_events = std::size(events);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(events, num_events));
+  ASSERT_EQ(1u, num_events);
+  EXPECT_EQ(3u, events[0].status.num_local_parcels);
+
+  CloseAll({a, b});
+}
+
+TEST_F(WaitSetTest, SkipStalePortals) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+
+  IpczWaitSetEvent event;
+  size_t num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED, WaitForEvents(&event, num_events));
+
+  CloseAll({a, b});
+}
+
+TEST_F(WaitSetTest, PartialBatches) {
+  auto [a, b] = OpenPortals();
+  auto [c, d] = OpenPortals();
+  auto [e, f] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(d, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 2));
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(f, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 3));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(e, "!"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "!"));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "!"));
+
+  // Portals are reported in the order they became ready, and any which don't
+  // fit are left for the next call.
+  IpczWaitSetEvent events[2];
+  size_t num_events = std::size(events);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(events, num_events));
+  ASSERT_EQ(2u, num_events);
+  EXPECT_EQ(3u, events[0].context);
+  EXPECT_EQ(1u, events[1].context);
+
+  num_events = std::size(events);
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(events, num_events));
+  ASSERT_EQ(1u, num_events);
+  EXPECT_EQ(2u, events[0].context);
+
+  CloseAll({a, b, c, d, e, f});
+}
+
+TEST_F(WaitSetTest, AddAndRemove) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_ALREADY_EXISTS,
+            Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+
+  // A removed portal isn't reported even if it was already ready.
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().RemoveFromWaitSet(wait_set(), b,
+                                                     IPCZ_NO_FLAGS, nullptr));
+  EXPECT_EQ(IPCZ_RESULT_NOT_FOUND, ipcz().RemoveFromWaitSet(
+                                       wait_set(), b, IPCZ_NO_FLAGS, nullptr));
+  IpczWaitSetEvent event;
+  size_t num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED, WaitForEvents(&event, num_events));
+
+  CloseAll({a, b});
+}
+
+TEST_F(WaitSetTest, RemoveOnClose) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  Close(b);
+
+  IpczWaitSetEvent event;
+  size_t num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED, WaitForEvents(&event, num_events));
+  Close(a);
+}
+
+TEST_F(WaitSetTest, PeerClosed) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_PEER_CLOSED, 1));
+  Close(a);
+
+  IpczWaitSetEvent event;
+  size_t num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_OK, WaitForEvents(&event, num_events));
+  EXPECT_EQ(IPCZ_TRAP_PEER_CLOSED, event.condition_flags);
+  Close(b);
+}
+
+TEST_F(WaitSetTest, WakeFromOtherThread) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Add(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1));
+
+  std::thread sender(
+      [a = a, this] { EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi")); });
+  IpczWaitSetEvent event;
+  size_t num_events = 1;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            WaitForEvents(&event, num_events, IPCZ_WAIT_INDEFINITELY));
+  EXPECT_EQ(1u, event.context);
+  sender.join();
+
+  CloseAll({a, b});
+}
+
+}  // namespace
+}  // namespace ipcz
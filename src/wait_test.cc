@@ -0,0 +1,200 @@
+// Copyright 2024 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ipcz/ipcz.h"
+#include "reference_drivers/sync_reference_driver.h"
+#include "test/multinode_test.h"
+#include "test/test.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "third_party/abseil-cpp/absl/time/clock.h"
+#include "third_party/abseil-cpp/absl/time/time.h"
+
+namespace ipcz {
+namespace {
+
+class WaitTest : public test::Test {
+ public:
+  ~WaitTest() override { Close(node_); }
+
+  std::pair<IpczHandle, IpczHandle> OpenPortals() {
+    return TestBase::OpenPortals(node_);
+  }
+
+  IpczResult Wait(IpczHandle portal,
+                  IpczTrapConditionFlags flags,
+                  uint64_t timeout_microseconds = IPCZ_WAIT_INDEFINITELY,
+                  IpczTrapConditionFlags* satisfied_flags = nullptr,
+                  IpczPortalStatus* status = nullptr) {
+    const IpczTrapConditions conditions = {
+        .size = sizeof(conditions),
+        .flags = flags,
+    };
+    const IpczWaitOptions options = {
+        .size = sizeof(options),
+        .timeout_microseconds = timeout_microseconds,
+        .spin_count = 100,
+    };
+    return ipcz().Wait(portal, &conditions, IPCZ_NO_FLAGS, &options,
+                       satisfied_flags, status);
+  }
+
+ private:
+  const IpczHandle node_{CreateNode(reference_drivers::kSyncReferenceDriver)};
+};
+
+TEST_F(WaitTest, AlreadySatisfied) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+
+  IpczTrapConditionFlags flags = 0;
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK, Wait(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+                                 IPCZ_WAIT_INDEFINITELY, &flags, &status));
+  EXPECT_EQ(IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, flags);
+  EXPECT_EQ(1u, status.num_local_parcels);
+  EXPECT_EQ(2u, status.num_local_bytes);
+  CloseAll({a, b});
+}
+
+TEST_F(WaitTest, Timeout) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED,
+            Wait(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 0));
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED,
+            Wait(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS, 1000));
+
+  // A parcel queued before the wait doesn't count as a new one.
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  EXPECT_EQ(IPCZ_RESULT_DEADLINE_EXCEEDED,
+            Wait(b, IPCZ_TRAP_NEW_LOCAL_PARCEL, 0));
+  CloseAll({a, b});
+}
+
+TEST_F(WaitTest, WakeOnNewParcel) {
+  auto [a, b] = OpenPortals();
+
+  std::thread sender(
+      [a = a, this] { EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi")); });
+
+  IpczTrapConditionFlags flags = 0;
+  EXPECT_EQ(IPCZ_RESULT_OK,
+            Wait(b, IPCZ_TRAP_NEW_LOCAL_PARCEL | IPCZ_TRAP_PEER_CLOSED,
+                 IPCZ_WAIT_INDEFINITELY, &flags));
+  EXPECT_EQ(IPCZ_TRAP_NEW_LOCAL_PARCEL, flags);
+  sender.join();
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ("hi", message);
+  CloseAll({a, b});
+}
+
+TEST_F(WaitTest, WakeOnParcelConsumed) {
+  auto [a, b] = OpenPortals();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+
+  std::thread receiver([b = b, this] {
+    std::string message;
+    EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  });
+
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_BELOW_MAX_REMOTE_PARCELS,
+      .max_remote_parcels = 1,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Wait(a, &conditions, IPCZ_NO_FLAGS, nullptr,
+                                        nullptr, nullptr));
+  receiver.join();
+  CloseAll({a, b});
+}
+
+TEST_F(WaitTest, WakeOnPeerClosed) {
+  auto [a, b] = OpenPortals();
+
+  std::thread closer([a = a, this] { Close(a); });
+
+  IpczTrapConditionFlags flags = 0;
+  IpczPortalStatus status = {.size = sizeof(status)};
+  EXPECT_EQ(IPCZ_RESULT_OK, Wait(b, IPCZ_TRAP_PEER_CLOSED,
+                                 IPCZ_WAIT_INDEFINITELY, &flags, &status));
+  EXPECT_EQ(IPCZ_TRAP_PEER_CLOSED, flags);
+  EXPECT_TRUE(status.flags & IPCZ_PORTAL_STATUS_PEER_CLOSED);
+  closer.join();
+  Close(b);
+}
+
+TEST_F(WaitTest, CancelOnClose) {
+  auto [a, b] = OpenPortals();
+
+  // Closing a portal cancels any waits on it, even from other threads. The
+  // waiter gets a head start so that it's blocked by the time we close.
+  std::thread waiter([b = b, this] {
+    EXPECT_EQ(IPCZ_RESULT_CANCELLED, Wait(b, IPCZ_TRAP_NEW_LOCAL_PARCEL));
+  });
+  absl::SleepFor(absl::Milliseconds(10));
+  Close(b);
+  waiter.join();
+  Close(a);
+}
+
+TEST_F(WaitTest, ManyWaiters) {
+  auto [a, b] = OpenPortals();
+
+  std::vector<std::thread> waiters;
+  for (size_t i = 0; i < 4; ++i) {
+    waiters.emplace_back([b = b, this] {
+      EXPECT_EQ(IPCZ_RESULT_OK, Wait(b, IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS));
+    });
+  }
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(a, "hi"));
+  for (std::thread& waiter : waiters) {
+    waiter.join();
+  }
+  CloseAll({a, b});
+}
+
+using WaitTestNode = test::TestNode;
+using WaitMultinodeTest = test::MultinodeTest<WaitTestNode>;
+
+MULTINODE_TEST_NODE(WaitTestNode, RemoteWaitClient) {
+  IpczHandle b = ConnectToBroker();
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Wait(b, &conditions, IPCZ_NO_FLAGS, nullptr,
+                                        nullptr, nullptr));
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(b, &message));
+  EXPECT_EQ("ping", message);
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(b, "pong"));
+  Close(b);
+}
+
+MULTINODE_TEST(WaitMultinodeTest, RemoteWait) {
+  IpczHandle c = SpawnTestNode<RemoteWaitClient>();
+  EXPECT_EQ(IPCZ_RESULT_OK, Put(c, "ping"));
+
+  const IpczTrapConditions conditions = {
+      .size = sizeof(conditions),
+      .flags = IPCZ_TRAP_ABOVE_MIN_LOCAL_PARCELS,
+  };
+  EXPECT_EQ(IPCZ_RESULT_OK, ipcz().Wait(c, &conditions, IPCZ_NO_FLAGS, nullptr,
+                                        nullptr, nullptr));
+
+  std::string message;
+  EXPECT_EQ(IPCZ_RESULT_OK, Get(c, &message));
+  EXPECT_EQ("pong", message);
+  Close(c);
+}
+
+}  // namespace
+}  // namespace ipcz